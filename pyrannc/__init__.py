@@ -11,7 +11,7 @@ import torch.random
 from . import _pyrannc, utils
 from .dist_param import store_dist_param, load_dist_param, set_dist_param, get_dist_param_range, set_dist_param_dtype, \
     DistributeModelParams
-from .opt import patch_optimizer
+from .opt import patch_optimizer, FusedAdam, FusedSGD
 
 # Run backward to set python engine as the default engine
 x = torch.randn(2, 2, requires_grad=True)
@@ -203,6 +203,7 @@ class RaNNCModule(_pyrannc.RaNNCModule):
         :param enable_zero: Set ``True`` to remove the redundancy of optimizer states following the approach of DeepSpeed.
         :param check_unused_values: If ``True``, RaNNC throws an exception when it finds unused values in a computation graph.
         :param offload_params: If ``True``, parameters are moved to host memory until they are used.
+            When ``offload_param_dir`` is configured, parameters and optimizer states are stored in files instead.
         """
 
         old_flag = torch._C._jit_set_profiling_executor(True)
@@ -368,6 +369,21 @@ class RaNNCModule(_pyrannc.RaNNCModule):
             self._setup_amp_params()
         super().clip_grad_norm(max_grad_norm)
 
+    def scale_grads(self, scale):
+        r"""
+        Multiplies gradients by ``scale`` and checks whether they have inf or NaN in the same pass.
+        Gradients on the local process are processed by fused kernels, and the result is shared among all ranks.
+
+        :param scale: Scale factor.
+        :return: ``True`` if gradients on any rank have inf or NaN.
+
+        .. note::
+            This method must be called from all ranks.
+        """
+        if self.enable_apex_amp:
+            self._setup_amp_params()
+        return super().scale_grads_and_check_overflow(scale)
+
     def _calc_grad_norm(self):
         if self.enable_apex_amp:
             self._setup_amp_params()
@@ -428,16 +444,19 @@ class RaNNCModule(_pyrannc.RaNNCModule):
 
         return self.model.load_state_dict(*args, **kwargs)
 
-    def allreduce_grads(self):
+    def allreduce_grads(self, grad_scale=1.0):
         r"""
         Performs *allreduce* on gradients of model parameters.
 
+        :param grad_scale: Factor by which the gradients are currently multiplied (e.g. the loss scale of amp).
+            Errors of ``grad_compression`` are kept divided by this factor, so that they stay valid when the factor changes.
+
         .. note::
             This method must be called from all ranks.
         """
         if self.enable_apex_amp:
             self._setup_amp_params()
-        super().allreduce_grads()
+        super().allreduce_grads(grad_scale)
 
     def zero_grad(self):
         r"""
@@ -577,7 +596,7 @@ def allreduce_grads(rmodel, optimizer, prescale=1.0):
                 if p.grad is None:
                     continue
                 p.grad.mul_(prescale)
-        rmodel.allreduce_grads()
+        rmodel.allreduce_grads(prescale)
 
     return False
 
@@ -105,15 +105,16 @@ def named_master_params(model, optimizer, zero=False):
                 yield n, amp_param_map[p]
 
 
-def scale_master_grads(optimizer, scale):
-    overflow_buf = torch.cuda.IntTensor([0])
-    master_grads = [param.grad for param in amp.master_params(optimizer) if param.grad is not None]
-    if len(master_grads) > 0:
-        amp_C.multi_tensor_scale(65536,
-                                 overflow_buf,
-                                 [master_grads, master_grads],
-                                 scale)
-    return overflow_buf
+def update_scale_with_overflow(had_overflow):
+    # The flag is already shared among ranks
+    scaler = _amp_state.loss_scalers[0]
+    overflow_buf = torch.cuda.IntTensor([1 if had_overflow else 0])
+    old_overflow_buf = scaler._overflow_buf
+    scaler._overflow_buf = overflow_buf
+    should_skip = scaler._update_scale_local()
+    scaler._overflow_buf = old_overflow_buf
+    return should_skip
+
 
 def allreduce_grads_amp(rmodel, optimizer, prescale=1.0):
 
@@ -122,25 +123,22 @@ def allreduce_grads_amp(rmodel, optimizer, prescale=1.0):
         assert(rmodel.allreduce_amp_master_params)
 
         rmodel.allreduce_grads_zero(scaler.loss_scale())
-
-        overflow_buf = scale_master_grads(optimizer, prescale)
-        old_overflow_buf = scaler._overflow_buf
-        scaler._overflow_buf = overflow_buf
-        had_overflow = scaler.update_scale()
-        scaler._overflow_buf = old_overflow_buf
-
-        return had_overflow
+        return update_scale_with_overflow(rmodel.scale_grads(prescale))
 
     if rmodel.allreduce_amp_master_params:
-        overflow_buf = scale_master_grads(optimizer, prescale)
+        had_overflow = rmodel.scale_grads(prescale)
+        grad_scale = prescale
     else:
         master_grads_to_model_grads(optimizer, scaler.loss_scale()*prescale)
+        grad_scale = scaler.loss_scale()*prescale
 
     # rannc's allreduce
-    rmodel.allreduce_grads()
+    rmodel.allreduce_grads(grad_scale)
+
+    if rmodel.allreduce_amp_master_params:
+        return update_scale_with_overflow(had_overflow)
 
-    if not rmodel.allreduce_amp_master_params:
-        overflow_buf = model_grads_to_master_grads(optimizer, 1./scaler.loss_scale())
+    overflow_buf = model_grads_to_master_grads(optimizer, 1./scaler.loss_scale())
 
     old_overflow_buf = scaler._overflow_buf
     scaler._overflow_buf = overflow_buf
@@ -152,6 +150,7 @@ def allreduce_grads_amp(rmodel, optimizer, prescale=1.0):
 
 def patch_amp_scaler():
     scaler = _amp_state.loss_scalers[0]
+    scaler._update_scale_local = scaler.update_scale
     def decorate(func):
         def wrapper():
             had_overflow = func()
@@ -36,6 +36,63 @@ def to_cuda_tensor(s):
     return s
 
 
+def _offloaded_state_key(param, state_name):
+    return "opt_state_{}_{}".format(id(param), state_name)
+
+
+def _offloaded_states(opt, param):
+    # scalar states (e.g. step) stay in memory
+    return [(k, v) for k, v in opt.state[param].items() if isinstance(v, torch.Tensor) and v.dim() > 0]
+
+
+def _prefetch_offloaded_param(opt, param):
+    _pyrannc.prefetch_offloaded_param(param)
+    for k, _ in _offloaded_states(opt, param):
+        _pyrannc.prefetch_offloaded_tensor(_offloaded_state_key(param, k))
+
+
+def _load_offloaded_param(opt, param, device):
+    _pyrannc.load_offloaded_param(param)
+    for k, v in _offloaded_states(opt, param):
+        _pyrannc.load_offloaded_tensor(_offloaded_state_key(param, k), v)
+        utils._to_in_place([v], device)
+
+
+def _store_offloaded_param(opt, param):
+    for k, v in _offloaded_states(opt, param):
+        _pyrannc.store_offloaded_tensor(_offloaded_state_key(param, k), v)
+    _pyrannc.store_offloaded_param(param)
+
+
+def _step_offloaded_params(opt, old_step, params, device, **kwargs):
+    # Params and their states are brought from the file by buckets of offload_prefetch_num params. The optimizer
+    # steps once for each bucket with the other params hidden from it, while the next bucket is read ahead.
+    bucket_size = max(1, _pyrannc.offload_prefetch_num())
+    buckets = [params[i:i + bucket_size] for i in range(0, len(params), bucket_size)]
+    groups = [g['params'] for g in opt.param_groups]
+    try:
+        for i, bucket in enumerate(buckets):
+            for g in opt.param_groups:
+                g['params'] = []
+            for _, p in bucket:
+                _load_offloaded_param(opt, p, device)
+            if i + 1 < len(buckets):
+                for _, p in buckets[i + 1]:
+                    _prefetch_offloaded_param(opt, p)
+
+            bucket_params = [p for _, p in bucket]
+            utils._to_in_place(bucket_params, device)
+            for group, p in bucket:
+                group['params'].append(p)
+            old_step(**kwargs)
+            utils._to_in_place(bucket_params, torch.device("cpu"))
+            for _, p in bucket:
+                _store_offloaded_param(opt, p)
+    finally:
+        for g, group_params in zip(opt.param_groups, groups):
+            g['params'] = group_params
+
+
 def replace_param_ids(opt_state_dict, order_local_to_global):
     new_state = {}
     for k, v in opt_state_dict.items():
@@ -300,10 +357,115 @@ def patch_optimizer(model, optimizer):
     # replace step
     if model.offload_params:
         old_step = optimizer.step
+        offload_to_file = _pyrannc.offload_file_enabled()
+
+        def new_step(opt, closure=None, **kwargs):
+            if offload_to_file:
+                loss = None
+                if closure is not None:
+                    with torch.enable_grad():
+                        loss = closure()
+                params = [(g, p) for g in opt.param_groups for p in g['params'] if id(p) in model.used_param_ids]
+                _step_offloaded_params(opt, old_step, params, model.device, **kwargs)
+                return loss
 
-        def new_step(opt, **kwargs):
             utils._to_in_place([p for p in model.parameters() if id(p) in model.used_param_ids], model.device)
-            old_step(**kwargs)
+            loss = old_step(closure=closure, **kwargs)
             utils._to_in_place([p for p in model.parameters() if id(p) in model.used_param_ids], torch.device("cpu"))
+            return loss
 
         optimizer.step = types.MethodType(new_step, optimizer)
+
+
+def _group_by_key(items):
+    groups = {}
+    for key, item in items:
+        groups.setdefault(key, []).append(item)
+    return groups
+
+
+class FusedAdam(torch.optim.Optimizer):
+    r"""
+    Adam (or AdamW if ``adamw`` is ``True``) whose update runs natively in one call for each param group.
+
+    The states (``step``, ``exp_avg`` and ``exp_avg_sq``) are the same as ``torch.optim.Adam``, and
+    checkpoints can be exchanged with it. When ``enable_zero`` is set, the optimizer updates only local
+    segments of parameters (or amp master params), and the next forward broadcasts the updated segments.
+    Contiguous fp32 parameters on CPU (e.g. offloaded ones) are updated by vectorized loops.
+    """
+
+    def __init__(self, params, lr=1e-3, betas=(0.9, 0.999), eps=1e-8, weight_decay=0, adamw=False):
+        defaults = dict(lr=lr, betas=betas, eps=eps, weight_decay=weight_decay, adamw=adamw)
+        super().__init__(params, defaults)
+
+    @torch.no_grad()
+    def step(self, closure=None):
+        loss = None
+        if closure is not None:
+            with torch.enable_grad():
+                loss = closure()
+
+        for group in self.param_groups:
+            items = []
+            for p in group['params']:
+                if p.grad is None:
+                    continue
+                state = self.state[p]
+                if len(state) == 0:
+                    state['step'] = 0
+                    state['exp_avg'] = torch.zeros_like(p, memory_format=torch.preserve_format)
+                    state['exp_avg_sq'] = torch.zeros_like(p, memory_format=torch.preserve_format)
+                state['step'] += 1
+                items.append((state['step'], p))
+
+            beta1, beta2 = group['betas']
+            # Bias corrections depend on the step count
+            for step, params in _group_by_key(items).items():
+                _pyrannc.fused_adam_step(params, [p.grad for p in params],
+                                         [self.state[p]['exp_avg'] for p in params],
+                                         [self.state[p]['exp_avg_sq'] for p in params],
+                                         step, group['lr'], beta1, beta2, group['eps'], group['weight_decay'],
+                                         group['adamw'])
+        return loss
+
+
+class FusedSGD(torch.optim.Optimizer):
+    r"""
+    SGD with momentum whose update runs natively in one call for each param group.
+
+    The state (``momentum_buffer``) is the same as ``torch.optim.SGD``. See :class:`FusedAdam` for
+    parameters partitioned by ``enable_zero``.
+    """
+
+    def __init__(self, params, lr, momentum=0, dampening=0, weight_decay=0, nesterov=False):
+        if nesterov and (momentum <= 0 or dampening != 0):
+            raise ValueError("Nesterov momentum requires a momentum and zero dampening")
+        defaults = dict(lr=lr, momentum=momentum, dampening=dampening, weight_decay=weight_decay, nesterov=nesterov)
+        super().__init__(params, defaults)
+
+    @torch.no_grad()
+    def step(self, closure=None):
+        loss = None
+        if closure is not None:
+            with torch.enable_grad():
+                loss = closure()
+
+        for group in self.param_groups:
+            momentum = group['momentum']
+            items = []
+            for p in group['params']:
+                if p.grad is None:
+                    continue
+                first_step = False
+                if momentum != 0:
+                    state = self.state[p]
+                    if 'momentum_buffer' not in state:
+                        state['momentum_buffer'] = torch.empty_like(p, memory_format=torch.preserve_format)
+                        first_step = True
+                items.append((first_step, p))
+
+            for first_step, params in _group_by_key(items).items():
+                bufs = [self.state[p]['momentum_buffer'] for p in params] if momentum != 0 else []
+                _pyrannc.fused_sgd_step(params, [p.grad for p in params], bufs, group['lr'], momentum,
+                                        group['dampening'], group['weight_decay'], group['nesterov'], first_step)
+        return loss
@@ -0,0 +1,75 @@
+"""
+Manages a plan store (``plan_store_dir``) offline.
+
+Examples::
+
+    # Show models and plans in the store
+    python -m pyrannc.plan_store /path/to/store list
+
+    # Compute plans for 8, 16 and 32 devices from the DP cache of each model
+    python -m pyrannc.plan_store /path/to/store precompute --world-sizes 8,16,32
+
+Plans are computed from the profiles stored by a job that ran with the store.
+No device is needed.
+"""
+
+import argparse
+
+from . import _pyrannc
+
+
+def _parse_ints(s):
+    return [int(v) for v in s.split(",") if v]
+
+
+def list_plans(store_dir):
+    """
+    Shows models and plans in a plan store.
+
+    :param store_dir: Directory of the plan store.
+    """
+    for model in _pyrannc.list_plan_models(store_dir):
+        print(model)
+        for dev_num, batch_size, dev_mem in _pyrannc.list_plans(store_dir, model):
+            print("  world_size={} batch_size={} dev_mem={}".format(dev_num, batch_size, dev_mem))
+
+
+def precompute_plans(store_dir, world_sizes, batch_sizes=None, model=None):
+    """
+    Computes plans for the given world sizes and batch sizes and adds them to a plan store.
+
+    :param store_dir: Directory of the plan store.
+    :param world_sizes: World sizes.
+    :param batch_sizes: Global batch sizes. The batch size of the job that stored the model is used if not given.
+    :param model: Fingerprint of the model. All models in the store are processed if not given.
+    :return: Number of plans added.
+    """
+    models = [model] if model else _pyrannc.list_plan_models(store_dir)
+    count = 0
+    for m in models:
+        count += _pyrannc.precompute_plans(store_dir, m, world_sizes, batch_sizes or [])
+    return count
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Manages a plan store of RaNNC.")
+    parser.add_argument("store_dir", help="Directory of the plan store")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    sub.add_parser("list", help="Show models and plans")
+
+    pre = sub.add_parser("precompute", help="Compute plans for world sizes and batch sizes")
+    pre.add_argument("--world-sizes", type=_parse_ints, required=True, help="Comma-separated world sizes")
+    pre.add_argument("--batch-sizes", type=_parse_ints, default=[], help="Comma-separated global batch sizes")
+    pre.add_argument("--model", default=None, help="Fingerprint of the model")
+
+    args = parser.parse_args()
+    if args.command == "list":
+        list_plans(args.store_dir)
+    elif args.command == "precompute":
+        count = precompute_plans(args.store_dir, args.world_sizes, args.batch_sizes, args.model)
+        print("Added {} plan(s)".format(count))
+
+
+if __name__ == "__main__":
+    main()
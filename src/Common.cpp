@@ -4,6 +4,9 @@
 #include <pwd.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #include "Common.h"
 #include "graph/ir.h"
@@ -237,4 +240,54 @@ double getResidentMem() {
   return resident_set;
 }
 
+void parallelFor(
+    size_t n, size_t thread_num, const std::function<void(size_t)>& f) {
+  if (thread_num == 0) {
+    thread_num = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  thread_num = std::min(thread_num, n);
+  if (thread_num <= 1) {
+    for (size_t i = 0; i < n; i++) {
+      f(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next_idx(0);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  const auto run = [&]() {
+    while (true) {
+      const size_t i = next_idx++;
+      if (i >= n) {
+        break;
+      }
+      try {
+        f(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        // Skip the remaining indices
+        next_idx = n;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(thread_num - 1);
+  for (size_t t = 1; t < thread_num; t++) {
+    threads.emplace_back(run);
+  }
+  run();
+  for (auto& th : threads) {
+    th.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
 } // namespace rannc
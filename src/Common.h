@@ -6,6 +6,7 @@
 #define PT_RANNC_COMMON_H
 
 #include <boost/filesystem.hpp>
+#include <functional>
 #include <iostream>
 #include <numeric>
 #include <random>
@@ -445,6 +446,14 @@ class CommErrorException : public std::runtime_error {
 };
 
 double getResidentMem();
+
+/**
+ * Runs *f(i)* for i in [0, n) using *thread_num* threads. If *thread_num* is 0,
+ * the number of hardware threads is used. An exception thrown by *f* is
+ * rethrown on the calling thread after all threads finish.
+ */
+void parallelFor(
+    size_t n, size_t thread_num, const std::function<void(size_t)>& f);
 } // namespace rannc
 
 #endif // PT_RANNC_COMMON_H
@@ -33,6 +33,7 @@ const char CONSOLIDATE_GRADS[] = "consolidate_grads";
 const char PROFILING_ITER[] = "profiling_iter";
 const char CHECKPOINTING[] = "checkpointing";
 const char CHECKPOINTING_NO_LAST[] = "checkpointing_no_last";
+const char SELECTIVE_RECOMPUTE[] = "selective_recompute";
 const char DISABLE_BALANCING[] = "disable_balancing";
 const char OPT_PARAM_FACTOR[] = "opt_param_factor";
 const char AUTO_PARALLEL[] = "auto_parallel";
@@ -64,6 +65,7 @@ const char LIMIT_DEV_NUM_MORE_THAN_BS[] = "limit_dev_num_more_than_bs";
 const char PROFILE_BY_ACC[] = "profile_by_acc";
 const char VERIFY_PARTITIONING[] = "verify_partitioning";
 const char ALLOC_REPL_FLAT[] = "alloc_repl_flat";
+const char ALLOC_MEM_AWARE[] = "alloc_mem_aware";
 const char SYNC_ALLREDUCE[] = "sync_allreduce";
 
 const char SAVE_MLPART_RESULTS[] = "save_mlpart_results";
@@ -83,6 +85,29 @@ const char WATCHDOG_LOCKFILE_DIR[] = "watchdog_lockfile_dir";
 const char FORCE_DIST_MATMUL[] = "force_dist_matmul";
 const char USE_NAMED_TENSORS[] = "use_named_tensors";
 const char PROFILER_CACHE_SIZE[] = "profiler_cache_size";
+const char OFFLOAD_PARAM_DIR[] = "offload_param_dir";
+const char OFFLOAD_PREFETCH_NUM[] = "offload_prefetch_num";
+const char OFFLOAD_DIRECT_IO[] = "offload_direct_io";
+const char OFFLOAD_ACTIVATIONS[] = "offload_activations";
+const char FUNC_CACHE_SIZE[] = "func_cache_size";
+const char PARTITIONING_THREAD_NUM[] = "partitioning_thread_num";
+const char AUTO_DIST_MATMUL[] = "auto_dist_matmul";
+const char CPG_SEARCH[] = "cpg_search";
+const char CPG_BEAM_WIDTH[] = "cpg_beam_width";
+const char DEV_CAPS[] = "dev_caps";
+const char PLAN_STORE_DIR[] = "plan_store_dir";
+const char PAD_UNEVEN_BATCHES[] = "pad_uneven_batches";
+const char OVERLAP_ZERO_BCAST[] = "overlap_zero_bcast";
+const char ZERO_BCAST_BUCKET_SIZE[] = "zero_bcast_bucket_size";
+const char ZERO_STAGE3[] = "zero_stage3";
+const char ZERO_PREFETCH_NUM[] = "zero_prefetch_num";
+const char HIERARCHICAL_ALLREDUCE[] = "hierarchical_allreduce";
+const char HIERARCHICAL_ALLREDUCE_MIN_SIZE[] = "hierarchical_allreduce_min_size";
+const char HIERARCHICAL_ALLREDUCE_BUCKET_SIZE[] =
+    "hierarchical_allreduce_bucket_size";
+const char GRAD_COMPRESSION[] = "grad_compression";
+const char POWERSGD_RANK[] = "powersgd_rank";
+const char TOPK_RATIO[] = "topk_ratio";
 
 const char CONF_DIR[] = "conf_dir";
 
@@ -128,6 +153,13 @@ void Config::display() {
   }
 }
 
+std::string Config::getValAsString(const std::string& name) {
+  if (contains(values_, name)) {
+    return toString(values_.at(name));
+  }
+  return toString(items_.at(name).default_val);
+}
+
 Config::Config() {
   const std::vector<ConfigItem> config_items = {
       makeConfigItem(SHOW_CONFIG_ITEMS, false),
@@ -146,6 +178,7 @@ Config::Config() {
       makeConfigItem(PROFILING_ITER, 1),
       makeConfigItem(CHECKPOINTING, false),
       makeConfigItem(CHECKPOINTING_NO_LAST, false),
+      makeConfigItem(SELECTIVE_RECOMPUTE, false),
       makeConfigItem(DISABLE_BALANCING, true),
       makeConfigItem(OPT_PARAM_FACTOR, 2),
       makeConfigItem(AUTO_PARALLEL, false),
@@ -179,6 +212,7 @@ Config::Config() {
       makeConfigItem(PROFILE_BY_ACC, false),
       makeConfigItem(VERIFY_PARTITIONING, false),
       makeConfigItem(ALLOC_REPL_FLAT, true),
+      makeConfigItem(ALLOC_MEM_AWARE, true),
       makeConfigItem(SYNC_ALLREDUCE, false),
 
       makeConfigItem(SAVE_MLPART_RESULTS, false),
@@ -200,6 +234,28 @@ Config::Config() {
       makeConfigItem(FORCE_DIST_MATMUL, false),
       makeConfigItem(USE_NAMED_TENSORS, false),
       makeConfigItem(PROFILER_CACHE_SIZE, 0),
+      makeConfigItem(OFFLOAD_PARAM_DIR, std::string("")),
+      makeConfigItem(OFFLOAD_PREFETCH_NUM, 4),
+      makeConfigItem(OFFLOAD_DIRECT_IO, true),
+      makeConfigItem(OFFLOAD_ACTIVATIONS, true),
+      makeConfigItem(FUNC_CACHE_SIZE, 256),
+      makeConfigItem(PARTITIONING_THREAD_NUM, 0),
+      makeConfigItem(AUTO_DIST_MATMUL, false),
+      makeConfigItem(CPG_SEARCH, false),
+      makeConfigItem(CPG_BEAM_WIDTH, 64),
+      makeConfigItem(DEV_CAPS, std::string("")),
+      makeConfigItem(PLAN_STORE_DIR, std::string("")),
+      makeConfigItem(PAD_UNEVEN_BATCHES, false),
+      makeConfigItem(OVERLAP_ZERO_BCAST, false),
+      makeConfigItem(ZERO_BCAST_BUCKET_SIZE, 32),
+      makeConfigItem(ZERO_STAGE3, false),
+      makeConfigItem(ZERO_PREFETCH_NUM, 2),
+      makeConfigItem(HIERARCHICAL_ALLREDUCE, true),
+      makeConfigItem(HIERARCHICAL_ALLREDUCE_MIN_SIZE, 1),
+      makeConfigItem(HIERARCHICAL_ALLREDUCE_BUCKET_SIZE, 32),
+      makeConfigItem(GRAD_COMPRESSION, std::string("")),
+      makeConfigItem(POWERSGD_RANK, 4),
+      makeConfigItem(TOPK_RATIO, 0.01f),
 
       makeConfigItem(CONF_DIR, "")};
 
@@ -29,6 +29,7 @@ extern const char CONSOLIDATE_GRADS[];
 extern const char PROFILING_ITER[];
 extern const char CHECKPOINTING[];
 extern const char CHECKPOINTING_NO_LAST[];
+extern const char SELECTIVE_RECOMPUTE[];
 extern const char DISABLE_BALANCING[];
 extern const char OPT_PARAM_FACTOR[];
 extern const char AUTO_PARALLEL[];
@@ -60,6 +61,7 @@ extern const char LIMIT_DEV_NUM_MORE_THAN_BS[];
 extern const char PROFILE_BY_ACC[];
 extern const char VERIFY_PARTITIONING[];
 extern const char ALLOC_REPL_FLAT[];
+extern const char ALLOC_MEM_AWARE[];
 extern const char SYNC_ALLREDUCE[];
 
 extern const char SAVE_MLPART_RESULTS[];
@@ -79,6 +81,28 @@ extern const char WATCHDOG_LOCKFILE_DIR[];
 extern const char FORCE_DIST_MATMUL[];
 extern const char USE_NAMED_TENSORS[];
 extern const char PROFILER_CACHE_SIZE[];
+extern const char OFFLOAD_PARAM_DIR[];
+extern const char OFFLOAD_PREFETCH_NUM[];
+extern const char OFFLOAD_DIRECT_IO[];
+extern const char OFFLOAD_ACTIVATIONS[];
+extern const char FUNC_CACHE_SIZE[];
+extern const char PARTITIONING_THREAD_NUM[];
+extern const char AUTO_DIST_MATMUL[];
+extern const char CPG_SEARCH[];
+extern const char CPG_BEAM_WIDTH[];
+extern const char DEV_CAPS[];
+extern const char PLAN_STORE_DIR[];
+extern const char PAD_UNEVEN_BATCHES[];
+extern const char OVERLAP_ZERO_BCAST[];
+extern const char ZERO_BCAST_BUCKET_SIZE[];
+extern const char ZERO_STAGE3[];
+extern const char ZERO_PREFETCH_NUM[];
+extern const char HIERARCHICAL_ALLREDUCE[];
+extern const char HIERARCHICAL_ALLREDUCE_MIN_SIZE[];
+extern const char HIERARCHICAL_ALLREDUCE_BUCKET_SIZE[];
+extern const char GRAD_COMPRESSION[];
+extern const char POWERSGD_RANK[];
+extern const char TOPK_RATIO[];
 
 extern const char
     CONF_DIR[]; // this is special because Config itself sets this item
@@ -189,6 +213,8 @@ class Config {
     return getDefaultVal<T>(name);
   }
 
+  std::string getValAsString(const std::string& name);
+
   template <typename T>
   void setVal(const std::string& name, T val) {
     values_[name] = ConfigValue(val);
@@ -7,6 +7,7 @@
 #include <torch/torch.h>
 
 #include <comm/MPIUtil.h>
+#include <comm/NCCLWrapper.h>
 #include <comm/ObjectComm.h>
 #include <Common.h>
 #include <cuda/CudaSync.h>
@@ -17,6 +18,38 @@
 
 namespace rannc {
 
+namespace {
+DeviceCapability getDeviceCapability(bool cuda) {
+  DeviceCapability cap;
+  if (cuda) {
+    const auto dev_info = getCudaDeviceInfo(getCurrentCudaDeviceId());
+    cap.mem = dev_info.total_mem;
+    cap.speed = (double)dev_info.multi_processor_count * dev_info.clock_rate;
+  }
+
+  // Capabilities given by the config override those of the device
+  const auto caps_conf =
+      config::Config::get().getVal<std::string>(config::DEV_CAPS);
+  if (caps_conf.empty()) {
+    return cap;
+  }
+  const auto caps = split(caps_conf, ',');
+  if (caps.size() <= mpi::getRank()) {
+    throw std::invalid_argument(
+        "No capability is given for rank " + std::to_string(mpi::getRank()) +
+        " in " + config::DEV_CAPS + ": " + caps_conf);
+  }
+  const auto mem_speed = split(caps.at(mpi::getRank()), ':');
+  if (mem_speed.size() != 2) {
+    throw std::invalid_argument(
+        "Invalid device capability: " + caps.at(mpi::getRank()));
+  }
+  cap.mem = std::stod(mem_speed.at(0)) * 1024L * 1024L * 1024L;
+  cap.speed = std::stod(mem_speed.at(1));
+  return cap;
+}
+} // namespace
+
 void RaNNCProcess::start() {
   int provided;
   int required = MPI_THREAD_SINGLE;
@@ -49,6 +82,7 @@ void RaNNCProcess::start() {
     }
     rank_idx++;
   }
+  NCCLWrapper::get().setNodeRanks(node_ranks);
 
   bool no_cuda = false;
   for (const auto& it : node_devices) {
@@ -95,6 +129,9 @@ void RaNNCProcess::start() {
     cudaSetDevice(dev_alloc.at(mpi::getRank()));
   }
 
+  DeviceCapability my_cap = getDeviceCapability(!no_cuda);
+  dev_caps_ = ocomm.allgather(my_cap);
+
   param_storage_ = std::make_shared<ParamStorage>();
 
   if (config::Config::get().getVal<bool>(config::RUN_WATCHDOG)) {
@@ -31,9 +31,15 @@ class RaNNCProcess {
     return param_storage_;
   }
 
+  // rank -> capability of the device
+  const std::vector<DeviceCapability>& getDeviceCapabilities() const {
+    return dev_caps_;
+  }
+
  private:
   std::unordered_map<std::string, RaNNCModule*> modules_;
   std::shared_ptr<ParamStorage> param_storage_;
+  std::vector<DeviceCapability> dev_caps_;
   const std::shared_ptr<spdlog::logger> logger = getLogger("RaNNCProcess");
 };
 } // namespace rannc
@@ -0,0 +1,330 @@
+#include "GradCompressor.h"
+
+#include <Config.h>
+#include "NCCLWrapper.h"
+
+namespace rannc {
+
+namespace {
+const std::unordered_map<std::string, GradCompressionType>&
+getCompressionTypes() {
+  static const std::unordered_map<std::string, GradCompressionType> types = {
+      {"none", GradCompressionType::NONE},
+      {"fp16", GradCompressionType::FP16},
+      {"bf16", GradCompressionType::BF16},
+      {"powersgd", GradCompressionType::POWER_SGD},
+      {"topk", GradCompressionType::TOP_K}};
+  return types;
+}
+
+GradCompressionType findType(
+    const std::vector<GradCompressionClass>& classes, size_t size) {
+  GradCompressionType type = GradCompressionType::NONE;
+  for (const auto& c : classes) {
+    if (c.min_size <= size) {
+      type = c.type;
+    }
+  }
+  return type;
+}
+
+// Shape of the matrix approximated by PowerSGD
+std::pair<int64_t, int64_t> getMatrixShape(const std::vector<int64_t>& dim) {
+  int64_t numel = productDim(dim);
+  int64_t n = dim.empty() ? 1 : dim.front();
+  return {n, n == 0 ? 0 : numel / n};
+}
+
+int64_t getPowerSGDRank(int64_t n, int64_t m, int rank) {
+  return std::min((int64_t)rank, std::min(n, m));
+}
+
+bool isPowerSGDCompressible(const std::vector<int64_t>& dim, int rank) {
+  if (dim.size() < 2) {
+    return false;
+  }
+  const auto shape = getMatrixShape(dim);
+  const int64_t r = getPowerSGDRank(shape.first, shape.second, rank);
+  return r * (shape.first + shape.second) < shape.first * shape.second;
+}
+} // namespace
+
+std::vector<GradCompressionClass> parseGradCompression(
+    const std::string& spec) {
+  std::vector<GradCompressionClass> classes;
+  if (spec.empty()) {
+    return classes;
+  }
+
+  for (const auto& item : split(spec, ',')) {
+    const auto size_type = split(item, ':');
+    if (size_type.size() != 2 ||
+        !contains(getCompressionTypes(), size_type.at(1))) {
+      throw std::invalid_argument("Invalid gradient compression: " + item);
+    }
+    classes.push_back(GradCompressionClass{
+        (size_t)(std::stod(size_type.at(0)) * 1024L),
+        getCompressionTypes().at(size_type.at(1))});
+  }
+  std::stable_sort(
+      classes.begin(), classes.end(),
+      [](const GradCompressionClass& c1, const GradCompressionClass& c2) {
+        return c1.min_size < c2.min_size;
+      });
+  return classes;
+}
+
+double getGradCompressionRatio(
+    const std::vector<int64_t>& dim, size_t elem_size) {
+  config::Config& conf = config::Config::get();
+  static const auto classes = parseGradCompression(
+      conf.getVal<std::string>(config::GRAD_COMPRESSION));
+  static const int powersgd_rank = conf.getVal<int>(config::POWERSGD_RANK);
+  static const double topk_ratio = conf.getVal<float>(config::TOPK_RATIO);
+
+  const size_t size = productDim(dim) * elem_size;
+  double ratio = 1.0;
+  switch (findType(classes, size)) {
+    case GradCompressionType::FP16:
+    case GradCompressionType::BF16:
+      ratio = 2.0 / elem_size;
+      break;
+    case GradCompressionType::POWER_SGD:
+      if (isPowerSGDCompressible(dim, powersgd_rank)) {
+        const auto shape = getMatrixShape(dim);
+        const int64_t r =
+            getPowerSGDRank(shape.first, shape.second, powersgd_rank);
+        ratio = r * (shape.first + shape.second) /
+            (double)(shape.first * shape.second);
+      }
+      break;
+    case GradCompressionType::TOP_K:
+      // fp32 values and int64 indices
+      ratio = topk_ratio * (4 + 8) / elem_size;
+      break;
+    default:
+      break;
+  }
+  return std::min(ratio, 1.0);
+}
+
+GradCompressor::GradCompressor() {
+  config::Config& conf = config::Config::get();
+  classes_ = parseGradCompression(
+      conf.getVal<std::string>(config::GRAD_COMPRESSION));
+  powersgd_rank_ = conf.getVal<int>(config::POWERSGD_RANK);
+  topk_ratio_ = conf.getVal<float>(config::TOPK_RATIO);
+}
+
+GradCompressionType GradCompressor::getType(const at::Tensor& grad) const {
+  auto type = findType(classes_, grad.nbytes());
+  if (type == GradCompressionType::POWER_SGD &&
+      !isPowerSGDCompressible(getTensorDim(grad), powersgd_rank_)) {
+    return GradCompressionType::NONE;
+  }
+  return type;
+}
+
+void GradCompressor::allreduce(
+    int tag, size_t rank_num, const std::vector<long>& param_ids,
+    const std::vector<at::Tensor>& grads, double grad_scale) {
+  assert(param_ids.size() == grads.size());
+  assert(grad_scale > 0);
+
+  // std::map keeps the order of collectives the same on all ranks
+  std::map<GradCompressionType, std::vector<long>> type_param_ids;
+  std::map<GradCompressionType, std::vector<at::Tensor>> type_grads;
+  for (size_t i = 0; i < grads.size(); i++) {
+    const auto& grad = grads.at(i);
+    assert(grad.is_cuda() && grad.is_contiguous());
+
+    const auto type = getType(grad);
+    type_param_ids[type].push_back(param_ids.at(i));
+    type_grads[type].push_back(grad);
+  }
+
+  torch::NoGradGuard no_grad;
+  for (const auto& it : type_grads) {
+    const auto& ids = type_param_ids.at(it.first);
+    switch (it.first) {
+      case GradCompressionType::FP16:
+        allreduceCast(tag, rank_num, it.second, at::ScalarType::Half);
+        break;
+      case GradCompressionType::BF16:
+        allreduceCast(tag, rank_num, it.second, at::ScalarType::BFloat16);
+        break;
+      case GradCompressionType::POWER_SGD:
+        allreducePowerSGD(tag, rank_num, ids, it.second, grad_scale);
+        break;
+      case GradCompressionType::TOP_K:
+        allreduceTopK(tag, rank_num, ids, it.second, grad_scale);
+        break;
+      default:
+        NCCLWrapper::get().allreduceHierarchical(tag, it.second);
+        break;
+    }
+  }
+}
+
+void GradCompressor::erase(long param_id) {
+  errors_.erase(param_id);
+  qs_.erase(param_id);
+  init_qs_.erase(param_id);
+}
+
+void GradCompressor::clear() {
+  errors_.clear();
+  qs_.clear();
+  init_qs_.clear();
+}
+
+void GradCompressor::allreduceCast(
+    int tag, size_t rank_num, const std::vector<at::Tensor>& grads,
+    at::ScalarType stype) {
+  int64_t numel = 0;
+  for (const auto& g : grads) {
+    numel += g.numel();
+  }
+  const int64_t chunk_size = (numel + rank_num - 1) / rank_num;
+
+  auto buf = torch::zeros(
+      {chunk_size * (int64_t)rank_num}, grads.front().options().dtype(stype));
+  int64_t offset = 0;
+  for (const auto& g : grads) {
+    buf.narrow(0, offset, g.numel()).copy_(g.view(-1));
+    offset += g.numel();
+  }
+
+  // Each rank sums one chunk in fp32 and gathers the sums of the others
+  NCCLWrapper& nccl = NCCLWrapper::get();
+  auto recv_buf = torch::empty_like(buf);
+  nccl.alltoall(tag, buf, recv_buf);
+  auto sum = recv_buf.view({(int64_t)rank_num, chunk_size})
+                 .to(at::ScalarType::Float)
+                 .sum(0)
+                 .to(stype);
+  nccl.allgather(tag, {sum}, {buf});
+
+  offset = 0;
+  for (const auto& g : grads) {
+    g.view(-1).copy_(buf.narrow(0, offset, g.numel()));
+    offset += g.numel();
+  }
+}
+
+void GradCompressor::allreducePowerSGD(
+    int tag, size_t rank_num, const std::vector<long>& param_ids,
+    const std::vector<at::Tensor>& grads, double grad_scale) {
+  NCCLWrapper& nccl = NCCLWrapper::get();
+
+  std::vector<long> new_param_ids;
+  std::vector<at::Tensor> new_qs;
+  std::vector<at::Tensor> mats;
+  for (size_t i = 0; i < grads.size(); i++) {
+    const auto& grad = grads.at(i);
+    long pid = param_ids.at(i);
+    const auto shape = getMatrixShape(getTensorDim(grad));
+    const auto options = grad.options().dtype(at::ScalarType::Float);
+
+    if (!contains(errors_, pid)) {
+      errors_[pid] = torch::zeros({shape.first, shape.second}, options);
+    }
+    if (!contains(qs_, pid)) {
+      const int64_t r =
+          getPowerSGDRank(shape.first, shape.second, powersgd_rank_);
+      qs_[pid] = torch::randn({shape.second, r}, options);
+      new_param_ids.push_back(pid);
+      new_qs.push_back(qs_.at(pid));
+    }
+    mats.push_back(
+        grad.view({shape.first, shape.second}).to(at::ScalarType::Float) +
+        errors_.at(pid) * grad_scale);
+  }
+
+  // All ranks must start from the same right factors
+  if (!new_qs.empty()) {
+    nccl.bcast(tag, new_qs, std::vector<int>(new_qs.size(), 0));
+    for (long pid : new_param_ids) {
+      init_qs_[pid] = qs_.at(pid).clone();
+    }
+  }
+
+  std::vector<at::Tensor> ps;
+  for (size_t i = 0; i < mats.size(); i++) {
+    ps.push_back(mats.at(i).matmul(qs_.at(param_ids.at(i))));
+  }
+  nccl.allreduce(tag, ps);
+
+  std::vector<at::Tensor> qs;
+  for (size_t i = 0; i < mats.size(); i++) {
+    ps.at(i) = std::get<0>(at::linalg_qr(ps.at(i)));
+    qs.push_back(mats.at(i).t().matmul(ps.at(i)));
+  }
+  nccl.allreduce(tag, qs);
+
+  for (size_t i = 0; i < mats.size(); i++) {
+    long pid = param_ids.at(i);
+    const auto& q = qs.at(i);
+    // Non-finite gradients (e.g. overflow with amp) stay in the result
+    auto approx = ps.at(i).matmul(q.t());
+    grads.at(i).view_as(approx).copy_(approx);
+
+    auto& error = errors_.at(pid);
+    error.copy_((mats.at(i) - approx / (double)rank_num) / grad_scale);
+    error.nan_to_num_(0, 0, 0);
+    qs_[pid] = torch::where(torch::isfinite(q), q, init_qs_.at(pid));
+  }
+}
+
+void GradCompressor::allreduceTopK(
+    int tag, size_t rank_num, const std::vector<long>& param_ids,
+    const std::vector<at::Tensor>& grads, double grad_scale) {
+  std::vector<at::Tensor> vals;
+  std::vector<at::Tensor> indices;
+  int64_t offset = 0;
+  for (size_t i = 0; i < grads.size(); i++) {
+    const auto& grad = grads.at(i);
+    long pid = param_ids.at(i);
+    const auto options = grad.options().dtype(at::ScalarType::Float);
+
+    if (!contains(errors_, pid)) {
+      errors_[pid] = torch::zeros({grad.numel()}, options);
+    }
+    auto& error = errors_.at(pid);
+    auto acc = grad.view(-1).to(at::ScalarType::Float) + error * grad_scale;
+
+    const int64_t k =
+        std::max((int64_t)1, (int64_t)(grad.numel() * topk_ratio_));
+    auto idx = std::get<1>(acc.abs().topk(k, 0, true, false));
+    vals.push_back(acc.index_select(0, idx));
+    indices.push_back(idx + offset);
+    // Zero unless the gradient has non-finite elements, which the sums on all
+    // ranks then have as well
+    vals.push_back((acc.sum() * 0).view({1}));
+    indices.push_back(torch::full({1}, offset, idx.options()));
+
+    error.copy_(acc / grad_scale);
+    error.index_fill_(0, idx, 0);
+    error.nan_to_num_(0, 0, 0);
+    offset += grad.numel();
+  }
+
+  auto send_vals = torch::cat(vals);
+  auto send_indices = torch::cat(indices);
+  auto recv_vals = torch::empty(
+      {send_vals.numel() * (int64_t)rank_num}, send_vals.options());
+  auto recv_indices = torch::empty(
+      {send_indices.numel() * (int64_t)rank_num}, send_indices.options());
+  NCCLWrapper::get().allgather(
+      tag, {send_vals, send_indices}, {recv_vals, recv_indices});
+
+  auto sum = torch::zeros({offset}, send_vals.options());
+  sum.index_add_(0, recv_indices, recv_vals);
+
+  offset = 0;
+  for (const auto& g : grads) {
+    g.view(-1).copy_(sum.narrow(0, offset, g.numel()));
+    offset += g.numel();
+  }
+}
+} // namespace rannc
@@ -0,0 +1,100 @@
+#ifndef PYRANNC_GRADCOMPRESSOR_H
+#define PYRANNC_GRADCOMPRESSOR_H
+
+#include <torch/torch.h>
+
+#include <Common.h>
+
+namespace rannc {
+
+enum class GradCompressionType { NONE, FP16, BF16, POWER_SGD, TOP_K };
+
+struct GradCompressionClass {
+  // Minimum size of a gradient in bytes
+  size_t min_size;
+  GradCompressionType type;
+};
+
+/**
+ * Parses a specification of gradient compression given as comma-separated
+ * ``<min size in KB>:<method>`` (e.g. ``0:bf16,1024:powersgd``). The method
+ * is one of ``none``, ``fp16``, ``bf16``, ``powersgd`` and ``topk``.
+ *
+ * @param spec Specification.
+ * @return Classes sorted by the minimum size.
+ */
+std::vector<GradCompressionClass> parseGradCompression(const std::string& spec);
+
+/**
+ * Returns the ratio of the data exchanged to allreduce a gradient with the
+ * compression set by *grad_compression* to that without compression.
+ *
+ * @param dim Shape of the gradient.
+ * @param elem_size Size of an element of the gradient.
+ */
+double getGradCompressionRatio(
+    const std::vector<int64_t>& dim, size_t elem_size);
+
+/**
+ * Sums gradients across ranks with the compression chosen by their sizes.
+ *
+ * - *fp16*/*bf16*: Gradients are exchanged in the type and summed in fp32.
+ * - *powersgd*: A gradient reshaped into a matrix is approximated by a
+ * low-rank product (PowerSGD).
+ * - *topk*: Only the elements with the largest magnitudes are exchanged.
+ *
+ * The errors of *powersgd* and *topk* are kept for each param and added to
+ * its gradient in the next call (error feedback). They are kept divided by the
+ * scale of the gradients, so that they stay valid when the scale (e.g. loss
+ * scale of amp) changes.
+ */
+class GradCompressor {
+ public:
+  GradCompressor();
+
+  bool enabled() const {
+    return !classes_.empty();
+  }
+
+  /**
+   * Sums gradients in place. All ranks of the communicator must give the
+   * gradients of the same shapes in the same order.
+   *
+   * @param tag Tag of the communicator.
+   * @param rank_num Number of ranks of the communicator.
+   * @param param_ids IDs of the params of the gradients.
+   * @param grads Contiguous gradients on the device.
+   * @param grad_scale Factor by which the gradients are multiplied.
+   */
+  void allreduce(
+      int tag, size_t rank_num, const std::vector<long>& param_ids,
+      const std::vector<at::Tensor>& grads, double grad_scale);
+  void erase(long param_id);
+  void clear();
+
+ private:
+  GradCompressionType getType(const at::Tensor& grad) const;
+  void allreduceCast(
+      int tag, size_t rank_num, const std::vector<at::Tensor>& grads,
+      at::ScalarType stype);
+  void allreducePowerSGD(
+      int tag, size_t rank_num, const std::vector<long>& param_ids,
+      const std::vector<at::Tensor>& grads, double grad_scale);
+  void allreduceTopK(
+      int tag, size_t rank_num, const std::vector<long>& param_ids,
+      const std::vector<at::Tensor>& grads, double grad_scale);
+
+  std::vector<GradCompressionClass> classes_;
+  int powersgd_rank_;
+  double topk_ratio_;
+
+  // Errors divided by the scale of gradients
+  std::unordered_map<long, at::Tensor> errors_;
+  // Right factors of PowerSGD reused in the next call
+  std::unordered_map<long, at::Tensor> qs_;
+  // Initial right factors, which replace non-finite elements of qs_
+  std::unordered_map<long, at::Tensor> init_qs_;
+};
+} // namespace rannc
+
+#endif // PYRANNC_GRADCOMPRESSOR_H
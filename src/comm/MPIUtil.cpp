@@ -163,4 +163,11 @@ int64_t allReduceMaxBatchSize(int64_t batch_size, MPI_Comm comm) {
       MPI_Allreduce(&batch_size, &sum, 1, MPI_LONG, MPI_MAX, comm));
   return sum;
 }
+
+bool allReduceOr(bool val, MPI_Comm comm) {
+  int in = val ? 1 : 0;
+  int out = 0;
+  mpi::checkMPIResult(MPI_Allreduce(&in, &out, 1, MPI_INT, MPI_LOR, comm));
+  return out != 0;
+}
 } // namespace mpi
@@ -57,6 +57,7 @@ int64_t allReduceSumBatchSize(
     int64_t batch_size, MPI_Comm comm = MPI_COMM_WORLD);
 int64_t allReduceMaxBatchSize(
     int64_t batch_size, MPI_Comm comm = MPI_COMM_WORLD);
+bool allReduceOr(bool val, MPI_Comm comm = MPI_COMM_WORLD);
 
 void checkMPIResult(int code);
 void checkMPIStatusCode(int code);
@@ -9,6 +9,7 @@
 
 #include <comm/SComm.h>
 #include <comp/EventRecorder.h>
+#include <Config.h>
 #include <cuda/CudaUtil.h>
 
 namespace rannc {
@@ -16,6 +17,19 @@ namespace rannc {
 int DEFAULT_TAG = 100;
 constexpr size_t NCCL_MAX_COLL_OP_NUM = 2048;
 
+namespace {
+// Stream set by NCCLStreamGuard. nullptr is the legacy default stream.
+thread_local cudaStream_t coll_stream = nullptr;
+} // namespace
+
+NCCLStreamGuard::NCCLStreamGuard(cudaStream_t stream) : prev_(coll_stream) {
+  coll_stream = stream;
+}
+
+NCCLStreamGuard::~NCCLStreamGuard() {
+  coll_stream = prev_;
+}
+
 void NCCLBulkJobExecutor::flush() {
   NCCLWrapper& nccl = NCCLWrapper::get();
   nccl.syncWithErrorCheck();
@@ -87,6 +101,17 @@ struct AllReduceComm {
   ncclComm_t* comm;
 };
 
+NCCLWrapper::NCCLWrapper() {
+  config::Config& conf = config::Config::get();
+  hierarchical_allreduce_ = conf.getVal<bool>(config::HIERARCHICAL_ALLREDUCE);
+  hierarchical_min_size_ =
+      conf.getVal<int>(config::HIERARCHICAL_ALLREDUCE_MIN_SIZE) * 1024L *
+      1024L;
+  hierarchical_bucket_size_ =
+      conf.getVal<int>(config::HIERARCHICAL_ALLREDUCE_BUCKET_SIZE) * 1024L *
+      1024L;
+}
+
 void NCCLWrapper::createCommunicator(
     int tag, const std::unordered_set<int>& ranks) {
   if (contains(comm_map_, tag)) {
@@ -134,6 +159,7 @@ void NCCLWrapper::destroy() {
   destroyAllCommunicators();
   comm_map_.clear();
   ranks_to_tag_.clear();
+  hier_comm_map_.clear();
   buf_cache_.clear();
   job_executor_ = NCCLBulkJobExecutor();
 }
@@ -283,15 +309,15 @@ void runCollectiveComm(
 
 void NCCLWrapper::doAllreduce(
     int tag, const std::vector<at::Tensor>& tensors, ncclRedOp_t red_op) {
+  const cudaStream_t stream = coll_stream;
   runCollectiveComm(
       comm_map_, tag, tensors, {}, {}, "allreduce",
-      [red_op](
+      [red_op, stream](
           void* sendptr, void* recvptr, size_t count, int root,
           ncclDataType_t datatype, ncclComm_t* ncomm) {
         // in-place only
         return ncclAllReduce(
-            sendptr, sendptr, count, datatype, red_op, *ncomm,
-            (cudaStream_t) nullptr);
+            sendptr, sendptr, count, datatype, red_op, *ncomm, stream);
       });
 }
 
@@ -309,59 +335,272 @@ void NCCLWrapper::allreduceMax(
   doAllreduce(tag, tensors, ncclMax);
 }
 
+void NCCLWrapper::allreduceHierarchical(
+    int tag, const std::vector<at::Tensor>& tensors) {
+  if (!hierarchical_allreduce_ || !contains(hier_comm_map_, tag)) {
+    allreduce(tag, tensors);
+    return;
+  }
+  const auto& hcomm = hier_comm_map_.at(tag);
+
+  // std::map keeps the order of the types the same on all ranks
+  std::map<at::ScalarType, std::vector<at::Tensor>> type_tensors;
+  for (const auto& t : tensors) {
+    type_tensors[t.scalar_type()].push_back(t);
+  }
+
+  torch::NoGradGuard no_grad;
+  std::vector<at::Tensor> flat_tensors;
+  for (const auto& it : type_tensors) {
+    const auto& ts = it.second;
+    const int64_t local_size = hcomm.local_size;
+    int64_t numel = 0;
+    for (const auto& t : ts) {
+      numel += t.numel();
+    }
+    const size_t elem_size = ts.front().element_size();
+    if (numel * elem_size < hierarchical_min_size_) {
+      flat_tensors.insert(flat_tensors.end(), ts.begin(), ts.end());
+      continue;
+    }
+
+    // The number of elements of a bucket is a multiple of the local size
+    const int64_t bucket_numel = std::max(
+        local_size,
+        (int64_t)(hierarchical_bucket_size_ / elem_size) / local_size *
+            local_size);
+    auto buf = torch::empty(
+        {std::min(
+            bucket_numel, (numel + local_size - 1) / local_size * local_size)},
+        ts.front().options());
+
+    // Parts of the tensors copied to the buffer
+    std::vector<at::Tensor> packed;
+    int64_t filled = 0;
+    const auto flush = [&]() {
+      if (filled == 0) {
+        return;
+      }
+      const int64_t count = (filled + local_size - 1) / local_size * local_size;
+      auto bucket = buf.narrow(0, 0, count);
+      bucket.narrow(0, filled, count - filled).zero_();
+      doAllreduceHierarchical(hcomm, bucket);
+
+      int64_t offset = 0;
+      for (auto& part : packed) {
+        part.copy_(bucket.narrow(0, offset, part.numel()));
+        offset += part.numel();
+      }
+      packed.clear();
+      filled = 0;
+    };
+
+    for (const auto& t : ts) {
+      const auto flat = t.view(-1);
+      int64_t offset = 0;
+      while (offset < flat.numel()) {
+        const int64_t rest = flat.numel() - offset;
+        // A part that splits evenly is reduced in place without copying
+        if (filled == 0 && (rest >= bucket_numel || rest % local_size == 0)) {
+          const int64_t count = std::min(rest, bucket_numel);
+          doAllreduceHierarchical(hcomm, flat.narrow(0, offset, count));
+          offset += count;
+          continue;
+        }
+
+        const int64_t count = std::min(rest, bucket_numel - filled);
+        auto part = flat.narrow(0, offset, count);
+        buf.narrow(0, filled, count).copy_(part);
+        packed.push_back(part);
+        filled += count;
+        offset += count;
+        if (filled == bucket_numel) {
+          flush();
+        }
+      }
+    }
+    flush();
+  }
+
+  if (!flat_tensors.empty()) {
+    allreduce(tag, flat_tensors);
+  }
+}
+
+void NCCLWrapper::doAllreduceHierarchical(
+    const HierarchicalComm& hcomm, const at::Tensor& buf) {
+  assert(buf.numel() % hcomm.local_size == 0);
+  auto chunk = torch::empty({buf.numel() / hcomm.local_size}, buf.options());
+  reduceScatter(hcomm.intra_tag, {buf}, {chunk});
+  allreduce(hcomm.inter_tag, {chunk});
+  allgather(hcomm.intra_tag, {chunk}, {buf});
+}
+
+void NCCLWrapper::createHierarchicalCommunicator(
+    int tag, const std::unordered_set<int>& ranks) {
+  if (!hierarchical_allreduce_) {
+    return;
+  }
+
+  // std::map keeps the order of the nodes the same on all ranks
+  std::map<std::string, std::vector<int>> node_ranks;
+  for (int r : ranks) {
+    if (!contains(rank_to_node_, r)) {
+      return;
+    }
+    node_ranks[rank_to_node_.at(r)].push_back(r);
+  }
+  if (node_ranks.size() < 2) {
+    return;
+  }
+  const size_t local_size = node_ranks.begin()->second.size();
+  if (local_size < 2) {
+    return;
+  }
+  for (auto& it : node_ranks) {
+    if (it.second.size() != local_size) {
+      return;
+    }
+    std::sort(it.second.begin(), it.second.end());
+  }
+
+  // All ranks, including those not in the communicator, register the tags of
+  // all groups in the same order so that the tag maps stay identical.
+  TagMap& tag_map = TagMap::get();
+  const int my_rank = mpi::getRank();
+  HierarchicalComm hcomm;
+  std::unordered_set<int> my_intra_ranks;
+  std::unordered_set<int> my_inter_ranks;
+  for (const auto& it : node_ranks) {
+    const auto intra_ranks = vectorToSet(it.second);
+    int intra_tag = tag_map.getRankSetTag(intra_ranks);
+    if (contains(intra_ranks, my_rank)) {
+      hcomm.intra_tag = intra_tag;
+      my_intra_ranks = intra_ranks;
+    }
+  }
+  for (size_t i = 0; i < local_size; i++) {
+    std::unordered_set<int> inter_ranks;
+    for (const auto& it : node_ranks) {
+      inter_ranks.insert(it.second.at(i));
+    }
+    int inter_tag = tag_map.getRankSetTag(inter_ranks);
+    if (contains(inter_ranks, my_rank)) {
+      hcomm.inter_tag = inter_tag;
+      my_inter_ranks = inter_ranks;
+    }
+  }
+
+  if (!contains(ranks, my_rank) || contains(hier_comm_map_, tag)) {
+    return;
+  }
+
+  // Both kinds of groups are disjoint. All ranks create the intra-node
+  // communicators first, so the creation does not deadlock.
+  createCommunicator(hcomm.intra_tag, my_intra_ranks);
+  createCommunicator(hcomm.inter_tag, my_inter_ranks);
+  hcomm.local_size = local_size;
+  hier_comm_map_[tag] = hcomm;
+
+  logger->trace(
+      "Created communicators for hierarchical allreduce. tag={} intra={} "
+      "inter={}",
+      tag, join_as_str(setToVector(my_intra_ranks)),
+      join_as_str(setToVector(my_inter_ranks)));
+}
+
 void NCCLWrapper::reduce(
     int tag, const std::vector<at::Tensor>& tensors,
     const std::vector<int>& roots) {
   assert(tensors.size() == roots.size());
+  const cudaStream_t stream = coll_stream;
   runCollectiveComm(
       comm_map_, tag, tensors, {}, roots, "reduce",
-      [](void* sendptr, void* recvptr, size_t count, int root,
+      [stream](
+          void* sendptr, void* recvptr, size_t count, int root,
          ncclDataType_t datatype, ncclComm_t* ncomm) {
         // in-place only
         return ncclReduce(
-            sendptr, sendptr, count, datatype, ncclSum, root, *ncomm,
-            (cudaStream_t) nullptr);
+            sendptr, sendptr, count, datatype, ncclSum, root, *ncomm, stream);
       });
 }
 
 void NCCLWrapper::bcast(
     int tag, const std::vector<at::Tensor>& tensors,
     const std::vector<int>& roots) {
+  const cudaStream_t stream = coll_stream;
   runCollectiveComm(
       comm_map_, tag, tensors, {}, roots, "bcast",
-      [](void* sendptr, void* recvptr, size_t count, int root,
+      [stream](
+          void* sendptr, void* recvptr, size_t count, int root,
          ncclDataType_t datatype, ncclComm_t* ncomm) {
         // in-place only
-        return ncclBcast(
-            sendptr, count, datatype, root, *ncomm, (cudaStream_t) nullptr);
+        return ncclBcast(sendptr, count, datatype, root, *ncomm, stream);
       });
 }
 
 void NCCLWrapper::allgather(
     int tag, const std::vector<at::Tensor>& tensors,
     const std::vector<at::Tensor>& out_bufs) {
+  const cudaStream_t stream = coll_stream;
   return runCollectiveComm(
       comm_map_, tag, tensors, out_bufs, {}, "allgather",
-      [](void* sendptr, void* recvptr, size_t count, int root,
+      [stream](
+          void* sendptr, void* recvptr, size_t count, int root,
          ncclDataType_t datatype, ncclComm_t* ncomm) {
         return ncclAllGather(
-            sendptr, recvptr, count, datatype, *ncomm, (cudaStream_t) nullptr);
+            sendptr, recvptr, count, datatype, *ncomm, stream);
       });
 }
 
 void NCCLWrapper::reduceScatter(
     int tag, const std::vector<at::Tensor>& tensors,
     const std::vector<at::Tensor>& out_bufs) {
-  size_t num_proc = tensors.size();
+  const cudaStream_t stream = coll_stream;
   return runCollectiveComm(
       comm_map_, tag, tensors, out_bufs, {}, "reduceScatter",
-      [num_proc](
+      [stream](
           void* sendptr, void* recvptr, size_t count, int root,
-          ncclDataType_t datatype, ncclComm_t* ncomm) {
+         ncclDataType_t datatype, ncclComm_t* ncomm) {
+        // Each rank receives 1/(#ranks) of the input
+        int num_proc;
+        ncclCommCount(*ncomm, &num_proc);
         assert(count % num_proc == 0);
         return ncclReduceScatter(
             sendptr, recvptr, count / num_proc, datatype, ncclSum, *ncomm,
-            (cudaStream_t) nullptr);
+            stream);
+      });
+}
+
+void NCCLWrapper::alltoall(
+    int tag, const at::Tensor& tensor, const at::Tensor& out_buf) {
+  const size_t elem_size = tensor.element_size();
+  const cudaStream_t stream = coll_stream;
+  runCollectiveComm(
+      comm_map_, tag, {tensor}, {out_buf}, {}, "alltoall",
+      [elem_size, stream](
+          void* sendptr, void* recvptr, size_t count, int root,
+          ncclDataType_t datatype, ncclComm_t* ncomm) {
+        int num_proc;
+        ncclCommCount(*ncomm, &num_proc);
+        assert(count % num_proc == 0);
+        const size_t peer_count = count / num_proc;
+
+        // Runs in a group started by runCollectiveCommBuf
+        ncclResult_t result = ncclSuccess;
+        for (int i = 0; i < num_proc; i++) {
+          const size_t offset = i * peer_count * elem_size;
+          ncclResult_t send_result = ncclSend(
+              (char*)sendptr + offset, peer_count, datatype, i, *ncomm,
+              stream);
+          ncclResult_t recv_result = ncclRecv(
+              (char*)recvptr + offset, peer_count, datatype, i, *ncomm,
+              stream);
+          if (result == ncclSuccess) {
+            result = send_result != ncclSuccess ? send_result : recv_result;
+          }
+        }
+        return result;
       });
 }
 
@@ -534,7 +773,7 @@ void NCCLWrapper::checkAllCommErrors() {
 void NCCLWrapper::syncWithErrorCheck() {
   cudaError_t cudaErr;
   while (true) {
-    cudaErr = cudaStreamQuery(nullptr);
+    cudaErr = cudaStreamQuery(coll_stream);
     if (cudaErr == cudaSuccess) {
       return;
     }
@@ -630,6 +869,33 @@ void NCCLWrapper::commWithRetry(const std::function<void()>& f) {
   }
 }
 
+void NCCLWrapper::setNodeRanks(
+    const std::unordered_map<std::string, std::unordered_set<int>>&
+        node_ranks) {
+  rank_to_node_.clear();
+  for (const auto& it : node_ranks) {
+    for (int r : it.second) {
+      rank_to_node_[r] = it.first;
+    }
+  }
+  hier_comm_map_.clear();
+}
+
+bool NCCLWrapper::spansNodes(int tag) const {
+  std::unordered_set<std::string> nodes;
+  for (const auto& it : ranks_to_tag_) {
+    if (it.second != tag) {
+      continue;
+    }
+    for (int r : it.first) {
+      if (contains(rank_to_node_, r)) {
+        nodes.insert(rank_to_node_.at(r));
+      }
+    }
+  }
+  return nodes.size() > 1;
+}
+
 std::string NCCLWrapper::getImplName() {
   return "NCCL";
 }
@@ -5,12 +5,32 @@
 #ifndef PYRANNC_MPIALLREDUCERUNNER_H
 #define PYRANNC_MPIALLREDUCERUNNER_H
 
+#include <cuda_runtime_api.h>
 #include <unordered_set>
 #include "torch/TorchUtil.h"
 
 namespace rannc {
 typedef struct AllReduceComm AllReduceComm;
 
+/**
+ * Issues the collectives of NCCLWrapper called in the scope (and
+ * *syncWithErrorCheck()*) on *stream*. Otherwise they are issued on the legacy
+ * default stream, which is ordered against all other blocking streams. A
+ * caller that gives a side stream must order it against the streams that
+ * produce and consume the tensors.
+ */
+class NCCLStreamGuard {
+ public:
+  explicit NCCLStreamGuard(cudaStream_t stream);
+  ~NCCLStreamGuard();
+
+  NCCLStreamGuard(const NCCLStreamGuard&) = delete;
+  NCCLStreamGuard& operator=(const NCCLStreamGuard&) = delete;
+
+ private:
+  cudaStream_t prev_;
+};
+
 class NCCLBulkJobExecutor {
  public:
   void flush();
@@ -47,9 +67,34 @@ class NCCLWrapper {
   void createCommunicator(int tag, const std::unordered_set<int>& ranks);
   void destroy();
 
+  // Collectives are issued on the current CUDA stream
   void allreduce(int tag, const std::vector<at::Tensor>& tensors);
   void allreduceMin(int tag, const std::vector<at::Tensor>& tensors);
   void allreduceMax(int tag, const std::vector<at::Tensor>& tensors);
+  /**
+   * Sums tensors by reduce-scatter within each node, allreduce among the ranks
+   * with the same local index across nodes, and allgather within each node.
+   * Falls back to *allreduce* when *createHierarchicalCommunicator* has not
+   * created the communicators for the tag. Tensors smaller than
+   * *hierarchical_allreduce_min_size* in total for each type are also
+   * allreduced at once. The others are reduced in buckets of
+   * *hierarchical_allreduce_bucket_size*.
+   *
+   * @param tag Tag of the communicator.
+   * @param tensors Contiguous tensors to sum in place.
+   */
+  void allreduceHierarchical(int tag, const std::vector<at::Tensor>& tensors);
+  /**
+   * Creates the communicators used by *allreduceHierarchical* when the ranks
+   * span multiple nodes with the same number of ranks on each node. All ranks
+   * must call this in the same order, including those not in *ranks*, because
+   * the tags of the communicators are registered to *TagMap* on all ranks.
+   *
+   * @param tag Tag of the communicator.
+   * @param ranks Ranks of the communicator.
+   */
+  void createHierarchicalCommunicator(
+      int tag, const std::unordered_set<int>& ranks);
   void reduce(
       int tag, const std::vector<at::Tensor>& tensors,
       const std::vector<int>& roots);
@@ -65,6 +110,8 @@ class NCCLWrapper {
   void reduceScatter(
       int tag, const std::vector<at::Tensor>& tensors,
       const std::vector<at::Tensor>& out_bufs);
+  // Sends the i-th of the equal parts of *tensor* to the i-th rank
+  void alltoall(int tag, const at::Tensor& tensor, const at::Tensor& out_buf);
   void startBulk();
   void endBulk();
   void checkCommError(int tag);
@@ -83,6 +130,14 @@ class NCCLWrapper {
     return ranks_to_tag_.at(ranks);
   }
 
+  // Sets the ranks on each node for hierarchical allreduce
+  void setNodeRanks(
+      const std::unordered_map<std::string, std::unordered_set<int>>&
+          node_ranks);
+
+  // Whether the ranks of the communicator are on multiple nodes
+  bool spansNodes(int tag) const;
+
   std::string getImplName();
 
   NCCLWrapper(const NCCLWrapper&) = delete;
@@ -91,16 +146,30 @@ class NCCLWrapper {
   NCCLWrapper& operator=(NCCLWrapper&&) = delete;
 
  private:
-  NCCLWrapper() = default;
+  struct HierarchicalComm {
+    int intra_tag = -1;
+    int inter_tag = -1;
+    int local_size = 0;
+  };
+
+  NCCLWrapper();
 
   void doAllreduce(
       int tag, const std::vector<at::Tensor>& tensors, ncclRedOp_t red_op);
+  void doAllreduceHierarchical(
+      const HierarchicalComm& hcomm, const at::Tensor& buf);
 
   std::unordered_map<int, AllReduceComm*> comm_map_;
   std::unordered_map<std::unordered_set<int>, int, IntSetHash> ranks_to_tag_;
   BufferTensorCache buf_cache_;
   NCCLBulkJobExecutor job_executor_;
 
+  bool hierarchical_allreduce_;
+  size_t hierarchical_min_size_;
+  size_t hierarchical_bucket_size_;
+  std::unordered_map<int, std::string> rank_to_node_;
+  std::unordered_map<int, HierarchicalComm> hier_comm_map_;
+
   std::shared_ptr<spdlog::logger> logger = getLogger("NCCLWrapper");
 };
 
@@ -11,6 +11,7 @@
 #include "NCCLWrapper.h"
 #include "SCommCommon.h"
 #include "SCommPrimitive.h"
+#include "torch/BufferArena.h"
 
 namespace {
 rannc::RedistArgs getRedistArgsSend(
@@ -339,6 +340,7 @@ torch::jit::IValue SComm::distributeBatchTensor(
     auto ten = val.toTensor();
     assert(ten.is_contiguous());
     send_ptr = ten.data_ptr();
+    BufferArena::get().use(ten);
   } else {
     throw std::runtime_error(
         "Unsupported tensor type for distribution: " + toString(toIRType(val)));
@@ -349,7 +351,7 @@ torch::jit::IValue SComm::distributeBatchTensor(
     const auto& dim = dest_dist.at(mpi::getRank());
     if (productDim(dim) > 0) {
       recv_buf =
-          buf_cache_.get(getKey(route), setDimToIRType(global_type, dim));
+          getBuffer(route, setDimToIRType(global_type, dim));
       recv_ptr = recv_buf.data_ptr();
     }
   }
@@ -535,10 +537,11 @@ torch::jit::IValue SComm::distributeLossTensor(
 
   double src_ratio = 0;
   if (val.isNone()) {
-    src = buf_cache_.get(getKey(route), type);
+    src = getBuffer(route, type);
     src.zero_();
   } else if (val.isTensor()) {
     src = val.toTensor();
+    BufferArena::get().use(src);
     if (!weight) {
       if (contains(route.sources, mpi::getRank())) {
         src_ratio = bs_calc_.getDpRatio(
@@ -605,10 +608,21 @@ at::Tensor SComm::bcastTensor(
 }
 
 void SComm::setPipeline(
-    int pipeline_num, int64_t global_batch_size, bool is_bwd) {
+    int pipeline_num, int64_t global_batch_size, bool is_bwd,
+    const std::unordered_map<int, int64_t>& local_batch_sizes) {
   pipeline_num_ = pipeline_num;
   is_bwd_ = is_bwd;
-  bs_calc_.setPipeline(pipeline_num, global_batch_size);
+  if (local_batch_sizes.empty()) {
+    bs_calc_.setPipeline(pipeline_num, global_batch_size);
+  } else {
+    assert(global_batch_size == sum(values(local_batch_sizes)));
+    bs_calc_.setPipeline(pipeline_num, local_batch_sizes);
+  }
+}
+
+at::Tensor SComm::getBuffer(const RouteDP& route, const IRType& type) {
+  // The contents are always overwritten by the communication
+  return BufferArena::get().getBuffer(getKey(route), type, true);
 }
 
 void SComm::startSplit(int split_index) {
@@ -632,7 +646,7 @@ bool SComm::isLastLocalSplit(
       last_index = i;
     }
   }
-  assert(last_index > 0);
+  assert(last_index >= 0);
 
   return last_index == split_index;
 }
@@ -738,6 +752,18 @@ int64_t SComm::allReduceMaxBatchSize(int64_t batch_size) {
   });
 }
 
+std::unordered_map<int, int64_t> SComm::allGatherBatchSize(
+    int64_t batch_size) {
+  ObjectComm& ocomm = ObjectComm::get();
+  const auto batch_sizes = ocomm.allgather(batch_size);
+
+  std::unordered_map<int, int64_t> results;
+  for (size_t i = 0; i < batch_sizes.size(); i++) {
+    results[i] = batch_sizes.at(i);
+  }
+  return results;
+}
+
 void SComm::destroy() {
   for (auto& c : comm_map_) {
     c.second.reset();
@@ -748,6 +774,6 @@ void SComm::destroy() {
     g.second.reset();
   }
   group_map_.clear();
-  buf_cache_.clear();
+  BufferArena::get().clear();
 }
 } // namespace rannc
@@ -79,7 +79,9 @@ class SComm {
  public:
   static SComm& get();
 
-  void setPipeline(int pipeline_num, int64_t global_batch_size, bool is_bwd);
+  void setPipeline(
+      int pipeline_num, int64_t global_batch_size, bool is_bwd,
+      const std::unordered_map<int, int64_t>& local_batch_sizes = {});
   void startSplit(int split_index);
   std::string getKey(const RouteDP& route) const;
 
@@ -106,6 +108,7 @@ class SComm {
 
   int64_t allReduceSumBatchSize(int64_t batch_size);
   int64_t allReduceMaxBatchSize(int64_t batch_size);
+  std::unordered_map<int, int64_t> allGatherBatchSize(int64_t batch_size);
 
   MPI_Comm getCommunicator(int tag, const std::unordered_set<int>& ranks);
 
@@ -142,12 +145,13 @@ class SComm {
       const std::unordered_set<int>& src_ranks,
       const std::unordered_set<int>& dest_ranks, int split_index);
 
-  BufferTensorCache buf_cache_;
+  at::Tensor getBuffer(const RouteDP& route, const IRType& type);
+
   BatchSizeCalculator bs_calc_;
 
   int pipeline_num_;
   int split_index_;
-  bool is_bwd_;
+  bool is_bwd_ = false;
 
   GroupMap group_map_;
   CommMap comm_map_;
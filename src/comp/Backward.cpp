@@ -103,7 +103,8 @@ variable_list RaNNCTensorBackward::apply(variable_list&& grads) {
       if (enable_zero_) {
         param_storage_->allReduceParamGradsZero(graph_id_, 1.0);
       } else {
-        param_storage_->allReduceParamGrads(graph_id_);
+        // The scale of gradients (e.g. loss scale of amp) is unknown here
+        param_storage_->allReduceParamGrads(graph_id_, 1.0);
       }
 
       std::stringstream ss_scale;
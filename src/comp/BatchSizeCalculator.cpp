@@ -79,12 +79,53 @@ std::vector<int64_t> getSplitBatchSizes(int pipeline_num, int64_t batch_size) {
   return result;
 }
 
+/**
+ * Splits the samples of each rank into splits. When the number of samples is
+ * not divisible by the number of splits, the remaining samples of a rank are
+ * placed from the split next to the ones of the previous rank. Thus the sum of
+ * the batch sizes of a split over the ranks equals the one given by
+ * getSplitBatchSizes() for the total number of samples.
+ *
+ * @param pipeline_num The number of splits.
+ * @param local_batch_sizes The number of samples on each rank.
+ * @return Batch sizes of splits on each rank.
+ */
+std::unordered_map<int, std::vector<int64_t>> splitLocalBatchSizes(
+    int pipeline_num,
+    const std::unordered_map<int, int64_t>& local_batch_sizes) {
+  // Sorted by rank
+  std::vector<int> vec_ranks = rannc::keys(local_batch_sizes);
+
+  std::unordered_map<int, std::vector<int64_t>> results;
+  int64_t offset = 0;
+  for (int rank : vec_ranks) {
+    int64_t bs = local_batch_sizes.at(rank);
+    int64_t base_size = bs / pipeline_num;
+    int64_t mod = bs % pipeline_num;
+
+    std::vector<int64_t> split_sizes;
+    for (int i = 0; i < pipeline_num; i++) {
+      int64_t pos = (i - offset + pipeline_num) % pipeline_num;
+      split_sizes.push_back(base_size + (pos < mod ? 1 : 0));
+    }
+    results[rank] = split_sizes;
+    offset = (offset + mod) % pipeline_num;
+  }
+  return results;
+}
+
 BatchSizeCalculator::BatchSizeCalculator(
     int pipeline_num, int64_t global_batch_size)
     : pipeline_num_(pipeline_num), global_batch_size_(global_batch_size) {
   split_batch_sizes_ = getSplitBatchSizes(pipeline_num_, global_batch_size_);
 }
 
+BatchSizeCalculator::BatchSizeCalculator(
+    int pipeline_num, const std::unordered_map<int, int64_t>& local_batch_sizes)
+    : BatchSizeCalculator() {
+  setPipeline(pipeline_num, local_batch_sizes);
+}
+
 int64_t BatchSizeCalculator::getGlobalSplitBatchSize(int split_index) const {
   assert(global_batch_size_ > 0);
   assert(pipeline_num_ > 0);
@@ -100,10 +141,8 @@ std::vector<int64_t> BatchSizeCalculator::getAllGlobalSplitBatchSizes() const {
 int64_t BatchSizeCalculator::getLocalSplitBatchSize(
     const std::unordered_set<int>& ranks, int my_rank, int split_index) const {
   assert(contains(ranks, my_rank));
-  int64_t split_bs = getGlobalSplitBatchSize(split_index);
-
   std::unordered_map<int, int64_t> split_bs_all_ranks =
-      getLocalSplitBatchSizes(split_bs, ranks, split_index);
+      getRankSplitBatchSizes(ranks, split_index);
   assert(contains(split_bs_all_ranks, my_rank));
 
   return split_bs_all_ranks.at(my_rank);
@@ -116,9 +155,8 @@ std::vector<int64_t> BatchSizeCalculator::getAllLocalSplitBatchSizes(
 
   for (int split_index = 0; split_index < split_batch_sizes_.size();
        split_index++) {
-    int64_t split_bs = getGlobalSplitBatchSize(split_index);
     std::unordered_map<int, int64_t> split_bs_all_ranks =
-        getLocalSplitBatchSizes(split_bs, ranks, split_index);
+        getRankSplitBatchSizes(ranks, split_index);
     assert(contains(split_bs_all_ranks, my_rank));
     split_sizes.push_back(split_bs_all_ranks.at(my_rank));
   }
@@ -160,7 +198,7 @@ std::unordered_map<int, std::vector<int64_t>> BatchSizeCalculator::
 
   int64_t split_bs = getGlobalSplitBatchSize(split_index);
   std::unordered_map<int, int64_t> batch_sizes =
-      getLocalSplitBatchSizes(split_bs, ranks, split_index);
+      getRankSplitBatchSizes(ranks, split_index);
 
   std::unordered_map<int, std::vector<int64_t>> results;
   for (const auto& it : batch_sizes) {
@@ -183,5 +221,33 @@ void BatchSizeCalculator::setPipeline(
   pipeline_num_ = pipeline_num;
   global_batch_size_ = global_batch_size;
   split_batch_sizes_ = getSplitBatchSizes(pipeline_num_, global_batch_size_);
+  rank_split_batch_sizes_.clear();
+}
+
+void BatchSizeCalculator::setPipeline(
+    int pipeline_num,
+    const std::unordered_map<int, int64_t>& local_batch_sizes) {
+  setPipeline(pipeline_num, sum(values(local_batch_sizes)));
+  rank_split_batch_sizes_ =
+      splitLocalBatchSizes(pipeline_num, local_batch_sizes);
+}
+
+/**
+ * Returns batch sizes of the given split on the ranks. The actual numbers of
+ * samples are used for the ranks that hold the inputs. Other sets of ranks
+ * (e.g. ranks of a stage) evenly split the batch size of the split.
+ */
+std::unordered_map<int, int64_t> BatchSizeCalculator::getRankSplitBatchSizes(
+    const std::unordered_set<int>& ranks, int split_index) const {
+  if (!rank_split_batch_sizes_.empty() &&
+      vectorToSet(keys(rank_split_batch_sizes_)) == ranks) {
+    std::unordered_map<int, int64_t> batch_sizes;
+    for (const auto& it : rank_split_batch_sizes_) {
+      batch_sizes[it.first] = it.second.at(split_index);
+    }
+    return batch_sizes;
+  }
+  return getLocalSplitBatchSizes(
+      getGlobalSplitBatchSize(split_index), ranks, split_index);
 }
 } // namespace rannc
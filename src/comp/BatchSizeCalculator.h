@@ -13,8 +13,14 @@ class BatchSizeCalculator {
  public:
   BatchSizeCalculator() : pipeline_num_(0), global_batch_size_(0) {}
   BatchSizeCalculator(int pipeline_num, int64_t global_batch_size);
+  BatchSizeCalculator(
+      int pipeline_num,
+      const std::unordered_map<int, int64_t>& local_batch_sizes);
 
   void setPipeline(int pipeline_num, int64_t global_batch_size);
+  void setPipeline(
+      int pipeline_num,
+      const std::unordered_map<int, int64_t>& local_batch_sizes);
 
   int64_t getGlobalSplitBatchSize(int split_index) const;
   std::vector<int64_t> getAllGlobalSplitBatchSizes() const;
@@ -37,9 +43,15 @@ class BatchSizeCalculator {
       const std::unordered_set<int>& ranks, int my_rank, int split_index) const;
 
  private:
+  std::unordered_map<int, int64_t> getRankSplitBatchSizes(
+      const std::unordered_set<int>& ranks, int split_index) const;
+
   int pipeline_num_;
   int64_t global_batch_size_;
   std::vector<int64_t> split_batch_sizes_;
+  // Batch sizes of splits on the ranks that hold the inputs. Set only when
+  // the ranks have different numbers of samples.
+  std::unordered_map<int, std::vector<int64_t>> rank_split_batch_sizes_;
 };
 
 } // namespace rannc
@@ -24,6 +24,20 @@ at::Tensor DistributedGradLocator::getLocalParamSegment(long pid) {
   return local_param_segments_.at(pid);
 }
 
+at::Tensor DistributedGradLocator::ownLocalParamSegment(long pid) {
+  auto& param = params_.at(pid);
+  local_param_segments_[pid] = getSegment(pid, my_indices_.at(pid), false)
+                                   .detach()
+                                   .clone()
+                                   .set_requires_grad(param.requires_grad());
+  return local_param_segments_.at(pid);
+}
+
+int DistributedGradLocator::getLocalIndex(long pid) {
+  assert(contains(my_indices_, pid));
+  return my_indices_.at(pid);
+}
+
 void DistributedGradLocator::setGradToLocalParamSegment(long pid) {
   auto local_param_segment = getLocalParamSegment(pid);
   if (local_param_segment.requires_grad()) {
@@ -16,6 +16,10 @@ class DistributedGradLocator : public DistributedParamLocatorBase {
       long pid, const at::Tensor& param, const std::unordered_set<int>& ranks);
   at::Tensor getSegment(long pid, int index, bool grad);
   at::Tensor getLocalParamSegment(long pid);
+  // Copies the local segment to its own storage so that the param can be
+  // released
+  at::Tensor ownLocalParamSegment(long pid);
+  int getLocalIndex(long pid);
   void setGradToLocalParamSegment(long pid);
 
  private:
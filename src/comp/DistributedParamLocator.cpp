@@ -8,6 +8,7 @@
 #include "comm/NCCLWrapper.h"
 #include "comm/ObjectComm.h"
 #include "comm/SComm.h"
+#include "torch/HalfConversion.h"
 
 namespace rannc {
 
@@ -62,7 +63,9 @@ void DistributedParamLocator::set(long pid, const at::Tensor& src) {
     auto src_buf = torch::flatten(src).narrow(0, offset, src_size);
     assert(contains(param_parts_, pid));
     auto param_part = param_parts_.at(pid);
-    param_part.copy_(src_buf);
+    // Values loaded from a checkpoint can differ in dtype (e.g. fp32 values
+    // for a param cast to fp16 by amp)
+    copyConverting(param_part, src_buf);
   }
 }
 
@@ -73,7 +76,7 @@ void DistributedParamLocator::setScalarType(
 
   torch::NoGradGuard no_grad;
   param_part.set_requires_grad(false);
-  param_parts_[pid] = param_part.to(stype);
+  param_parts_[pid] = convertScalarType(param_part, stype);
 
   assert(contains(ir_types_, pid));
   auto ir_type = ir_types_.at(pid);
@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <future>
 
+#include <c10/cuda/CUDACachingAllocator.h>
 #include <c10/cuda/CUDAGuard.h>
 #include <c10/cuda/CUDAStream.h>
 #include <comm/SComm.h>
@@ -12,9 +13,24 @@
 
 #include "EventRecorder.h"
 #include "GraphConnector.h"
+#include "ZeroParamMap.h"
+#include "torch/BufferArena.h"
 
 namespace {
 
+void recordStream(
+    const rannc::IValueMap& values, const c10::cuda::CUDAStream& stream) {
+  for (const auto& it : values) {
+    rannc::transformTensorsInIValue(it.second, [&stream](const at::Tensor& t) {
+      if (t.is_cuda()) {
+        c10::cuda::CUDACachingAllocator::recordStream(
+            t.storage().data_ptr(), stream);
+      }
+      return t;
+    });
+  }
+}
+
 int getDelay(
     const rannc::RouteDP& r,
     const std::unordered_map<std::string, int>& graph_order) {
@@ -206,6 +222,16 @@ void GraphConnector::deployGraph() {
     }
   }
 
+  const bool wait_zero_params =
+      param_storage_->zeroEnabled(deployment_.id) &&
+      config::Config::get().getVal<bool>(config::OVERLAP_ZERO_BCAST);
+  released_zero_params_.clear();
+  if (param_storage_->zeroEnabled(deployment_.id) &&
+      config::Config::get().getVal<bool>(config::ZERO_STAGE3) &&
+      !deployment_.offload_params) {
+    released_zero_params_ = releaseZeroParams();
+  }
+
   for (const auto& it : graphs_) {
     const auto& subgraph = it.second;
     logger->trace("GraphConnector::deployGraph receiving constants and params");
@@ -226,9 +252,14 @@ void GraphConnector::deployGraph() {
     logger->trace("GraphConnector::deployGraph received params");
 
     const std::string& sg_name = subgraph->getName();
+    auto exec_conf = toDriverExecConf(deployment_, sg_name);
+    exec_conf.wait_zero_params = wait_zero_params;
+    if (contains(released_zero_params_, sg_name)) {
+      exec_conf.released_zero_params = released_zero_params_.at(sg_name);
+    }
     driver_.createModule(
         sg_name, deployment_.id, subgraph, constants, this->functions_,
-        param_tensors, toDriverExecConf(deployment_));
+        param_tensors, exec_conf);
 
     checkpointing_[sg_name] = deployment_.checkpointing;
     assert(contains(deployment_.allocation, sg_name));
@@ -240,6 +271,66 @@ void GraphConnector::deployGraph() {
   max_bwd_delay_ = getMaxDelay(deployment_.bwd_routes, bwd_graph_order_);
 }
 
+// A released param is gathered by a collective among the ranks holding it.
+// The ranks must run the nodes using it in the same order, so params are
+// released only when one subgraph uses them and all the ranks of the subgraph
+// hold them.
+std::unordered_map<std::string, std::unordered_set<std::string>>
+GraphConnector::releaseZeroParams() {
+  std::unordered_map<std::string, int> param_graph_counts;
+  for (const auto& it : deployment_.subgraphs) {
+    for (const auto& irp : graphParamValues(it.second)) {
+      param_graph_counts[irp.getName()]++;
+    }
+  }
+
+  std::unordered_map<std::string, std::unordered_set<std::string>> released;
+  for (const auto& it : graphs_) {
+    const auto& sg_name = it.first;
+    assert(contains(deployment_.allocation, sg_name));
+    const auto& alloc = deployment_.allocation.at(sg_name);
+
+    // Subgraphs on the same ranks can run in different orders on the ranks
+    bool alloc_shared = false;
+    for (const auto& other_it : graphs_) {
+      if (other_it.first != sg_name &&
+          deployment_.allocation.at(other_it.first) == alloc) {
+        alloc_shared = true;
+      }
+    }
+    if (alloc_shared) {
+      continue;
+    }
+
+    std::unordered_set<std::string> param_names;
+    for (const auto& name : findReleasableParams(it.second)) {
+      long pid = param_storage_->getParamID(deployment_.id, name);
+      if (param_graph_counts.at(name) == 1 &&
+          param_storage_->getRanks(pid) == alloc) {
+        param_names.insert(name);
+      }
+    }
+    released[sg_name] =
+        param_storage_->shardParamsZero(deployment_.id, param_names);
+  }
+  return released;
+}
+
+void GraphConnector::keepZeroParamsGathered(
+    const std::string& id, int split_index) {
+  if (!contains(released_zero_params_, id)) {
+    return;
+  }
+
+  // Released params stay gathered until the last micro-batch of the pass uses
+  // them. Those of the other subgraphs are not affected because a param is
+  // released only when a single subgraph uses it.
+  SComm& scomm = SComm::get();
+  assert(contains(allocation_, id));
+  ZeroParamMap::get().keepGathered(!scomm.isLastLocalSplit(
+      allocation_.at(id), mpi::getRank(), split_index));
+}
+
 void GraphConnector::runDriver(
     std::unordered_set<std::string>& graphs_done,
     std::unordered_map<std::string, IValueMap>& values, int split_index,
@@ -288,6 +379,16 @@ void GraphConnector::runDriver(
   }
 }
 
+size_t GraphConnector::getPassStepNum() const {
+  // The launcher uses the first and last steps
+  return 2 + deployment_.pipeline_num * fwd_sorted_graph_ids_.size();
+}
+
+size_t GraphConnector::getComputeStep(
+    int split_index, size_t graph_index) const {
+  return 1 + split_index * fwd_sorted_graph_ids_.size() + graph_index;
+}
+
 std::unordered_map<std::string, IValueMap> GraphConnector::compute(
     const std::string& id, bool is_bwd,
     const std::unordered_map<std::string, IValueMap>& inputs, int split_index,
@@ -324,7 +425,11 @@ std::unordered_map<std::string, IValueMap> GraphConnector::compute(
           IValueLocation, std::vector<torch::jit::IValue>, IValueLocationHash>>
       recv_values;
 
-  for (const auto& sg_name : sorted_graph_ids) {
+  BufferArena& buf_arena = BufferArena::get();
+  for (size_t gi = 0; gi < sorted_graph_ids.size(); gi++) {
+    const auto& sg_name = sorted_graph_ids.at(gi);
+    buf_arena.setStep(getComputeStep(split_index, gi));
+
     // recv
     assert(contains(recv_routes, sg_name));
     for (const auto& r : recv_routes.at(sg_name)) {
@@ -400,6 +505,7 @@ std::unordered_map<std::string, IValueMap> GraphConnector::forward(
     assert(contains(cp, id));
 
     this->rng_states_[id][split_index] = getRngState();
+    this->keepZeroParamsGathered(id, split_index);
 
     if (cp.at(id)) {
       if (split_index == 0) {
@@ -408,35 +514,21 @@ std::unordered_map<std::string, IValueMap> GraphConnector::forward(
         }
       }
 
-      c10::cuda::CUDAStream stream = c10::cuda::getStreamFromPool();
-      {
-        TraceEvent evt(getFuncKey(
-            "GraphConnector", "input_to_cpu_async", id, split_index, false));
-        c10::cuda::CUDAStreamGuard guard(stream);
-
-        inputs_[id][split_index] = toCPU(inputs, true, true);
-        copy_to_cpu_events_[id][split_index].record(stream);
+      if (driver.isSelectiveRecompute(id) &&
+          torch::autograd::GradMode::is_enabled()) {
+        // The driver keeps activations and inputs for recomputation
+        return driver.forwardSelective(id, inputs, split_index);
       }
 
-      SComm& scomm = SComm::get();
-      assert(contains(allocation_, id));
-      const std::unordered_set<int>& sg_ranks = allocation_.at(id);
-      // Before computing the *last* split in pipeline, start moving inputs for
-      // the *first* split to gpu
-      if (scomm.isLastLocalSplit(
-              allocation_.at(id), mpi::getRank(), split_index)) { //
-        TraceEvent evt(
-            getFuncKey("GraphConnector", "input_to_gpu", id, 0, false));
-        c10::cuda::CUDAStreamGuard guard(stream);
-        int first_split =
-            scomm.getFirstLocalSplitIndex(sg_ranks, mpi::getRank());
-
-        // Make sure that copy to cpu has finished
-        copy_to_cpu_events_[id][first_split].block(stream);
-
-        inputs_[id][first_split] =
-            toCUDAIfAvailable(inputs_[id][first_split], true, true);
-        copy_to_gpu_events_[id][first_split].record(stream);
+      if (offload_activations_) {
+        offloadInputs(id, inputs, split_index);
+      } else {
+        // Inputs may be placed in receive buffers reused by later splits
+        IValueMap stashed;
+        for (const auto& it : inputs) {
+          stashed[it.first] = cloneTensorsInIValue(it.second);
+        }
+        inputs_[id][split_index] = stashed;
       }
 
       torch::NoGradGuard no_grad;
@@ -522,6 +614,12 @@ std::unordered_map<std::string, IValueMap> GraphConnector::backward(
     auto& cp = this->checkpointing_;
     assert(contains(cp, id));
 
+    this->keepZeroParamsGathered(id, split_index);
+
+    if (cp.at(id) && driver.isSelectiveRecompute(id)) {
+      return driver.backwardSelective(id, inputs, split_index);
+    }
+
     if (cp.at(id)) {
       const auto stashed_rng_state = getRngState();
 
@@ -545,31 +643,17 @@ std::unordered_map<std::string, IValueMap> GraphConnector::backward(
         // Move inputs to cuda for the *next* split. This intends to overlap the
         // copy and backward. Note that inputs for the first split has already
         // been moved when finishing forward for the last split
-        if (!scomm.isLastLocalSplit(sg_ranks, mpi::getRank(), split_index)) {
-          TraceEvent evt(getFuncKey(
-              "GraphConnector", "input_to_gpu_async", id, split_index, false));
-
-          c10::cuda::CUDAStream stream = c10::cuda::getStreamFromPool();
-
-          int next_split = scomm.getNextLocalSplitIndex(
-              sg_ranks, mpi::getRank(), split_index);
-          c10::cuda::CUDAStreamGuard guard(stream);
-
-          // Make sure that copy to cpu has finished
-          at::cuda::CUDAEvent& prev_evt = copy_to_cpu_events_[id][next_split];
-          prev_evt.block(stream);
-
-          inputs_[id][next_split] =
-              toCUDAIfAvailable(inputs_[id][next_split], true, true);
+        if (offload_activations_) {
+          if (!scomm.isLastLocalSplit(sg_ranks, mpi::getRank(), split_index)) {
+            int next_split = scomm.getNextLocalSplitIndex(
+                sg_ranks, mpi::getRank(), split_index);
+            prefetchInputs(id, next_split);
+          }
 
-          at::cuda::CUDAEvent& cuda_evt =
-              copy_to_gpu_events_[id][split_index + 1];
-          cuda_evt.record(stream);
+          // We have to wait for inputs back to gpu
+          copy_to_gpu_events_[id][split_index].block(
+              c10::cuda::getCurrentCUDAStream());
         }
-
-        // We have to wait for inputs back to gpu
-        copy_to_gpu_events_[id][split_index].block(
-            c10::cuda::getCurrentCUDAStream());
         const auto outputs =
             driver_.forward(id, inputs_[id][split_index], split_index);
 
@@ -640,6 +724,55 @@ std::unordered_map<std::string, IValueMap> GraphConnector::backward(
   return values;
 }
 
+void GraphConnector::offloadInputs(
+    const std::string& id, const IValueMap& inputs, int split_index) {
+  TraceEvent evt(getFuncKey(
+      "GraphConnector", "input_to_cpu_async", id, split_index, false));
+
+  c10::cuda::CUDAStream stream = c10::cuda::getStreamFromPool();
+
+  // The inputs may still be being produced on the compute stream
+  at::cuda::CUDAEvent ready_evt;
+  ready_evt.record(c10::cuda::getCurrentCUDAStream());
+  ready_evt.block(stream);
+
+  {
+    c10::cuda::CUDAStreamGuard guard(stream);
+    inputs_[id][split_index] = toPinnedCPU(inputs, true);
+    // Keep the device memory of the inputs until the copy finishes
+    recordStream(inputs, stream);
+    copy_to_cpu_events_[id][split_index].record(stream);
+  }
+
+  SComm& scomm = SComm::get();
+  assert(contains(allocation_, id));
+  const std::unordered_set<int>& sg_ranks = allocation_.at(id);
+  // Before computing the *last* split in pipeline, start moving inputs for
+  // the *first* split to gpu
+  if (scomm.isLastLocalSplit(sg_ranks, mpi::getRank(), split_index)) {
+    int first_split = scomm.getFirstLocalSplitIndex(sg_ranks, mpi::getRank());
+    prefetchInputs(id, first_split);
+  }
+}
+
+void GraphConnector::prefetchInputs(const std::string& id, int split_index) {
+  TraceEvent evt(getFuncKey(
+      "GraphConnector", "input_to_gpu_async", id, split_index, false));
+
+  // The inputs are consumed on the compute stream
+  c10::cuda::CUDAStream compute_stream = c10::cuda::getCurrentCUDAStream();
+  c10::cuda::CUDAStream stream = c10::cuda::getStreamFromPool();
+  c10::cuda::CUDAStreamGuard guard(stream);
+
+  // Make sure that copy to cpu has finished
+  copy_to_cpu_events_[id][split_index].block(stream);
+
+  inputs_[id][split_index] =
+      toCUDAIfAvailable(inputs_[id][split_index], true, true);
+  recordStream(inputs_[id][split_index], compute_stream);
+  copy_to_gpu_events_[id][split_index].record(stream);
+}
+
 void GraphConnector::enableDropout(const std::string& id, bool enable) {
   driver_.enableDropout(id, enable);
 }
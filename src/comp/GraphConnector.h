@@ -34,6 +34,8 @@ class GraphConnector {
     time_counter_.enable(enable_profiling_);
 
     verify_recomp_ = config::Config::get().getVal<bool>(config::VERIFY_RECOMP);
+    offload_activations_ =
+        config::Config::get().getVal<bool>(config::OFFLOAD_ACTIVATIONS);
   }
 
   GraphConnector(const GraphConnector&) = delete;
@@ -57,6 +59,8 @@ class GraphConnector {
       int split_index);
 
   void enableDropout(const std::string& id, bool enable);
+  // Number of steps of the buffer arena in a forward or backward pass
+  size_t getPassStepNum() const;
 
  private:
   Deployment deployment_;
@@ -85,6 +89,7 @@ class GraphConnector {
   TimeCounter time_counter_;
   bool enable_profiling_;
   bool verify_recomp_;
+  bool offload_activations_;
 
   std::unordered_map<std::string, bool> checkpointing_;
   std::unordered_map<std::string, std::unordered_set<int>> allocation_;
@@ -107,6 +112,9 @@ class GraphConnector {
   std::unordered_map<std::string, std::unordered_map<int, RngState>>
       rng_states_;
   std::unordered_map<int, bool> skip_fwd_split_;
+  // Params released between uses for each subgraph (zero_stage3)
+  std::unordered_map<std::string, std::unordered_set<std::string>>
+      released_zero_params_;
   std::unordered_map<std::string, std::unordered_map<int, at::cuda::CUDAEvent>>
       copy_to_cpu_events_;
   std::unordered_map<std::string, std::unordered_map<int, at::cuda::CUDAEvent>>
@@ -134,6 +142,13 @@ class GraphConnector {
       const std::function<std::vector<std::string>(
           const std::shared_ptr<IRGraph>&)>& input_names_getter,
       const std::function<bool(const IValueMap&, int)>& skip);
+  std::unordered_map<std::string, std::unordered_set<std::string>>
+  releaseZeroParams();
+  void keepZeroParamsGathered(const std::string& id, int split_index);
+  void offloadInputs(
+      const std::string& id, const IValueMap& inputs, int split_index);
+  void prefetchInputs(const std::string& id, int split_index);
+  size_t getComputeStep(int split_index, size_t graph_index) const;
   void runDriver(
       std::unordered_set<std::string>& graphs_done,
       std::unordered_map<std::string, IValueMap>& values, int split_index,
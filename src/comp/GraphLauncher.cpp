@@ -6,9 +6,173 @@
 #include <comm/SComm.h>
 #include <cuda/CudaUtil.h>
 #include "EventRecorder.h"
+#include "ZeroBcastEvents.h"
+#include "ZeroParamMap.h"
+#include "torch/BufferArena.h"
 
 namespace rannc {
 
+namespace {
+const std::string MERGED_OUT_KEY = "OUT";
+
+std::vector<std::string> getParamUseOrder(const Deployment& deployment) {
+  std::vector<std::string> param_order;
+  std::unordered_set<std::string> found;
+  for (const auto& sg_name : deployment.fwd_graph_order) {
+    assert(contains(deployment.subgraphs, sg_name));
+    const auto& sg = deployment.subgraphs.at(sg_name);
+    for (const auto& node : sg->getNodes()) {
+      for (const auto& in_name : node.getInputNames()) {
+        if (sg->getValue(in_name).isParam() && !contains(found, in_name)) {
+          found.insert(in_name);
+          param_order.push_back(in_name);
+        }
+      }
+    }
+  }
+  return param_order;
+}
+
+// Writes outputs of splits into tensors of the whole batch at their offsets.
+// This saves cloning the receive buffers of each split and concatenating
+// them. Outputs not split along the batch (e.g. losses) are cloned and merged
+// afterwards.
+class SplitOutputMerger {
+ public:
+  explicit SplitOutputMerger(std::vector<int64_t> split_batch_sizes)
+      : split_batch_sizes_(std::move(split_batch_sizes)) {
+    int64_t offset = 0;
+    for (int64_t bs : split_batch_sizes_) {
+      offsets_.push_back(offset);
+      offset += bs;
+    }
+    total_batch_size_ = offset;
+  }
+
+  void add(int split_index, const torch::jit::IValue& val) {
+    if (!fits(split_index, val)) {
+      received_.push_back({split_index, false, cloneTensorsInIValue(val)});
+      return;
+    }
+
+    if (buffers_.empty()) {
+      template_ = val;
+      transformTensorsInIValueWithPath(
+          val, MERGED_OUT_KEY,
+          [this](const at::Tensor& t, const IValueLocation& loc) {
+            auto sizes = t.sizes().vec();
+            sizes[0] = total_batch_size_;
+            buffers_[toString(loc)] = torch::empty(sizes, t.options());
+            return t;
+          });
+    }
+
+    const int64_t offset = offsets_.at(split_index);
+    const int64_t bs = split_batch_sizes_.at(split_index);
+    transformTensorsInIValueWithPath(
+        val, MERGED_OUT_KEY,
+        [this, offset, bs](const at::Tensor& t, const IValueLocation& loc) {
+          torch::NoGradGuard no_grad;
+          buffers_.at(toString(loc)).narrow(0, offset, bs).copy_(t);
+          return t;
+        });
+    received_.push_back({split_index, true, torch::jit::IValue()});
+  }
+
+  torch::jit::IValue merge(int64_t batch_size) const {
+    bool all_placed = received_.size() == split_batch_sizes_.size();
+    for (const auto& r : received_) {
+      all_placed &= r.placed;
+    }
+    if (all_placed) {
+      return getPlaced(0, total_batch_size_);
+    }
+
+    std::vector<torch::jit::IValue> values;
+    for (const auto& r : received_) {
+      if (r.placed) {
+        values.push_back(getPlaced(
+            offsets_.at(r.split_index),
+            split_batch_sizes_.at(r.split_index)));
+      } else {
+        values.push_back(r.value);
+      }
+    }
+    return concatOrSumTensorsInIValues(values, batch_size);
+  }
+
+  bool empty() const {
+    return received_.empty();
+  }
+
+ private:
+  struct ReceivedSplit {
+    int split_index;
+    bool placed;
+    // Set only when the split was not placed in the buffers
+    torch::jit::IValue value;
+  };
+
+  bool fits(int split_index, const torch::jit::IValue& val) const {
+    if (split_index >= (int)split_batch_sizes_.size()) {
+      return false;
+    }
+
+    bool ok = true;
+    size_t tensor_num = 0;
+    const int64_t bs = split_batch_sizes_.at(split_index);
+    transformTensorsInIValueWithPath(
+        val, MERGED_OUT_KEY,
+        [this, bs, &ok, &tensor_num](
+            const at::Tensor& t, const IValueLocation& loc) {
+          tensor_num++;
+          if (!t.defined() || t.dim() == 0 || t.size(0) != bs) {
+            ok = false;
+            return t;
+          }
+          if (!buffers_.empty()) {
+            const auto key = toString(loc);
+            if (!contains(buffers_, key)) {
+              ok = false;
+              return t;
+            }
+            const auto& buf = buffers_.at(key);
+            if (buf.scalar_type() != t.scalar_type() ||
+                buf.device() != t.device() ||
+                buf.sizes().slice(1) != t.sizes().slice(1)) {
+              ok = false;
+            }
+          }
+          return t;
+        });
+    return ok && tensor_num > 0 &&
+        (buffers_.empty() || tensor_num == buffers_.size());
+  }
+
+  torch::jit::IValue getPlaced(int64_t offset, int64_t bs) const {
+    return transformTensorsInIValueWithPath(
+        template_, MERGED_OUT_KEY,
+        [this, offset, bs](const at::Tensor& t, const IValueLocation& loc) {
+          const auto& buf = buffers_.at(toString(loc));
+          if (offset == 0 && bs == total_batch_size_) {
+            return buf;
+          }
+          return buf.narrow(0, offset, bs);
+        });
+  }
+
+  std::vector<int64_t> split_batch_sizes_;
+  std::vector<int64_t> offsets_;
+  int64_t total_batch_size_;
+
+  std::vector<ReceivedSplit> received_;
+  // Structure of the output. Tensors in this value are replaced with the
+  // buffers.
+  torch::jit::IValue template_;
+  std::unordered_map<std::string, at::Tensor> buffers_;
+};
+} // namespace
+
 bool isBatch(
     const std::shared_ptr<IRGraph>& graph, const std::string& value_name) {
   return graph->getValue(value_name).isBatch();
@@ -55,6 +219,15 @@ std::vector<RouteDP> rewriteOutRoute(
   });
 }
 
+// Ranks can process their own samples without padding unless a rank has no
+// sample.
+bool isUnevenBatch(const std::unordered_map<int, int64_t>& local_batch_sizes) {
+  const auto batch_sizes = values(local_batch_sizes);
+  const auto minmax =
+      std::minmax_element(batch_sizes.begin(), batch_sizes.end());
+  return *minmax.first > 0 && *minmax.first != *minmax.second;
+}
+
 IValueMap GraphLauncher::alignBatch(
     const IValueMap& input, int batch_size,
     const std::shared_ptr<IRGraph>& graph, bool zero_pad) {
@@ -80,6 +253,15 @@ std::unordered_map<std::string, IValueMap> toCUDAIfAvailable(
   return ret;
 }
 
+std::unordered_map<std::string, IValueMap> toCUDAIfAvailableNoCopy(
+    const std::unordered_map<std::string, IValueMap>& inputs) {
+  std::unordered_map<std::string, IValueMap> ret;
+  for (const auto& it : inputs) {
+    ret[it.first] = toCUDAIfAvailableNoCopy(it.second);
+  }
+  return ret;
+}
+
 void GraphLauncher::deployGraph() {
   logger->trace("GraphLauncher::deployGraph starting");
 
@@ -116,6 +298,10 @@ void GraphLauncher::deployGraph() {
     bcast_route_ = bcast_route;
   }
 
+  if (overlap_zero_bcast_ && param_storage_->zeroEnabled(deployment_.id)) {
+    zero_param_order_ = getParamUseOrder(deployment_);
+  }
+
   logger->trace("GraphLauncher::deployGraph finished");
 }
 
@@ -132,9 +318,11 @@ void GraphLauncher::undeployGraph(const std::string& id) {
 IValueMap GraphLauncher::compute(
     const std::string& id, bool is_bwd, int64_t batch_size,
     const IValueMap& inputs, std::vector<RouteDP>& in_routes,
-    std::vector<RouteDP>& out_routes) {
+    std::vector<RouteDP>& out_routes,
+    const std::unordered_map<int, int64_t>& local_batch_sizes) {
   // Assume we already padded the global batch size according to the world size
-  assert(batch_size % mpi::getSize() == 0);
+  // unless the batch sizes of ranks are given
+  assert(!local_batch_sizes.empty() || batch_size % mpi::getSize() == 0);
 
   logger->trace("GraphLauncher::compute starting");
 
@@ -143,7 +331,14 @@ IValueMap GraphLauncher::compute(
   int actual_pipeline_num = deployment_.pipeline_num > batch_size
       ? batch_size
       : deployment_.pipeline_num;
-  scomm.setPipeline(deployment_.pipeline_num, batch_size, is_bwd);
+  scomm.setPipeline(
+      deployment_.pipeline_num, batch_size, is_bwd, local_batch_sizes);
+
+  // Inputs are distributed at the first step and outputs at the last step.
+  // The connector sets the steps in between.
+  BufferArena& buf_arena = BufferArena::get();
+  const size_t step_num = driver_[id]->getPassStepNum();
+  buf_arena.beginPass(id + (is_bwd ? "_bwd" : "_fwd"), step_num);
 
   // Routes from/to subgraphs
   std::unordered_map<
@@ -163,6 +358,9 @@ IValueMap GraphLauncher::compute(
 
   // *global* batch size in the pipeline
   BatchSizeCalculator bs_calc(actual_pipeline_num, batch_size);
+  if (!local_batch_sizes.empty()) {
+    bs_calc.setPipeline(actual_pipeline_num, local_batch_sizes);
+  }
 
   // *local* batch size of *this split* in the pipeline
   std::vector<int64_t> local_split_batch_sizes;
@@ -186,6 +384,7 @@ IValueMap GraphLauncher::compute(
   graph_inputs.reserve(actual_pipeline_num);
   NCCLWrapper& ar = NCCLWrapper::get();
   //        ar.startBulk();
+  buf_arena.setStep(0);
   for (int i = 0; i < actual_pipeline_num; i++) {
     std::unordered_map<std::string, IValueMap> split_inputs;
 
@@ -205,6 +404,16 @@ IValueMap GraphLauncher::compute(
             "Unexpected type of graph input. route=" + toString(r));
       }
 
+      // Each rank receives exactly its own slice when the route does not
+      // change the ranks. The slice is a view of the input.
+      if (gather_inputs_ && !r.ir_value.isLoss() &&
+          vectorToSet(r.sources) == vectorToSet(r.dests)) {
+        if (contains(r.dests, mpi::getRank())) {
+          split_inputs[r.dest_graph][r.location] = detach(send_val);
+        }
+        continue;
+      }
+
       logger->trace(
           "Sending input via route {} split={} {}", toString(r), i,
           toString(toIRType(send_val)));
@@ -214,10 +423,11 @@ IValueMap GraphLauncher::compute(
           toString(toIRType(in)));
 
       if (!in.isNone()) {
+        // Receive buffers are reused by the next split
         const auto event_key =
-            getFuncKey("GraphLauncher", "input_to_cpu", id, i, false);
+            getFuncKey("GraphLauncher", "clone_input", id, i, false);
         recordStart(event_key);
-        split_inputs[r.dest_graph][r.location] = toCPU(in, true);
+        split_inputs[r.dest_graph][r.location] = cloneTensorsInIValue(in);
         recordEnd(event_key);
       }
     }
@@ -242,7 +452,7 @@ IValueMap GraphLauncher::compute(
     const auto event_key =
         getFuncKey("GraphLauncher", "input_to_cuda", id, i, false);
     recordStart(event_key);
-    const auto connector_inputs = toCUDAIfAvailable(graph_inputs.at(i), true);
+    const auto connector_inputs = toCUDAIfAvailableNoCopy(graph_inputs.at(i));
     recordEnd(event_key);
 
     if (is_bwd) {
@@ -257,7 +467,18 @@ IValueMap GraphLauncher::compute(
   /////////////////////////////////////////////////////
   // Step 3: distribute (outputs)
   /////////////////////////////////////////////////////
-  std::vector<std::unordered_map<std::string, IValueMap>> graph_outputs;
+  std::unordered_map<
+      std::string,
+      std::unordered_map<IValueLocation, SplitOutputMerger, IValueLocationHash>>
+      out_mergers;
+  for (const auto& g_it : out_route_map) {
+    for (const auto& r_it : g_it.second) {
+      out_mergers[g_it.first].emplace(
+          r_it.first, SplitOutputMerger(local_split_batch_sizes));
+    }
+  }
+
+  buf_arena.setStep(step_num - 1);
   for (int i = 0; i < actual_pipeline_num; i++) {
     assert(graph_driver_out.size() > i);
 
@@ -267,7 +488,6 @@ IValueMap GraphLauncher::compute(
     // *global* batch sizes of this split in the pipeline
     scomm.startSplit(i);
 
-    std::unordered_map<std::string, IValueMap> split_out;
     for (const auto& g_it : out_route_map) {
       const auto& sg_name = g_it.first;
       const auto& sg_out_routes = g_it.second;
@@ -284,8 +504,7 @@ IValueMap GraphLauncher::compute(
               "GraphLauncher", "output_to_cuda", route.ir_value.getName(),
               route.ir_value.getType());
           recordStart(event_key);
-          send_val =
-              toCUDAIfAvailable(split_driver_out[sg_name].at(loc), true, false);
+          send_val = toCUDAIfAvailableNoCopy(split_driver_out[sg_name].at(loc));
           recordEnd(event_key);
         }
         logger->trace(
@@ -302,16 +521,15 @@ IValueMap GraphLauncher::compute(
             toString(toIRType(out)), toString(route), i);
 
         if (!out.isNone()) {
+          // Receive buffers are reused by the next split
           const auto event_key =
-              getFuncKey("GraphLauncher", "clone_output", id, i, false);
+              getFuncKey("GraphLauncher", "merge_output", id, i, false);
           recordStart(event_key);
-          split_out[sg_name][loc] = cloneTensorsInIValue(out);
+          out_mergers.at(sg_name).at(loc).add(i, out);
           recordEnd(event_key);
         }
       }
     }
-
-    graph_outputs.push_back(std::move(split_out));
   }
 
   IValueMap ret;
@@ -325,23 +543,11 @@ IValueMap GraphLauncher::compute(
       const auto& loc = r_it.first;
       const auto& route = r_it.second;
 
-      std::vector<torch::jit::IValue> loc_values;
-      for (int i = 0; i < actual_pipeline_num; i++) {
-        const auto& split_recv_map = graph_outputs.at(i);
-        if (!contains(split_recv_map, sg_name))
-          break;
-
-        const auto& sg_split_recv_map = split_recv_map.at(sg_name);
-        if (!contains(sg_split_recv_map, loc))
-          break;
-
-        loc_values.push_back(sg_split_recv_map.at(loc));
-      }
-
+      const auto& merger = out_mergers.at(sg_name).at(loc);
       const auto& ir_val = route.ir_value;
-      if (!loc_values.empty()) {
+      if (!merger.empty()) {
         if (ir_val.isLoss() || ir_val.isBatch()) {
-          ret[loc] = concatOrSumTensorsInIValues(loc_values, batch_size);
+          ret[loc] = merger.merge(batch_size);
         } else {
           throw std::runtime_error(
               "Unexpected type of graph input. route=" + toString(route));
@@ -350,6 +556,8 @@ IValueMap GraphLauncher::compute(
     }
   }
 
+  buf_arena.endPass();
+
   logger->trace("GraphLauncher::compute finished");
 
   return ret;
@@ -362,8 +570,19 @@ torch::jit::IValue GraphLauncher::forward(
 
   logger->trace("GraphLauncher::forward starting");
 
+  const bool async_zero_bcast =
+      param_storage_->zeroEnabled(id) && overlap_zero_bcast_;
   if (param_storage_->zeroEnabled(id)) {
-    param_storage_->bcastParamsZero(id, false);
+    // Gathered params can be stale after the optimizer updated the segments
+    ZeroParamMap::get().releaseAll();
+  }
+  if (async_zero_bcast) {
+    // TorchDriver waits for each bucket when it first reads a param in it
+    param_storage_->bcastParamsZeroAsync(
+        id, zero_param_order_, zero_bcast_bucket_size_);
+  } else if (param_storage_->zeroEnabled(id)) {
+    // Released params are gathered when they are used
+    param_storage_->bcastParamsZero(id, false, true);
   }
 
   time_counter_.start("GraphLauncher::forward");
@@ -373,14 +592,32 @@ torch::jit::IValue GraphLauncher::forward(
   config::Config& conf = config::Config::get();
   IValueMap pad_inputs;
   int64_t global_batch_size;
+  last_local_batch_sizes_.clear();
   if (gather_inputs_) {
     SComm& scomm = SComm::get();
-    int64_t max_local_batch_size =
-        scomm.allReduceMaxBatchSize(input_batch_size);
-    last_batch_size_ = max_local_batch_size;
-    global_batch_size = max_local_batch_size * mpi::getSize();
-    pad_inputs =
-        alignBatch(inputs, max_local_batch_size, deployment_.graph, false);
+    int64_t max_local_batch_size;
+    if (pad_uneven_batches_) {
+      max_local_batch_size = scomm.allReduceMaxBatchSize(input_batch_size);
+    } else {
+      const auto local_batch_sizes =
+          scomm.allGatherBatchSize(input_batch_size);
+      max_local_batch_size = max(values(local_batch_sizes));
+      if (isUnevenBatch(local_batch_sizes)) {
+        last_local_batch_sizes_ = local_batch_sizes;
+      }
+    }
+
+    if (last_local_batch_sizes_.empty()) {
+      last_batch_size_ = max_local_batch_size;
+      global_batch_size = max_local_batch_size * mpi::getSize();
+      pad_inputs =
+          alignBatch(inputs, max_local_batch_size, deployment_.graph, false);
+    } else {
+      // Each rank processes only its own samples
+      last_batch_size_ = input_batch_size;
+      global_batch_size = sum(values(last_local_batch_sizes_));
+      pad_inputs = inputs;
+    }
   } else {
     global_batch_size = last_batch_size_ = input_batch_size;
 
@@ -394,7 +631,12 @@ torch::jit::IValue GraphLauncher::forward(
   SComm& scomm = SComm::get();
   auto outputs = compute(
       id, false, global_batch_size, pad_inputs, deployment_.fwd_in_routes,
-      deployment_.fwd_out_routes);
+      deployment_.fwd_out_routes, last_local_batch_sizes_);
+  if (param_storage_->zeroEnabled(id)) {
+    // Params not used on this rank are also ready after forward. Gathers
+    // ahead also finish before the outputs are broadcast.
+    ZeroBcastEvents::get().waitAll();
+  }
 
   const auto& output_names = deployment_.graph->getOutputNames();
   assert(output_names.size() == 1);
@@ -446,7 +688,12 @@ IValueMap GraphLauncher::backward(
   config::Config& conf = config::Config::get();
   IValueMap scaled_inputs;
   int64_t global_batch_size;
-  if (gather_inputs_) {
+  if (gather_inputs_ && !last_local_batch_sizes_.empty()) {
+    // Gradients are split in the same way as the inputs of the forward pass
+    assert(input_batch_size == last_local_batch_sizes_.at(mpi::getRank()));
+    global_batch_size = sum(values(last_local_batch_sizes_));
+    scaled_inputs = inputs;
+  } else if (gather_inputs_) {
     SComm& scomm = SComm::get();
     int64_t max_local_batch_size =
         scomm.allReduceMaxBatchSize(input_batch_size);
@@ -469,7 +716,7 @@ IValueMap GraphLauncher::backward(
   SComm& scomm = SComm::get();
   auto outputs = compute(
       id, true, global_batch_size, scaled_inputs, deployment_.bwd_in_routes,
-      deployment_.bwd_out_routes);
+      deployment_.bwd_out_routes, last_local_batch_sizes_);
 
   if (gather_inputs_) {
     outputs = alignBatch(outputs, input_batch_size, deployment_.graph, false);
@@ -481,6 +728,8 @@ IValueMap GraphLauncher::backward(
   }
 
   if (param_storage_->zeroEnabled(id)) {
+    // Also finishes gathers ahead before collectives for gradients
+    ZeroParamMap::get().releaseAll();
     param_storage_->setGradToLocalParamSegment(id);
   }
 
@@ -34,6 +34,16 @@ class GraphLauncher {
         deployment_(std::move(deployment)),
         gather_inputs_(gather_inputs) {
     enable_profiling_ = config::Config::get().getVal<bool>(config::PROFILING);
+    // With zero_stage3, all ranks holding a param must run the same
+    // micro-batches to gather it
+    pad_uneven_batches_ =
+        config::Config::get().getVal<bool>(config::PAD_UNEVEN_BATCHES) ||
+        config::Config::get().getVal<bool>(config::ZERO_STAGE3);
+    overlap_zero_bcast_ =
+        config::Config::get().getVal<bool>(config::OVERLAP_ZERO_BCAST);
+    zero_bcast_bucket_size_ =
+        config::Config::get().getVal<int>(config::ZERO_BCAST_BUCKET_SIZE) *
+        1024L * 1024L;
 
     time_counter_.enable(enable_profiling_);
   }
@@ -48,7 +58,8 @@ class GraphLauncher {
   IValueMap compute(
       const std::string& id, bool is_bwd, int64_t batch_size,
       const IValueMap& inputs, std::vector<RouteDP>& in_routes,
-      std::vector<RouteDP>& out_routes);
+      std::vector<RouteDP>& out_routes,
+      const std::unordered_map<int, int64_t>& local_batch_sizes);
 
   IValueMap alignBatch(
       const IValueMap& input, int batch_size,
@@ -65,10 +76,18 @@ class GraphLauncher {
   std::unordered_map<std::string, std::shared_ptr<Blob>> buffer;
   RouteDP bcast_route_;
   int64_t last_batch_size_;
+  // Batch sizes of ranks in the last forward pass. Empty when the inputs were
+  // padded.
+  std::unordered_map<int, int64_t> last_local_batch_sizes_;
 
   TimeCounter time_counter_;
   bool enable_profiling_;
   bool gather_inputs_;
+  bool pad_uneven_batches_;
+  bool overlap_zero_bcast_;
+  size_t zero_bcast_bucket_size_;
+  // Names of params in the order of their first use in forward
+  std::vector<std::string> zero_param_order_;
 
   const std::shared_ptr<spdlog::logger> logger = getLogger("GraphLauncher");
 };
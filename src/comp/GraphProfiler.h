@@ -11,6 +11,7 @@
 #include "graph/ir.h"
 #include "torch/TorchDriver.h"
 #include "torch/TorchUtil.h"
+#include "torch/TrackingAllocator.h"
 
 namespace rannc {
 
@@ -174,7 +175,11 @@ class GraphProfiler {
         functions_(std::move(functions)),
         batch_size_(batch_size),
         dev_num_(dev_num),
-        min_pipeline_num_(min_pipeline_num) {}
+        min_pipeline_num_(min_pipeline_num) {
+    if (!torch::cuda::is_available()) {
+      TrackingCPUAllocator::get().install();
+    }
+  }
 
   ~GraphProfiler() {
     clear();
@@ -3,13 +3,32 @@
 //
 
 #include "OffloadedParamMap.h"
+#include <comm/MPIUtil.h>
+#include <Config.h>
 #include "Common.h"
+#include "torch/TorchUtil.h"
 
 namespace rannc {
 
+OffloadedParamMap::OffloadedParamMap() {
+  config::Config& conf = config::Config::get();
+  const auto file_dir = conf.getVal<std::string>(config::OFFLOAD_PARAM_DIR);
+  if (!file_dir.empty()) {
+    std::stringstream ss;
+    ss << "rannc_offload_" << mpi::getRank() << ".bin";
+    const fs::path path = fs::path(file_dir) / ss.str();
+    file_store_ = std::make_unique<ParamFileStore>(
+        path.string(), conf.getVal<bool>(config::OFFLOAD_DIRECT_IO));
+    prefetch_num_ = conf.getVal<int>(config::OFFLOAD_PREFETCH_NUM);
+  }
+}
+
 void OffloadedParamMap::registerParam(
     const std::string& name, const at::Tensor& param) {
   param_map_[name] = param;
+  param_names_[param.unsafeGetTensorImpl()] = name;
+  file_resident_.erase(name);
+  file_clean_.erase(name);
 }
 
 at::Tensor OffloadedParamMap::getParam(const std::string& name) {
@@ -17,4 +36,130 @@ at::Tensor OffloadedParamMap::getParam(const std::string& name) {
   return param_map_.at(name);
 }
 
-} // namespace rannc
\ No newline at end of file
+void OffloadedParamMap::fetch(const std::string& name, bool backward) {
+  at::Tensor param = getParam(name);
+
+  if (file_store_) {
+    doLoadFromFile(name, param);
+    if (!param.requires_grad()) {
+      // Buffers (e.g. running stats) can be updated by the following op
+      file_clean_.erase(name);
+    }
+    prefetchNext(name, backward);
+  }
+  toCUDAInPlace(param);
+}
+
+void OffloadedParamMap::offload(const std::string& name) {
+  at::Tensor param = getParam(name);
+
+  if (file_store_) {
+    doStoreToFile(name, param);
+  } else {
+    toCPUInPlace(param);
+  }
+}
+
+const std::string* OffloadedParamMap::findParamName(
+    const at::Tensor& param) const {
+  auto it = param_names_.find(param.unsafeGetTensorImpl());
+  if (it == param_names_.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+void OffloadedParamMap::loadParamFromFile(const at::Tensor& param) {
+  const auto name = findParamName(param);
+  if (!file_store_ || name == nullptr) {
+    return;
+  }
+  doLoadFromFile(*name, param_map_.at(*name));
+}
+
+void OffloadedParamMap::storeParamToFile(const at::Tensor& param) {
+  const auto name = findParamName(param);
+  if (!file_store_ || name == nullptr) {
+    return;
+  }
+  file_clean_.erase(*name);
+  doStoreToFile(*name, param_map_.at(*name));
+}
+
+void OffloadedParamMap::prefetchParamFromFile(const at::Tensor& param) {
+  const auto name = findParamName(param);
+  if (!file_store_ || name == nullptr) {
+    return;
+  }
+  prefetchTensorFromFile(*name);
+}
+
+void OffloadedParamMap::storeTensorToFile(
+    const std::string& key, at::Tensor& ten) {
+  assert(file_store_);
+  file_clean_.erase(key);
+  doStoreToFile(key, ten);
+}
+
+void OffloadedParamMap::loadTensorFromFile(
+    const std::string& key, at::Tensor& ten) {
+  assert(file_store_);
+  doLoadFromFile(key, ten);
+}
+
+void OffloadedParamMap::prefetchTensorFromFile(const std::string& key) {
+  assert(file_store_);
+  if (contains(file_resident_, key)) {
+    file_store_->prefetch(key);
+  }
+}
+
+void OffloadedParamMap::doStoreToFile(const std::string& key, at::Tensor& ten) {
+  if (contains(file_resident_, key)) {
+    return;
+  }
+
+  // Parameters are not modified by forward/backward. We write them only after
+  // they are updated.
+  if (!contains(file_clean_, key)) {
+    file_store_->store(key, ten);
+    file_clean_.insert(key);
+  }
+
+  torch::NoGradGuard no_grad;
+  ten.set_data(torch::empty(
+      {0}, ten.options().device(c10::Device(c10::DeviceType::CPU))));
+  file_resident_.insert(key);
+}
+
+void OffloadedParamMap::doLoadFromFile(
+    const std::string& key, at::Tensor& ten) {
+  if (!contains(file_resident_, key)) {
+    return;
+  }
+
+  at::Tensor buf = file_store_->load(key);
+  torch::NoGradGuard no_grad;
+  ten.set_data(buf);
+  file_resident_.erase(key);
+}
+
+void OffloadedParamMap::prefetchNext(const std::string& name, bool backward) {
+  PairKey<std::string, bool> access{name, backward};
+  if (!last_access_.first.empty()) {
+    next_access_[last_access_] = access;
+  }
+  last_access_ = access;
+
+  for (size_t i = 0; i < prefetch_num_; i++) {
+    if (!contains(next_access_, access)) {
+      break;
+    }
+    access = next_access_.at(access);
+    if (contains(file_resident_, access.first)) {
+      file_store_->prefetch(access.first);
+    }
+  }
+}
+
+} // namespace rannc
@@ -7,6 +7,9 @@
 
 #include <torch/torch.h>
 
+#include <Common.h>
+#include "ParamFileStore.h"
+
 namespace rannc {
 
 class OffloadedParamMap {
@@ -24,11 +27,63 @@ class OffloadedParamMap {
   void registerParam(const std::string& name, const at::Tensor& param);
   at::Tensor getParam(const std::string& name);
 
+  /**
+   * Moves a parameter onto the device. If the parameter resides in the file
+   * tier, it is read from the file first. Parameters expected to be used next
+   * are prefetched from the file following the order observed in past calls.
+   *
+   * @param name Name of the parameter.
+   * @param backward Whether the parameter is used in backward.
+   */
+  void fetch(const std::string& name, bool backward);
+  /**
+   * Moves a parameter to host memory, or to the file tier if it is enabled.
+   *
+   * @param name Name of the parameter.
+   */
+  void offload(const std::string& name);
+
+  bool fileTierEnabled() const {
+    return (bool)file_store_;
+  }
+  size_t getPrefetchNum() const {
+    return prefetch_num_;
+  }
+  // Reads a parameter in the file tier back into host memory.
+  void loadParamFromFile(const at::Tensor& param);
+  // Writes a parameter (e.g. updated by an optimizer) to the file tier and
+  // releases host memory.
+  void storeParamToFile(const at::Tensor& param);
+  void prefetchParamFromFile(const at::Tensor& param);
+  // Offloads a tensor that is not a parameter (e.g. an optimizer state).
+  void storeTensorToFile(const std::string& key, at::Tensor& ten);
+  void loadTensorFromFile(const std::string& key, at::Tensor& ten);
+  void prefetchTensorFromFile(const std::string& key);
+
  private:
-  OffloadedParamMap(){};
+  OffloadedParamMap();
   ~OffloadedParamMap() = default;
 
+  void doStoreToFile(const std::string& key, at::Tensor& ten);
+  void doLoadFromFile(const std::string& key, at::Tensor& ten);
+  void prefetchNext(const std::string& name, bool backward);
+  const std::string* findParamName(const at::Tensor& param) const;
+
   std::unordered_map<std::string, at::Tensor> param_map_;
+  std::unordered_map<const c10::TensorImpl*, std::string> param_names_;
+
+  std::unique_ptr<ParamFileStore> file_store_;
+  size_t prefetch_num_ = 0;
+  // Keys whose data currently lives only in the file
+  std::unordered_set<std::string> file_resident_;
+  // Keys whose file copy is up to date
+  std::unordered_set<std::string> file_clean_;
+  // (name, backward) -> (name, backward) accessed next
+  std::unordered_map<
+      PairKey<std::string, bool>, PairKey<std::string, bool>,
+      PairHash<std::string, bool>>
+      next_access_;
+  PairKey<std::string, bool> last_access_{"", false};
 };
 } // namespace rannc
 
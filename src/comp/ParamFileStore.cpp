@@ -0,0 +1,281 @@
+#include "ParamFileStore.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+#include "Common.h"
+
+namespace rannc {
+
+int64_t FileSpace::alloc(int64_t capacity) {
+  auto it = free_by_capacity_.lower_bound({capacity, 0});
+  if (it == free_by_capacity_.end()) {
+    int64_t offset = end_;
+    end_ += capacity;
+    return offset;
+  }
+
+  const int64_t free_capacity = it->first;
+  const int64_t offset = it->second;
+  removeFree(offset, free_capacity);
+  // The rest is released again
+  if (free_capacity > capacity) {
+    addFree(offset + capacity, free_capacity - capacity);
+  }
+  return offset;
+}
+
+void FileSpace::release(int64_t offset, int64_t capacity) {
+  const auto next = free_by_offset_.find(offset + capacity);
+  if (next != free_by_offset_.end()) {
+    const int64_t next_capacity = next->second;
+    removeFree(offset + capacity, next_capacity);
+    capacity += next_capacity;
+  }
+
+  const auto it = free_by_offset_.lower_bound(offset);
+  if (it != free_by_offset_.begin()) {
+    const auto prev = std::prev(it);
+    if (prev->first + prev->second == offset) {
+      const int64_t prev_offset = prev->first;
+      const int64_t prev_capacity = prev->second;
+      removeFree(prev_offset, prev_capacity);
+      offset = prev_offset;
+      capacity += prev_capacity;
+    }
+  }
+
+  if (offset + capacity == end_) {
+    end_ = offset;
+    return;
+  }
+  addFree(offset, capacity);
+}
+
+void FileSpace::addFree(int64_t offset, int64_t capacity) {
+  free_by_offset_[offset] = capacity;
+  free_by_capacity_.insert({capacity, offset});
+}
+
+void FileSpace::removeFree(int64_t offset, int64_t capacity) {
+  free_by_offset_.erase(offset);
+  free_by_capacity_.erase({capacity, offset});
+}
+
+ParamFileStore::ParamFileStore(const std::string& path, bool direct_io)
+    : path_(path), direct_io_(direct_io) {
+  page_size_ = sysconf(_SC_PAGESIZE);
+
+  fs::path dir = fs::path(path_).parent_path();
+  if (!dir.empty()) {
+    fs::create_directories(dir);
+  }
+
+  int flags = O_RDWR | O_CREAT | O_TRUNC;
+  fd_ = -1;
+  if (direct_io_) {
+    fd_ = open(path_.c_str(), flags | O_DIRECT, 0600);
+    if (fd_ < 0) {
+      // e.g. tmpfs does not support O_DIRECT
+      logger->warn(
+          "Failed to open {} with O_DIRECT. Falling back to buffered I/O.",
+          path_);
+      direct_io_ = false;
+    }
+  }
+  if (fd_ < 0) {
+    fd_ = open(path_.c_str(), flags, 0600);
+  }
+  if (fd_ < 0) {
+    throw std::runtime_error("Failed to open file for offloading: " + path_);
+  }
+
+  prefetch_th_ = std::thread([this]() { this->runPrefetchLoop(); });
+}
+
+ParamFileStore::~ParamFileStore() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  prefetch_th_.join();
+
+  close(fd_);
+  fs::remove(path_);
+}
+
+FileExtent ParamFileStore::allocExtent(
+    const std::string& key, const at::Tensor& ten) {
+  const int64_t nbytes = ten.nbytes();
+  const int64_t capacity = std::max(
+      page_size_, ((nbytes + page_size_ - 1) / page_size_) * page_size_);
+
+  if (contains(extents_, key)) {
+    auto& extent = extents_.at(key);
+    if (extent.capacity >= capacity) {
+      extent.dim = ten.sizes().vec();
+      extent.scalar_type = ten.scalar_type();
+      return extent;
+    }
+    // Released first so that the extent can grow into the adjacent space
+    space_.release(extent.offset, extent.capacity);
+  }
+
+  FileExtent extent{
+      space_.alloc(capacity), capacity, ten.sizes().vec(), ten.scalar_type()};
+  extents_[key] = extent;
+  return extent;
+}
+
+void ParamFileStore::store(const std::string& key, const at::Tensor& ten) {
+  FileExtent extent;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cancelPrefetch(lock, key);
+    extent = allocExtent(key, ten);
+  }
+
+  void* buf = nullptr;
+  if (posix_memalign(&buf, page_size_, extent.capacity) != 0) {
+    throw std::bad_alloc();
+  }
+  at::TensorOptions options;
+  options = options.dtype(extent.scalar_type)
+                .device(c10::Device(c10::DeviceType::CPU));
+  auto buf_ten =
+      torch::from_blob(buf, extent.dim, [](void* p) { free(p); }, options);
+  {
+    torch::NoGradGuard no_grad;
+    buf_ten.copy_(ten.detach());
+  }
+  const int64_t nbytes = buf_ten.nbytes();
+  memset(static_cast<char*>(buf) + nbytes, 0, extent.capacity - nbytes);
+
+  int64_t done = 0;
+  while (done < extent.capacity) {
+    ssize_t ret = pwrite(
+        fd_, static_cast<char*>(buf) + done, extent.capacity - done,
+        extent.offset + done);
+    if (ret <= 0) {
+      std::stringstream ss;
+      ss << "Failed to write tensor to " << path_ << ": key=" << key
+         << " offset=" << extent.offset << " errno=" << errno;
+      throw std::runtime_error(ss.str());
+    }
+    done += ret;
+  }
+}
+
+at::Tensor ParamFileStore::readExtent(const FileExtent& extent) const {
+  void* buf = nullptr;
+  if (posix_memalign(&buf, page_size_, extent.capacity) != 0) {
+    throw std::bad_alloc();
+  }
+
+  int64_t done = 0;
+  while (done < extent.capacity) {
+    ssize_t ret = pread(
+        fd_, static_cast<char*>(buf) + done, extent.capacity - done,
+        extent.offset + done);
+    if (ret <= 0) {
+      free(buf);
+      std::stringstream ss;
+      ss << "Failed to read tensor from " << path_
+         << ": offset=" << extent.offset << " errno=" << errno;
+      throw std::runtime_error(ss.str());
+    }
+    done += ret;
+  }
+
+  at::TensorOptions options;
+  options = options.dtype(extent.scalar_type)
+                .device(c10::Device(c10::DeviceType::CPU));
+  return torch::from_blob(buf, extent.dim, [](void* p) { free(p); }, options);
+}
+
+at::Tensor ParamFileStore::load(const std::string& key) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!contains(extents_, key)) {
+    throw std::invalid_argument("No tensor is stored in file: " + key);
+  }
+
+  // Read it now if the prefetch has not been started
+  auto q_it = std::find(prefetch_queue_.begin(), prefetch_queue_.end(), key);
+  if (q_it != prefetch_queue_.end()) {
+    prefetch_queue_.erase(q_it);
+  }
+  cond_.wait(lock, [this, &key]() { return !contains(in_flight_, key); });
+
+  if (contains(prefetched_, key)) {
+    at::Tensor ten = prefetched_.at(key);
+    prefetched_.erase(key);
+    return ten;
+  }
+
+  const FileExtent extent = extents_.at(key);
+  lock.unlock();
+  return readExtent(extent);
+}
+
+void ParamFileStore::prefetch(const std::string& key) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!contains(extents_, key) || contains(prefetched_, key) ||
+        contains(in_flight_, key) ||
+        std::find(prefetch_queue_.begin(), prefetch_queue_.end(), key) !=
+            prefetch_queue_.end()) {
+      return;
+    }
+    prefetch_queue_.push_back(key);
+  }
+  cond_.notify_all();
+}
+
+bool ParamFileStore::stored(const std::string& key) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return contains(extents_, key);
+}
+
+void ParamFileStore::cancelPrefetch(
+    std::unique_lock<std::mutex>& lock, const std::string& key) {
+  auto q_it = std::find(prefetch_queue_.begin(), prefetch_queue_.end(), key);
+  if (q_it != prefetch_queue_.end()) {
+    prefetch_queue_.erase(q_it);
+  }
+  cond_.wait(lock, [this, &key]() { return !contains(in_flight_, key); });
+  prefetched_.erase(key);
+}
+
+void ParamFileStore::runPrefetchLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cond_.wait(lock, [this]() { return stop_ || !prefetch_queue_.empty(); });
+    if (stop_) {
+      break;
+    }
+
+    const std::string key = prefetch_queue_.front();
+    prefetch_queue_.pop_front();
+    const FileExtent extent = extents_.at(key);
+    in_flight_.insert(key);
+    lock.unlock();
+
+    at::Tensor ten;
+    try {
+      ten = readExtent(extent);
+    } catch (std::exception& e) {
+      // load() retries synchronously and reports the error
+      logger->warn("Failed to prefetch {}: {}", key, e.what());
+    }
+
+    lock.lock();
+    in_flight_.erase(key);
+    if (ten.defined()) {
+      prefetched_[key] = ten;
+    }
+    cond_.notify_all();
+  }
+}
+} // namespace rannc
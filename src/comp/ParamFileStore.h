@@ -0,0 +1,100 @@
+#ifndef PYRANNC_PARAMFILESTORE_H
+#define PYRANNC_PARAMFILESTORE_H
+
+#include <torch/torch.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <Logging.h>
+
+namespace rannc {
+
+struct FileExtent {
+  int64_t offset;
+  int64_t capacity; // aligned to the page size
+  std::vector<int64_t> dim;
+  c10::ScalarType scalar_type;
+};
+
+/**
+ * Space of a file divided into extents. A released extent is merged with the
+ * adjacent free ones, and free space at the end of the file shrinks it, so
+ * that a larger extent can reuse the space of smaller ones.
+ */
+class FileSpace {
+ public:
+  // Returns the offset of the smallest free extent that is large enough, or
+  // extends the file
+  int64_t alloc(int64_t capacity);
+  void release(int64_t offset, int64_t capacity);
+
+  int64_t getEnd() const {
+    return end_;
+  }
+  size_t getFreeExtentNum() const {
+    return free_by_offset_.size();
+  }
+
+ private:
+  void addFree(int64_t offset, int64_t capacity);
+  void removeFree(int64_t offset, int64_t capacity);
+
+  int64_t end_ = 0;
+  // offset -> capacity
+  std::map<int64_t, int64_t> free_by_offset_;
+  // (capacity, offset)
+  std::set<std::pair<int64_t, int64_t>> free_by_capacity_;
+};
+
+/**
+ * Stores tensors in a file on a local disk (typically NVMe SSD).
+ * Each key owns a page-aligned extent so that the file can be accessed with
+ * O_DIRECT. An extent that becomes too small for its key is released and
+ * reused for other keys. Reads can be issued in advance by prefetch(), which
+ * are served by a background thread.
+ */
+class ParamFileStore {
+ public:
+  ParamFileStore(const std::string& path, bool direct_io);
+  ~ParamFileStore();
+
+  ParamFileStore(const ParamFileStore&) = delete;
+  ParamFileStore& operator=(const ParamFileStore&) = delete;
+
+  void store(const std::string& key, const at::Tensor& ten);
+  at::Tensor load(const std::string& key);
+  void prefetch(const std::string& key);
+  bool stored(const std::string& key) const;
+
+ private:
+  FileExtent allocExtent(const std::string& key, const at::Tensor& ten);
+  at::Tensor readExtent(const FileExtent& extent) const;
+  void cancelPrefetch(
+      std::unique_lock<std::mutex>& lock, const std::string& key);
+  void runPrefetchLoop();
+
+  std::string path_;
+  int fd_;
+  bool direct_io_;
+  int64_t page_size_;
+  std::unordered_map<std::string, FileExtent> extents_;
+  FileSpace space_;
+
+  std::thread prefetch_th_;
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::string> prefetch_queue_;
+  std::unordered_set<std::string> in_flight_;
+  std::unordered_map<std::string, at::Tensor> prefetched_;
+  bool stop_ = false;
+
+  const std::shared_ptr<spdlog::logger> logger = getLogger("ParamFileStore");
+};
+} // namespace rannc
+
+#endif // PYRANNC_PARAMFILESTORE_H
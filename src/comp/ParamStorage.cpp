@@ -3,6 +3,7 @@
 //
 
 #include "ParamStorage.h"
+#include <c10/cuda/CUDAGuard.h>
 #include <comm/NCCLWrapper.h>
 #include <comm/ObjectComm.h>
 #include <Config.h>
@@ -10,11 +11,15 @@
 #include <cuda/CudaUtil.h>
 #include <distop/DistTaskDispatcher.h>
 #include <graph/Decomposition.h>
+#include <torch/HalfConversion.h>
+#include <torch/MultiTensorScale.h>
 #include "comm/SComm.h"
 #include "Common.h"
 #include "ConfiguredTorch.h"
 #include "DistributedParamLocator.h"
 #include "EventRecorder.h"
+#include "ZeroBcastEvents.h"
+#include "ZeroParamMap.h"
 
 namespace rannc {
 
@@ -329,7 +334,8 @@ std::vector<int> ParamStorage::sortCommTags(const std::string& graph_id) {
   return sorted_tags;
 }
 
-void ParamStorage::allReduceParamGrads(const std::string& graph_id) {
+void ParamStorage::allReduceParamGrads(
+    const std::string& graph_id, double grad_scale) {
   const auto& graph_grouped_params = grouped_params_[graph_id];
 
   assert(contains(sliced_param_locators_, graph_id));
@@ -350,11 +356,14 @@ void ParamStorage::allReduceParamGrads(const std::string& graph_id) {
     if (contains(ranks, mpi::getRank())) {
       if (consolidate_) {
         const auto& graph_grad_cons = grad_cons_[graph_id];
-        ar.allreduce(tag, graph_grad_cons.at(tag)->getConsolidatedGrads());
+        ar.allreduceHierarchical(
+            tag, graph_grad_cons.at(tag)->getConsolidatedGrads());
       } else {
         const auto& param_ids = graph_grouped_params.at(tag);
+        std::vector<long> grad_param_ids;
         std::vector<at::Tensor> grads;
 
+        grad_param_ids.reserve(param_ids.size());
         grads.reserve(param_ids.size());
         for (long pid : param_ids) {
           if (sp_loc->registered(pid)) {
@@ -366,10 +375,18 @@ void ParamStorage::allReduceParamGrads(const std::string& graph_id) {
               : getParamTensor(pid);
           auto& grad = param.grad();
           if (grad.defined()) {
+            grad_param_ids.push_back(pid);
             grads.push_back(grad);
           }
         }
-        ar.allreduce(tag, grads);
+
+        // Compression pays off only for the links between nodes
+        if (grad_compressor_.enabled() && ar.spansNodes(tag)) {
+          grad_compressor_.allreduce(
+              tag, ranks.size(), grad_param_ids, grads, grad_scale);
+        } else {
+          ar.allreduceHierarchical(tag, grads);
+        }
       }
     }
     if (sync_allreduce) {
@@ -466,8 +483,8 @@ void ParamStorage::allReduceParamGradsZero(
               // segment_fp32.
 
               const at::Tensor segment = locator->getSegment(pid, i, true);
-              auto segment_fp32 = segment.to(at::ScalarType::Float, true);
-              segment_fp32 = segment_fp32.mul_(1 / loss_scale).detach();
+              auto segment_fp32 =
+                  toFloatScaled(segment, 1 / loss_scale).detach();
               grads.push_back(segment_fp32);
 
               comm_size += segment_fp32.nbytes();
@@ -524,10 +541,16 @@ void ParamStorage::clearParamGrads(const std::string& graph_id) {
   }
 }
 
-void ParamStorage::bcastParamsZero(const std::string& graph_id, bool grad) {
+void ParamStorage::bcastParamsZero(
+    const std::string& graph_id, bool grad, bool skip_sharded) {
   assert(zeroEnabled(graph_id));
   const auto& graph_grouped_params = grouped_params_[graph_id];
   auto locator = zero_grad_locators_.at(graph_id);
+  const auto& sharded_params = zero_sharded_params_[graph_id];
+  if (!grad && !skip_sharded && !sharded_params.empty()) {
+    // Gathers ahead must finish before the broadcast on the current stream
+    ZeroParamMap::get().releaseAll();
+  }
 
   std::stringstream ss;
   ss << "ParamStorage::bcastParams_graph_" << graph_id;
@@ -553,6 +576,13 @@ void ParamStorage::bcastParamsZero(const std::string& graph_id, bool grad) {
       roots.reserve(param_ids.size() * ranks.size());
 
       for (long pid : param_ids) {
+        if (!grad && contains(sharded_params, pid)) {
+          if (skip_sharded) {
+            continue;
+          }
+          ZeroParamMap::get().allocate(sharded_params.at(pid));
+        }
+
         for (int i = 0; i < locator->getSegmentNum(pid); i++) {
           const auto range = locator->getSegmentRange(pid, i);
           if (range.first == range.second) {
@@ -572,23 +602,167 @@ void ParamStorage::bcastParamsZero(const std::string& graph_id, bool grad) {
   recordEnd(key);
 }
 
+void ParamStorage::bcastParamsZeroAsync(
+    const std::string& graph_id, const std::vector<std::string>& param_order,
+    size_t bucket_size) {
+  assert(zeroEnabled(graph_id));
+  const auto& graph_grouped_params = grouped_params_[graph_id];
+  auto locator = zero_grad_locators_.at(graph_id);
+
+  const auto& sharded_params = zero_sharded_params_[graph_id];
+  const auto& graph_params = graph_params_.at(graph_id);
+  std::unordered_map<long, std::string> param_names;
+  for (const auto& it : graph_params) {
+    param_names[it.second] = it.first;
+  }
+  // Params not used in forward come last
+  std::unordered_map<long, size_t> use_order;
+  for (size_t i = 0; i < param_order.size(); i++) {
+    const auto& name = param_order.at(i);
+    if (contains(graph_params, name)) {
+      use_order[graph_params.at(name)] = i;
+    }
+  }
+  const auto get_use_order = [&use_order, &param_order](long pid) {
+    return contains(use_order, pid) ? use_order.at(pid) : param_order.size();
+  };
+
+  std::stringstream ss;
+  ss << "ParamStorage::bcastParamsZeroAsync_graph_" << graph_id;
+  const auto key = ss.str();
+  recordStart(key);
+
+  ZeroBcastEvents& bcast_events = ZeroBcastEvents::get();
+  // The segments may still be updated on the compute stream
+  at::cuda::CUDAEvent ready_evt;
+  ready_evt.record(c10::cuda::getCurrentCUDAStream());
+
+  NCCLWrapper& ar = NCCLWrapper::get();
+  std::vector<int> sorted_tags = sortCommTags(graph_id);
+  for (int tag : sorted_tags) {
+    assert(contains(tag_rank_set_, tag));
+    const auto& ranks = tag_rank_set_.at(tag);
+    if (!contains(ranks, mpi::getRank())) {
+      continue;
+    }
+
+    const auto bcast_stream = bcast_events.getStream(tag);
+    ready_evt.block(bcast_stream);
+    c10::cuda::CUDAStreamGuard guard(bcast_stream);
+    NCCLStreamGuard nccl_guard(bcast_stream.stream());
+
+    auto param_ids = graph_grouped_params.at(tag);
+    std::stable_sort(
+        param_ids.begin(), param_ids.end(), [&get_use_order](long p1, long p2) {
+          return get_use_order(p1) < get_use_order(p2);
+        });
+
+    std::vector<at::Tensor> params;
+    std::vector<int> roots;
+    std::vector<std::string> bucket_param_names;
+    size_t bucket_bytes = 0;
+    const auto flush = [&]() {
+      if (!params.empty()) {
+        ar.bcast(tag, params, roots);
+      }
+      bcast_events.record(bucket_param_names, bcast_stream);
+      params.clear();
+      roots.clear();
+      bucket_param_names.clear();
+      bucket_bytes = 0;
+    };
+
+    for (long pid : param_ids) {
+      // Gathered on demand by ZeroParamMap
+      if (contains(sharded_params, pid)) {
+        continue;
+      }
+
+      for (int i = 0; i < locator->getSegmentNum(pid); i++) {
+        const auto range = locator->getSegmentRange(pid, i);
+        if (range.first == range.second) {
+          continue;
+        }
+
+        const auto segment = locator->getSegment(pid, i, false);
+        params.push_back(segment);
+        roots.push_back(i);
+        bucket_bytes += segment.nbytes();
+      }
+      if (contains(param_names, pid)) {
+        bucket_param_names.push_back(param_names.at(pid));
+      }
+      if (bucket_bytes >= bucket_size) {
+        flush();
+      }
+    }
+    flush();
+  }
+  recordEnd(key);
+}
+
+std::unordered_set<std::string> ParamStorage::shardParamsZero(
+    const std::string& graph_id,
+    const std::unordered_set<std::string>& param_names) {
+  assert(zeroEnabled(graph_id));
+  auto locator = zero_grad_locators_.at(graph_id);
+
+  std::unordered_map<long, int> param_tags;
+  for (const auto& it : grouped_params_[graph_id]) {
+    for (long pid : it.second) {
+      param_tags[pid] = it.first;
+    }
+  }
+
+  ZeroParamMap& zero_param_map = ZeroParamMap::get();
+  std::unordered_set<std::string> sharded_names;
+  for (const auto& name : param_names) {
+    long pid = getParamID(graph_id, name);
+    // Buffers can be updated by forward
+    if (!locator->registered(pid) || sliced(pid) ||
+        contains(buffer_ids_, pid) || !contains(param_tags, pid)) {
+      continue;
+    }
+    // Releasing the storage must not affect other tensors
+    const auto param = getParamTensor(pid);
+    if (!param.is_cuda() || !param.is_contiguous() ||
+        param.storage_offset() != 0 ||
+        param.storage().nbytes() != param.nbytes() ||
+        param.storage().use_count() != 1) {
+      continue;
+    }
+
+    std::vector<std::pair<int64_t, int64_t>> ranges;
+    for (int i = 0; i < locator->getSegmentNum(pid); i++) {
+      ranges.push_back(locator->getSegmentRange(pid, i));
+    }
+    const auto local_segment = locator->ownLocalParamSegment(pid);
+    zero_param_map.registerParam(
+        name, param, local_segment, param_tags.at(pid), ranges,
+        locator->getLocalIndex(pid));
+
+    zero_sharded_params_[graph_id][pid] = name;
+    sharded_names.insert(name);
+  }
+
+  logger->trace(
+      "Released {} params for zero. graph={}", sharded_names.size(),
+      graph_id);
+  return sharded_names;
+}
+
 void ParamStorage::doScaleGrads(
     const std::string& graph_id, bool unscale, bool amp_master_grads) {
   double ratio = 1 / (double)mpi::getSize();
+  std::vector<at::Tensor> grads;
   for (const auto& it : my_param_ranks_[graph_id]) {
     long pid = it.first;
-    torch::NoGradGuard no_grad;
     auto p = amp_master_grads && hasAmpMasterParam(pid)
         ? getAmpMasterParamTensor(pid)
         : getParamTensor(pid);
-    if (p.grad().defined()) {
-      if (unscale) {
-        p.grad().mul_(1. / ratio);
-      } else {
-        p.grad().mul_(ratio);
-      }
-    }
+    grads.push_back(p.grad());
   }
+  scaleTensors(grads, unscale ? 1. / ratio : ratio);
 }
 
 void ParamStorage::scaleGrads(
@@ -700,25 +874,40 @@ void ParamStorage::clipGradNorm(
   double global_norm = calcGradGlobalL2Norm(graph_id, use_amp_master) + 1e-6;
 
   if (global_norm > max_grad_norm) {
-    for (const auto& it : getParamIDs(graph_id, false)) {
-      long pid = it.second;
-      at::Tensor param;
-      if (use_amp_master && contains(amp_master_params_, pid)) {
-        param = amp_master_params_.at(pid);
-      } else if (zeroEnabled(graph_id)) {
-        assert(contains(zero_grad_locators_, graph_id));
-        auto locator = zero_grad_locators_.at(graph_id);
-        param = locator->getLocalParamSegment(pid); // fp32 param grad
-      } else {
-        param = getParamTensor(pid);
-      }
+    scaleTensors(
+        getLocalGrads(graph_id, use_amp_master), max_grad_norm / global_norm);
+  }
+}
 
-      if (param.grad().defined()) {
-        double scale = max_grad_norm / global_norm;
-        param.grad().mul_(scale);
-      }
+bool ParamStorage::scaleGradsAndCheckOverflow(
+    const std::string& graph_id, double scale, bool use_amp_master) {
+  bool found_inf = scaleTensorsAndCheckFinite(
+      getLocalGrads(graph_id, use_amp_master), scale);
+  // All ranks must skip the step together
+  return mpi::allReduceOr(found_inf);
+}
+
+std::vector<at::Tensor> ParamStorage::getLocalGrads(
+    const std::string& graph_id, bool use_amp_master) {
+  std::vector<at::Tensor> grads;
+  for (const auto& it : getParamIDs(graph_id, false)) {
+    long pid = it.second;
+    at::Tensor param;
+    if (use_amp_master && contains(amp_master_params_, pid)) {
+      param = amp_master_params_.at(pid);
+    } else if (zeroEnabled(graph_id)) {
+      assert(contains(zero_grad_locators_, graph_id));
+      auto locator = zero_grad_locators_.at(graph_id);
+      param = locator->getLocalParamSegment(pid); // fp32 param grad
+    } else {
+      param = getParamTensor(pid);
+    }
+
+    if (param.grad().defined()) {
+      grads.push_back(param.grad());
     }
   }
+  return grads;
 }
 
 double ParamStorage::calcGradGlobalL2Norm(
@@ -910,6 +1099,8 @@ void ParamStorage::deploy(
             "Finished creating communicator for params: tag={} ranks={}",
             comm_tag, join_as_str(param_ranks));
       }
+      // All ranks call this to register the tags of the communicators
+      ar.createHierarchicalCommunicator(comm_tag, param_ranks);
     }
 
     if (distributed(param_id)) {
@@ -1212,6 +1403,17 @@ void ParamStorage::useAmpMasterParams(
 }
 
 void ParamStorage::releaseGraphParams(const std::string& graph_id) {
+  if (contains(zero_sharded_params_, graph_id) &&
+      !zero_sharded_params_.at(graph_id).empty()) {
+    // Give the params back to the module with their whole data
+    bcastParamsZero(graph_id, false);
+    ZeroParamMap& zero_param_map = ZeroParamMap::get();
+    for (const auto& it : zero_sharded_params_.at(graph_id)) {
+      zero_param_map.unregisterParam(it.second);
+    }
+  }
+  zero_sharded_params_.erase(graph_id);
+
   for (const auto& it : graph_params_[graph_id]) {
     const auto& name = it.first;
     long param_id = graph_params_[graph_id][name];
@@ -1258,8 +1460,17 @@ void ParamStorage::clear() {
   DistributedParamLocator& zpl = DistributedParamLocator::get();
   zpl.clear();
 
+  ZeroParamMap& zero_param_map = ZeroParamMap::get();
+  for (const auto& it : zero_sharded_params_) {
+    for (const auto& param_it : it.second) {
+      zero_param_map.unregisterParam(param_it.second);
+    }
+  }
+  zero_sharded_params_.clear();
+
   zero_grad_locators_.clear();
   sliced_param_locators_.clear();
+  grad_compressor_.clear();
 }
 
 void ParamStorage::doReleaseParam(long param_id) {
@@ -1269,6 +1480,7 @@ void ParamStorage::doReleaseParam(long param_id) {
     params_.erase(param_id);
     ranks_.erase(param_id);
     ref_counts_.erase(param_id);
+    grad_compressor_.erase(param_id);
 
     long global_id = id_local_to_global_.at(param_id);
     id_local_to_global_.erase(param_id);
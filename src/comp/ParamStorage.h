@@ -7,6 +7,7 @@
 
 #include <torch/torch.h>
 
+#include <comm/GradCompressor.h>
 #include <comm/NCCLWrapper.h>
 #include <graph/Decomposition.h>
 #include <Logging.h>
@@ -81,10 +82,39 @@ class ParamStorage {
   long globalToLocal(long global_param_id);
   long localToGlobal(long local_param_id);
 
-  void allReduceParamGrads(const std::string& graph_id);
+  // grad_scale: Factor by which the gradients are multiplied (e.g. loss scale)
+  void allReduceParamGrads(const std::string& graph_id, double grad_scale);
   void allReduceParamGradsZero(const std::string& graph_id, double loss_scale);
   void clearParamGrads(const std::string& graph_id);
-  void bcastParamsZero(const std::string& graph_id, bool grad);
+  /**
+   * Broadcasts ZeRO parameter segments (or gradient segments if *grad* is
+   * true). Params released by shardParamsZero are allocated again and kept
+   * until they are released next time, unless *skip_sharded* is true.
+   */
+  void bcastParamsZero(
+      const std::string& graph_id, bool grad, bool skip_sharded = false);
+  /**
+   * Broadcasts ZeRO parameter segments on a side stream without waiting for
+   * completion. Params are split into buckets following *param_order*, and
+   * the completion of each bucket is registered to ZeroBcastEvents.
+   *
+   * @param param_order Names of params in the order of their first use.
+   * @param bucket_size Size of a bucket in bytes.
+   */
+  void bcastParamsZeroAsync(
+      const std::string& graph_id,
+      const std::vector<std::string>& param_order, size_t bucket_size);
+  /**
+   * Keeps only the local segments of ZeRO params and releases the params.
+   * The params are gathered on demand through ZeroParamMap. Params that are
+   * not contiguous or share storage with others are skipped.
+   *
+   * @param param_names Names of params to release.
+   * @return Names of the released params.
+   */
+  std::unordered_set<std::string> shardParamsZero(
+      const std::string& graph_id,
+      const std::unordered_set<std::string>& param_names);
   void prepareBackward(const std::string& graph_id);
   void scaleGrads(const std::string& graph_id, bool amp_master_grads);
   void unscaleGrads(const std::string& graph_id, bool amp_master_grads);
@@ -96,6 +126,8 @@ class ParamStorage {
       const at::Tensor& param_tensor);
   void clipGradNorm(
       const std::string& graph_id, double max_grad_norm, bool use_amp_master);
+  bool scaleGradsAndCheckOverflow(
+      const std::string& graph_id, double scale, bool use_amp_master);
   double calcGradGlobalL2Norm(const std::string& graph_id, bool use_amp_master);
 
   at::Tensor syncParam(long param_id, bool amp_master_param);
@@ -140,6 +172,8 @@ class ParamStorage {
   virtual void doReleaseParam(long param_id);
   void doScaleGrads(
       const std::string& graph_id, bool unscale, bool amp_master_grads);
+  std::vector<at::Tensor> getLocalGrads(
+      const std::string& graph_id, bool use_amp_master);
   at::Tensor doSyncParam(long param_id, bool grad, bool amp_master_param);
   at::Tensor doGatherParam(long param_id, bool grad, bool amp_master_param);
   at::Tensor doGatherParamZero(long param_id, bool grad, bool amp_master_param);
@@ -184,6 +218,10 @@ class ParamStorage {
       zero_grad_locators_;
   std::unordered_map<std::string, std::shared_ptr<SlicedParamLocator>>
       sliced_param_locators_;
+  // Params released by shardParamsZero (param id -> name)
+  std::unordered_map<std::string, std::unordered_map<long, std::string>>
+      zero_sharded_params_;
+  GradCompressor grad_compressor_;
 
   static bool sync_on_init_;
 
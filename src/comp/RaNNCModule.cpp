@@ -22,6 +22,7 @@
 #include <graph/ir.h>
 #include <graph/MetaDecomposer.h>
 #include <graph/Partitioner.h>
+#include <graph/PlanStore.h>
 
 #include "Backward.h"
 #include "EventRecorder.h"
@@ -108,6 +109,7 @@ RaNNCModule::RaNNCModule(
   load_deployment_ = conf.getVal<bool>(config::LOAD_DEPLOYMENT);
   save_deployment_ = conf.getVal<bool>(config::SAVE_DEPLOYMENT);
   deployment_file_ = conf.getVal<std::string>(config::DEPLOYMENT_FILE);
+  plan_store_dir_ = conf.getVal<std::string>(config::PLAN_STORE_DIR);
   bool consolidate_grads = conf.getVal<bool>(config::CONSOLIDATE_GRADS);
   dry_run_np_ = conf.getVal<int>(config::PARTITIONING_DRY_RUN_NP);
   load_profile_ = conf.getVal<bool>(config::LOAD_GRAPH_PROFILE);
@@ -183,6 +185,18 @@ std::vector<long> RaNNCModule::init(
   PartitioningConf pconf = makePartitioningConf(
       mpi::getSize(), batch_size, dev_info.total_mem, use_amp_master_params_,
       enable_zero_, offload_params_);
+  const auto& dev_caps = master_->getDeviceCapabilities();
+  if (dev_caps.size() == pconf.dev_num) {
+    pconf.dev_caps = dev_caps;
+    // Stages that do not consider the capabilities fit to any device
+    size_t min_mem = dev_caps.front().mem;
+    for (const auto& cap : dev_caps) {
+      min_mem = std::min(min_mem, cap.mem);
+    }
+    if (min_mem > 0) {
+      pconf.dev_mem = min_mem;
+    }
+  }
 
   if (mpi::isMaster()) {
     logger->info("Tracing model ...");
@@ -246,29 +260,6 @@ std::vector<long> RaNNCModule::init(
   DistTaskDispatcher& dtd = DistTaskDispatcher::get();
   dtd.start(sg_prof, prof_cache_size_);
   if (mpi::isMaster()) {
-    if (load_profile_) {
-      logger->info("Loading graph profiles from {}", graph_profile_file_);
-      sg_prof->load(graph_profile_file_);
-    }
-
-    logger->info("Running profiler ...");
-    pybind11::gil_scoped_release no_gil;
-    ProfilingResult prof_results;
-    try {
-      prof_results = sg_prof->init(use_named_tensors_);
-    } catch (std::exception& e) {
-      std::stringstream ss;
-      ss << "Failed to profile graph."
-         << " Try to reduce the batch size or increase min_pipline_num."
-         << " message=" << e.what();
-      throw std::runtime_error(ss.str());
-    }
-    logger->info("Profiling finished");
-    ir_graph_ = setValueTypes(ir_graph_, prof_results.value_types);
-    ir_graph_ = guessValueTypes(ir_graph_);
-    ir_graph_->setBatchSize(batch_size);
-    logger->info("Assuming batch size: {}", batch_size);
-
     if (check_unused_values_) {
       const auto unused_vals = findUnusedValue(ir_graph_);
       if (!unused_vals.empty()) {
@@ -282,10 +273,64 @@ std::vector<long> RaNNCModule::init(
       }
     }
 
+    pybind11::gil_scoped_release no_gil;
+
+    // The stored plan has the subgraphs with the value types, so the profiler
+    // does not need to run
+    std::shared_ptr<PlanStore> plan_store;
+    std::string model_fp;
+    PlanKey plan_key;
+    if (!plan_store_dir_.empty()) {
+      plan_store = std::make_shared<PlanStore>(plan_store_dir_);
+      model_fp = getModelFingerprint(ir_graph_, value_storage_->getValues());
+      plan_key = makePlanKey(pconf, decomp_name_);
+      pconf.model_fp = model_fp;
+    }
+    const bool use_stored_plan = !load_deployment_ && plan_store &&
+        plan_store->hasPlan(model_fp, plan_key);
+
+    if (use_stored_plan) {
+      logger->info(
+          "Loading a plan from the plan store: model={} dir={}", model_fp,
+          plan_store_dir_);
+      deployment_ = plan_store->loadPlan(model_fp, plan_key);
+      deployment_.id = id_;
+
+      logger->info("Allocations: dev_num={}", mpi::getSize());
+      for (const auto& it : deployment_.subgraphs) {
+        assert(contains(deployment_.allocation, it.first));
+        logger->info(
+            "   {} ranks={}", it.first,
+            join_as_str(deployment_.allocation.at(it.first)));
+      }
+    } else {
+      if (load_profile_) {
+        logger->info("Loading graph profiles from {}", graph_profile_file_);
+        sg_prof->load(graph_profile_file_);
+      }
+
+      logger->info("Running profiler ...");
+      ProfilingResult prof_results;
+      try {
+        prof_results = sg_prof->init(use_named_tensors_);
+      } catch (std::exception& e) {
+        std::stringstream ss;
+        ss << "Failed to profile graph."
+           << " Try to reduce the batch size or increase min_pipline_num."
+           << " message=" << e.what();
+        throw std::runtime_error(ss.str());
+      }
+      logger->info("Profiling finished");
+      ir_graph_ = setValueTypes(ir_graph_, prof_results.value_types);
+      ir_graph_ = guessValueTypes(ir_graph_);
+      ir_graph_->setBatchSize(batch_size);
+      logger->info("Assuming batch size: {}", batch_size);
+    }
+
     if (load_deployment_) {
       logger->info("Loading deployment state from {}", deployment_file_);
-      deployment_ =
-          loadDeployment(deployment_file_, mpi::getSize(), dev_info.total_mem);
+      deployment_ = loadDeployment(
+          deployment_file_, mpi::getSize(), dev_info.total_mem);
       deployment_.id = id_;
 
       std::unordered_map<std::string, GraphProfile> profiles;
@@ -314,6 +359,7 @@ std::vector<long> RaNNCModule::init(
             deployment_.checkpointing,
             part_info,
             pconf};
+        prof_in.force_dist_matmul = deployment_.force_dist_matmul;
         profiles[it] = prof_util.profile(prof_in);
         part_info_map[it] = part_info;
       }
@@ -336,7 +382,7 @@ std::vector<long> RaNNCModule::init(
             "   {} ranks={}", it.first,
             join_as_str(deployment_.allocation.at(it.first)));
       }
-    } else {
+    } else if (!use_stored_plan) {
       int np = mpi::getSize();
       if (dry_run_np_ > 0) {
         np = dry_run_np_;
@@ -345,6 +391,12 @@ std::vector<long> RaNNCModule::init(
             dry_run_np_, batch_size);
       }
 
+      if (plan_store && plan_store->hasProfiles(model_fp)) {
+        const auto prof_file = plan_store->getProfileFile(model_fp);
+        logger->info("Loading graph profiles from {}", prof_file);
+        sg_prof->load(prof_file);
+      }
+
       MetaDecomposer decomposer(sg_prof, pconf);
       deployment_ = decomposer.decompose(decomp_name_, ir_graph_);
 
@@ -352,6 +404,10 @@ std::vector<long> RaNNCModule::init(
         logger->info("Saving deployment state to {}", deployment_file_);
         save(deployment_file_, deployment_, np, dev_info.total_mem);
       }
+      if (plan_store) {
+        plan_store->savePlan(model_fp, plan_key, deployment_);
+        sg_prof->save(plan_store->getProfileFile(model_fp));
+      }
     }
 
     for (const auto& it : deployment_.subgraphs) {
@@ -379,7 +435,7 @@ std::vector<long> RaNNCModule::init(
     verifyDeployment(deployment_);
     logger->info("Routes verification passed.");
 
-    if (save_profile_) {
+    if (save_profile_ && !use_stored_plan) {
       logger->info("Saving graph profiles to {}", graph_profile_file_);
       sg_prof->save(graph_profile_file_);
     }
@@ -513,9 +569,9 @@ py::object RaNNCModule::operator()(
   return torch::jit::toPyObject(std::move(out));
 }
 
-void RaNNCModule::allReduceParamGrads() {
+void RaNNCModule::allReduceParamGrads(double grad_scale) {
   NCCLWrapper& ar = NCCLWrapper::get();
-  param_storage_->allReduceParamGrads(this->id_);
+  param_storage_->allReduceParamGrads(this->id_, grad_scale);
   param_storage_->scaleGrads(id_, allreduce_amp_master_param_);
 }
 
@@ -537,6 +593,11 @@ void RaNNCModule::clipGrad(float max_grad_norm) {
   param_storage_->clipGradNorm(id_, max_grad_norm, use_amp_master_params_);
 }
 
+bool RaNNCModule::scaleGradsAndCheckOverflow(double scale) {
+  return param_storage_->scaleGradsAndCheckOverflow(
+      id_, scale, use_amp_master_params_);
+}
+
 double RaNNCModule::calcGradL2Norm() {
   return param_storage_->calcGradGlobalL2Norm(id_, use_amp_master_params_);
 }
@@ -51,10 +51,11 @@ class RaNNCModule {
       bool gather_inputs);
   bool isCheckpointingEnabled() const;
 
-  void allReduceParamGrads();
+  void allReduceParamGrads(double grad_scale);
   void allReduceParamGradsZero(double loss_scale);
   void clearParamGrads();
   void clipGrad(float max_grad_norm);
+  bool scaleGradsAndCheckOverflow(double scale);
   double calcGradL2Norm();
 
   at::Tensor syncParam(long param_id);
@@ -97,6 +98,7 @@ class RaNNCModule {
   bool load_deployment_;
   bool save_deployment_;
   std::string deployment_file_;
+  std::string plan_store_dir_;
   int dry_run_np_;
   bool load_profile_;
   std::string graph_profile_file_;
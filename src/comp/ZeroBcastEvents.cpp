@@ -0,0 +1,55 @@
+#include "ZeroBcastEvents.h"
+
+namespace rannc {
+
+c10::cuda::CUDAStream ZeroBcastEvents::getStream(int tag) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = streams_.find(tag);
+  if (it == streams_.end()) {
+    it = streams_.emplace(tag, c10::cuda::getStreamFromPool()).first;
+  }
+  return it->second;
+}
+
+void ZeroBcastEvents::record(
+    const std::vector<std::string>& param_names,
+    const c10::cuda::CUDAStream& stream) {
+  auto evt = std::make_shared<at::cuda::CUDAEvent>();
+  evt->record(stream);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& name : param_names) {
+    events_[name] = evt;
+  }
+  last_events_[stream.id()] = evt;
+}
+
+void ZeroBcastEvents::wait(const std::string& param_name) {
+  std::shared_ptr<at::cuda::CUDAEvent> evt;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = events_.find(param_name);
+    if (it == events_.end()) {
+      return;
+    }
+    evt = it->second;
+    events_.erase(it);
+  }
+  evt->block(c10::cuda::getCurrentCUDAStream());
+}
+
+void ZeroBcastEvents::waitAll() {
+  std::vector<std::shared_ptr<at::cuda::CUDAEvent>> evts;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& it : last_events_) {
+      evts.push_back(it.second);
+    }
+    events_.clear();
+    last_events_.clear();
+  }
+  for (const auto& evt : evts) {
+    evt->block(c10::cuda::getCurrentCUDAStream());
+  }
+}
+} // namespace rannc
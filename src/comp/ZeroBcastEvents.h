@@ -0,0 +1,75 @@
+#ifndef PYRANNC_ZEROBCASTEVENTS_H
+#define PYRANNC_ZEROBCASTEVENTS_H
+
+#include <ATen/cuda/CUDAEvent.h>
+#include <c10/cuda/CUDAStream.h>
+
+#include <mutex>
+
+#include <Common.h>
+
+namespace rannc {
+
+/**
+ * Tracks broadcasts of ZeRO parameter segments that are still in flight.
+ * Buckets of params are broadcast on side streams, and the compute stream
+ * waits for a bucket only when a param in it is used for the first time.
+ */
+class ZeroBcastEvents {
+ public:
+  ZeroBcastEvents(const ZeroBcastEvents&) = delete;
+  ZeroBcastEvents& operator=(const ZeroBcastEvents&) = delete;
+  ZeroBcastEvents(ZeroBcastEvents&&) = delete;
+  ZeroBcastEvents& operator=(ZeroBcastEvents&&) = delete;
+
+  static ZeroBcastEvents& get() {
+    static ZeroBcastEvents instance;
+    return instance;
+  }
+
+  /**
+   * Returns the side stream on which ZeRO params are broadcast or gathered
+   * with a communicator. Each communicator has its own stream. The ranks issue
+   * the collectives of a communicator in the same order, but a rank can
+   * interleave those of different communicators differently from the others.
+   * A shared stream would then serialize them in conflicting orders.
+   *
+   * @param tag Tag of the communicator.
+   */
+  c10::cuda::CUDAStream getStream(int tag);
+
+  /**
+   * Records an event on *stream* after the broadcast of a bucket.
+   *
+   * @param param_names Names of params in the bucket.
+   * @param stream Stream on which the broadcast was issued.
+   */
+  void record(
+      const std::vector<std::string>& param_names,
+      const c10::cuda::CUDAStream& stream);
+
+  /**
+   * Makes the current stream wait for the broadcast of a param. This does
+   * nothing if the param has no pending broadcast.
+   */
+  void wait(const std::string& param_name);
+
+  /**
+   * Makes the current stream wait for all pending broadcasts.
+   */
+  void waitAll();
+
+ private:
+  ZeroBcastEvents() = default;
+
+  std::unordered_map<std::string, std::shared_ptr<at::cuda::CUDAEvent>>
+      events_;
+  // The last event on each stream covers all recorded on it
+  std::unordered_map<c10::StreamId, std::shared_ptr<at::cuda::CUDAEvent>>
+      last_events_;
+  std::unordered_map<int, c10::cuda::CUDAStream> streams_;
+  std::mutex mutex_;
+};
+} // namespace rannc
+
+#endif // PYRANNC_ZEROBCASTEVENTS_H
@@ -0,0 +1,198 @@
+#include "ZeroParamMap.h"
+
+#include <c10/cuda/CUDACachingAllocator.h>
+#include <c10/cuda/CUDAGuard.h>
+
+#include <comm/NCCLWrapper.h>
+#include <Config.h>
+#include "ZeroBcastEvents.h"
+
+namespace rannc {
+
+namespace {
+// Tensors sharing the storage (e.g. views saved by autograd) are also affected
+void allocStorage(const at::Tensor& ten, size_t nbytes) {
+  c10::StorageImpl* storage = ten.storage().unsafeGetStorageImpl();
+  storage->set_data_ptr(storage->allocator()->allocate(nbytes));
+  storage->set_nbytes(nbytes);
+}
+
+void freeStorage(const at::Tensor& ten) {
+  c10::StorageImpl* storage = ten.storage().unsafeGetStorageImpl();
+  storage->set_data_ptr(at::DataPtr(nullptr, ten.device()));
+  storage->set_nbytes(0);
+}
+
+at::Tensor getSegment(
+    const at::Tensor& param, const std::pair<int64_t, int64_t>& range) {
+  return param.view(-1).narrow(0, range.first, range.second - range.first);
+}
+} // namespace
+
+ZeroParamMap::ZeroParamMap() {
+  prefetch_num_ = config::Config::get().getVal<int>(config::ZERO_PREFETCH_NUM);
+}
+
+void ZeroParamMap::registerParam(
+    const std::string& name, const at::Tensor& param,
+    const at::Tensor& local_segment, int tag,
+    const std::vector<std::pair<int64_t, int64_t>>& ranges, int local_index) {
+  assert(param.is_cuda() && param.is_contiguous());
+  assert(param.storage_offset() == 0);
+  assert(param.storage().nbytes() == param.nbytes());
+  assert(local_index < ranges.size());
+
+  ParamEntry entry;
+  entry.param = param;
+  entry.local_segment = local_segment;
+  entry.nbytes = param.nbytes();
+  entry.tag = tag;
+  entry.ranges = ranges;
+  entry.local_index = local_index;
+  entry.gathered = true;
+  doRelease(entry);
+  param_map_[name] = entry;
+}
+
+void ZeroParamMap::unregisterParam(const std::string& name) {
+  param_map_.erase(name);
+}
+
+bool ZeroParamMap::registered(const std::string& name) const {
+  return contains(param_map_, name);
+}
+
+void ZeroParamMap::gather(const std::string& name, bool backward) {
+  auto& entry = getEntry(name);
+  if (!entry.gathered) {
+    doGather(entry);
+  }
+  waitGather(entry);
+  prefetchNext(name, backward);
+}
+
+void ZeroParamMap::release(const std::string& name) {
+  auto& entry = getEntry(name);
+  if (!keep_gathered_) {
+    doRelease(entry);
+  }
+}
+
+void ZeroParamMap::keepGathered(bool keep) {
+  keep_gathered_ = keep;
+}
+
+void ZeroParamMap::releaseAll() {
+  // Collectives gathering ahead must finish before the compute stream issues
+  // others on the same communicators
+  for (auto& it : param_map_) {
+    waitGather(it.second);
+    doRelease(it.second);
+  }
+}
+
+void ZeroParamMap::allocate(const std::string& name) {
+  auto& entry = getEntry(name);
+  if (entry.gathered) {
+    waitGather(entry);
+  } else {
+    allocStorage(entry.param, entry.nbytes);
+    entry.gathered = true;
+  }
+
+  // The local segment may be updated after the param was gathered
+  torch::NoGradGuard no_grad;
+  getSegment(entry.param, entry.ranges.at(entry.local_index))
+      .copy_(entry.local_segment);
+}
+
+ZeroParamMap::ParamEntry& ZeroParamMap::getEntry(const std::string& name) {
+  if (!contains(param_map_, name)) {
+    throw std::invalid_argument("Param is not registered for zero: " + name);
+  }
+  return param_map_.at(name);
+}
+
+void ZeroParamMap::doGather(ParamEntry& entry) {
+  // The memory is allocated for the compute stream. The side stream waits for
+  // the kernels that used the memory before.
+  allocStorage(entry.param, entry.nbytes);
+  entry.gathered = true;
+
+  ZeroBcastEvents& bcast_events = ZeroBcastEvents::get();
+  const auto stream = bcast_events.getStream(entry.tag);
+  at::cuda::CUDAEvent alloc_evt;
+  alloc_evt.record(c10::cuda::getCurrentCUDAStream());
+  alloc_evt.block(stream);
+
+  {
+    c10::cuda::CUDAStreamGuard guard(stream);
+    NCCLStreamGuard nccl_guard(stream.stream());
+    torch::NoGradGuard no_grad;
+
+    std::vector<at::Tensor> segments;
+    std::vector<int> roots;
+    for (int i = 0; i < entry.ranges.size(); i++) {
+      const auto& range = entry.ranges.at(i);
+      if (range.first == range.second) {
+        continue;
+      }
+
+      auto segment = getSegment(entry.param, range);
+      if (i == entry.local_index) {
+        segment.copy_(entry.local_segment);
+      }
+      segments.push_back(segment);
+      roots.push_back(i);
+    }
+    NCCLWrapper::get().bcast(entry.tag, segments, roots);
+  }
+  c10::cuda::CUDACachingAllocator::recordStream(
+      entry.param.storage().data_ptr(), stream);
+
+  entry.ready = std::make_shared<at::cuda::CUDAEvent>();
+  entry.ready->record(stream);
+  // Lets ZeroBcastEvents::waitAll cover the gather
+  bcast_events.record({}, stream);
+}
+
+void ZeroParamMap::waitGather(ParamEntry& entry) {
+  if (entry.ready) {
+    entry.ready->block(c10::cuda::getCurrentCUDAStream());
+    entry.ready.reset();
+  }
+}
+
+void ZeroParamMap::doRelease(ParamEntry& entry) {
+  if (!entry.gathered) {
+    return;
+  }
+  // The caching allocator reuses the memory after the kernels issued so far
+  entry.ready.reset();
+  freeStorage(entry.param);
+  entry.gathered = false;
+}
+
+void ZeroParamMap::prefetchNext(const std::string& name, bool backward) {
+  const int tag = getEntry(name).tag;
+  PairKey<std::string, bool> access{name, backward};
+  if (contains(last_access_, tag)) {
+    next_access_[last_access_.at(tag)] = access;
+  }
+  last_access_[tag] = access;
+
+  for (size_t i = 0; i < prefetch_num_; i++) {
+    if (!contains(next_access_, access)) {
+      break;
+    }
+    access = next_access_.at(access);
+    if (!contains(param_map_, access.first)) {
+      break;
+    }
+    auto& entry = param_map_.at(access.first);
+    if (!entry.gathered) {
+      doGather(entry);
+    }
+  }
+}
+} // namespace rannc
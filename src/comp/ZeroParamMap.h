@@ -0,0 +1,118 @@
+#ifndef PYRANNC_ZEROPARAMMAP_H
+#define PYRANNC_ZEROPARAMMAP_H
+
+#include <ATen/cuda/CUDAEvent.h>
+#include <torch/torch.h>
+
+#include <Common.h>
+
+namespace rannc {
+
+/**
+ * Keeps ZeRO params released except while the operators using them run. A
+ * released param holds no device memory and only its local segment is kept.
+ * The storage object of the param stays the same, so tensors saved for
+ * backward (e.g. views of the param) see the data again once it is gathered.
+ *
+ * The ranks holding a param must call *gather* and *release* for it in the
+ * same order because a gather is a collective among them.
+ *
+ * While *keepGathered* is set (e.g. for micro-batches other than the last one
+ * of a pass), *release* leaves params gathered so that a param is gathered
+ * once per pass rather than once per micro-batch. They are released by the
+ * uses in the last micro-batch or by *releaseAll*.
+ */
+class ZeroParamMap {
+ public:
+  ZeroParamMap(const ZeroParamMap&) = delete;
+  ZeroParamMap& operator=(const ZeroParamMap&) = delete;
+  ZeroParamMap(ZeroParamMap&&) = delete;
+  ZeroParamMap& operator=(ZeroParamMap&&) = delete;
+
+  static ZeroParamMap& get() {
+    static ZeroParamMap instance;
+    return instance;
+  }
+
+  /**
+   * Registers a param and releases it.
+   *
+   * @param name Name of the param.
+   * @param param Contiguous param on the device that solely uses its storage.
+   * @param local_segment Local segment of the param. Must not share storage
+   * with *param*.
+   * @param tag Tag of the communicator of the ranks holding the param.
+   * @param ranges Ranges of the segments of the ranks.
+   * @param local_index Index of the local segment in *ranges*.
+   */
+  void registerParam(
+      const std::string& name, const at::Tensor& param,
+      const at::Tensor& local_segment, int tag,
+      const std::vector<std::pair<int64_t, int64_t>>& ranges, int local_index);
+  void unregisterParam(const std::string& name);
+  bool registered(const std::string& name) const;
+
+  /**
+   * Gathers a param unless it is already gathered and makes the current stream
+   * wait for it. Params expected to be used next are gathered ahead on a side
+   * stream following the order observed in past calls.
+   *
+   * @param name Name of the param.
+   * @param backward Whether the param is used in backward.
+   */
+  void gather(const std::string& name, bool backward);
+  /**
+   * Frees the device memory of a param unless *keepGathered* is set.
+   *
+   * @param name Name of the param.
+   */
+  void release(const std::string& name);
+  void keepGathered(bool keep);
+  // Releases all params including those gathered ahead.
+  void releaseAll();
+  /**
+   * Allocates the memory of a param and copies the local segment to it. The
+   * other segments must be broadcast by the caller.
+   *
+   * @param name Name of the param.
+   */
+  void allocate(const std::string& name);
+
+ private:
+  struct ParamEntry {
+    at::Tensor param;
+    at::Tensor local_segment;
+    size_t nbytes;
+    int tag;
+    std::vector<std::pair<int64_t, int64_t>> ranges;
+    int local_index;
+    bool gathered;
+    // Set while the gather is in flight
+    std::shared_ptr<at::cuda::CUDAEvent> ready;
+  };
+
+  ZeroParamMap();
+  ~ZeroParamMap() = default;
+
+  ParamEntry& getEntry(const std::string& name);
+  void doGather(ParamEntry& entry);
+  void waitGather(ParamEntry& entry);
+  void doRelease(ParamEntry& entry);
+  void prefetchNext(const std::string& name, bool backward);
+
+  std::unordered_map<std::string, ParamEntry> param_map_;
+
+  size_t prefetch_num_ = 0;
+  bool keep_gathered_ = false;
+  // (name, backward) -> (name, backward) accessed next
+  std::unordered_map<
+      PairKey<std::string, bool>, PairKey<std::string, bool>,
+      PairHash<std::string, bool>>
+      next_access_;
+  // The last access for each communicator. Accesses are chained only within a
+  // communicator so that all ranks of it prefetch the same params.
+  std::unordered_map<int, PairKey<std::string, bool>> last_access_;
+};
+} // namespace rannc
+
+#endif // PYRANNC_ZEROPARAMMAP_H
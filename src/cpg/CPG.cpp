@@ -4,17 +4,289 @@
 
 #include "CPG.h"
 
+#include <map>
+
+#include <Config.h>
+#include <graph/ProfilerUtil.h>
+#include <graph/RecomputePolicy.h>
+
 namespace {
-std::vector<rannc::CPGVar> toCPGVars(
-    const rannc::IRGraph& ir_g, const std::vector<std::string>& v_names) {
-  std::vector<rannc::CPGVar> vars;
-  for (const auto& in : v_names) {
-    const rannc::IRValue& v = ir_g.getValue(in);
-    vars.emplace_back(v, ir_g.getName());
+// Throughput used to convert the number of multiply-adds to time (us)
+const double OPS_PER_USEC = 1e7;
+
+const std::unordered_set<std::string> ELEMENTWISE_OPS = {
+    "aten::add",     "aten::add_",        "aten::sub",        "aten::sub_",
+    "aten::mul",     "aten::mul_",        "aten::div",        "aten::div_",
+    "aten::neg",     "aten::pow",         "aten::exp",        "aten::sqrt",
+    "aten::rsqrt",   "aten::relu",        "aten::relu_",      "aten::gelu",
+    "aten::tanh",    "aten::sigmoid",     "aten::dropout",    "aten::dropout_",
+    "aten::where",   "aten::masked_fill", "aten::contiguous", "aten::to"};
+const std::unordered_set<std::string> MATMUL_OPS = {
+    "aten::matmul", "aten::mm", "aten::bmm"};
+
+// arg index -> split dim. Args not in the map are replicated.
+struct SplitRule {
+  std::unordered_map<size_t, int> in_dims;
+  int out_dim;
+  // The contracted dim is split and the output is a partial sum
+  bool partial;
+};
+
+const std::vector<int64_t>& getArgDim(
+    const rannc::IRGraph& g, const rannc::IRNode& node, size_t arg_idx) {
+  return g.getValue(node.getInputNames().at(arg_idx)).getType().getTensorDim();
+}
+
+bool isTensorArg(
+    const rannc::IRGraph& g, const rannc::IRNode& node, size_t arg_idx) {
+  return arg_idx < node.getInputNames().size() &&
+      g.getValue(node.getInputNames().at(arg_idx)).getType().getBaseType() ==
+      rannc::IRBaseType::TENSOR;
+}
+
+// Dim of *in_dim* broadcast to *out_idx* of *out_dim*. -1 if the dim is
+// broadcast from size 1 or does not exist.
+int alignDim(
+    const std::vector<int64_t>& in_dim, const std::vector<int64_t>& out_dim,
+    int out_idx) {
+  int idx = out_idx - ((int)out_dim.size() - (int)in_dim.size());
+  if (idx < 0 || in_dim.at(idx) != out_dim.at(out_idx)) {
+    return -1;
+  }
+  return idx;
+}
+
+bool isBroadcastable(
+    const std::vector<int64_t>& in_dim, const std::vector<int64_t>& out_dim) {
+  if (in_dim.size() > out_dim.size()) {
+    return false;
+  }
+  size_t offset = out_dim.size() - in_dim.size();
+  for (size_t i = 0; i < in_dim.size(); i++) {
+    if (in_dim.at(i) != 1 && in_dim.at(i) != out_dim.at(i + offset)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<SplitRule> getElementwiseRules(
+    const rannc::IRGraph& g, const rannc::IRNode& node,
+    const std::vector<int64_t>& out_dim) {
+  std::vector<size_t> tensor_args;
+  for (size_t i = 0; i < node.getInputNames().size(); i++) {
+    if (isTensorArg(g, node, i)) {
+      if (!isBroadcastable(getArgDim(g, node, i), out_dim)) {
+        return {};
+      }
+      tensor_args.push_back(i);
+    }
+  }
+
+  std::vector<SplitRule> rules;
+  for (int d = 0; d < out_dim.size(); d++) {
+    SplitRule rule{{}, d, false};
+    for (size_t i : tensor_args) {
+      rule.in_dims[i] = alignDim(getArgDim(g, node, i), out_dim, d);
+    }
+    rules.push_back(rule);
+  }
+  return rules;
+}
+
+// matmul(a, b) with optional bias broadcast to the output
+std::vector<SplitRule> getMatmulRules(
+    const rannc::IRGraph& g, const rannc::IRNode& node, size_t a_idx,
+    size_t b_idx, int bias_idx, const std::vector<int64_t>& out_dim) {
+  if (!isTensorArg(g, node, a_idx) || !isTensorArg(g, node, b_idx)) {
+    return {};
+  }
+  const auto& a_dim = getArgDim(g, node, a_idx);
+  const auto& b_dim = getArgDim(g, node, b_idx);
+  int ra = a_dim.size();
+  int rb = b_dim.size();
+  int ro = out_dim.size();
+  if (ra < 2 || rb < 2 || ro < 2) {
+    return {};
+  }
+
+  std::vector<int64_t> a_batch(a_dim.begin(), a_dim.end() - 2);
+  std::vector<int64_t> b_batch(b_dim.begin(), b_dim.end() - 2);
+  std::vector<int64_t> o_batch(out_dim.begin(), out_dim.end() - 2);
+
+  const auto set_bias = [&](SplitRule& rule) {
+    if (bias_idx >= 0 && isTensorArg(g, node, bias_idx)) {
+      rule.in_dims[bias_idx] =
+          alignDim(getArgDim(g, node, bias_idx), out_dim, rule.out_dim);
+    }
+  };
+
+  std::vector<SplitRule> rules;
+  for (int d = 0; d < ro - 2; d++) {
+    SplitRule rule{
+        {{a_idx, alignDim(a_batch, o_batch, d)},
+         {b_idx, alignDim(b_batch, o_batch, d)}},
+        d,
+        false};
+    set_bias(rule);
+    rules.push_back(rule);
+  }
+  SplitRule row{{{a_idx, ra - 2}}, ro - 2, false};
+  set_bias(row);
+  rules.push_back(row);
+  SplitRule col{{{b_idx, rb - 1}}, ro - 1, false};
+  set_bias(col);
+  rules.push_back(col);
+  rules.push_back({{{a_idx, ra - 1}, {b_idx, rb - 2}}, -1, true});
+  return rules;
+}
+
+std::vector<SplitRule> getLinearRules(
+    const rannc::IRGraph& g, const rannc::IRNode& node,
+    const std::vector<int64_t>& out_dim) {
+  if (!isTensorArg(g, node, 0) || !isTensorArg(g, node, 1)) {
+    return {};
+  }
+  int ri = getArgDim(g, node, 0).size();
+  int ro = out_dim.size();
+  if (ri != ro || ri < 1) {
+    return {};
+  }
+  bool has_bias = isTensorArg(g, node, 2);
+
+  std::vector<SplitRule> rules;
+  for (int d = 0; d < ro - 1; d++) {
+    rules.push_back({{{0, d}}, d, false});
+  }
+  SplitRule col{{{1, 0}}, ro - 1, false};
+  if (has_bias) {
+    col.in_dims[2] = 0;
+  }
+  rules.push_back(col);
+  rules.push_back({{{0, ri - 1}, {1, 1}}, -1, true});
+  return rules;
+}
+
+std::vector<SplitRule> getEmbeddingRules(
+    const rannc::IRGraph& g, const rannc::IRNode& node,
+    const std::vector<int64_t>& out_dim) {
+  if (!isTensorArg(g, node, 0) || !isTensorArg(g, node, 1) ||
+      getArgDim(g, node, 0).size() != 2) {
+    return {};
+  }
+  int ro = out_dim.size();
+  std::vector<SplitRule> rules;
+  for (int d = 0; d < ro - 1; d++) {
+    rules.push_back({{{1, d}}, d, false});
+  }
+  rules.push_back({{{0, 1}}, ro - 1, false});
+  // vocab-parallel
+  rules.push_back({{{0, 0}}, -1, true});
+  return rules;
+}
+
+std::vector<SplitRule> getLayerNormRules(
+    const rannc::IRGraph& g, const rannc::IRNode& node,
+    const std::vector<int64_t>& out_dim) {
+  if (!isTensorArg(g, node, 0)) {
+    return {};
+  }
+  // Dims normalized are given by the weight
+  int norm_dim_num = isTensorArg(g, node, 2) ? getArgDim(g, node, 2).size() : 1;
+  std::vector<SplitRule> rules;
+  for (int d = 0; d < (int)out_dim.size() - norm_dim_num; d++) {
+    rules.push_back({{{0, d}}, d, false});
+  }
+  return rules;
+}
+
+std::vector<SplitRule> getSplitRules(
+    const rannc::IRGraph& g, const rannc::IRNode& node,
+    const std::vector<int64_t>& out_dim) {
+  const auto& op = node.getName();
+  if (rannc::contains(ELEMENTWISE_OPS, op)) {
+    return getElementwiseRules(g, node, out_dim);
+  } else if (rannc::contains(MATMUL_OPS, op)) {
+    return getMatmulRules(g, node, 0, 1, -1, out_dim);
+  } else if (op == "aten::addmm") {
+    return getMatmulRules(g, node, 1, 2, 0, out_dim);
+  } else if (op == "aten::linear") {
+    return getLinearRules(g, node, out_dim);
+  } else if (op == "aten::embedding") {
+    return getEmbeddingRules(g, node, out_dim);
+  } else if (op == "aten::layer_norm") {
+    return getLayerNormRules(g, node, out_dim);
+  }
+  return {};
+}
+
+// Whether the op runs as its distributed version, which computes with the
+// params split by the rule. Ops that do not are given the gathered params.
+bool runsAsDistOp(
+    const rannc::IRGraph& g, const rannc::IRNode& node, const SplitRule& rule) {
+  std::unordered_map<size_t, int> param_dims;
+  for (const auto& it : rule.in_dims) {
+    if (g.getValue(node.getInputNames().at(it.first)).isParam()) {
+      param_dims[it.first] = it.second;
+    }
+  }
+  if (param_dims.empty()) {
+    return false;
+  }
+
+  for (const auto& op : rannc::getDistOps()) {
+    if (op.original_name != node.getName() ||
+        op.partition_dim.size() != param_dims.size()) {
+      continue;
+    }
+    if (op.applicable && !op.applicable(node, g.getValues())) {
+      continue;
+    }
+    bool match = true;
+    for (const auto& pd : op.partition_dim) {
+      if (!rannc::contains(param_dims, pd.first) ||
+          param_dims.at(pd.first) != (int)pd.second) {
+        match = false;
+      }
+    }
+    if (match) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool isSplittable(const rannc::CPGVar& var, int dim, int dev_num) {
+  if (dim < 0) {
+    return true;
+  }
+  for (const auto& n : var.getNodes()) {
+    if (n.split_dim_ == dim) {
+      const auto& tensor_dim = var.getValue().getType().getTensorDim();
+      return tensor_dim.at(dim) % dev_num == 0;
+    }
   }
-  return vars;
+  return false;
 }
 
+// Split dims of the values used later. Ordered to serve as the key to merge
+// states.
+using LiveSplits = std::map<std::string, int>;
+
+struct SearchState {
+  LiveSplits splits;
+  long cost;
+  size_t parent;
+  size_t edge;
+};
+
+std::string toKey(const LiveSplits& splits) {
+  std::stringstream ss;
+  for (const auto& it : splits) {
+    ss << it.first << ":" << it.second << ";";
+  }
+  return ss.str();
+}
 } // namespace
 
 namespace rannc {
@@ -24,128 +296,295 @@ CPGVar::CPGVar(IRValue value, std::string op_graph)
   const IRType& type = value_.getType();
   assert(type.getBaseType() == IRBaseType::TENSOR);
 
-  int start_dim = value.isBatch() ? 1 : 0;
+  int start_dim = value_.isBatch() ? 1 : 0;
   for (int i = start_dim; i < type.getTensorDim().size(); i++) {
     nodes_.emplace_back(value_.getName(), i, op_graph_);
   }
 }
 
-std::vector<std::vector<CPGNode>> doCartesianProductDim(
-    std::vector<CPGVar> rest_vars, const std::vector<CPGNode>& combination) {
-  if (rest_vars.empty()) {
-    return {combination};
+OpCPG generateOpCPG(
+    const std::shared_ptr<IRGraph>& g, const IRNode& node, int dev_num) {
+  const auto& node_id = node.getId();
+
+  std::vector<size_t> tensor_args;
+  std::vector<CPGVar> in_vars;
+  for (size_t i = 0; i < node.getInputNames().size(); i++) {
+    if (isTensorArg(*g, node, i)) {
+      tensor_args.push_back(i);
+      in_vars.emplace_back(g->getValue(node.getInputNames().at(i)), node_id);
+    }
+  }
+  std::vector<CPGVar> out_vars;
+  for (const auto& out_name : node.getOutputNames()) {
+    const auto& out_val = g->getValue(out_name);
+    if (out_val.getType().getBaseType() == IRBaseType::TENSOR) {
+      out_vars.emplace_back(out_val, node_id);
+    }
   }
 
-  CPGVar last_var = rest_vars.at(rest_vars.size() - 1);
-  rest_vars.pop_back();
+  const long compute =
+      std::max(1L, (long)(estimateNodeCost(g, node) / OPS_PER_USEC));
 
-  std::vector<std::vector<CPGNode>> results;
-  for (const auto& n : last_var.getNodes()) {
-    std::vector<CPGNode> new_comb = combination;
-    new_comb.emplace_back(
-        last_var.getValue().getName(), n.split_dim_, last_var.getOpGraph());
-    for (const auto& c : doCartesianProductDim(rest_vars, new_comb)) {
-      results.push_back(c);
+  std::vector<SplitRule> rules;
+  // Only ops with a single tensor output are split
+  if (out_vars.size() == 1) {
+    const auto& out_dim = out_vars.front().getValue().getType().getTensorDim();
+    rules = getSplitRules(*g, node, out_dim);
+  }
+
+  std::vector<OpHyEdge> edges;
+  std::unordered_set<std::string> edge_keys;
+  const auto add_edge = [&](const SplitRule* rule) {
+    std::vector<CPGNode> in_nodes;
+    std::vector<CPGNode> out_nodes;
+    std::stringstream key;
+    const bool dist_op = rule && runsAsDistOp(*g, node, *rule);
+    long cost = dist_op ? compute / dev_num : compute;
+
+    for (size_t i = 0; i < tensor_args.size(); i++) {
+      int dim = -1;
+      if (rule && contains(rule->in_dims, tensor_args.at(i))) {
+        dim = rule->in_dims.at(tensor_args.at(i));
+      }
+      const auto& var = in_vars.at(i);
+      if (!isSplittable(var, dim, dev_num)) {
+        return;
+      }
+      // Grads of a replicated param are partial if others are split
+      if (dist_op && dim < 0 && var.getValue().isParam()) {
+        cost += calcAllReduceTime(var.getValue().getSizeInByte());
+      }
+      if (!dist_op && dim >= 0 && var.getValue().isParam()) {
+        cost += calcAllGatherTime(var.getValue().getSizeInByte());
+      }
+      in_nodes.emplace_back(var.getValue().getName(), dim, node_id);
+      key << dim << ",";
+    }
+    for (const auto& var : out_vars) {
+      int dim = rule ? rule->out_dim : -1;
+      if (!isSplittable(var, dim, dev_num)) {
+        return;
+      }
+      if (rule && rule->partial) {
+        cost += calcAllReduceTime(var.getValue().getSizeInByte());
+      }
+      out_nodes.emplace_back(var.getValue().getName(), dim, node_id);
+      key << dim << ",";
+    }
+    if (rule && rule->partial) {
+      key << "p";
+    }
+    if (!contains(edge_keys, key.str())) {
+      edge_keys.insert(key.str());
+      edges.emplace_back(in_nodes, out_nodes, cost);
+    }
+  };
+
+  add_edge(nullptr);
+  if (dev_num > 1) {
+    for (const auto& rule : rules) {
+      add_edge(&rule);
     }
   }
-  return results;
-}
 
-std::vector<std::vector<CPGNode>> cartesianProductDim(
-    const std::vector<CPGVar>& vars) {
-  return doCartesianProductDim(vars, {});
+  return {node_id, in_vars, out_vars, edges};
 }
 
-OpCPG generateOpCPG(const IRGraph& ir_g) {
-  IRNode op_node;
-  for (const auto& node : ir_g.getNodes()) {
-    //    spdlog::info("node {} batch={}", node.getName(), node.isBatch());
-    if (node.isBatch()) {
-      op_node = node;
+CPG::CPG(std::shared_ptr<IRGraph> g, int dev_num)
+    : g_(std::move(g)), dev_num_(dev_num) {
+  for (const auto& node : g_->getNodes()) {
+    // Ops that produce no tensor (e.g. aten::size) do not need the values
+    bool has_tensor_output = false;
+    for (const auto& out_name : node.getOutputNames()) {
+      if (g_->getValue(out_name).getType().getBaseType() ==
+          IRBaseType::TENSOR) {
+        has_tensor_output = true;
+      }
+    }
+    if (has_tensor_output) {
+      op_cpgs_.push_back(generateOpCPG(g_, node, dev_num_));
     }
   }
-  spdlog::info("target op {}", op_node.getName());
+}
 
-  std::vector<CPGVar> in_vars = toCPGVars(ir_g, ir_g.getInputNames());
-  std::vector<CPGVar> out_vars = toCPGVars(ir_g, ir_g.getOutputNames());
+long CPG::calcReshardCost(
+    const std::string& val_name, int from, int to) const {
+  // A replicated value can be sliced locally
+  if (from == to || from < 0) {
+    return 0;
+  }
+  long size = g_->getValue(val_name).getSizeInByte();
+  long comm_size = to < 0 ? size * (dev_num_ - 1) / dev_num_
+                          : size * (dev_num_ - 1) / (dev_num_ * dev_num_);
+  // The collective in backward moves the same amount of data
+  return 2 * calcCommTime(comm_size);
+}
 
-  std::unordered_set<std::string> in_names, out_names;
-  for (const auto& v : in_vars) {
-    in_names.insert(v.getValue().getName());
+CPGSolution CPG::search(size_t beam_width) const {
+  std::unordered_map<std::string, size_t> last_use;
+  for (size_t i = 0; i < op_cpgs_.size(); i++) {
+    for (const auto& var : op_cpgs_.at(i).getInVars()) {
+      last_use[var.getValue().getName()] = i;
+    }
   }
-  for (const auto& v : out_vars) {
-    out_names.insert(v.getValue().getName());
+  for (const auto& out_name : g_->getOutputNames()) {
+    last_use[out_name] = op_cpgs_.size();
   }
+  const auto is_live = [&last_use](const std::string& name, size_t step) {
+    return contains(last_use, name) && last_use.at(name) > step;
+  };
 
-  assert(out_vars.size() == 1);
-  std::vector<CPGVar> target_vals = in_vars;
-  target_vals.push_back(out_vars.front());
-  const std::vector<std::vector<CPGNode>> comb =
-      cartesianProductDim(target_vals);
+  std::vector<SearchState> states = {SearchState{{}, 0, 0, 0}};
+  // step -> states kept
+  std::vector<std::vector<SearchState>> history;
 
-  std::vector<OpHyEdge> edges;
-  for (const auto& it : comb) {
-    std::stringstream ss;
-    ss << "[";
-    for (const CPGNode& n : it) {
-      ss << "(" << n.name_ << "," << n.split_dim_ << "," << n.op_graph_ << ")";
-    }
-    ss << "]";
-    spdlog::info("comb {}", ss.str());
+  for (size_t i = 0; i < op_cpgs_.size(); i++) {
+    const auto& edges = op_cpgs_.at(i).getEdges();
+    std::unordered_map<std::string, size_t> key_idx;
+    std::vector<SearchState> next;
 
-    std::vector<CPGNode> in_nodes;
-    std::vector<CPGNode> out_nodes;
+    for (size_t s = 0; s < states.size(); s++) {
+      const auto& state = states.at(s);
+      for (size_t e = 0; e < edges.size(); e++) {
+        const auto& edge = edges.at(e);
+        LiveSplits splits = state.splits;
+        long cost = state.cost + edge.cost;
+
+        for (const auto& n : edge.in_nodes) {
+          if (contains(splits, n.name_)) {
+            cost += calcReshardCost(n.name_, splits.at(n.name_), n.split_dim_);
+          } else if (g_->getValue(n.name_).isParam()) {
+            // A param is stored as the first consumer requires
+            splits[n.name_] = n.split_dim_;
+          }
+          // Other inputs of the graph are replicated and sliced locally
+        }
+        for (const auto& n : edge.in_nodes) {
+          if (!is_live(n.name_, i)) {
+            splits.erase(n.name_);
+          }
+        }
+        for (const auto& n : edge.out_nodes) {
+          if (is_live(n.name_, i)) {
+            splits[n.name_] = n.split_dim_;
+          }
+        }
 
-    for (const CPGNode& n : it) {
-      if (contains(in_names, n.name_)) {
-        in_nodes.push_back(n);
-      } else if (contains(out_names, n.name_)) {
-        out_nodes.push_back(n);
-      } else {
-        throw std::runtime_error("name not found");
+        const auto key = toKey(splits);
+        if (!contains(key_idx, key)) {
+          key_idx[key] = next.size();
+          next.push_back(SearchState{std::move(splits), cost, s, e});
+        } else if (cost < next.at(key_idx.at(key)).cost) {
+          next.at(key_idx.at(key)) =
+              SearchState{std::move(splits), cost, s, e};
+        }
       }
     }
-    edges.emplace_back(in_nodes, out_nodes);
-  }
 
-  return {ir_g.getName(), in_vars, out_vars, edges};
-}
+    std::sort(
+        next.begin(), next.end(),
+        [](const SearchState& a, const SearchState& b) {
+          return a.cost < b.cost;
+        });
+    if (next.size() > beam_width) {
+      next.resize(beam_width);
+    }
+    states = next;
+    history.push_back(next);
+  }
 
-CPG createCPG(const std::vector<OpCPG>& op_cpgs) {
-  // value_name -> op_graph
-  std::unordered_map<std::string, std::string> val_out_graphs;
-  for (const auto& op_cpg : op_cpgs) {
-    for (const auto& v : op_cpg.getOutVars()) {
-      val_out_graphs[v.getValue().getName()] = op_cpg.getName();
+  // Outputs of the graph are passed to the next stage as replicated values
+  size_t best_idx = 0;
+  long best_cost = std::numeric_limits<long>::max();
+  for (size_t s = 0; s < states.size(); s++) {
+    long cost = states.at(s).cost;
+    for (const auto& it : states.at(s).splits) {
+      cost += calcReshardCost(it.first, it.second, -1);
+    }
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_idx = s;
     }
   }
 
-  // value_name -> (src_op_graph, tgt_op_graph)
-  std::unordered_map<std::string, std::pair<std::string, std::string>> io_pairs;
-  for (const auto& op_cpg : op_cpgs) {
-    for (const auto& v : op_cpg.getInVars()) {
-      const auto& val_name = v.getValue().getName();
-      if (contains(val_out_graphs, val_name)) {
-        io_pairs[val_name] = {val_out_graphs.at(val_name), v.getOpGraph()};
+  CPGSolution sol;
+  sol.cost = best_cost;
+  sol.edge_choices.resize(op_cpgs_.size());
+  size_t idx = best_idx;
+  for (size_t i = op_cpgs_.size(); i > 0; i--) {
+    const auto& state = history.at(i - 1).at(idx);
+    sol.edge_choices.at(i - 1) = state.edge;
+    idx = state.parent;
+  }
+
+  for (const auto& in_name : g_->getInputNames()) {
+    sol.split_dims[in_name] = -1;
+  }
+  std::unordered_set<std::string> assigned_params;
+  for (size_t i = 0; i < op_cpgs_.size(); i++) {
+    const auto& edge = op_cpgs_.at(i).getEdges().at(sol.edge_choices.at(i));
+    for (const auto& n : edge.in_nodes) {
+      if (g_->getValue(n.name_).isParam() &&
+          !contains(assigned_params, n.name_)) {
+        sol.split_dims[n.name_] = n.split_dim_;
+        assigned_params.insert(n.name_);
       }
     }
+    for (const auto& n : edge.out_nodes) {
+      sol.split_dims[n.name_] = n.split_dim_;
+    }
   }
 
-  //  std::vector<CPGNode> out_nodes;
-  //
-  //  std::vector<CPGNode> nodes;
-  //  for (const auto& op_cpg: op_cpgs) {
-  //    for (const auto& v: op_cpg.getInVars()) {
-  //      nodes.push_back(v);
-  //    }
-  //    for (const auto& v: op_cpg.getOutVars()) {
-  //      nodes.push_back(v);
-  //    }
-  //  }
+  logger->trace(
+      "CPG search finished: graph={} #ops={} cost={}", g_->getName(),
+      op_cpgs_.size(), sol.cost);
+
+  return sol;
+}
+
+ParamPartitionMap searchDistParams(
+    const std::shared_ptr<IRGraph>& g, int dev_num) {
+  const ParamPartitionMap dist_params = getDistParams(g);
+  if (dev_num <= 1) {
+    return dist_params;
+  }
 
-  std::vector<CPGNode> out_nodes;
+  const int beam_width =
+      config::Config::get().getVal<int>(config::CPG_BEAM_WIDTH);
+  CPG cpg(g, dev_num);
+  const CPGSolution sol = cpg.search(std::max(1, beam_width));
 
-  return CPG();
+  // Params used by an op of the catalog keep its partitioning when the search
+  // chose the same dim. The others are gathered before use, which
+  // replaceWithDistOp() inserts.
+  std::unordered_map<std::string, size_t> use_counts;
+  std::unordered_map<std::string, size_t> arg_indices;
+  for (const auto& node : g->getNodes()) {
+    const auto& in_names = node.getInputNames();
+    for (size_t i = 0; i < in_names.size(); i++) {
+      if (g->getValue(in_names.at(i)).isParam()) {
+        use_counts[in_names.at(i)]++;
+        arg_indices[in_names.at(i)] = i;
+      }
+    }
+  }
+
+  ParamPartitionMap ret;
+  for (const auto& it : use_counts) {
+    const auto& name = it.first;
+    if (it.second != 1 || !contains(sol.split_dims, name) ||
+        sol.split_dims.at(name) < 0) {
+      continue;
+    }
+    const size_t split_dim = sol.split_dims.at(name);
+    if (contains(dist_params, name) &&
+        dist_params.at(name).second == split_dim) {
+      ret[name] = dist_params.at(name);
+    } else {
+      ret[name] = {arg_indices.at(name), split_dim};
+    }
+  }
+  return ret;
 }
 
 IRGraph testLoadGraph(const std::string& file) {
@@ -172,8 +611,11 @@ void testCPG() {
 
   for (const auto& g : graphs) {
     spdlog::info("testCPG {}", toString(g));
-    OpCPG opg = generateOpCPG(g);
-    spdlog::info("g={}", toString(opg));
+    CPG cpg(std::make_shared<IRGraph>(g), 4);
+    for (const auto& op_cpg : cpg.getOpCPGs()) {
+      spdlog::info("op={}", toString(op_cpg));
+    }
+    spdlog::info("sol={}", toString(cpg.search(64)));
   }
 }
 } // namespace rannc
\ No newline at end of file
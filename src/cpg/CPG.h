@@ -6,10 +6,13 @@
 #define PYRANNC_CPG_H
 
 #include <ostream>
+#include "distop/PartitionTensor.h"
 #include "graph/ir.h"
+#include "Logging.h"
 
 namespace rannc {
 
+// A value split along *split_dim_*. -1 means the value is replicated.
 struct CPGNode {
   CPGNode(std::string name, int split_dim, std::string op_graph)
       : name_(std::move(name)),
@@ -54,17 +57,25 @@ class CPGVar {
   std::string op_graph_;
 };
 
+// A way to run an op: split dims of tensor inputs and outputs. *cost* covers
+// the computation and the collectives the op itself needs (e.g. allreduce of
+// partial sums when the contracted dim is split). The computation is divided
+// only when the op runs as its distributed version (*DistOp*). Otherwise split
+// params are gathered before the op, which costs the full computation and the
+// allgather.
 struct OpHyEdge {
   OpHyEdge(
       const std::vector<CPGNode>& in_nodes,
-      const std::vector<CPGNode>& out_nodes)
-      : in_nodes(in_nodes), out_nodes(out_nodes) {}
+      const std::vector<CPGNode>& out_nodes, long cost = 0)
+      : in_nodes(in_nodes), out_nodes(out_nodes), cost(cost) {}
 
   std::vector<CPGNode> in_nodes;
   std::vector<CPGNode> out_nodes;
+  long cost;
 
   friend std::ostream& operator<<(std::ostream& os, const OpHyEdge& edge) {
-    os << "in_nodes:" << edge.in_nodes << " out_nodes:" << edge.out_nodes;
+    os << "in_nodes:" << edge.in_nodes << " out_nodes:" << edge.out_nodes
+       << " cost:" << edge.cost;
     return os;
   }
 };
@@ -105,7 +116,75 @@ class OpCPG {
   std::vector<OpHyEdge> edges_;
 };
 
-class CPG {};
+struct CPGSolution {
+  // value name -> split dim (-1: replicated)
+  std::unordered_map<std::string, int> split_dims;
+  // op index -> index of the chosen edge
+  std::vector<size_t> edge_choices;
+  long cost = 0;
+
+  friend std::ostream& operator<<(std::ostream& os, const CPGSolution& sol) {
+    os << "split_dims: {";
+    for (const auto& it : sol.split_dims) {
+      os << it.first << ":" << it.second << ",";
+    }
+    os << "} cost: " << sol.cost;
+    return os;
+  }
+};
+
+/**
+ * Cartesian partitioning graph of a whole *IRGraph*. Each op has hyper-edges
+ * that connect split dims of its inputs and outputs. The edges are derived
+ * from rules for known ops (elementwise, matmul family, embedding and
+ * layer_norm) rather than by enumerating all combinations of dims, so that
+ * the number of edges of an op is linear in the rank of its output. Ops
+ * without rules only have the replicated edge.
+ *
+ * *search()* chooses an edge for each op so that the sum of the costs of the
+ * edges and the resharding between them is minimized.
+ */
+class CPG {
+ public:
+  CPG(std::shared_ptr<IRGraph> g, int dev_num);
+
+  const std::vector<OpCPG>& getOpCPGs() const {
+    return op_cpgs_;
+  }
+
+  /**
+   * Runs a DP over ops in topological order. A state holds split dims of the
+   * values that are used later, and states with the same split dims are
+   * merged. At most *beam_width* states are kept at each step.
+   *
+   * @param beam_width Max number of states kept at each step.
+   * @return Split dims of values and chosen edges.
+   */
+  CPGSolution search(size_t beam_width) const;
+
+  long calcReshardCost(const std::string& val_name, int from, int to) const;
+
+ private:
+  std::shared_ptr<IRGraph> g_;
+  int dev_num_;
+  std::vector<OpCPG> op_cpgs_;
+
+  const std::shared_ptr<spdlog::logger> logger = getLogger("CPG");
+};
+
+/**
+ * Chooses params to partition by a search on the CPG of *g*. A param whose
+ * chosen split dim matches the catalog of operators (*getDistOps()*) is
+ * computed by the distributed op. The other params are partitioned along the
+ * chosen dims and gathered before use. Params used by multiple ops are not
+ * partitioned.
+ *
+ * @param g Graph.
+ * @param dev_num Number of devices across which params are partitioned.
+ * @return Params to partition.
+ */
+ParamPartitionMap searchDistParams(
+    const std::shared_ptr<IRGraph>& g, int dev_num);
 
 void testCPG();
 
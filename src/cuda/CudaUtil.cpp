@@ -72,6 +72,8 @@ CudaDeviceInfo getCudaDeviceInfo(int id) {
   info.name = prop.name;
   info.pci_bus_id = prop.pciBusID;
   info.pci_dev_id = prop.pciDeviceID;
+  info.multi_processor_count = prop.multiProcessorCount;
+  info.clock_rate = prop.clockRate;
 
   size_t free_mem;
   size_t total_mem;
@@ -23,6 +23,9 @@ struct CudaDeviceInfo {
   int pci_dev_id = -1;
   size_t free_mem = 0;
   size_t total_mem = 0;
+  int multi_processor_count = 0;
+  // kHz
+  int clock_rate = 0;
 
   bool operator==(const CudaDeviceInfo& rhs) const {
     return hostname == rhs.hostname && pci_bus_id == rhs.pci_bus_id &&
@@ -38,12 +41,15 @@ struct CudaDeviceInfo {
     os << "id: " << info.dev_id << " name: " << info.name
        << " hostname: " << info.hostname << " pci_bus_id: " << info.pci_bus_id
        << " pci_dev_id: " << info.pci_dev_id << " free_mem: " << info.free_mem
-       << " total_mem: " << info.total_mem;
+       << " total_mem: " << info.total_mem
+       << " multi_processor_count: " << info.multi_processor_count
+       << " clock_rate: " << info.clock_rate;
     return os;
   }
 
   MSGPACK_DEFINE(
-      dev_id, name, hostname, pci_bus_id, pci_dev_id, free_mem, total_mem);
+      dev_id, name, hostname, pci_bus_id, pci_dev_id, free_mem, total_mem,
+      multi_processor_count, clock_rate);
 };
 
 struct CudaDeviceInfoHash {
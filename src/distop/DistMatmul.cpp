@@ -4,6 +4,8 @@
 
 #include "DistMatmul.h"
 
+#include <c10/cuda/CUDACachingAllocator.h>
+#include <c10/cuda/CUDAGuard.h>
 #include <comm/MPIUtil.h>
 #include <comm/SComm.h>
 #include <comp/EventRecorder.h>
@@ -15,83 +17,169 @@
 
 namespace rannc {
 
-at::TensorOptions makeTensorOptions(at::ScalarType dtype, bool requires_grad) {
+at::TensorOptions makeTensorOptions(
+    at::ScalarType dtype, const c10::Device& device, bool requires_grad) {
   at::TensorOptions options;
-  options = options.dtype(dtype)
-                .device(c10::Device(c10::DeviceType::CUDA))
-                .requires_grad(requires_grad);
+  options = options.dtype(dtype).device(device).requires_grad(requires_grad);
   return options;
 }
 
 const std::shared_ptr<spdlog::logger> DistLinearFunction::logger =
     getLogger("DistLinearFunction");
+const std::shared_ptr<spdlog::logger> EmbeddingDistFunction::logger =
+    getLogger("EmbeddingDistFunction");
 
-at::Tensor DistMatmul::run(
-    const at::Tensor& x, const at::Tensor& y,
-    const std::unordered_set<int>& ranks) {
-  TraceEvent evt(getFuncKey("DistMatmul", "run", "no_id", 0, false));
+namespace {
+std::unordered_set<int> toRankSet(const std::vector<int64_t>& dist_ranks) {
+  std::unordered_set<int> ranks;
+  for (const int64_t r : dist_ranks) {
+    ranks.insert(r);
+  }
+  return ranks;
+}
 
+// Splits a tensor along the given dim and reduces i-th slice to i-th rank
+at::Tensor reduceSlices(
+    int tag, const at::Tensor& ten, int64_t dim_idx,
+    const std::unordered_set<int>& ranks) {
   NCCLWrapper& nccl = NCCLWrapper::get();
-  TagMap& tag_map = TagMap::get();
-  int tag = tag_map.getRankSetTag(ranks);
-  nccl.createCommunicator(tag, ranks);
 
-  /*
-   * We assume both x and y are partitioned along 0-th dim
-   */
   int np = ranks.size();
-  int my_rank = mpi::getRank();
-  assert(contains(ranks, my_rank));
+  int local_rank = getLocalRank(ranks, mpi::getRank());
+  auto slices = ten.split(ten.size(dim_idx) / np, dim_idx);
+  assert(slices.size() == np);
 
-  std::vector<int64_t> x_dim = getTensorDim(x);
-  assert(x_dim.size() > 1);
-  std::vector<int64_t> y_dim = getTensorDim(y);
-  assert(y_dim.size() == 2);
+  at::Tensor ret;
+  for (int i = 0; i < np; i++) {
+    const auto slice = slices[i].contiguous();
+    nccl.reduce(tag, {slice}, {i});
+    if (i == local_rank) {
+      ret = slice;
+    }
+  }
+  nccl.syncWithErrorCheck();
+  return ret;
+}
+} // namespace
+
+DistMatmulComm::DistMatmulComm(const std::unordered_set<int>& ranks, bool cuda)
+    : cuda_(cuda) {
+  tag_ = TagMap::get().getRankSetTag(ranks);
+  local_rank_ = getLocalRank(ranks, mpi::getRank());
 
-  if (out_buf_.defined()) {
-    out_buf_ = out_buf_.detach();
-    out_buf_.zero_();
+  if (cuda_) {
+    NCCLWrapper::get().createCommunicator(tag_, ranks);
+    stream_ = c10::cuda::getStreamFromPool();
   } else {
-    std::vector<int64_t> out_dims = x_dim;
-    out_dims[x_dim.size() - 1] = y_dim.at(1);
-    out_buf_ = torch::zeros(
-                   out_dims, makeTensorOptions(x.dtype().toScalarType(), true))
-                   .clone();
+    mpi_comm_ = SComm::get().getCommunicator(tag_, ranks);
   }
+}
 
-  for (int i = 0; i <= np; i++) {
-    if (i < np) {
-      TraceEvent evt_bcast(
-          getFuncKey("DistMatmul", "bcast", "no_id", i, false));
-
-      nccl.bcast(tag, {y}, {i});
-      nccl.syncWithErrorCheck();
+DistMatmulComm::~DistMatmulComm() {
+  // Buffers must not be released while MPI is still using them
+  for (auto& req : requests_) {
+    if (req != MPI_REQUEST_NULL) {
+      MPI_Wait(&req, MPI_STATUS_IGNORE);
     }
+  }
+}
 
-    int target_idx;
-    if (i == 0) {
-      target_idx = my_rank;
-    } else {
-      target_idx = i - 1;
-    }
+size_t DistMatmulComm::postNCCL(
+    const at::Tensor& buf, const std::function<void()>& f) {
+  // The buffer may still be written or read on the compute stream
+  at::cuda::CUDAEvent ready_evt;
+  ready_evt.record(c10::cuda::getCurrentCUDAStream());
+  ready_evt.block(*stream_);
 
-    if (i != my_rank) {
-      TraceEvent evt_bcast(
-          getFuncKey("DistMatmul", "matmul", "no_id", i, false));
+  {
+    c10::cuda::CUDAStreamGuard guard(*stream_);
+    NCCLStreamGuard nccl_guard(stream_->stream());
+    f();
+  }
+  // Keep the memory of the buffer until the collective finishes
+  c10::cuda::CUDACachingAllocator::recordStream(
+      buf.storage().data_ptr(), *stream_);
+
+  auto done_evt = std::make_shared<at::cuda::CUDAEvent>();
+  done_evt->record(*stream_);
+  events_.push_back(done_evt);
+  return events_.size() - 1;
+}
 
-      int64_t x_split_dim = x_dim.size() - 1;
+size_t DistMatmulComm::addRequest(MPI_Request req) {
+  requests_.push_back(req);
+  return requests_.size() - 1;
+}
 
-      int64_t step = x_dim.at(x_split_dim) / np;
+size_t DistMatmulComm::bcast(const at::Tensor& buf, int root) {
+  assert(buf.is_contiguous());
 
-      const auto x_slice =
-          x.slice(x_split_dim, step * target_idx, step * (target_idx + 1));
-      at::Tensor z = torch::matmul(x_slice, y);
-      out_buf_ += z;
-      nccl.syncWithErrorCheck();
-    }
+  if (cuda_) {
+    return postNCCL(buf, [this, &buf, root]() {
+      NCCLWrapper::get().bcast(tag_, {buf}, {root});
+    });
+  }
+
+  MPI_Request req;
+  mpi::checkMPIResult(MPI_Ibcast(
+      buf.data_ptr(), buf.numel(), scalarTypeToMPIDatatype(buf.scalar_type()),
+      root, mpi_comm_, &req));
+  return addRequest(req);
+}
+
+size_t DistMatmulComm::reduce(const at::Tensor& buf, int root) {
+  assert(buf.is_contiguous());
+
+  if (cuda_) {
+    return postNCCL(buf, [this, &buf, root]() {
+      NCCLWrapper::get().reduce(tag_, {buf}, {root});
+    });
+  }
+
+  // in-place, as NCCLWrapper::reduce does
+  void* send_ptr = local_rank_ == root ? MPI_IN_PLACE : buf.data_ptr();
+  MPI_Request req;
+  mpi::checkMPIResult(MPI_Ireduce(
+      send_ptr, buf.data_ptr(), buf.numel(),
+      scalarTypeToMPIDatatype(buf.scalar_type()), MPI_SUM, root, mpi_comm_,
+      &req));
+  return addRequest(req);
+}
+
+void DistMatmulComm::wait(size_t handle) {
+  if (cuda_) {
+    events_.at(handle)->block(c10::cuda::getCurrentCUDAStream());
+    return;
+  }
+
+  auto& req = requests_.at(handle);
+  if (req != MPI_REQUEST_NULL) {
+    mpi::checkMPIResult(MPI_Wait(&req, MPI_STATUS_IGNORE));
   }
+}
 
-  return out_buf_;
+void DistMatmulComm::waitAll() {
+  size_t num = cuda_ ? events_.size() : requests_.size();
+  for (size_t i = 0; i < num; i++) {
+    wait(i);
+  }
+  if (cuda_) {
+    // The current stream waits for the collectives. This also checks errors
+    // of the communicators.
+    NCCLWrapper::get().syncWithErrorCheck();
+  }
+}
+
+at::Tensor DistMatmul::run(
+    const at::Tensor& x, const at::Tensor& y,
+    const std::unordered_set<int>& ranks) {
+  TraceEvent evt(getFuncKey("DistMatmul", "run", "no_id", 0, false));
+
+  /*
+   * x is partitioned along the last dim and y is partitioned along 0-th dim.
+   * This is the ring version of runRRR_AG.
+   */
+  return run_AG(x, y, ranks, false);
 }
 
 at::Tensor DistMatmul::run_AG(
@@ -99,55 +187,68 @@ at::Tensor DistMatmul::run_AG(
     const std::unordered_set<int>& ranks, bool part_y_column) {
   torch::NoGradGuard no_grad;
 
-  NCCLWrapper& nccl = NCCLWrapper::get();
-  TagMap& tag_map = TagMap::get();
-  int tag = tag_map.getRankSetTag(ranks);
-  nccl.createCommunicator(tag, ranks);
-
-  /*
-   * We assume both x and y are partitioned along 0-th dim
-   */
   int np = ranks.size();
   int my_rank = mpi::getRank();
   assert(contains(ranks, my_rank));
+  int local_rank = getLocalRank(ranks, my_rank);
 
   std::vector<int64_t> x_dim = getTensorDim(x);
   assert(x_dim.size() > 1);
   std::vector<int64_t> y_dim = getTensorDim(y);
   assert(y_dim.size() == 2);
 
+  TraceEvent evt(getFuncKey(
+      "DistMatmul", "run_AG", part_y_column ? "part_y=true" : "part_y=false",
+      0, false));
+
+  DistMatmulComm comm(ranks, x.is_cuda());
+
+  // Shards of y are broadcast from each rank in turn. The shard for step i+1
+  // is transferred while the matmul of step i runs.
+  const auto y_shard = part_y_column ? y.t().contiguous() : y.contiguous();
+  std::vector<at::Tensor> bufs = {
+      torch::empty_like(y_shard), torch::empty_like(y_shard)};
+  const auto post_bcast = [&](int i) {
+    auto& buf = bufs.at(i % 2);
+    if (i == local_rank) {
+      buf.copy_(y_shard);
+    }
+    return comm.bcast(buf, i);
+  };
+
+  int64_t split_dim = x_dim.size() - 1;
+  std::vector<int64_t> out_dim = x_dim;
+  int64_t step;
   at::Tensor ret;
   if (part_y_column) {
-    TraceEvent evt(getFuncKey("DistMatmul", "run_AG", "part_y=true", 0, false));
-
-    std::vector<int64_t> gathered_y_buf_dim = {y_dim.at(1) * np, y_dim.at(0)};
-    at::Tensor gathered_y = torch::zeros(
-        gathered_y_buf_dim, makeTensorOptions(x.dtype().toScalarType(), false));
-    {
-      TraceEvent evt_allgather(
-          getFuncKey("DistMatmul", "run_AG", "allgather", 0, false));
-      nccl.allgather(tag, {y.t().contiguous()}, {gathered_y});
-    }
-    {
-      TraceEvent evt_matmul(
-          getFuncKey("DistMatmul", "run_AG", "matmul", 0, false));
-      ret = torch::matmul(x, gathered_y.t()).contiguous();
-    }
+    // y: [m, n/np] -> out: [..., n]
+    step = y_dim.at(1);
+    out_dim[split_dim] = step * np;
+    ret = torch::empty(out_dim, x.options().requires_grad(false));
   } else {
-    TraceEvent evt(
-        getFuncKey("DistMatmul", "run_AG", "part_y=false", 0, false));
-
-    std::vector<int64_t> gathered_y_dim = {y_dim.at(0) * np, y_dim.at(1)};
-    at::Tensor gathered_y = torch::zeros(
-        gathered_y_dim, makeTensorOptions(x.dtype().toScalarType(), false));
-    {
-      TraceEvent evt_allgather(
-          getFuncKey("DistMatmul", "run_AG", "allgather", 0, false));
-      nccl.allgather(tag, {y}, {gathered_y});
+    // y: [k/np, n] -> out: [..., n]
+    step = y_dim.at(0);
+    out_dim[split_dim] = y_dim.at(1);
+    ret = torch::zeros(out_dim, x.options().requires_grad(false));
+  }
+
+  size_t handle = post_bcast(0);
+  for (int i = 0; i < np; i++) {
+    size_t next_handle = i + 1 < np ? post_bcast(i + 1) : 0;
+    comm.wait(handle);
+
+    TraceEvent evt_matmul(
+        getFuncKey("DistMatmul", "run_AG", "matmul", i, false));
+    const auto& buf = bufs.at(i % 2);
+    if (part_y_column) {
+      ret.narrow(split_dim, step * i, step).copy_(torch::matmul(x, buf.t()));
+    } else {
+      ret.add_(torch::matmul(x.narrow(split_dim, step * i, step), buf));
     }
-    { ret = torch::matmul(x, gathered_y); }
-    nccl.syncWithErrorCheck();
+    handle = next_handle;
   }
+  comm.waitAll();
+
   return ret;
 }
 
@@ -168,13 +269,9 @@ at::Tensor DistMatmul::runCRC(
     const std::unordered_set<int>& ranks) {
   torch::NoGradGuard no_grad;
 
-  NCCLWrapper& nccl = NCCLWrapper::get();
-  TagMap& tag_map = TagMap::get();
-  int tag = tag_map.getRankSetTag(ranks);
-  nccl.createCommunicator(tag, ranks);
-
   /*
-   * We assume both x and y are partitioned along 0-th dim
+   * y is partitioned along 1st dim of the output. i-th slice of the output
+   * is reduced to i-th rank.
    */
   int np = ranks.size();
   int my_rank = mpi::getRank();
@@ -187,30 +284,21 @@ at::Tensor DistMatmul::runCRC(
 
   TraceEvent evt(getFuncKey("DistMatmul", "runCRC", "part_y=true", 0, false));
 
-  at::Tensor z;
-  {
-    TraceEvent evt(getFuncKey("DistMatmul", "runCRC", "matmul", 0, false));
-    z = torch::matmul(x, y);
-  }
-
-  at::Tensor out_buf = torch::zeros(
-      {x_dim.at(0), y_dim.at(1) / np},
-      makeTensorOptions(x.dtype().toScalarType(), true));
+  DistMatmulComm comm(ranks, x.is_cuda());
 
+  // The reduction of a slice overlaps with the matmul for the next slice
   int64_t step = y_dim.at(1) / np;
+  std::vector<at::Tensor> z_slices;
   for (int i = 0; i < np; i++) {
-    const auto z_slice = z.slice(1, step * i, step * (i + 1)).contiguous();
-    {
-      TraceEvent evt(getFuncKey("DistMatmul", "runCRC", "reduce", i, false));
-      nccl.reduce(tag, {z_slice}, {i});
-    }
-    if (getLocalRank(ranks, mpi::getRank()) == i) {
-      out_buf.copy_(z_slice);
-    }
+    TraceEvent evt_matmul(
+        getFuncKey("DistMatmul", "runCRC", "matmul", i, false));
+    z_slices.push_back(
+        torch::matmul(x, y.narrow(1, step * i, step)).contiguous());
+    comm.reduce(z_slices.back(), i);
   }
+  comm.waitAll();
 
-  nccl.syncWithErrorCheck();
-  return out_buf;
+  return z_slices.at(getLocalRank(ranks, my_rank));
 }
 
 torch::Tensor DistLinearFunction::forward(
@@ -303,6 +391,138 @@ torch::autograd::tensor_list DistLinearFunction::backward(
   return {d_input, d_weight, d_bias, at::Tensor()};
 }
 
+torch::Tensor EmbeddingDistFunction::forward(
+    torch::autograd::AutogradContext* ctx, torch::Tensor weight,
+    torch::Tensor indices, int64_t padding_idx, bool scale_grad_by_freq,
+    bool sparse, std::vector<int64_t> dist_ranks) {
+  TraceEvent evt(
+      getFuncKey("EmbeddingDistFunction", "forward", "no_id", 0, false));
+
+  NCCLWrapper& nccl = NCCLWrapper::get();
+  const auto ranks = toRankSet(dist_ranks);
+  int tag = TagMap::get().getRankSetTag(ranks);
+  nccl.createCommunicator(tag, ranks);
+
+  int64_t np = ranks.size();
+  int64_t local_rank = getLocalRank(ranks, mpi::getRank());
+  int64_t shard_size = weight.size(0);
+  int64_t emb_dim = weight.size(1);
+  const auto idx_options =
+      makeTensorOptions(at::ScalarType::Long, weight.device(), false);
+  const auto options =
+      makeTensorOptions(weight.dtype().toScalarType(), weight.device(), false);
+
+  const auto flat_indices =
+      indices.reshape({-1}).to(idx_options).contiguous();
+  int64_t idx_num = flat_indices.numel();
+
+  // The indices are padded to the largest number across ranks so that the
+  // results can be scattered. The padding index (the vocabulary size) is held
+  // by no rank.
+  at::Tensor idx_nums = torch::zeros({np}, idx_options);
+  nccl.allgather(tag, {torch::full({1}, idx_num, idx_options)}, {idx_nums});
+  nccl.syncWithErrorCheck();
+  int64_t max_idx_num = idx_nums.max().item<int64_t>();
+  const auto padded_indices = torch::cat(
+      {flat_indices,
+       torch::full({max_idx_num - idx_num}, np * shard_size, idx_options)});
+
+  ctx->saved_data["idx_num"] = idx_num;
+  ctx->saved_data["max_idx_num"] = max_idx_num;
+  ctx->saved_data["padding_idx"] = padding_idx;
+  ctx->saved_data["scale_grad_by_freq"] = scale_grad_by_freq;
+  ctx->saved_data["shard_size"] = shard_size;
+  ctx->saved_data["ranks"] = dist_ranks;
+
+  logger->trace(
+      "weight.size={} indices.size={} max_idx_num={} dist_ranks={}",
+      join_as_str(getTensorDim(weight)), join_as_str(getTensorDim(indices)),
+      max_idx_num, join_as_str(dist_ranks));
+
+  std::vector<int64_t> out_dim = getTensorDim(indices);
+  out_dim.push_back(emb_dim);
+
+  at::Tensor all_indices = torch::zeros({np, max_idx_num}, idx_options);
+  nccl.allgather(tag, {padded_indices}, {all_indices});
+  ctx->saved_data["all_indices"] = all_indices;
+
+  // Rows held by other ranks are looked up as zeros
+  const auto local_indices = all_indices - shard_size * local_rank;
+  const auto mask =
+      local_indices.ge(0).logical_and(local_indices.lt(shard_size));
+  at::Tensor partial = torch::embedding(
+      weight, local_indices.masked_fill(mask.logical_not(), 0));
+  partial.masked_fill_(mask.logical_not().unsqueeze(-1), 0);
+
+  at::Tensor out = torch::zeros({max_idx_num, emb_dim}, options);
+  nccl.reduceScatter(tag, {partial.contiguous()}, {out});
+  nccl.syncWithErrorCheck();
+
+  return out.narrow(0, 0, idx_num).reshape(out_dim);
+}
+
+torch::autograd::tensor_list EmbeddingDistFunction::backward(
+    torch::autograd::AutogradContext* ctx,
+    torch::autograd::tensor_list grad_outputs) {
+  TraceEvent evt(
+      getFuncKey("EmbeddingDistFunction", "backward", "no_id", 0, false));
+
+  assert(grad_outputs.size() == 1);
+
+  NCCLWrapper& nccl = NCCLWrapper::get();
+  const auto ranks = toRankSet(ctx->saved_data["ranks"].toIntVector());
+  int tag = TagMap::get().getRankSetTag(ranks);
+  nccl.createCommunicator(tag, ranks);
+
+  int64_t np = ranks.size();
+  int64_t local_rank = getLocalRank(ranks, mpi::getRank());
+  int64_t shard_size = ctx->saved_data["shard_size"].toInt();
+  int64_t padding_idx = ctx->saved_data["padding_idx"].toInt();
+  bool scale_grad_by_freq = ctx->saved_data["scale_grad_by_freq"].toBool();
+  int64_t idx_num = ctx->saved_data["idx_num"].toInt();
+  int64_t max_idx_num = ctx->saved_data["max_idx_num"].toInt();
+  const auto all_indices =
+      ctx->saved_data["all_indices"].toTensor().reshape({-1});
+
+  // Gradients are always dense
+  auto og = grad_outputs.at(0);
+  int64_t emb_dim = og.size(-1);
+  const auto options =
+      makeTensorOptions(og.dtype().toScalarType(), og.device(), false);
+  at::Tensor padded_og = torch::zeros({max_idx_num, emb_dim}, options);
+  padded_og.narrow(0, 0, idx_num).copy_(og.reshape({-1, emb_dim}));
+
+  at::Tensor all_og = torch::zeros({np * max_idx_num, emb_dim}, options);
+  nccl.allgather(tag, {padded_og}, {all_og});
+  nccl.syncWithErrorCheck();
+
+  if (scale_grad_by_freq) {
+    // Frequencies are counted in the batch of each rank. The padding index
+    // is counted separately from any row.
+    const auto src = torch::arange(np, all_indices.options())
+                         .repeat_interleave(max_idx_num);
+    const auto keys = src * (np * shard_size + 1) + all_indices;
+    const auto uniq = at::_unique2(keys, false, true, true);
+    const auto counts =
+        std::get<2>(uniq).index_select(0, std::get<1>(uniq).reshape({-1}));
+    all_og = all_og / counts.unsqueeze(-1).to(all_og.dtype());
+  }
+
+  const auto local_indices = all_indices - shard_size * local_rank;
+  auto mask = local_indices.ge(0).logical_and(local_indices.lt(shard_size));
+  if (padding_idx >= 0) {
+    mask = mask.logical_and(all_indices.ne(padding_idx));
+  }
+  const auto sel = mask.nonzero().reshape({-1});
+
+  at::Tensor d_weight = torch::zeros({shard_size, emb_dim}, options);
+  d_weight.index_add_(
+      0, local_indices.index_select(0, sel), all_og.index_select(0, sel));
+
+  return {d_weight,    at::Tensor(), at::Tensor(),
+          at::Tensor(), at::Tensor(), at::Tensor()};
+}
+
 torch::Tensor GatherFunction::forward(
     torch::autograd::AutogradContext* ctx, torch::Tensor input, int64_t dim_idx,
     std::vector<int64_t> dist_ranks) {
@@ -328,7 +548,8 @@ torch::Tensor GatherFunction::forward(
     gathered_dim.push_back(d);
   }
   at::Tensor gathered_y = torch::zeros(
-      gathered_dim, makeTensorOptions(input.dtype().toScalarType(), true));
+      gathered_dim,
+      makeTensorOptions(input.dtype().toScalarType(), input.device(), true));
 
   nccl.allgather(tag, {input.contiguous()}, {gathered_y});
 
@@ -359,22 +580,12 @@ torch::autograd::tensor_list GatherFunction::backward(
   nccl.createCommunicator(tag, rank_set);
 
   const auto& out_grad = grad_outputs.at(0);
-
-  std::vector<int64_t> split_dim = getTensorDim(out_grad);
   int64_t dim_idx = ctx->saved_data["dim_idx"].toInt();
-  split_dim[dim_idx] /= rank_set.size();
 
-  at::Tensor scattered_y = torch::zeros(
-      split_dim, makeTensorOptions(out_grad.dtype().toScalarType(), true));
-
-  auto split_out_grad = out_grad.split(split_dim.at(dim_idx), dim_idx);
-  for (size_t i = 0; i < split_out_grad.size(); i++) {
-    split_out_grad[i] = split_out_grad[i].contiguous();
-  }
-  for (int r : rank_set) {
-    nccl.reduce(tag, {split_out_grad[r]}, {r});
-  }
-  return {split_out_grad[mpi::getRank()], at::Tensor(), at::Tensor()};
+  // Slices are indexed by local ranks
+  return {
+      reduceSlices(tag, out_grad, dim_idx, rank_set), at::Tensor(),
+      at::Tensor()};
 }
 
 } // namespace rannc
@@ -5,12 +5,54 @@
 #ifndef TPTESTS_DISTMATMUL_H
 #define TPTESTS_DISTMATMUL_H
 
+#include <mpi.h>
+
+#include <ATen/cuda/CUDAEvent.h>
+#include <c10/cuda/CUDAStream.h>
 #include <comp/TimeCounter.h>
 #include <torch/torch.h>
 #include <torch/TorchUtil.h>
 
 namespace rannc {
 
+/**
+ * Posts collectives of *DistMatmul* asynchronously so that they overlap with
+ * local matmuls. Collectives on CUDA tensors run with NCCL on a side stream,
+ * and those on CPU tensors run as nonblocking MPI collectives. Roots are
+ * indices in the sorted ranks.
+ */
+class DistMatmulComm {
+ public:
+  DistMatmulComm(const std::unordered_set<int>& ranks, bool cuda);
+  ~DistMatmulComm();
+
+  // These return a handle to wait for the collective
+  size_t bcast(const at::Tensor& buf, int root);
+  size_t reduce(const at::Tensor& buf, int root);
+
+  // Makes the current stream (NCCL) or the caller (MPI) wait
+  void wait(size_t handle);
+  void waitAll();
+
+ private:
+  size_t postNCCL(const at::Tensor& buf, const std::function<void()>& f);
+  size_t addRequest(MPI_Request req);
+
+  bool cuda_;
+  int tag_;
+  int local_rank_;
+  MPI_Comm mpi_comm_ = MPI_COMM_NULL;
+  std::vector<MPI_Request> requests_;
+  c10::optional<c10::cuda::CUDAStream> stream_;
+  std::vector<std::shared_ptr<at::cuda::CUDAEvent>> events_;
+};
+
+/**
+ * Matmuls whose operands are partitioned across ranks. The shards are
+ * transferred in a ring of broadcasts (or reduced one by one) and the
+ * transfer for the next step overlaps with the local matmul of the current
+ * step.
+ */
 class DistMatmul {
  public:
   at::Tensor run(
@@ -30,8 +72,6 @@ class DistMatmul {
   at::Tensor run_AG(
       const at::Tensor& x, const at::Tensor& y,
       const std::unordered_set<int>& ranks, bool part_y_column);
-
-  at::Tensor out_buf_;
 };
 
 class DistLinearFunction
@@ -50,6 +90,29 @@ class DistLinearFunction
   static const std::shared_ptr<spdlog::logger> logger;
 };
 
+/**
+ * Vocab-parallel embedding. Each rank holds rows of the embedding table
+ * partitioned along the vocabulary. Indices of all ranks are gathered, each
+ * rank looks up the rows it holds, and the results are reduced to the ranks
+ * that own the indices. Indices are padded to the largest number across ranks
+ * with an index that no rank holds, so that the table is never gathered.
+ */
+class EmbeddingDistFunction
+    : public torch::autograd::Function<EmbeddingDistFunction> {
+ public:
+  static torch::Tensor forward(
+      torch::autograd::AutogradContext* ctx, torch::Tensor weight,
+      torch::Tensor indices, int64_t padding_idx, bool scale_grad_by_freq,
+      bool sparse, std::vector<int64_t> dist_ranks);
+
+  static torch::autograd::tensor_list backward(
+      torch::autograd::AutogradContext* ctx,
+      torch::autograd::tensor_list grad_outputs);
+
+ private:
+  static const std::shared_ptr<spdlog::logger> logger;
+};
+
 class GatherFunction : public torch::autograd::Function<GatherFunction> {
  public:
   static torch::Tensor forward(
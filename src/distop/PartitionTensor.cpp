@@ -6,8 +6,45 @@
 #include <torch/TorchUtil.h>
 
 namespace rannc {
+
+namespace {
+bool isTensorArg(
+    const IRNode& node, size_t arg_idx,
+    const std::unordered_map<std::string, IRValue>& values) {
+  const std::vector<std::string>& in_names = node.getInputNames();
+  if (arg_idx >= in_names.size() || !contains(values, in_names.at(arg_idx))) {
+    return false;
+  }
+  const auto& ir_type = values.at(in_names.at(arg_idx)).getType();
+  return ir_type.getBaseType() == IRBaseType::TENSOR;
+}
+
+size_t getArgDimNum(
+    const IRNode& node, size_t arg_idx,
+    const std::unordered_map<std::string, IRValue>& values) {
+  const auto& in_name = node.getInputNames().at(arg_idx);
+  return values.at(in_name).getType().getTensorDim().size();
+}
+
+// matmul(input, weight) with a 2-dim weight is computed in the same way as
+// linear
+bool isLinearMatmul(
+    const IRNode& node,
+    const std::unordered_map<std::string, IRValue>& values) {
+  return isTensorArg(node, 0, values) && isTensorArg(node, 1, values) &&
+      getArgDimNum(node, 0, values) >= 2 && getArgDimNum(node, 1, values) == 2;
+}
+} // namespace
+
 std::vector<DistOp> dist_ops = {
-    {"aten::linear", "rannc::linear_dist", {{1, 1}}}};
+    {"aten::linear", "rannc::linear_dist", {{1, 1}}},
+    {"aten::matmul", "rannc::matmul_dist", {{1, 0}}, isLinearMatmul},
+    // vocab-parallel
+    {"aten::embedding", "rannc::embedding_dist", {{0, 0}}}};
+
+const std::vector<DistOp>& getDistOps() {
+  return dist_ops;
+}
 
 std::unordered_map<std::string, std::string> getDistOpNameMap() {
   std::unordered_map<std::string, std::string> name_map;
@@ -17,6 +54,27 @@ std::unordered_map<std::string, std::string> getDistOpNameMap() {
   return name_map;
 }
 
+std::vector<std::pair<size_t, size_t>> getPartitionDims(
+    const IRNode& node, const DistOp& dist_op,
+    const std::unordered_map<std::string, IRValue>& values) {
+  std::vector<std::pair<size_t, size_t>> part_dims;
+  for (const auto& part_dim : dist_op.partition_dim) {
+    if (isTensorArg(node, part_dim.first, values)) {
+      part_dims.push_back(part_dim);
+    }
+  }
+  return part_dims;
+}
+
+bool isApplicable(
+    const IRNode& node, const DistOp& dist_op,
+    const std::unordered_map<std::string, IRValue>& values) {
+  if (dist_op.applicable && !dist_op.applicable(node, values)) {
+    return false;
+  }
+  return !getPartitionDims(node, dist_op, values).empty();
+}
+
 ParamPartitionMap getDistParams(const std::shared_ptr<IRGraph>& g) {
   std::unordered_map<std::string, DistOp> dist_op_map;
   for (const auto& op : dist_ops) {
@@ -40,14 +98,19 @@ ParamPartitionMap getDistParams(const std::shared_ptr<IRGraph>& g) {
 
   ParamPartitionMap ret;
 
+  const auto& values = g->getValues();
   for (const auto& node : g->getNodes()) {
     if (contains(dist_op_map, node.getName())) {
       const auto& dist_op = dist_op_map.at(node.getName());
-      for (const auto& part_dims : dist_op.partition_dim) {
+      if (!isApplicable(node, dist_op, values)) {
+        continue;
+      }
+      for (const auto& part_dims : getPartitionDims(node, dist_op, values)) {
         assert(part_dims.first < node.getInputNames().size());
         const auto& param_name = node.getInputNames().at(part_dims.first);
-        if (!contains(shared_params, param_name)) {
-          ret[node.getInputNames().at(part_dims.first)] = part_dims;
+        if (g->getValue(param_name).isParam() &&
+            !contains(shared_params, param_name)) {
+          ret[param_name] = part_dims;
         }
       }
     }
@@ -60,7 +123,7 @@ bool isInputDivisible(
     const IRNode& node, const DistOp& dist_op,
     const std::unordered_map<std::string, IRValue>& values, size_t div_num) {
   const std::vector<std::string>& in_names = node.getInputNames();
-  for (const auto& part_dim : dist_op.partition_dim) {
+  for (const auto& part_dim : getPartitionDims(node, dist_op, values)) {
     size_t arg_idx = part_dim.first;
     assert(arg_idx < in_names.size());
     const auto& in_name = in_names.at(arg_idx);
@@ -72,7 +135,9 @@ bool isInputDivisible(
     const auto& dim = ir_type.getTensorDim();
 
     size_t dim_idx = part_dim.second;
-    assert(dim_idx < dim.size());
+    if (dim_idx >= dim.size()) {
+      return false;
+    }
 
     if (dim.at(dim_idx) % div_num != 0) {
       return false;
@@ -83,14 +148,17 @@ bool isInputDivisible(
 
 bool inputParamSlicable(
     const IRNode& node, const DistOp& dist_op,
+    const std::unordered_map<std::string, IRValue>& values,
     const ParamPartitionMap& global_param_part) {
   const std::vector<std::string>& in_names = node.getInputNames();
-  for (const auto& part_dim : dist_op.partition_dim) {
+  for (const auto& part_dim : getPartitionDims(node, dist_op, values)) {
     size_t arg_idx = part_dim.first;
     assert(arg_idx < in_names.size());
     const auto& in_name = in_names.at(arg_idx);
 
-    if (!contains(global_param_part, in_name)) {
+    // The param must be partitioned as the op expects
+    if (!contains(global_param_part, in_name) ||
+        global_param_part.at(in_name) != part_dim) {
       return false;
     }
   }
@@ -105,10 +173,10 @@ bool isDistOpAvailable(
   if (!contains(dist_op_map, node.getName())) {
     return false;
   }
-  return isInputDivisible(
-             node, dist_op_map.at(node.getName()), values, div_num) &&
-      inputParamSlicable(
-             node, dist_op_map.at(node.getName()), global_param_part);
+  const auto& dist_op = dist_op_map.at(node.getName());
+  return isApplicable(node, dist_op, values) &&
+      isInputDivisible(node, dist_op, values, div_num) &&
+      inputParamSlicable(node, dist_op, values, global_param_part);
 }
 
 std::pair<std::string, std::vector<std::string>> addRankList(
@@ -159,6 +227,13 @@ TensorPartitioningGraphInfo insertGather(
     new_values[in_name] = vals.at(in_name);
   }
 
+  std::unordered_set<std::string> dist_names;
+  for (const auto& op : dist_ops) {
+    if (!op.dist_name.empty()) {
+      dist_names.insert(op.dist_name);
+    }
+  }
+
   // find target param
   int ex_rank_arg_idx = 0;
   int ex_rank_list_arg_idx = 0;
@@ -168,7 +243,7 @@ TensorPartitioningGraphInfo insertGather(
     for (const auto& in_name : node.getInputNames()) {
       // if this node uses the sliced param
       if (contains(global_param_part, in_name) &&
-          node.getName() != "rannc::linear_dist") { // op does not support
+          !contains(dist_names, node.getName())) { // op does not support
         const auto& param_part = global_param_part.at(in_name);
         const auto rank_list_info = addRankList(
             new_nodes, new_values, part_info.rank_values, ex_rank_arg_idx,
@@ -180,7 +255,8 @@ TensorPartitioningGraphInfo insertGather(
 
         // dim
         std::stringstream ss_dim_arg_name;
-        ss_dim_arg_name << "_slice_dim_" << ex_dim_arg_idx;
+        ss_dim_arg_name << "_" << node.getId() << "_slice_dim_"
+                        << ex_dim_arg_idx;
         const std::string dim_arg_name = ss_dim_arg_name.str();
         part_info.dim_values[dim_arg_name] = param_part.second;
         ex_dim_arg_idx++;
@@ -250,9 +326,21 @@ TensorPartitioningGraphInfo replaceWithDistOp(
   int ex_rank_arg_idx = 0;
   int ex_rank_list_arg_idx = 0;
   ParamPartitionMap param_part;
+  bool gather_params = false;
   for (const auto& n : g->getNodes()) {
-    if (isDistOpAvailable(
-            n, dist_op_map, vals, ranks.size(), global_param_part)) {
+    bool available = isDistOpAvailable(
+        n, dist_op_map, vals, ranks.size(), global_param_part);
+    if (available) {
+      const auto& dist_op = dist_op_map.at(n.getName());
+      for (const auto& part_dim : getPartitionDims(n, dist_op, vals)) {
+        const auto arg_idx = part_dim.first;
+        const auto& param_name = n.getInputNames().at(arg_idx);
+        assert(contains(global_param_part, param_name));
+        param_part[param_name] = global_param_part.at(param_name);
+      }
+    }
+
+    if (available) {
       const auto rank_list_info = addRankList(
           new_nodes, new_values, dist_ranks, ex_rank_arg_idx,
           ex_rank_list_arg_idx, n.getId(), "ex_rank", ranks);
@@ -260,17 +348,6 @@ TensorPartitioningGraphInfo replaceWithDistOp(
       const std::vector<std::string>& ranks_val_node_names =
           rank_list_info.second;
 
-      for (const auto& dist_info : dist_ops) {
-        if (dist_info.original_name == n.getName()) {
-          for (const auto& part_dim : dist_info.partition_dim) {
-            const auto dim_idx = part_dim.first;
-            const auto& param_name = n.getInputNames().at(dim_idx);
-            assert(contains(global_param_part, param_name));
-            param_part[param_name] = global_param_part.at(param_name);
-          }
-        }
-      }
-
       std::vector<std::string> input_names = n.getInputNames();
       input_names.push_back(int_list_val_name);
 
@@ -292,8 +369,26 @@ TensorPartitioningGraphInfo replaceWithDistOp(
       g->getName(), new_nodes, new_values, g->getInputNames(),
       g->getOutputNames());
 
+  // Other params (e.g. those of ops without a distributed version) are
+  // partitioned as well and gathered before use
+  for (const auto& in_name : g->getInputNames()) {
+    if (!contains(global_param_part, in_name) ||
+        contains(param_part, in_name)) {
+      continue;
+    }
+    const auto& dim = vals.at(in_name).getType().getTensorDim();
+    size_t dim_idx = global_param_part.at(in_name).second;
+    if (dim_idx < dim.size() && dim.at(dim_idx) % ranks.size() == 0) {
+      param_part[in_name] = global_param_part.at(in_name);
+      gather_params = true;
+    }
+  }
+
   auto part_info = TensorPartitioningGraphInfo{
       ret_graph, ranks, param_part, dist_ranks, {}, rank_value_names};
+  if (gather_params) {
+    return insertGather(part_info, param_part);
+  }
   return part_info;
 }
 
@@ -9,14 +9,37 @@
 
 namespace rannc {
 
+/**
+ * An entry of the catalog of operators computed with partitioned params by
+ * their distributed versions (*dist_name*).
+ *
+ * Params of other operators are partitioned only by the search of
+ * *cpg_search* and gathered by *rannc::gather* before the operator runs.
+ * The catalog does not cover:
+ * - bmm and conv2d: both args are activations for bmm, and a conv2d split
+ *   along output channels needs the input gradients to be reduced across the
+ *   ranks, for which no operator exists yet.
+ * - layer_norm: its params are too small to be worth partitioning, and
+ *   splitting the normalized dims needs distributed statistics.
+ * - softmax: it has no params.
+ * - attention: it is a composition of matmul, softmax and linear, whose
+ *   linear projections are already covered.
+ */
 struct DistOp {
   std::string original_name;
   std::string dist_name;
 
   // (arg index, partitioning dim)
+  // Args that are not tensors (e.g. a bias given as None) are skipped.
   std::vector<std::pair<size_t, size_t>> partition_dim;
+
+  // Additional condition for the node (e.g. ranks of args). Can be empty.
+  std::function<bool(
+      const IRNode&, const std::unordered_map<std::string, IRValue>&)>
+      applicable;
 };
 
+const std::vector<DistOp>& getDistOps();
 std::unordered_map<std::string, std::string> getDistOpNameMap();
 
 // param name -> (arg index, dim index)
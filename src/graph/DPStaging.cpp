@@ -3,6 +3,8 @@
 //
 
 #include "DPStaging.h"
+#include <cpg/CPG.h>
+#include <graph/PlanStore.h>
 #include <cuda/CudaUtil.h>
 
 #include <distop/PartitionTensor.h>
@@ -17,6 +19,41 @@ int isPowerOfTwo(size_t x) {
 } // namespace
 namespace rannc {
 
+void scaleBySpeed(GraphProfile& prof, double speed) {
+  if (speed > 0 && speed != 1.0) {
+    prof.fwd_time = prof.fwd_time / speed;
+    prof.bwd_time = prof.bwd_time / speed;
+  }
+}
+
+DeviceCapability getStageCapability(
+    const PartitioningConf& conf, size_t dev_begin, size_t dev_end,
+    size_t dev_num_per_group, int replica_num) {
+  DeviceCapability stage_cap{conf.dev_mem, 1.0};
+  if (conf.dev_caps.size() != conf.dev_num) {
+    return stage_cap;
+  }
+
+  const double base_speed = conf.dev_caps.front().speed;
+  bool first = true;
+  for (int k = 0; k < replica_num; k++) {
+    for (size_t i = dev_begin; i < dev_end; i++) {
+      const auto& cap = conf.dev_caps.at(k * dev_num_per_group + i);
+      // Memory is unknown on CPU workers
+      size_t mem = cap.mem > 0 ? cap.mem : conf.dev_mem;
+      double speed = base_speed > 0 ? cap.speed / base_speed : 1.0;
+      if (first) {
+        stage_cap = {mem, speed};
+        first = false;
+      } else {
+        stage_cap.mem = std::min(stage_cap.mem, mem);
+        stage_cap.speed = std::min(stage_cap.speed, speed);
+      }
+    }
+  }
+  return stage_cap;
+}
+
 std::string getMergedGraphId(size_t from, size_t to) {
   std::stringstream ss;
   ss << "MERGE_" << from << "_" << to;
@@ -154,6 +191,20 @@ size_t estimateOutputSize(const std::vector<std::shared_ptr<IRGraph>>& graphs) {
       [](const std::shared_ptr<IRGraph>& g) { return g->getInputNames(); });
 }
 
+size_t calcPartitionedGradCommSize(
+    const TensorPartitioningGraphInfo& part_info, bool compress) {
+  if (!part_info.valid()) {
+    return 0;
+  }
+
+  size_t size_sum = 0;
+  for (const auto& it : part_info.param_partitions) {
+    size_sum +=
+        calcGradCommSize(part_info.graph->getValue(it.first), compress);
+  }
+  return size_sum;
+}
+
 GraphProfile DPStaging::estimateProf(const ProfilingInput& prof_in) {
   return accProfileValues(prof_util_, prof_in);
 }
@@ -267,8 +318,17 @@ long DPStaging::estimateTime(const AllocSolution& sol, const MLGraph& graph) {
   }
 
   long max_ar_time = 0;
-  for (const auto& sg : sol.graphs) {
-    long ar_time = calcAllReduceTime(sg->getParamSizeInByte());
+  size_t dev_num_per_group = sol.dev_nums.back();
+  for (size_t g_idx = 0; g_idx < sol.graphs.size(); g_idx++) {
+    const auto& sg = sol.graphs.at(g_idx);
+    assert(contains(sol.part_info, sg->getName()));
+    bool compress = compressGrads(
+        sol.dev_nums.at(g_idx), sol.dev_nums.at(g_idx + 1), dev_num_per_group,
+        conf_.dev_num / dev_num_per_group);
+    long ar_time = calcAllReduceTime(
+        calcGradCommSize(sg, compress) -
+        calcPartitionedGradCommSize(
+            sol.part_info.at(sg->getName()), compress));
     max_ar_time = std::max(max_ar_time, ar_time);
   }
 
@@ -289,7 +349,14 @@ GraphProfile DPStaging::estimateSolutionGraph(
       sol.pipeline_num > 1,
       sol.part_info.at(sg->getName()),
       conf_};
-  return prof_util_.profile(in);
+  GraphProfile prof = prof_util_.profile(in);
+
+  size_t dev_num_per_group = sol.dev_nums.back();
+  const auto cap = getStageCapability(
+      conf_, sol.dev_nums.at(g_idx), sol.dev_nums.at(g_idx + 1),
+      dev_num_per_group, conf_.dev_num / dev_num_per_group);
+  scaleBySpeed(prof, cap.speed);
+  return prof;
 }
 
 AllocSolution DPStaging::runDpComm(const MLGraph& graph) {
@@ -392,15 +459,21 @@ AllocSolution DPStaging::runDpComm(const MLGraph& graph) {
     }
   }
 
-  if (!dump_dp_cache_.empty()) {
+  if (!dump_dp_cache_.empty() || !plan_store_dir_.empty()) {
     DPStagingCache cache;
     cache.graph = graph;
     cache.ml_profile_cache = prof_util_.getProfileCache();
     cache.conf = conf_;
     cache.ir_graph = ir_graph_;
 
-    logger->info("Saving DP cache to {}", dump_dp_cache_);
-    saveToFile(dump_dp_cache_, cache);
+    if (!dump_dp_cache_.empty()) {
+      logger->info("Saving DP cache to {}", dump_dp_cache_);
+      saveToFile(dump_dp_cache_, cache);
+    }
+    if (!plan_store_dir_.empty()) {
+      PlanStore store(plan_store_dir_);
+      store.saveDPCache(conf_.model_fp, cache);
+    }
   }
 
   if (pl_sols.empty()) {
@@ -471,6 +544,8 @@ struct DPState {
   long max_allreduce;
   size_t pre_boundary;
   size_t pre_dev_num;
+  bool dist_params = false;
+  long mem = 0;
   std::shared_ptr<IRGraph> step_graph;
 };
 
@@ -487,7 +562,6 @@ AllocSolution DPStaging::doRunDpComm(
     int replica_num, int pipeline_num, bool checkpointing) {
   GraphMergeHelper merge_helper(graph);
 
-  const ParamPartitionMap global_param_part = getDistParams(ir_graph_);
   const std::vector<MLNode>& nodes = graph.nodes;
   size_t layer_num = nodes.size();
   const int min_pipeline_bs =
@@ -496,6 +570,15 @@ AllocSolution DPStaging::doRunDpComm(
       config::Config::get().getVal<bool>(config::LIMIT_DEV_NUM_POT);
   const bool limit_dev_num_more_than_bs =
       config::Config::get().getVal<bool>(config::LIMIT_DEV_NUM_MORE_THAN_BS);
+  const bool profile_by_acc =
+      config::Config::get().getVal<bool>(config::PROFILE_BY_ACC);
+
+  // Whether params of a stage are partitioned across the replicas of the
+  // stage. With auto_dist_matmul, both are evaluated for each stage.
+  std::vector<bool> dist_choices = {conf_.force_dist_matmul};
+  if (conf_.auto_dist_matmul && !conf_.force_dist_matmul) {
+    dist_choices.push_back(true);
+  }
 
   // 3-dimensional table
   // table[stage][boundary][used_dev]
@@ -597,11 +680,6 @@ AllocSolution DPStaging::doRunDpComm(
               continue;
             }
 
-            long step_val = LONG_MAX;
-            long step_mem = LONG_MAX;
-            long ar_comm = 0;
-            GraphProfile step_prof;
-
             // merge graphs from j+1 to i (inclusive)
             auto step_graph = merge_helper.merge(b_prev, b - 1);
             size_t step_in_comm = calcCommTime(
@@ -610,104 +688,133 @@ AllocSolution DPStaging::doRunDpComm(
             size_t step_out_comm = calcCommTime(
                 calcOutputSize(step_graph) /
                 ((d - d_prev) * replica_num * pipeline_num));
-            ar_comm = calcAllReduceTime(step_graph->getParamSizeInByte());
-
-            TensorPartitioningGraphInfo part_info = partitionParams(
-                step_graph, (d - d_prev) * replica_num, global_param_part);
-
-            // run profiler for the merged graph
-            ProfilingInput merged_in{
-                part_info.graph,
-                DEFALUT_ITERATION_NUM,
-                (d - d_prev) * replica_num,
-                static_cast<size_t>(pipeline_num),
-                checkpointing,
-                part_info,
-                conf_};
-
-            bool profile_by_acc =
-                config::Config::get().getVal<bool>(config::PROFILE_BY_ACC);
-            if (profile_by_acc) {
-              // Just estimate time by accumulation
-              assert(graph.nodes.size() > b - 1);
-              std::unordered_map<std::string, std::shared_ptr<IRGraph>>
-                  ir_graphs;
-              std::unordered_map<std::string, TensorPartitioningGraphInfo>
-                  part_info_map;
-              std::unordered_map<std::string, size_t> repl_nums;
-              for (size_t i = b_prev; i <= b - 1; i++) {
-                const auto& g = graph.nodes.at(i).graph;
-
-                TensorPartitioningGraphInfo part_info_sg = partitionParams(
-                    g, (d - d_prev) * replica_num, global_param_part);
-                ir_graphs[g->getName()] = part_info_sg.graph;
-                part_info_map[g->getName()] = part_info_sg;
-                repl_nums[g->getName()] = (d - d_prev) * replica_num;
+
+            bool fit_mem = false;
+            for (bool dist_params : dist_choices) {
+              TensorPartitioningGraphInfo part_info = partitionParams(
+                  step_graph, (d - d_prev) * replica_num,
+                  getParamPartition((d - d_prev) * replica_num),
+                  dist_params);
+              if (dist_params && !conf_.force_dist_matmul &&
+                  part_info.param_partitions.empty()) {
+                // Same as the stage without partitioning
+                continue;
               }
 
-              ProfilingInput acc_in{
-                  ir_graphs,     DEFALUT_ITERATION_NUM,
-                  repl_nums,     static_cast<size_t>(pipeline_num),
-                  checkpointing, part_info_map,
+              // Gradients of partitioned params are reduced to the owners in
+              // the backward pass, which is included in the profile
+              bool compress = compressGrads(
+                  d_prev, d, dev_num_per_group, replica_num);
+              long ar_comm = calcAllReduceTime(
+                  calcGradCommSize(step_graph, compress) -
+                  calcPartitionedGradCommSize(part_info, compress));
+
+              // run profiler for the merged graph
+              ProfilingInput merged_in{
+                  part_info.graph,
+                  DEFALUT_ITERATION_NUM,
+                  (d - d_prev) * replica_num,
+                  static_cast<size_t>(pipeline_num),
+                  checkpointing,
+                  part_info,
                   conf_};
-              step_prof = accProfileValues(prof_util_, acc_in);
+              merged_in.force_dist_matmul = dist_params;
+
+              GraphProfile step_prof;
+              if (profile_by_acc) {
+                // Just estimate time by accumulation
+                assert(graph.nodes.size() > b - 1);
+                std::unordered_map<std::string, std::shared_ptr<IRGraph>>
+                    ir_graphs;
+                std::unordered_map<std::string, TensorPartitioningGraphInfo>
+                    part_info_map;
+                std::unordered_map<std::string, size_t> repl_nums;
+                for (size_t i = b_prev; i <= b - 1; i++) {
+                  const auto& g = graph.nodes.at(i).graph;
+
+                  TensorPartitioningGraphInfo part_info_sg = partitionParams(
+                      g, (d - d_prev) * replica_num,
+                      getParamPartition((d - d_prev) * replica_num),
+                      dist_params);
+                  ir_graphs[g->getName()] = part_info_sg.graph;
+                  part_info_map[g->getName()] = part_info_sg;
+                  repl_nums[g->getName()] = (d - d_prev) * replica_num;
+                }
+
+                ProfilingInput acc_in{
+                    ir_graphs,     DEFALUT_ITERATION_NUM,
+                    repl_nums,     static_cast<size_t>(pipeline_num),
+                    checkpointing, part_info_map,
+                    conf_};
+                acc_in.force_dist_matmul = dist_params;
+                step_prof = accProfileValues(prof_util_, acc_in);
+              } else {
+                step_prof = prof_util_.profile(merged_in);
+              }
+
+              const auto stage_cap = getStageCapability(
+                  conf_, d_prev, d, dev_num_per_group, replica_num);
+              scaleBySpeed(step_prof, stage_cap.speed);
 
-              step_mem = calcGraphMem(
+              long step_mem = calcGraphMem(
                   step_graph, step_prof, conf_.batch_size, merged_in);
-            } else {
-              step_prof = prof_util_.profile(merged_in);
-            }
+              long step_val = ::rannc::estimateEval(
+                  step_prof, step_in_comm, step_out_comm,
+                  table[s - 1][b_prev][d_prev].max_fwd,
+                  table[s - 1][b_prev][d_prev].max_bwd,
+                  table[s - 1][b_prev][d_prev].max_allreduce);
 
-            step_val = ::rannc::estimateEval(
-                step_prof, step_in_comm, step_out_comm,
-                table[s - 1][b_prev][d_prev].max_fwd,
-                table[s - 1][b_prev][d_prev].max_bwd,
-                table[s - 1][b_prev][d_prev].max_allreduce);
+              if (step_mem >= stage_cap.mem) {
+                logger->trace(
+                    "DPStaging::doRunDpComm: The required memory exceeded the limit. stage_num={} s={} b={} d={} b_prev={} d_prev={} dist_params={} mem={}",
+                    stage_num, s, b, d, b_prev, d_prev, dist_params, step_mem);
+                continue;
+              }
+              fit_mem = true;
+
+              bool update = table[s][b][d].eval > step_val;
+
+              found_b_sol = true;
+              found_d_sol = true;
+
+              if (update) {
+                table[s][b][d].eval =
+                    std::max(step_val, table[s - 1][b_prev][d_prev].eval);
+                table[s][b][d].max_fwd = std::max(
+                    step_prof.fwd_time, table[s - 1][b_prev][d_prev].max_fwd);
+                table[s][b][d].max_bwd = std::max(
+                    step_prof.bwd_time, table[s - 1][b_prev][d_prev].max_bwd);
+                table[s][b][d].max_allreduce = std::max(
+                    ar_comm, table[s - 1][b_prev][d_prev].max_allreduce);
+                table[s][b][d].pre_boundary = b_prev;
+                table[s][b][d].pre_dev_num = d_prev;
+                table[s][b][d].dist_params = dist_params;
+                table[s][b][d].mem = step_mem;
 
-            if (step_mem >= conf_.dev_mem) {
-              logger->trace(
-                  "DPStaging::doRunDpComm: The required memory exceeded the limit. stage_num={} s={} b={} d={} b_prev={} d_prev={} mem={}",
-                  stage_num, s, b, d, b_prev, d_prev, step_mem);
+                logger->trace(
+                    "DPStaging::doRunDpComm: UPDATED stage_num={} s={} b={} d={} s'={} b'={} d'={}: step_val={} "
+                    "table[{}][{}][{}]={} table[{}][{}][{}]={} #pre_graphs={} dist_params={} update={}",
+                    stage_num, s, b, d, s - 1, b_prev, d_prev, step_val, s, b,
+                    d, table[s][b][d].eval, s - 1, b_prev, d_prev,
+                    table[s - 1][b_prev][d_prev].eval, s - 1, dist_params,
+                    update);
+              } else {
+                logger->trace(
+                    "DPStaging::doRunDpComm: NO_UPDATE stage_num={} s={} b={} d={} s'={} b'={} d'={}: step_val={} "
+                    "table[{}][{}][{}]={} table[{}][{}][{}]={} #pre_graphs={} min_dev_num={} dist_params={} update={}",
+                    stage_num, s, b, d, s - 1, b_prev, d_prev, step_val, s, b,
+                    d, table[s][b][d].eval, s - 1, b_prev, d_prev,
+                    table[s - 1][b_prev][d_prev].eval, s - 1, min_d,
+                    dist_params, update);
+              }
+            }
 
+            if (!fit_mem) {
               // we break here, not continue
               // this is because larger d_prev gives less gpus for the step
               // graph
               break;
             }
-
-            bool update = table[s][b][d].eval > step_val;
-
-            found_b_sol = true;
-            found_d_sol = true;
-
-            if (update) {
-              table[s][b][d].eval =
-                  std::max(step_val, table[s - 1][b_prev][d_prev].eval);
-              table[s][b][d].max_fwd = std::max(
-                  step_prof.fwd_time, table[s - 1][b_prev][d_prev].max_fwd);
-              table[s][b][d].max_bwd = std::max(
-                  step_prof.bwd_time, table[s - 1][b_prev][d_prev].max_bwd);
-              table[s][b][d].max_allreduce =
-                  std::max(ar_comm, table[s - 1][b_prev][d_prev].max_allreduce);
-              table[s][b][d].pre_boundary = b_prev;
-              table[s][b][d].pre_dev_num = d_prev;
-              //                                table[s][b][d].step_graph =
-              //                                step_graph;
-              //
-              logger->trace(
-                  "DPStaging::doRunDpComm: UPDATED stage_num={} s={} b={} d={} s'={} b'={} d'={}: step_val={} "
-                  "table[{}][{}][{}]={} table[{}][{}][{}]={} #pre_graphs={} update={}",
-                  stage_num, s, b, d, s - 1, b_prev, d_prev, step_val, s, b, d,
-                  table[s][b][d].eval, s - 1, b_prev, d_prev,
-                  table[s - 1][b_prev][d_prev].eval, s - 1, update);
-            } else {
-              logger->trace(
-                  "DPStaging::doRunDpComm: NO_UPDATE stage_num={} s={} b={} d={} s'={} b'={} d'={}: step_val={} "
-                  "table[{}][{}][{}]={} table[{}][{}][{}]={} #pre_graphs={} min_dev_num={} update={}",
-                  stage_num, s, b, d, s - 1, b_prev, d_prev, step_val, s, b, d,
-                  table[s][b][d].eval, s - 1, b_prev, d_prev,
-                  table[s - 1][b_prev][d_prev].eval, s - 1, min_d, update);
-            }
           }
         }
         if (!found_d_sol && !skip_small_bs) {
@@ -757,6 +864,7 @@ AllocSolution DPStaging::doRunDpComm(
 
   std::unordered_map<std::string, int> repl_nums;
   std::unordered_map<std::string, TensorPartitioningGraphInfo> part_info_map;
+  std::unordered_map<std::string, size_t> graph_mems;
   std::vector<std::shared_ptr<IRGraph>> sol_graphs;
   for (size_t s_sol = stage_num; s_sol > 0; s_sol--) {
     const auto& state = table[s_sol][b_sol][d_sol];
@@ -766,9 +874,10 @@ AllocSolution DPStaging::doRunDpComm(
 
     auto sg = merge_helper.merge(state.pre_boundary, b_sol - 1);
     repl_nums[sg->getName()] = (d_sol - state.pre_dev_num) * replica_num;
-    const ParamPartitionMap global_param_part = getDistParams(ir_graph_);
-    part_info_map[sg->getName()] =
-        partitionParams(sg, repl_nums.at(sg->getName()), global_param_part);
+    part_info_map[sg->getName()] = partitionParams(
+        sg, repl_nums.at(sg->getName()),
+        getParamPartition(repl_nums.at(sg->getName())), state.dist_params);
+    graph_mems[sg->getName()] = state.mem;
 
     sol_graphs.push_back(part_info_map[sg->getName()].graph);
 
@@ -785,15 +894,16 @@ AllocSolution DPStaging::doRunDpComm(
   logger->trace("sol boundaries={}", join_as_str(boundaries));
   logger->trace("sol dev_nums={}", join_as_str(dev_nums));
 
-  return AllocSolution{sol_graphs,    repl_nums,  part_info_map, pipeline_num,
-                       checkpointing, boundaries, dev_nums};
+  return AllocSolution{
+      sol_graphs,    repl_nums,  part_info_map, pipeline_num,
+      checkpointing, boundaries, dev_nums,      graph_mems};
 }
 
 TensorPartitioningGraphInfo DPStaging::partitionParams(
     std::shared_ptr<IRGraph> g, int repl_num,
-    const ParamPartitionMap& param_part) const {
+    const ParamPartitionMap& param_part, bool dist_params) const {
   TensorPartitioningGraphInfo part_info;
-  if (conf_.force_dist_matmul) {
+  if (dist_params) {
     part_info = replaceWithDistOp(g, createDummyRanks(repl_num), param_part);
   } else {
     part_info.graph = g;
@@ -801,6 +911,88 @@ TensorPartitioningGraphInfo DPStaging::partitionParams(
   return part_info;
 }
 
+const ParamPartitionMap& DPStaging::getParamPartition(int repl_num) {
+  const bool cpg_search =
+      config::Config::get().getVal<bool>(config::CPG_SEARCH);
+  // Without the search, the partition does not depend on the number
+  const int key = cpg_search ? repl_num : 0;
+  if (!contains(param_part_cache_, key)) {
+    param_part_cache_[key] = cpg_search ? searchDistParams(ir_graph_, repl_num)
+                                        : getDistParams(ir_graph_);
+  }
+  return param_part_cache_.at(key);
+}
+
+bool DPStaging::compressGrads(
+    size_t dev_begin, size_t dev_end, size_t dev_num_per_group,
+    int replica_num) const {
+  // GradCompressor is not used by these paths
+  if (conf_.enable_zero ||
+      config::Config::get().getVal<bool>(config::CONSOLIDATE_GRADS)) {
+    return false;
+  }
+  if (replica_num > 1) {
+    // Groups of ranks are placed on different nodes
+    return true;
+  }
+  size_t dev_per_node =
+      std::max(1, std::min((int)conf_.dev_num, getCudaDeviceCount()));
+  return dev_end > dev_begin &&
+      dev_begin / dev_per_node != (dev_end - 1) / dev_per_node;
+}
+
+std::unordered_map<std::string, std::unordered_set<int>> allocateDevices(
+    const PartitionDP& repl, const AllocSolution& sol,
+    const PartitioningConf& conf) {
+  const auto logger = getLogger("DPStaging");
+  std::unordered_map<std::string, std::unordered_set<int>> alloc;
+
+  if (conf.dev_caps.size() == conf.dev_num && isHeterogeneous(conf.dev_caps)) {
+    // Stage i uses devices [dev_nums[i], dev_nums[i+1]) of each group
+    logger->trace("allocateDevices: heterogeneous devices");
+    size_t dev_num_per_group = sol.dev_nums.back();
+    int replica_num = conf.dev_num / dev_num_per_group;
+    for (size_t g_idx = 0; g_idx < sol.graphs.size(); g_idx++) {
+      auto& devs = alloc[sol.graphs.at(g_idx)->getName()];
+      for (int k = 0; k < replica_num; k++) {
+        for (size_t i = sol.dev_nums.at(g_idx); i < sol.dev_nums.at(g_idx + 1);
+             i++) {
+          devs.insert(k * dev_num_per_group + i);
+        }
+      }
+    }
+    return alloc;
+  }
+
+  if (config::Config::get().getVal<bool>(config::ALLOC_MEM_AWARE)) {
+    logger->trace("searchAllocation");
+    std::vector<size_t> dev_mems(conf.dev_num, conf.dev_mem);
+    if (conf.dev_caps.size() == conf.dev_num) {
+      for (size_t i = 0; i < dev_mems.size(); i++) {
+        if (conf.dev_caps.at(i).mem > 0) {
+          dev_mems.at(i) = conf.dev_caps.at(i).mem;
+        }
+      }
+    }
+    int dev_per_node = std::min(conf.dev_num, getCudaDeviceCount());
+    alloc = searchAllocation(repl, dev_mems, sol.graph_mems, dev_per_node);
+    if (alloc.empty()) {
+      logger->warn(
+          "No allocation of devices fits the estimated memory. Devices are allocated regardless of memory.");
+    }
+  }
+  if (alloc.empty()) {
+    if (config::Config::get().getVal<bool>(config::ALLOC_REPL_FLAT)) {
+      logger->trace("searchAllocationFlat");
+      alloc = searchAllocationFlat(repl, conf.dev_num, conf.dev_mem);
+    } else {
+      logger->trace("searchAllocationSimple");
+      alloc = searchAllocationSimple(repl, conf.dev_num, conf.dev_mem);
+    }
+  }
+  return alloc;
+}
+
 void DPStaging::saveAllocSolution(
     size_t stage_num, size_t pipeline_num, const AllocSolution& sol) {
   const auto file = makeAllocSolutionFileName(stage_num, pipeline_num);
@@ -852,20 +1044,18 @@ Deployment DPDryStaging::partition() {
       replicate(new_part, repl_nums, sol.pipeline_num, conf_.batch_size);
   logger->trace("Partitioning finished: id={}", ir_graph_->getName());
 
-  std::unordered_map<std::string, std::unordered_set<int>> alloc;
-
-  if (config::Config::get().getVal<bool>(config::ALLOC_REPL_FLAT)) {
-    logger->trace("searchAllocationFlat");
-    alloc = searchAllocationFlat(repl, conf_.dev_num, conf_.dev_mem);
-  } else {
-    logger->trace("searchAllocationSimple");
-    alloc = searchAllocationSimple(repl, conf_.dev_num, conf_.dev_mem);
-  }
+  const auto alloc = allocateDevices(repl, sol, conf_);
 
   if (alloc.empty()) {
     throw std::runtime_error("Failed to allocate gpus to subgraphs.");
   }
 
+  std::unordered_map<std::string, TensorPartitioningGraphInfo> part_info;
+  for (const auto& it : alloc) {
+    assert(contains(sol.part_info, it.first));
+    part_info[it.first] = setRanks(sol.part_info.at(it.first), it.second);
+  }
+
   for (const auto& it : alloc) {
     logger->info(
         " Assigned subgraph {} to rank{}", it.first, join_as_str(it.second));
@@ -873,6 +1063,14 @@ Deployment DPDryStaging::partition() {
   Deployment deployment = createDeployment(repl, alloc, conf_.dev_num);
   deployment.pipeline_num = sol.pipeline_num;
   deployment.checkpointing = sol.checkpointing;
+  deployment.offload_params = conf_.offload_params;
+  deployment.force_dist_matmul = conf_.force_dist_matmul;
+  for (const auto& it : part_info) {
+    if (!it.second.param_partitions.empty()) {
+      deployment.force_dist_matmul = true;
+    }
+  }
+  deployment.part_info = part_info;
   logger->trace("Created deployment finished");
 
   return deployment;
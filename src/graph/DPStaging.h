@@ -29,12 +29,40 @@ struct AllocSolution {
   bool checkpointing;
   std::vector<size_t> boundaries;
   std::vector<size_t> dev_nums;
+  // graph name -> memory required on a device
+  std::unordered_map<std::string, size_t> graph_mems;
 
   MSGPACK_DEFINE(
       graphs, repl_nums, part_info, pipeline_num, checkpointing, boundaries,
-      dev_nums);
+      dev_nums, graph_mems);
 };
 
+/**
+ * Allocates devices to the stages of a solution. With heterogeneous devices,
+ * each stage is placed on the devices that DP assumed for the stage.
+ * Otherwise devices are allocated based on the memory of stages, or by the
+ * flat or simple allocation.
+ *
+ * @param repl Partition with replica numbers.
+ * @param sol Solution of DP.
+ * @param conf Configuration of partitioning.
+ * @return Devices of subgraphs.
+ */
+std::unordered_map<std::string, std::unordered_set<int>> allocateDevices(
+    const PartitionDP& repl, const AllocSolution& sol,
+    const PartitioningConf& conf);
+
+// Times are profiled on the device of rank 0. Scales them for a device of the
+// given speed relative to it.
+void scaleBySpeed(GraphProfile& prof, double speed);
+
+// A stage uses devices [dev_begin, dev_end) of each group of ranks. Returns
+// the smallest memory and the lowest speed (relative to rank 0) of them, or
+// the memory of *conf* if the capabilities of devices are unknown.
+DeviceCapability getStageCapability(
+    const PartitioningConf& conf, size_t dev_begin, size_t dev_end,
+    size_t dev_num_per_group, int replica_num);
+
 class DPStaging {
  public:
   DPStaging(
@@ -47,6 +75,7 @@ class DPStaging {
     dump_dp_node_profiles_ =
         config.getVal<std::string>(config::DUMP_DP_NODE_PROFILES);
     dump_dp_cache_ = config.getVal<std::string>(config::DUMP_DP_CACHE);
+    plan_store_dir_ = config.getVal<std::string>(config::PLAN_STORE_DIR);
   }
 
   AllocSolution runDpComm(const MLGraph& graph);
@@ -65,7 +94,18 @@ class DPStaging {
 
   TensorPartitioningGraphInfo partitionParams(
       std::shared_ptr<IRGraph> g, int repl_num,
-      const ParamPartitionMap& param_part) const;
+      const ParamPartitionMap& param_part, bool dist_params) const;
+  // Params of the whole graph that can be partitioned across *repl_num*
+  // replicas of a stage. The result of the search by *cpg_search* depends on
+  // the number and is cached for each number.
+  const ParamPartitionMap& getParamPartition(int repl_num);
+
+  // Whether GradCompressor compresses the gradients of a stage using devices
+  // [dev_begin, dev_end) of each group of ranks. It does so only when the
+  // replicas of the stage span nodes.
+  bool compressGrads(
+      size_t dev_begin, size_t dev_end, size_t dev_num_per_group,
+      int replica_num) const;
 
   void saveAllocSolution(
       size_t stage_num, size_t pipeline_num, const AllocSolution& sol);
@@ -76,7 +116,10 @@ class DPStaging {
 
   std::string dump_dp_node_profiles_;
   std::string dump_dp_cache_;
+  std::string plan_store_dir_;
   std::shared_ptr<IRGraph> ir_graph_;
+  // replica num -> partition of params
+  std::unordered_map<int, ParamPartitionMap> param_part_cache_;
 
   static const int DEFALUT_ITERATION_NUM;
 
@@ -103,6 +146,7 @@ class DPDryStaging : public DPStaging {
     prof_util_.setProfileCache(cache.ml_profile_cache);
     dump_dp_node_profiles_.clear();
     dump_dp_cache_.clear();
+    plan_store_dir_.clear();
   }
 
   Deployment partition();
@@ -113,7 +157,6 @@ class DPDryStaging : public DPStaging {
 
  private:
   MLGraph graph_;
-  std::shared_ptr<IRGraph> ir_graph_;
   PartitioningConf conf_;
 };
 } // namespace rannc
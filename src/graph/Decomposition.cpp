@@ -1016,141 +1016,234 @@ PartitionDP replicate(
   return rep_partition;
 }
 
-bool isAllocFeasible(
-    const std::unordered_map<int, size_t>& alloc_mem, size_t dev_mem) {
-  for (const auto& it : alloc_mem) {
-    if (dev_mem < it.second) {
-      return false;
+HGraph toHGraph(const PartitionDP& partition);
+
+namespace {
+// Max number of steps of the branch-and-bound search of allocation. This
+// bounds the time for a large number of devices.
+const size_t MAX_ALLOC_SEARCH_STEPS = 100000;
+
+// Places replicas of subgraphs in the order of stages. A replica is placed
+// on the device with the most free memory in the node that holds the same
+// replica of the previous stage, and on such a device in any node if the node
+// has no room.
+bool allocateByStage(
+    const std::vector<std::string>& order,
+    const std::unordered_map<std::string, int>& replica_nums,
+    const std::unordered_map<std::string, size_t>& graph_mems,
+    const std::vector<size_t>& dev_mems, int dev_per_node,
+    std::unordered_map<std::string, std::unordered_set<int>>& alloc) {
+  const size_t dev_count = dev_mems.size();
+  std::vector<size_t> free_mems = dev_mems;
+  std::vector<int> prev_devs;
+
+  for (const auto& sg_name : order) {
+    const size_t mem = graph_mems.at(sg_name);
+    auto& sg_devs = alloc[sg_name];
+    std::vector<int> devs;
+
+    for (int r = 0; r < replica_nums.at(sg_name); r++) {
+      const auto find_dev = [&](size_t begin, size_t end) {
+        int best = -1;
+        for (size_t dev = begin; dev < end; dev++) {
+          if (contains(sg_devs, dev) || free_mems.at(dev) < mem) {
+            continue;
+          }
+          if (best < 0 || free_mems.at(dev) > free_mems.at(best)) {
+            best = dev;
+          }
+        }
+        return best;
+      };
+
+      int dev = -1;
+      if (!prev_devs.empty()) {
+        size_t node = prev_devs.at(r % prev_devs.size()) / dev_per_node;
+        size_t begin = node * dev_per_node;
+        dev = find_dev(begin, std::min(begin + dev_per_node, dev_count));
+      }
+      if (dev < 0) {
+        dev = find_dev(0, dev_count);
+      }
+      if (dev < 0) {
+        return false;
+      }
+
+      free_mems.at(dev) -= mem;
+      sg_devs.insert(dev);
+      devs.push_back(dev);
     }
+    prev_devs = devs;
   }
   return true;
 }
 
-struct AllocState {
-  int dev;
-  std::unordered_map<std::string, int> alloc;
-  std::unordered_map<int, size_t> alloc_mem;
+struct AllocItem {
+  std::string sg_name;
+  size_t mem;
+};
 
-  size_t getMaxAllocMem() const {
-    size_t max = 0;
-    for (const auto& it : alloc_mem) {
-      if (it.second > max) {
-        max = it.second;
-      }
+// Branch-and-bound search over replicas sorted by memory. Devices are tried
+// in the best-fit order. Empty devices of the same memory are
+// interchangeable, so only one of them is tried for a replica.
+class AllocSearch {
+ public:
+  AllocSearch(std::vector<AllocItem> items, const std::vector<size_t>& dev_mems)
+      : items_(std::move(items)),
+        free_mems_(dev_mems),
+        sg_names_(dev_mems.size()),
+        devs_(items_.size(), -1) {
+    std::stable_sort(
+        items_.begin(), items_.end(),
+        [](const AllocItem& a, const AllocItem& b) { return a.mem > b.mem; });
+    free_mem_ = 0;
+    for (size_t mem : dev_mems) {
+      free_mem_ += mem;
     }
-    return max;
   }
-};
 
-bool hasReplica(
-    const std::string& sg_name, int dev,
-    const std::unordered_map<std::string, std::unordered_set<std::string>>&
-        replications,
-    const std::unordered_map<std::string, int>& alloc) {
-  for (const auto& it : replications) {
-    const auto& repl_set = it.second;
-    if (contains(repl_set, sg_name)) {
-      for (const auto& repl_id : repl_set) {
-        if (contains(alloc, repl_id)) {
-          if (alloc.at(repl_id) == dev) {
-            return true;
-          }
-        }
-      }
+  bool run(std::unordered_map<std::string, std::unordered_set<int>>& alloc) {
+    size_t rest_mem = 0;
+    for (const auto& item : items_) {
+      rest_mem += item.mem;
     }
+    if (!search(0, rest_mem)) {
+      return false;
+    }
+    for (size_t i = 0; i < items_.size(); i++) {
+      alloc[items_.at(i).sg_name].insert(devs_.at(i));
+    }
+    return true;
   }
-  return false;
-}
 
-std::unordered_map<std::string, int> doSearchAllocation(
-    std::vector<std::string> sg_names,
-    const std::unordered_map<std::string, std::unordered_set<std::string>>&
-        replications,
-    const std::unordered_map<std::string, int>& alloc,
-    const std::unordered_map<int, size_t>& alloc_mem,
-    const std::unordered_map<std::string, size_t>& graph_sizes,
-    const std::vector<int>& devices, size_t dev_mem) {
-  const auto logger = getLogger(LOGGER_NAME);
-
-  if (!isAllocFeasible(alloc_mem, dev_mem)) {
-    return std::unordered_map<std::string, int>();
-  }
-  if (sg_names.empty()) {
-    return alloc;
+  size_t getSteps() const {
+    return steps_;
   }
 
-  const std::string sg_name = sg_names.back();
-  sg_names.pop_back();
-
-  std::vector<AllocState> alloc_states;
-  for (int dev : devices) {
-    if (hasReplica(sg_name, dev, replications, alloc)) {
-      continue;
+ private:
+  bool search(size_t idx, size_t rest_mem) {
+    if (idx == items_.size()) {
+      return true;
+    }
+    if (++steps_ > MAX_ALLOC_SEARCH_STEPS || rest_mem > free_mem_) {
+      return false;
     }
 
-    auto _alloc = alloc;
-    auto _alloc_mem = alloc_mem;
+    const auto& item = items_.at(idx);
+    std::vector<int> cands;
+    std::unordered_set<size_t> tried_empty_mems;
+    for (size_t dev = 0; dev < free_mems_.size(); dev++) {
+      if (free_mems_.at(dev) < item.mem ||
+          contains(sg_names_.at(dev), item.sg_name)) {
+        continue;
+      }
+      if (sg_names_.at(dev).empty()) {
+        if (contains(tried_empty_mems, free_mems_.at(dev))) {
+          continue;
+        }
+        tried_empty_mems.insert(free_mems_.at(dev));
+      }
+      cands.push_back(dev);
+    }
+    std::stable_sort(cands.begin(), cands.end(), [this](int a, int b) {
+      return free_mems_.at(a) < free_mems_.at(b);
+    });
+
+    for (int dev : cands) {
+      free_mems_.at(dev) -= item.mem;
+      free_mem_ -= item.mem;
+      sg_names_.at(dev).insert(item.sg_name);
+      devs_.at(idx) = dev;
+
+      if (search(idx + 1, rest_mem - item.mem)) {
+        return true;
+      }
 
-    _alloc[sg_name] = dev;
-    _alloc_mem[dev] += graph_sizes.at(sg_name);
-    AllocState state = {dev, _alloc, _alloc_mem};
-    alloc_states.push_back(state);
-  }
+      free_mems_.at(dev) += item.mem;
+      free_mem_ += item.mem;
+      sg_names_.at(dev).erase(item.sg_name);
+    }
+    return false;
+  }
+
+  std::vector<AllocItem> items_;
+  // device -> free memory
+  std::vector<size_t> free_mems_;
+  size_t free_mem_;
+  // device -> subgraphs whose replicas are on the device
+  std::vector<std::unordered_set<std::string>> sg_names_;
+  // item index -> device
+  std::vector<int> devs_;
+  size_t steps_ = 0;
+};
+} // namespace
 
-  std::sort(
-      alloc_states.begin(), alloc_states.end(),
-      [](const AllocState& s1, const AllocState& s2) {
-        return s1.getMaxAllocMem() < s2.getMaxAllocMem();
-      });
+std::unordered_map<std::string, std::unordered_set<int>> searchAllocation(
+    const PartitionDP& partition, std::vector<size_t> dev_mems,
+    const std::unordered_map<std::string, size_t>& graph_mems,
+    int dev_per_node) {
+  const auto logger = getLogger(LOGGER_NAME);
 
-  for (const auto& st : alloc_states) {
-    const auto ret_alloc = doSearchAllocation(
-        sg_names, replications, st.alloc, st.alloc_mem, graph_sizes, devices,
-        dev_mem);
-    if (!ret_alloc.empty()) {
-      return ret_alloc;
+  const size_t dev_count = dev_mems.size();
+  size_t max_dev_mem = 0;
+  size_t total_dev_mem = 0;
+  for (auto& mem : dev_mems) {
+    if (mem == 0) {
+      mem = std::numeric_limits<size_t>::max() / (dev_count + 1);
     }
+    max_dev_mem = std::max(max_dev_mem, mem);
+    total_dev_mem += mem;
   }
+  dev_per_node = std::max(1, dev_per_node);
 
-  return std::unordered_map<std::string, int>();
-}
-
-std::unordered_map<std::string, std::unordered_set<int>> searchAllocation(
-    const PartitionDP& partition, size_t dev_count, size_t dev_mem) {
-  int repl_num = -1;
-  for (const auto& it : partition.replica_nums) {
-    repl_num = it.second;
+  // Subgraphs in the order of stages
+  std::vector<std::string> order;
+  std::unordered_map<std::string, size_t> mems;
+  HGraph hg = toHGraph(partition);
+  for (const auto& v : all_nodes_topo<HVertex, HGraph>(hg)) {
+    const auto& sg = hg[v];
+    order.push_back(sg->getName());
+    mems[sg->getName()] = contains(graph_mems, sg->getName())
+        ? graph_mems.at(sg->getName())
+        : getSizeInByte(sg);
+  }
+
+  size_t total_mem = 0;
+  for (const auto& sg_name : order) {
+    assert(contains(partition.replica_nums, sg_name));
+    size_t repl_num = partition.replica_nums.at(sg_name);
+    // Replicas of a subgraph must be on different devices
+    if (repl_num > dev_count || mems.at(sg_name) > max_dev_mem) {
+      return {};
+    }
+    total_mem += repl_num * mems.at(sg_name);
+  }
+  if (total_mem > total_dev_mem) {
+    return {};
   }
 
   std::unordered_map<std::string, std::unordered_set<int>> ret;
-  int i = 0;
-  for (size_t repl_idx = 0; repl_idx < repl_num; repl_idx++) {
-    for (const auto& it : partition.subgraphs) {
-      ret[it.first].insert(i % dev_count);
-      i++;
+  if (allocateByStage(
+          order, partition.replica_nums, mems, dev_mems, dev_per_node, ret)) {
+    return ret;
+  }
+
+  std::vector<AllocItem> items;
+  for (const auto& sg_name : order) {
+    for (int i = 0; i < partition.replica_nums.at(sg_name); i++) {
+      items.push_back({sg_name, mems.at(sg_name)});
     }
   }
+  AllocSearch search(items, dev_mems);
+  ret.clear();
+  bool found = search.run(ret);
+  logger->trace(
+      "searchAllocation: #replicas={} found={} steps={}", items.size(), found,
+      search.getSteps());
+  if (!found) {
+    return {};
+  }
   return ret;
-
-  //        std::unordered_map<std::string, int> alloc;
-  //        std::vector<std::string> sg_names = keys(partition.subgraphs);
-  //
-  //        std::unordered_map<int, size_t> alloc_mem;
-  //        for (size_t i=1; i<=dev_count; i++) {
-  //            alloc_mem[i] = 0;
-  //        }
-  //        std::unordered_map<std::string, size_t> graph_sizes;
-  //        for (const auto& sg: partition.subgraphs) {
-  //            graph_sizes[sg.first] = getSizeInByte(sg.second);
-  //        }
-  //
-  //        std::vector<int> devices;
-  //        for (size_t i=1; i<=dev_count; i++) {
-  //            devices.push_back(i);
-  //        }
-  //
-  //        return doSearchAllocation(sg_names, partition.replications, alloc,
-  //        alloc_mem, graph_sizes, devices, dev_mem);
 }
 
 std::unordered_map<std::string, std::unordered_set<int>> searchAllocationFlat(
@@ -1195,6 +1288,24 @@ std::unordered_map<std::string, std::unordered_set<int>> searchAllocationSimple(
   return ret;
 }
 
+std::unordered_map<std::string, std::unordered_set<int>>
+searchAllocationRoundRobin(const PartitionDP& partition, size_t dev_count) {
+  int repl_num = 0;
+  for (const auto& it : partition.replica_nums) {
+    repl_num = std::max(repl_num, it.second);
+  }
+
+  std::unordered_map<std::string, std::unordered_set<int>> ret;
+  int i = 0;
+  for (int repl_idx = 0; repl_idx < repl_num; repl_idx++) {
+    for (const auto& it : partition.subgraphs) {
+      ret[it.first].insert(i % dev_count);
+      i++;
+    }
+  }
+  return ret;
+}
+
 HGraph toHGraph(const PartitionDP& partition) {
   HGraph hg;
   std::unordered_map<std::string, HVertex> node_map;
@@ -1572,6 +1683,10 @@ std::ostream& operator<<(std::ostream& os, const Deployment& deployment) {
     assert(contains(deployment.subgraphs, sg_name));
     const auto graph = deployment.subgraphs.at(sg_name);
     os << "  order: " << idx << " " << *graph;
+    if (contains(deployment.stored_nodes, sg_name)) {
+      os << "  stored_nodes: " << deployment.stored_nodes.at(sg_name).size()
+         << std::endl;
+    }
     os << "  allocation: " << join_as_str(deployment.allocation.at(sg_name))
        << std::endl;
 
@@ -1604,6 +1719,24 @@ std::ostream& operator<<(std::ostream& os, const Deployment& deployment) {
   return os;
 }
 
+bool isHeterogeneous(const std::vector<DeviceCapability>& dev_caps) {
+  for (const auto& cap : dev_caps) {
+    if (cap.mem != dev_caps.front().mem ||
+        cap.speed != dev_caps.front().speed) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t getMaxDevMem(const PartitioningConf& conf) {
+  size_t max_mem = conf.dev_mem;
+  for (const auto& cap : conf.dev_caps) {
+    max_mem = std::max(max_mem, cap.mem);
+  }
+  return max_mem;
+}
+
 PartitioningConf makePartitioningConf(
     int dev_num, size_t batch_size, size_t dev_mem, bool use_amp_master_params,
     bool enable_zero, bool offload_params) {
@@ -1618,6 +1751,7 @@ PartitioningConf makePartitioningConf(
   part_conf.enable_zero = enable_zero;
   part_conf.offload_params = offload_params;
   part_conf.force_dist_matmul = conf.getVal<bool>(config::FORCE_DIST_MATMUL);
+  part_conf.auto_dist_matmul = conf.getVal<bool>(config::AUTO_DIST_MATMUL);
   part_conf.min_pipeline_num = conf.getVal<int>(config::MIN_PIPELINE);
   part_conf.max_pipeline_num = conf.getVal<int>(config::MAX_PIPELINE);
   part_conf.cfg_pipeline_num = conf.getVal<int>(config::PIPELINE_NUM);
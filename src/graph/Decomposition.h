@@ -170,6 +170,9 @@ struct Deployment {
   bool checkpointing;
   bool offload_params;
   bool force_dist_matmul;
+  // subgraph -> ids of nodes whose activations are not recomputed
+  std::unordered_map<std::string, std::unordered_set<std::string>>
+      stored_nodes;
 
   friend std::ostream& operator<<(
       std::ostream& os, const Deployment& deployment);
@@ -178,7 +181,7 @@ struct Deployment {
       id, graph, subgraphs, allocation, part_info, fwd_routes, fwd_in_routes,
       fwd_out_routes, fwd_graph_order, bwd_routes, bwd_in_routes,
       bwd_out_routes, bwd_graph_order, pipeline_num, checkpointing,
-      offload_params, force_dist_matmul);
+      offload_params, force_dist_matmul, stored_nodes);
 };
 
 void verifyDeployment(const Deployment& deployment);
@@ -524,12 +527,31 @@ std::vector<IRValue> searchGraphValuesByName(
     const std::vector<std::shared_ptr<IRGraph>>& ir_graphs,
     const std::string& val_name);
 
+/**
+ * Allocates devices to replicas of subgraphs so that the memory required on
+ * each device does not exceed its memory. Replicas of the same subgraph are
+ * placed on different devices, and adjacent stages are placed in the same
+ * node when possible.
+ *
+ * @param partition Partition with replica numbers.
+ * @param dev_mems Memory of each device. 0 means unlimited.
+ * @param graph_mems Memory required by a replica of each subgraph. The size of
+ * a graph is used for subgraphs not in the map.
+ * @param dev_per_node Number of devices in a node.
+ * @return Devices of subgraphs. Empty if no allocation is found.
+ */
 std::unordered_map<std::string, std::unordered_set<int>> searchAllocation(
-    const PartitionDP& partition, size_t dev_count, size_t dev_mem);
+    const PartitionDP& partition, std::vector<size_t> dev_mems,
+    const std::unordered_map<std::string, size_t>& graph_mems,
+    int dev_per_node);
 std::unordered_map<std::string, std::unordered_set<int>> searchAllocationFlat(
     const PartitionDP& partition, size_t dev_count, size_t dev_mem);
 std::unordered_map<std::string, std::unordered_set<int>> searchAllocationSimple(
     const PartitionDP& partition, size_t dev_count, size_t dev_mem);
+// Places replicas on devices in turn regardless of memory. Devices are shared
+// when there are more replicas than devices.
+std::unordered_map<std::string, std::unordered_set<int>>
+searchAllocationRoundRobin(const PartitionDP& partition, size_t dev_count);
 std::unordered_map<std::string, std::unordered_set<int>>
 searchAllocationFitToDevice(const PartitionDP& partition);
 
@@ -546,29 +568,48 @@ typedef boost::adjacency_list<
     HGraph;
 typedef boost::graph_traits<HGraph>::vertex_descriptor HVertex;
 
+// Capability of the device of a rank. *speed* is a relative throughput.
+struct DeviceCapability {
+  size_t mem = 0;
+  double speed = 1.0;
+
+  MSGPACK_DEFINE(mem, speed);
+};
+
+bool isHeterogeneous(const std::vector<DeviceCapability>& dev_caps);
+
 struct PartitioningConf {
   int dev_num;
   size_t batch_size;
+  // Memory of the smallest device
   size_t dev_mem;
+  // rank -> capability. Empty if unknown.
+  std::vector<DeviceCapability> dev_caps;
   int opt_param_factor;
   bool use_amp_master_params;
   bool enable_zero;
   bool offload_params;
   bool force_dist_matmul;
+  bool auto_dist_matmul;
   int min_pipeline_num;
   int max_pipeline_num;
   int min_partition_num;
   int max_partition_num;
   int cfg_pipeline_num;
   size_t cfg_stage_num;
+  // Fingerprint of the model (getModelFingerprint) used to store the DP
+  // cache. Not serialized because it is not a part of the configuration.
+  std::string model_fp;
 
   MSGPACK_DEFINE(
       dev_num, batch_size, dev_mem, opt_param_factor, use_amp_master_params,
-      enable_zero, offload_params, force_dist_matmul, min_pipeline_num,
-      max_pipeline_num, min_partition_num, max_partition_num, cfg_pipeline_num,
-      cfg_stage_num);
+      enable_zero, offload_params, force_dist_matmul, auto_dist_matmul,
+      min_pipeline_num, max_pipeline_num, min_partition_num, max_partition_num,
+      cfg_pipeline_num, cfg_stage_num, dev_caps);
 };
 
+size_t getMaxDevMem(const PartitioningConf& conf);
+
 PartitioningConf makePartitioningConf(
     int dev_num, size_t batch_size, size_t dev_mem, bool use_amp_master_params,
     bool enable_zero, bool offload_params);
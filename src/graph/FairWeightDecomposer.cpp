@@ -211,7 +211,14 @@ Deployment FairWeightDecomposer::decompose(
       partitionDp.subgraphs.size(), mpi::getSize(), dev_mem_, conf_n_pipeline);
 
   std::unordered_map<std::string, std::unordered_set<int>> alloc =
-      searchAllocation(partitionDp, mpi::getSize(), dev_mem_ * 2);
+      searchAllocation(
+          partitionDp, std::vector<size_t>(mpi::getSize(), dev_mem_ * 2), {},
+          mpi::getSize());
+  if (alloc.empty()) {
+    logger->warn(
+        "No allocation of devices fits the estimated memory. Devices are allocated regardless of memory.");
+    alloc = searchAllocationRoundRobin(partitionDp, mpi::getSize());
+  }
   if (alloc.empty()) {
     throw std::runtime_error("Failed to allocate gpus to subgraphs.");
   }
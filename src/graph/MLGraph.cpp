@@ -598,6 +598,104 @@ bool isConvex(const MLVertex& n1, const MLVertex& n2, MLBGraph& graph) {
   return !ret;
 }
 
+std::vector<size_t> calcTopoLevels(const MLBGraph& graph) {
+  std::vector<size_t> levels(boost::num_vertices(graph), 0);
+  for (const auto& v : all_nodes_topo<MLVertex, MLBGraph>(graph)) {
+    for (const auto& tgt : target_nodes<MLVertex, MLBGraph>(v, graph)) {
+      levels[tgt] = std::max(levels[tgt], levels[v] + 1);
+    }
+  }
+  return levels;
+}
+
+bool isConvex(
+    const MLVertex& n1, const MLVertex& n2, const MLBGraph& graph,
+    const std::vector<size_t>& levels) {
+  // Any other path from n1 to n2 has two or more edges
+  if (levels.at(n2) == levels.at(n1) + 1) {
+    return true;
+  }
+
+  // Vertices at the level of n2 or higher cannot reach n2
+  std::vector<bool> visited(boost::num_vertices(graph), false);
+  std::vector<MLVertex> stack;
+  for (const auto& tgt : target_nodes<MLVertex, MLBGraph>(n1, graph)) {
+    if (tgt != n2 && levels.at(tgt) < levels.at(n2) && !visited[tgt]) {
+      visited[tgt] = true;
+      stack.push_back(tgt);
+    }
+  }
+
+  while (!stack.empty()) {
+    const MLVertex v = stack.back();
+    stack.pop_back();
+    for (const auto& tgt : target_nodes<MLVertex, MLBGraph>(v, graph)) {
+      if (tgt == n2) {
+        return false;
+      }
+      if (levels.at(tgt) < levels.at(n2) && !visited[tgt]) {
+        visited[tgt] = true;
+        stack.push_back(tgt);
+      }
+    }
+  }
+  return true;
+}
+
+const size_t ConvexityIndex::MAX_BITSET_BYTES = 1024L * 1024L * 1024L;
+
+ConvexityIndex::ConvexityIndex(const MLBGraph& graph) : graph_(graph) {
+  levels_ = calcTopoLevels(graph_);
+
+  const size_t n = boost::num_vertices(graph_);
+  // The bitsets take about n^2/2 bits in total
+  if (n * n / 16 > MAX_BITSET_BYTES) {
+    return;
+  }
+
+  const auto topo = all_nodes_topo<MLVertex, MLBGraph>(graph_);
+  topo_pos_.resize(n);
+  for (size_t i = 0; i < topo.size(); i++) {
+    topo_pos_[topo.at(i)] = i;
+  }
+
+  reachable_.resize(n);
+  for (auto it = topo.rbegin(); it != topo.rend(); ++it) {
+    const MLVertex v = *it;
+    const size_t pos = topo_pos_[v];
+    auto& bits = reachable_[v];
+    bits.resize(n - pos - 1);
+
+    for (const auto& tgt : target_nodes<MLVertex, MLBGraph>(v, graph_)) {
+      const size_t shift = topo_pos_[tgt] - pos;
+      bits.set(shift - 1);
+
+      auto tgt_bits = reachable_[tgt];
+      tgt_bits.resize(bits.size());
+      tgt_bits <<= shift;
+      bits |= tgt_bits;
+    }
+  }
+}
+
+bool ConvexityIndex::isConvex(const MLVertex& src, const MLVertex& tgt) const {
+  if (levels_.at(tgt) == levels_.at(src) + 1) {
+    return true;
+  }
+  if (reachable_.empty()) {
+    return rannc::isConvex(src, tgt, graph_, levels_);
+  }
+
+  const size_t tgt_pos = topo_pos_.at(tgt);
+  for (const auto& v : target_nodes<MLVertex, MLBGraph>(src, graph_)) {
+    const size_t pos = topo_pos_.at(v);
+    if (v != tgt && pos < tgt_pos && reachable_.at(v).test(tgt_pos - pos - 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 std::unordered_set<std::string> getMLNodeIds(const std::vector<MLNode>& nodes) {
   std::unordered_set<std::string> ret;
   ret.reserve(nodes.size());
@@ -5,6 +5,8 @@
 #ifndef PYRANNC_MLGRAPH_H
 #define PYRANNC_MLGRAPH_H
 
+#include <boost/dynamic_bitset.hpp>
+
 #include <comp/GraphProfiler.h>
 #include "Decomposition.h"
 #include "ir.h"
@@ -122,6 +124,40 @@ typedef boost::graph_traits<MLBGraph>::vertex_descriptor MLVertex;
 
 MLGraph convert(const Partition& partition);
 bool isConvex(const MLVertex& n1, const MLVertex& n2, MLBGraph& graph);
+// Length of the longest path from a source to each vertex
+std::vector<size_t> calcTopoLevels(const MLBGraph& graph);
+/**
+ * Checks if merging *n1* and its target *n2* keeps the graph acyclic. Unlike
+ * the other version, this does not modify the graph and can be called from
+ * multiple threads. The search is pruned by topological levels.
+ */
+bool isConvex(
+    const MLVertex& n1, const MLVertex& n2, const MLBGraph& graph,
+    const std::vector<size_t>& levels);
+
+/**
+ * Answers *isConvex()* for adjacent vertices of a graph that is not modified.
+ * The vertices reachable from each vertex are kept as a bitset over the
+ * vertices that follow it in topological order, so that a query needs one bit
+ * test per target of the source vertex. When the bitsets do not fit in
+ * *MAX_BITSET_BYTES*, queries fall back to the search pruned by levels.
+ */
+class ConvexityIndex {
+ public:
+  explicit ConvexityIndex(const MLBGraph& graph);
+
+  bool isConvex(const MLVertex& src, const MLVertex& tgt) const;
+
+  static const size_t MAX_BITSET_BYTES;
+
+ private:
+  const MLBGraph& graph_;
+  std::vector<size_t> levels_;
+  std::vector<size_t> topo_pos_;
+  // Bit i of reachable_[v] is set if the vertex at topo_pos_[v]+1+i is
+  // reachable from v
+  std::vector<boost::dynamic_bitset<>> reachable_;
+};
 MLNode liftUp(const MLNode& n);
 std::vector<IRValue> getCutValues(const MLNode& n1, const MLNode& n2);
 std::vector<MLEdge> mergeEdgesNoCopy(
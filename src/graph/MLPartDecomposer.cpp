@@ -15,13 +15,29 @@ Deployment MLPartDecomposer::decompose(
   config::Config& conf = config::Config::get();
   if (conf_.dev_mem > 0) {
     const auto mem_limit = conf.getVal<int>(config::MEM_LIMIT_GB);
-    if (mem_limit > 0) {
-      conf_.dev_mem =
-          std::min(conf_.dev_mem, (size_t)(mem_limit * 1024L * 1024L * 1024L));
-    }
     const auto mem_margin = conf.getVal<float>(config::MEM_MARGIN);
-    conf_.dev_mem *= (1 - mem_margin);
+    const auto available_mem = [mem_limit, mem_margin](size_t mem) {
+      if (mem_limit > 0) {
+        mem = std::min(mem, (size_t)(mem_limit * 1024L * 1024L * 1024L));
+      }
+      return (size_t)(mem * (1 - mem_margin));
+    };
+    conf_.dev_mem = available_mem(conf_.dev_mem);
+    for (auto& cap : conf_.dev_caps) {
+      cap.mem = available_mem(cap.mem);
+    }
     logger->info("Available device memory: {}", conf_.dev_mem);
+    if (isHeterogeneous(conf_.dev_caps)) {
+      std::vector<size_t> mems;
+      std::vector<double> speeds;
+      for (const auto& cap : conf_.dev_caps) {
+        mems.push_back(cap.mem);
+        speeds.push_back(cap.speed);
+      }
+      logger->info(
+          "Heterogeneous devices: memory={} speed={}", join_as_str(mems),
+          join_as_str(speeds));
+    }
   } else {
     logger->warn(
         "No CUDA device found on workers. Assuming (almost) unlimited host memory when assigning subgraphs.");
@@ -76,15 +92,7 @@ Deployment MLPartDecomposer::decompose(
       replicate(new_part, repl_nums, sol.pipeline_num, conf_.batch_size);
   logger->trace("Partitioning finished: id={}", ir_graph->getName());
 
-  std::unordered_map<std::string, std::unordered_set<int>> alloc;
-
-  if (config::Config::get().getVal<bool>(config::ALLOC_REPL_FLAT)) {
-    logger->trace("searchAllocationFlat");
-    alloc = searchAllocationFlat(repl, conf_.dev_num, conf_.dev_mem);
-  } else {
-    logger->trace("searchAllocationSimple");
-    alloc = searchAllocationSimple(repl, conf_.dev_num, conf_.dev_mem);
-  }
+  const auto alloc = allocateDevices(repl, sol, conf_);
 
   std::unordered_map<std::string, TensorPartitioningGraphInfo> part_info;
   for (const auto& it : alloc) {
@@ -106,7 +114,13 @@ Deployment MLPartDecomposer::decompose(
   deployment.pipeline_num = sol.pipeline_num;
   deployment.checkpointing = sol.checkpointing;
   deployment.offload_params = conf_.offload_params;
+  // Params can be partitioned only in some stages with auto_dist_matmul
   deployment.force_dist_matmul = conf_.force_dist_matmul;
+  for (const auto& it : part_info) {
+    if (!it.second.param_partitions.empty()) {
+      deployment.force_dist_matmul = true;
+    }
+  }
   deployment.part_info = part_info;
 
   logger->trace("MLPartDecomposer::decompose finished");
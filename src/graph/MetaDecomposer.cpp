@@ -5,6 +5,7 @@
 #include "MetaDecomposer.h"
 #include "FairWeightDecomposer.h"
 #include "MLPartDecomposer.h"
+#include "RecomputePolicy.h"
 
 namespace rannc {
 enum class DecomposerType { FAIR_WEIGHT, ML_PART };
@@ -45,6 +46,8 @@ Deployment MetaDecomposer::decompose(
       break;
     }
   }
+  setRecomputePolicy(deployment);
+
   return deployment;
 }
 } // namespace rannc
\ No newline at end of file
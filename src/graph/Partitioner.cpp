@@ -3,8 +3,11 @@
 //
 
 #include "Partitioner.h"
+#include <cpg/CPG.h>
 #include <cuda/CudaUtil.h>
+#include <map>
 #include <random>
+#include <set>
 
 namespace rannc {
 
@@ -58,8 +61,12 @@ ProfilingInput MLPartitioner::makeProfileDistInput(
     const std::shared_ptr<IRGraph>& g) const {
   TensorPartitioningGraphInfo part_info;
   if (conf_.force_dist_matmul) {
+    const ParamPartitionMap param_part =
+        config::Config::get().getVal<bool>(config::CPG_SEARCH)
+        ? searchDistParams(g, conf_.dev_num)
+        : getDistParams(g);
     part_info =
-        replaceWithDistOp(g, createDummyRanks(conf_.dev_num), getDistParams(g));
+        replaceWithDistOp(g, createDummyRanks(conf_.dev_num), param_part);
   } else {
     part_info.graph = g;
   }
@@ -96,22 +103,92 @@ MLGraph MLPartitioner::mergeAdjacents(
   // communication time
   nodes_sort = sortNodesByEval(nodes_sort, bg);
 
+  // Nodes were profiled when sorted
+  std::vector<long> node_evals(boost::num_vertices(bg));
   long eval_sum = 0;
   for (const auto& bv : nodes_sort) {
-    const auto& v = bg[bv];
-    eval_sum += eval(profile(v.graph));
+    node_evals[bv] = eval(profile(bg[bv].graph));
+    eval_sum += node_evals[bv];
   }
   long eval_ave = eval_sum / nodes_sort.size();
   long eval_var = 0;
   for (const auto& bv : nodes_sort) {
-    const auto& v = bg[bv];
-    long d = eval(profile(v.graph)) - eval_ave;
+    long d = node_evals[bv] - eval_ave;
     eval_var += d * d;
   }
   long eval_sigma = std::sqrt(eval_var / nodes_sort.size());
 
+  // Estimate the improvement of all pairs of adjacent nodes in parallel. The
+  // estimate does not subtract the eval value of the merged node, which is not
+  // negative, so it bounds the improvement from above.
+  struct MergeCandidate {
+    MLVertex src;
+    MLVertex tgt;
+    bool valid;
+    long imprv;
+    std::shared_ptr<MLNode> merged;
+  };
+  std::vector<MergeCandidate> candidates;
+  std::unordered_map<MLVertex, std::pair<size_t, size_t>> candidate_ranges;
+  for (const auto& bv : nodes_sort) {
+    size_t begin = candidates.size();
+    for (const auto& b_adj : target_nodes<MLVertex, MLBGraph>(bv, bg)) {
+      candidates.push_back({bv, b_adj, false, -1, nullptr});
+    }
+    candidate_ranges[bv] = {begin, candidates.size()};
+  }
+
+  const ConvexityIndex conv_index(bg);
+  parallelFor(candidates.size(), thread_num_, [&](size_t i) {
+    auto& c = candidates.at(i);
+    if (!conv_index.isConvex(c.src, c.tgt)) {
+      return;
+    }
+
+    const auto& v = bg[c.src];
+    const auto& adj = bg[c.tgt];
+    const auto cut_values = getCutValues(v, adj);
+    long cut_size = getSize(cut_values);
+    long comm_time =
+        calcCommTime(cut_size / (conf_.dev_num * conf_.max_pipeline_num));
+
+    long eval_v = node_evals[c.src];
+    long eval_adj = node_evals[c.tgt];
+
+    // We do not merge nodes if the estimated time is extremely long
+    if (skip_profiling) {
+      if ((eval_v > eval_ave + eval_sigma * 2) ||
+          (eval_adj > eval_ave + eval_sigma * 2)) {
+        return;
+      }
+    }
+    c.imprv = eval_v + eval_adj + comm_time;
+    c.valid = true;
+  });
+
+  // Profiles a merged node when the matching reaches the candidate
+  const auto profile_candidate = [&](MergeCandidate& c) {
+    c.merged = std::make_shared<MLNode>(
+        merge(bg[c.src], bg[c.tgt], ml_graph.nodes, ml_graph.edges));
+    const auto& prof_merged = profile(c.merged->graph);
+    if (!fitToMem(
+            c.merged->graph, prof_merged, getMaxDevMem(conf_),
+            conf_.use_amp_master_params, conf_.enable_zero, max_repl_num_)) {
+      c.valid = false;
+      return;
+    }
+    long eval_merged = eval(prof_merged);
+    if (eval_merged > eval_ave + eval_sigma * 2) {
+      c.valid = false;
+      return;
+    }
+    c.imprv -= eval_merged;
+  };
+
+  // Greedy matching in the order of eval values
   std::unordered_set<MLVertex> matched;
   std::vector<MLNode> merged_nodes;
+  std::vector<MergeCandidate*> selected;
   std::unordered_map<std::string, std::string> name_map;
 
   for (const auto& bv : nodes_sort) {
@@ -119,117 +196,69 @@ MLGraph MLPartitioner::mergeAdjacents(
       continue;
     }
 
-    const auto& v = bg[bv];
-
-    long best_imprv = -1;
-    MLVertex best_adj;
-    MLNode best_merged = liftUp(v);
-
-    std::vector<MLVertex> targets;
+    MergeCandidate* best = nullptr;
     if (nodes_sort.size() - matched.size() + merged_nodes.size() >
         min_partition_num) {
-      targets = target_nodes<MLVertex, MLBGraph>(bv, bg);
-    }
-
-    for (const auto& b_adj : targets) {
-      const auto& adj = bg[b_adj];
-
-      if (contains(matched, b_adj)) {
-        //                    spdlog::info("v={} adj={}: adj is already
-        //                    matched", v.id, adj.id);
-        continue;
-      }
-
-      if (!isConvex(bv, b_adj, bg)) {
-        //                    spdlog::info("v={} adj={}: merged graph is not
-        //                    convex", v.id, adj.id);
-        continue;
-      }
-
-      const auto cut_values = getCutValues(v, adj);
-      long cut_size = getSize(cut_values);
-      long comm_time =
-          calcCommTime(cut_size / (conf_.dev_num * conf_.max_pipeline_num));
-
-      long eval_v = 0, eval_adj = 0, eval_merged = 0;
-
-      MLNode merged = merge(v, adj, ml_graph.nodes, ml_graph.edges);
-
-      //                std::stringstream ss;
-      //                ss << "id_v=" << v.id << " v=" << *v.graph
-      //                   << "id_adj=" << adj.id << " adj=" << *adj.graph
-      //                   << "id_merged=" << merged.id << " merged=" <<
-      //                   *merged.graph;
-      //                spdlog::info("merge {}", ss.str());
-
-      eval_v = eval(profile(v.graph));
-      eval_adj = eval(profile(adj.graph));
-
-      // We do not merge nodes if the estimated time is extremely long
-      bool skip_merge = false;
-      if (skip_profiling) {
-        skip_merge = (eval_v > eval_ave + eval_sigma * 2) ||
-            (eval_adj > eval_ave + eval_sigma * 2);
-      } else {
-        const auto& prof_merged = profile(merged.graph);
-        if (!fitToMem(
-                merged.graph, prof_merged, conf_.dev_mem,
-                conf_.use_amp_master_params, conf_.enable_zero,
-                max_repl_num_)) {
-          //                    spdlog::info("v={} adj={}: merged graph does not
-          //                    fit to mem. mem={}", v.id, adj.id,
-          //                    prof_merged.max_allocated_mem);
-          continue;
+      std::vector<MergeCandidate*> node_candidates;
+      const auto& range = candidate_ranges.at(bv);
+      for (size_t i = range.first; i < range.second; i++) {
+        auto& c = candidates.at(i);
+        if (c.valid && c.imprv >= 0 && !contains(matched, c.tgt)) {
+          node_candidates.push_back(&c);
         }
-        eval_merged = eval(prof_merged);
-        skip_merge = eval_merged > eval_ave + eval_sigma * 2;
       }
-
-      //                std::stringstream ss;
-      //                ss << "id_v=" << v.id << "eval_v=" << eval_v << " v=" <<
-      //                *v.graph
-      //                   << "id_adj=" << adj.id << " eval_adj=" << eval_adj <<
-      //                   " adj=" << *adj.graph
-      //                   << "id_merged=" << merged.id << " eval_merged=" <<
-      //                   eval_merged << " merged=" << *merged.graph
-      //                   << " eval_ave=" << eval_ave << " eval_sigma=" <<
-      //                   eval_sigma
-      //                   << " update=" << skip_merge
-      //                   << std::endl;
-      //                spdlog::info(ss.str());
-
-      if (!skip_merge) {
-        long imprv = eval_v + eval_adj + comm_time - eval_merged;
-
-        //                spdlog::info("v={} adj={} eval_v={} eval_adj={}
-        //                eval_merged={} comm={} improve={}",
-        //                             v.id, adj.id, eval_v, eval_adj,
-        //                             eval_merged, comm_time, imprv);
-
-        if (best_imprv <= imprv) {
-          //                    spdlog::info("UPDATED v={} best_imprv={}", v.id,
-          //                    adj.id, imprv);
-
-          best_adj = b_adj;
-          best_merged = merged;
-          best_imprv = imprv;
+      std::stable_sort(
+          node_candidates.begin(), node_candidates.end(),
+          [](const MergeCandidate* c1, const MergeCandidate* c2) {
+            return c1->imprv > c2->imprv;
+          });
+
+      // Candidates whose upper bounds are below the best improvement found
+      // are not profiled. Among equal improvements, the later candidate is
+      // taken.
+      for (auto c : node_candidates) {
+        if (best != nullptr && c->imprv < best->imprv) {
+          break;
+        }
+        if (!skip_profiling) {
+          profile_candidate(*c);
+          if (!c->valid || c->imprv < 0) {
+            continue;
+          }
+        }
+        if (best == nullptr || best->imprv < c->imprv ||
+            (best->imprv == c->imprv && best < c)) {
+          best = c;
         }
       }
-      //                spdlog::info("adj {} -> {} cut={} comm_time={}
-      //                imprv={}",
-      //                        v.id, adj.id, cut_size, comm_time, imprv);
     }
-    merged_nodes.push_back(best_merged);
-    matched.insert(bv);
-    name_map[v.id] = best_merged.id;
 
-    if (best_imprv >= 0) {
-      matched.insert(best_adj);
-      name_map[bg[best_adj].id] = best_merged.id;
-      //                spdlog::info("Merged best adj {}->{} imprv={}", v.id,
-      //                bg[best_adj].id, best_imprv);
+    matched.insert(bv);
+    if (best) {
+      matched.insert(best->tgt);
+      merged_nodes.emplace_back();
     } else {
-      //                spdlog::info("No merge {} as {}", v.id, best_merged.id);
+      merged_nodes.push_back(liftUp(bg[bv]));
+      name_map[bg[bv].id] = merged_nodes.back().id;
+    }
+    selected.push_back(best);
+  }
+
+  // Build merged nodes that were not created for profiling
+  parallelFor(selected.size(), thread_num_, [&](size_t i) {
+    auto c = selected.at(i);
+    if (c && !c->merged) {
+      c->merged = std::make_shared<MLNode>(
+          merge(bg[c->src], bg[c->tgt], ml_graph.nodes, ml_graph.edges));
+    }
+  });
+
+  for (size_t i = 0; i < selected.size(); i++) {
+    auto c = selected.at(i);
+    if (c) {
+      merged_nodes[i] = *c->merged;
+      name_map[bg[c->src].id] = merged_nodes[i].id;
+      name_map[bg[c->tgt].id] = merged_nodes[i].id;
     }
   }
 
@@ -492,259 +521,413 @@ MoveResult MLPartitioner::move_to_src(
   return MoveResult{new_src_node, new_tgt_node, new_edge};
 }
 
-struct NodeMove {
+namespace {
+// Number of FM passes and consecutive moves without improvement allowed in a
+// pass
+const int FM_MAX_PASS_NUM = 4;
+const size_t FM_MAX_NO_IMPRV_MOVES = 64;
+
+struct BoundaryMove {
+  std::string node_id; // level L-1
+  bool direction; // move from src to tgt if true
   std::string src_id; // level L
-  MLEdge edge; // level L
   std::string tgt_id; // level L
-  MLNode moved_node; // level L-1
-  MLEdge sub_edge; // level L-1
-  bool direction; // move src to tgt if true
+  long gain;
 };
 
-MLGraph MLPartitioner::adjustBoundaries(const MLGraph& ml_graph) {
-  std::unordered_map<std::string, MLNode> node_map;
-  std::unordered_map<std::string, MLNode> lower_node_map;
-  std::vector<MLEdge> all_sub_edges;
-
-  for (const auto& n : ml_graph.nodes) {
-    node_map[n.id] = n;
-    for (const auto& sn : n.sub_nodes) {
-      lower_node_map[sn.id] = sn;
+/**
+ * Fiduccia-Mattheyses style refinement of boundaries between nodes at level L.
+ * Nodes at level L-1 are moved across edges using estimated values: the eval
+ * value of a node at level L is the sum of those of its sub nodes and the
+ * communication time is given by the sizes of cut edges. Gains are kept in
+ * buckets and only the gains of moves near a moved node are updated.
+ */
+class BoundaryRefiner {
+ public:
+  BoundaryRefiner(
+      const MLGraph& ml_graph,
+      const std::unordered_map<std::string, long>& sub_evals, long comm_div)
+      : sub_evals_(sub_evals), comm_div_(comm_div) {
+    for (const auto& n : ml_graph.nodes) {
+      node_evals_[n.id] = 0;
+      for (const auto& sn : n.sub_nodes) {
+        owner_[sn.id] = n.id;
+        members_[n.id].insert(sn.id);
+        node_evals_[n.id] += sub_evals_.at(sn.id);
+      }
+      for (const auto& se : n.sub_edges) {
+        addSubEdge(se);
+      }
+    }
+    for (const auto& e : ml_graph.edges) {
+      for (const auto& se : e.sub_edges) {
+        addSubEdge(se);
+      }
     }
+  }
 
-    if (!verify(n)) {
-      spdlog::info("Node verification failed: {} {}", n.id, dumpMLNode(n));
-      throw std::runtime_error("Verification failed");
+  std::vector<BoundaryMove> refine() {
+    std::vector<BoundaryMove> accepted;
+    for (int pass = 0; pass < FM_MAX_PASS_NUM; pass++) {
+      const auto moves = runPass();
+      if (moves.empty()) {
+        break;
+      }
+      accepted.insert(accepted.end(), moves.begin(), moves.end());
     }
+    return accepted;
   }
 
-  MLEdgeMap edge_map;
-  for (const auto& e : ml_graph.edges) {
-    MLEdgeKey k{e.src_id, e.tgt_id};
-    edge_map[k] = e;
+ private:
+  void addSubEdge(const MLEdge& se) {
+    long size = calcEdgeSize(se);
+    out_edges_[se.src_id][se.tgt_id] += size;
+    in_edges_[se.tgt_id][se.src_id] += size;
+  }
 
-    for (const auto& se : e.sub_edges) {
-      all_sub_edges.push_back(se);
+  bool findMove(
+      const std::string& id, bool direction, BoundaryMove& move) const {
+    const auto& from = owner_.at(id);
+    if (members_.at(from).size() < 2) {
+      return false;
     }
-  }
 
-  // List possible choices of movements
-  std::unordered_map<std::string, std::vector<NodeMove>> move_choices;
-  for (const auto& e : ml_graph.edges) {
-    assert(contains(node_map, e.src_id));
-    assert(contains(node_map, e.tgt_id));
+    // Same conditions as moves made by move_to_tgt/move_to_src: the node has
+    // only one neighbor in another node in the direction of the move, and the
+    // others are in the same node.
+    const auto& fwd = direction ? out_edges_ : in_edges_;
+    const auto& bwd = direction ? in_edges_ : out_edges_;
+    if (!contains(fwd, id) || fwd.at(id).size() != 1) {
+      return false;
+    }
+    const auto& to = owner_.at(fwd.at(id).begin()->first);
+    if (to == from) {
+      return false;
+    }
+    if (contains(bwd, id)) {
+      for (const auto& it : bwd.at(id)) {
+        if (owner_.at(it.first) != from) {
+          return false;
+        }
+      }
+    }
 
-    const MLNode& src_node = node_map.at(e.src_id);
-    const MLNode& tgt_node = node_map.at(e.tgt_id);
+    move = BoundaryMove{id, direction, direction ? from : to,
+                        direction ? to : from, calcGain(id, from, to)};
+    return true;
+  }
 
-    //            spdlog::info("doUncoarsen checking edge: src_node={}
-    //            #src_elems={} tgt_node={} #tgt_elems={}",
-    //                         src_node.id, src_node.sub_nodes.size(),
-    //                         tgt_node.id, tgt_node.sub_nodes.size());
+  long calcGain(
+      const std::string& id, const std::string& from,
+      const std::string& to) const {
+    long cut_diff = 0;
+    for (const auto* edges : {&out_edges_, &in_edges_}) {
+      if (!contains(*edges, id)) {
+        continue;
+      }
+      for (const auto& it : edges->at(id)) {
+        const auto& adj_owner = owner_.at(it.first);
+        cut_diff += it.second * ((adj_owner != from) - (adj_owner != to));
+      }
+    }
 
-    for (const auto& se : e.sub_edges) { // lower level edges
-      //                spdlog::info("Move candidate src: {}", se.src_id);
-      assert(contains(lower_node_map, se.src_id));
-      //                spdlog::info("Move candidate tgt: {}", se.tgt_id);
-      assert(contains(lower_node_map, se.tgt_id));
+    // The larger node bounds the time of a pipeline stage
+    long e = sub_evals_.at(id);
+    long e_from = node_evals_.at(from);
+    long e_to = node_evals_.at(to);
+    long bal_diff = std::max(e_from, e_to) - std::max(e_from - e, e_to + e);
 
-      const MLNode& moved_node_src = lower_node_map.at(se.src_id);
-      move_choices[moved_node_src.id].push_back(
-          NodeMove{src_node.id, e, tgt_node.id, moved_node_src, se, true});
+    return calcCommTime(cut_diff / comm_div_) + bal_diff;
+  }
 
-      const MLNode& moved_node_tgt = lower_node_map.at(se.tgt_id);
-      move_choices[moved_node_tgt.id].push_back(
-          NodeMove{src_node.id, e, tgt_node.id, moved_node_tgt, se, false});
+  void removeMoves(const std::string& id) {
+    for (bool direction : {true, false}) {
+      const auto key = moveKey(id, direction);
+      if (contains(moves_, key)) {
+        long gain = moves_.at(key).gain;
+        buckets_[gain].erase(key);
+        if (buckets_.at(gain).empty()) {
+          buckets_.erase(gain);
+        }
+        moves_.erase(key);
+      }
     }
   }
 
-  std::vector<std::string> move_cand_ids = keys(move_choices);
-  //        std::vector<std::string> move_cand_ids =
-  //        shuffle(keys(move_choices));
-  std::vector<MLNode> all_nodes = ml_graph.nodes;
-  for (const auto& move_node_id : move_cand_ids) {
-    //            spdlog::info("Checking node move: move_node_id={}",
-    //            move_node_id);
-    const auto& possible_moves = move_choices.at(move_node_id);
-    assert(!possible_moves.empty());
-
-    MoveResult best_moved_result;
-    long best_imprv = 0;
-
-    for (const auto& move : possible_moves) {
-      assert(contains(node_map, move.src_id));
-      const MLNode& src_node = node_map.at(move.src_id);
-      assert(contains(node_map, move.tgt_id));
-      const MLNode& tgt_node = node_map.at(move.tgt_id);
-
-      if (move.direction) {
-        if (src_node.sub_nodes.size() < 2 ||
-            countRefTgtInSubgraph(src_node, move.moved_node) != 0 ||
-            countRefInEdgesSrc(move.moved_node, all_sub_edges) > 1 ||
-            countRefInEdgesTgt(move.moved_node, all_sub_edges) != 0) {
-          continue;
-        }
-      } else {
-        if (tgt_node.sub_nodes.size() < 2 ||
-            countRefSrcInSubgraph(tgt_node, move.moved_node) != 0 ||
-            countRefInEdgesTgt(move.moved_node, all_sub_edges) > 1 ||
-            countRefInEdgesSrc(move.moved_node, all_sub_edges) != 0) {
-          continue;
-        }
+  void updateMoves(const std::string& id) {
+    removeMoves(id);
+    if (contains(locked_, id)) {
+      return;
+    }
+    for (bool direction : {true, false}) {
+      BoundaryMove move;
+      if (findMove(id, direction, move)) {
+        const auto key = moveKey(id, direction);
+        moves_[key] = move;
+        buckets_[move.gain].insert(key);
       }
+    }
+  }
 
-      MLEdgeKey k{move.edge.src_id, move.edge.tgt_id};
-      // get current edge@L
-      // An edge can be modified during this iteration
-      MLEdge edge = edge_map.at(k);
+  void apply(const BoundaryMove& move, bool undo) {
+    const auto& from = (move.direction ^ undo) ? move.src_id : move.tgt_id;
+    const auto& to = (move.direction ^ undo) ? move.tgt_id : move.src_id;
+    long e = sub_evals_.at(move.node_id);
+    owner_[move.node_id] = to;
+    members_[from].erase(move.node_id);
+    members_[to].insert(move.node_id);
+    node_evals_[from] -= e;
+    node_evals_[to] += e;
+  }
 
-      // The edge@L may not contain subedge from/to moved_node anymore
-      if (!containsSubedge(edge, move.sub_edge)) {
-        continue;
+  std::vector<BoundaryMove> runPass() {
+    locked_.clear();
+    moves_.clear();
+    buckets_.clear();
+    for (const auto& id : keys(owner_)) {
+      updateMoves(id);
+    }
+
+    std::vector<BoundaryMove> seq;
+    long sum_gain = 0;
+    long best_gain = 0;
+    size_t best_len = 0;
+    while (!buckets_.empty() && seq.size() - best_len < FM_MAX_NO_IMPRV_MOVES) {
+      // Take a move with the largest gain
+      const auto& key = *buckets_.rbegin()->second.begin();
+      const BoundaryMove move = moves_.at(key);
+
+      apply(move, false);
+      locked_.insert(move.node_id);
+      removeMoves(move.node_id);
+      seq.push_back(move);
+
+      sum_gain += move.gain;
+      if (sum_gain > best_gain) {
+        best_gain = sum_gain;
+        best_len = seq.size();
       }
 
-      MoveResult moved_result;
-      if (move.direction) {
-        if (!containsSubgraph(src_node, move.moved_node.id)) {
-          continue;
+      // Gains change only for nodes in the two nodes at level L and their
+      // neighbors
+      std::unordered_set<std::string> affected;
+      for (const auto& n : {move.src_id, move.tgt_id}) {
+        for (const auto& id : members_.at(n)) {
+          affected.insert(id);
+          for (const auto* edges : {&out_edges_, &in_edges_}) {
+            if (contains(*edges, id)) {
+              for (const auto& it : edges->at(id)) {
+                affected.insert(it.first);
+              }
+            }
+          }
         }
-        moved_result = move_to_tgt(
-            src_node, edge, tgt_node, move.sub_edge, move.moved_node,
-            getRequiredInputs(src_node, tgt_node, all_nodes));
-      } else {
-        if (!containsSubgraph(tgt_node, move.moved_node.id)) {
-          continue;
-        }
-        moved_result = move_to_src(
-            src_node, edge, tgt_node, move.sub_edge, move.moved_node,
-            getPreservedOutputs(
-                src_node.id, move.moved_node.graph->getName(), all_nodes));
       }
-
-      if (!verifyNodeInputs(moved_result.src_node.graph) ||
-          !verifyNodeInputs(moved_result.tgt_node.graph)) {
-        continue;
+      for (const auto& id : setToVector(affected)) {
+        updateMoves(id);
       }
+    }
 
-      if (!verify(moved_result.src_node) || !verify(moved_result.tgt_node) ||
-          !verifyNoDuplicatedOutputs(moved_result.src_node.graph) ||
-          !verifyNoDuplicatedOutputs(moved_result.tgt_node.graph) ||
-          !verifyNodeInputs(moved_result.src_node.graph, true) ||
-          !verifyNodeInputs(moved_result.tgt_node.graph, true) ||
-          !noUnusedValue(moved_result.src_node.graph, true) ||
-          !noUnusedValue(moved_result.tgt_node.graph, true)) {
-        spdlog::info(
-            "Node verification failed after move: direction={} SRC {}={} TGT {}={}",
-            move.direction, moved_result.src_node.id,
-            verify(moved_result.src_node), moved_result.tgt_node.id,
-            verify(moved_result.tgt_node));
-
-        spdlog::info(
-            "Move choice: src={} tgt={} move={} direction={}", move.src_id,
-            move.tgt_id, move.moved_node.id, move.direction);
-
-        spdlog::info(
-            "TO REMOVE: id={} g={} \nBEFORE MOVE: src={}\n tgt={}",
-            move.moved_node.id, toString(*move.moved_node.graph),
-            toString(*src_node.graph), toString(*tgt_node.graph));
-
-        spdlog::info(
-            "MOVE_RESULT: src {}\ntgt ={}",
-            toString(*moved_result.src_node.graph),
-            toString(*moved_result.tgt_node.graph));
-
-        if (move.direction) {
-          spdlog::info(
-              "countRefTgtInSubgraph={} countRefInEdgesSrc={} countRefInEdgesTgt={}",
-              countRefTgtInSubgraph(src_node, move.moved_node),
-              countRefInEdgesSrc(move.moved_node, all_sub_edges),
-              countRefInEdgesTgt(move.moved_node, all_sub_edges));
-        } else {
-          spdlog::info(
-              "countRefSrcInSubgraph={} countRefInEdgesTgt={} countRefInEdgesSrc={}",
-              countRefSrcInSubgraph(tgt_node, move.moved_node),
-              countRefInEdgesTgt(move.moved_node, all_sub_edges),
-              countRefInEdgesSrc(move.moved_node, all_sub_edges));
-        }
+    // Roll back to the best point
+    while (seq.size() > best_len) {
+      apply(seq.back(), true);
+      seq.pop_back();
+    }
+    return seq;
+  }
 
-        for (const auto& sn : src_node.sub_nodes) {
-          spdlog::info("source subnode graph: {}", toString(*sn.graph));
-        }
-        for (const auto& sn : tgt_node.sub_nodes) {
-          spdlog::info("target subnode graph: {}", toString(*sn.graph));
-        }
+  static std::string moveKey(const std::string& id, bool direction) {
+    return id + (direction ? "+" : "-");
+  }
 
-        throw std::runtime_error("Verification failed");
-      }
+  const std::unordered_map<std::string, long>& sub_evals_;
+  long comm_div_;
+
+  std::unordered_map<std::string, std::string> owner_;
+  std::unordered_map<std::string, std::unordered_set<std::string>> members_;
+  std::unordered_map<std::string, long> node_evals_;
+  // node id -> adjacent node id -> size of values
+  std::unordered_map<std::string, std::unordered_map<std::string, long>>
+      out_edges_;
+  std::unordered_map<std::string, std::unordered_map<std::string, long>>
+      in_edges_;
+
+  std::unordered_set<std::string> locked_;
+  std::unordered_map<std::string, BoundaryMove> moves_;
+  // gain -> keys of moves
+  std::map<long, std::set<std::string>> buckets_;
+};
+} // namespace
 
-      //                spdlog::info("AFTER MOVE: src={}",
-      //                toString(*moved_result.src_node.graph));
-      //                spdlog::info("AFTER MOVE: tgt={}",
-      //                toString(*moved_result.tgt_node.graph));
+MLGraph MLPartitioner::adjustBoundaries(const MLGraph& ml_graph) {
+  std::unordered_map<std::string, MLNode> node_map;
+  std::unordered_map<std::string, MLNode> lower_node_map;
+  std::unordered_map<std::string, long> sub_evals;
 
-      long eval_src = eval(profile(src_node.graph));
-      long eval_tgt = eval(profile(tgt_node.graph));
-      long eval_comm = calcCommTime(
-          calcEdgeSize(edge) / (conf_.dev_num * conf_.max_pipeline_num));
+  for (const auto& n : ml_graph.nodes) {
+    node_map[n.id] = n;
+    for (const auto& sn : n.sub_nodes) {
+      lower_node_map[sn.id] = sn;
+      // Nodes at level L-1 were profiled during coarsening
+      sub_evals[sn.id] = eval(profile(sn.graph));
+    }
 
-      const auto prof_moved_src = profile(moved_result.src_node.graph);
-      long eval_moved_src = eval(prof_moved_src);
-      if (!fitToMem(
-              moved_result.src_node.graph, prof_moved_src, conf_.dev_mem,
-              conf_.use_amp_master_params, conf_.enable_zero, max_repl_num_)) {
-        continue;
-      }
+    if (!verify(n)) {
+      spdlog::info("Node verification failed: {} {}", n.id, dumpMLNode(n));
+      throw std::runtime_error("Verification failed");
+    }
+  }
 
-      const auto prof_moved_tgt = profile(moved_result.tgt_node.graph);
-      long eval_moved_tgt = eval(prof_moved_tgt);
-      if (!fitToMem(
-              moved_result.tgt_node.graph, prof_moved_tgt, conf_.dev_mem,
-              conf_.use_amp_master_params, conf_.enable_zero, max_repl_num_)) {
-        continue;
-      }
-      long eval_moved_comm = calcCommTime(
-          calcEdgeSize(moved_result.edge) /
-          (conf_.dev_num * conf_.max_pipeline_num));
+  MLEdgeMap edge_map;
+  for (const auto& e : ml_graph.edges) {
+    MLEdgeKey k{e.src_id, e.tgt_id};
+    edge_map[k] = e;
+  }
 
-      long imprv = (eval_src + eval_tgt + eval_comm) -
-          (eval_moved_src + eval_moved_tgt + eval_moved_comm);
+  const long comm_div = conf_.dev_num * conf_.max_pipeline_num;
+  BoundaryRefiner refiner(ml_graph, sub_evals, comm_div);
+  const auto moves = refiner.refine();
+  if (moves.empty()) {
+    return ml_graph;
+  }
 
-      if (imprv > best_imprv) {
-        best_imprv = imprv;
-        best_moved_result = moved_result;
+  // Keep the order of the original nodes and edges so that the result does
+  // not depend on the iteration order of the maps
+  const auto sorted_nodes = [&ml_graph, &node_map]() {
+    std::vector<MLNode> nodes;
+    for (const auto& n : ml_graph.nodes) {
+      nodes.push_back(node_map.at(n.id));
+    }
+    return nodes;
+  };
+  const auto sorted_edges = [&ml_graph, &edge_map]() {
+    std::vector<MLEdge> edges;
+    for (const auto& e : ml_graph.edges) {
+      MLEdgeKey k{e.src_id, e.tgt_id};
+      if (contains(edge_map, k)) {
+        edges.push_back(edge_map.at(k));
       }
     }
+    return edges;
+  };
 
-    if (best_imprv > 0) {
-      //                spdlog::info("MOVE: best_imprv={} src_id={} tgt_id={}",
-      //                best_imprv,
-      //                             best_moved_result.src_node.id,
-      //                             best_moved_result.tgt_node.id);
+  // Build nodes for the accepted moves
+  std::vector<MLNode> all_nodes = ml_graph.nodes;
+  std::unordered_set<std::string> changed_nodes;
+  size_t applied_num = 0;
+  for (const auto& move : moves) {
+    const MLNode& src_node = node_map.at(move.src_id);
+    const MLNode& tgt_node = node_map.at(move.tgt_id);
+    const MLNode& moved_node = lower_node_map.at(move.node_id);
+
+    MLEdgeKey k{move.src_id, move.tgt_id};
+    if (!contains(edge_map, k)) {
+      break;
+    }
+    const MLEdge edge = edge_map.at(k);
+
+    MLEdge sub_edge;
+    bool found = false;
+    for (const auto& se : edge.sub_edges) {
+      if ((move.direction && se.src_id == move.node_id) ||
+          (!move.direction && se.tgt_id == move.node_id)) {
+        sub_edge = se;
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      break;
+    }
 
-      node_map[best_moved_result.src_node.id] = best_moved_result.src_node;
-      node_map[best_moved_result.tgt_node.id] = best_moved_result.tgt_node;
-      MLEdgeKey k{best_moved_result.edge.src_id, best_moved_result.edge.tgt_id};
+    MoveResult moved_result;
+    if (move.direction) {
+      moved_result = move_to_tgt(
+          src_node, edge, tgt_node, sub_edge, moved_node,
+          getRequiredInputs(src_node, tgt_node, all_nodes));
+    } else {
+      moved_result = move_to_src(
+          src_node, edge, tgt_node, sub_edge, moved_node,
+          getPreservedOutputs(
+              src_node.id, moved_node.graph->getName(), all_nodes));
+    }
 
-      if (best_moved_result.edge.sub_edges.empty()) {
-        edge_map.erase(k);
-      } else {
-        edge_map[k] = best_moved_result.edge;
-      }
+    if (!verify(moved_result.src_node) || !verify(moved_result.tgt_node) ||
+        !verifyNodeInputs(moved_result.src_node.graph, true) ||
+        !verifyNodeInputs(moved_result.tgt_node.graph, true) ||
+        !verifyNoDuplicatedOutputs(moved_result.src_node.graph) ||
+        !verifyNoDuplicatedOutputs(moved_result.tgt_node.graph) ||
+        !noUnusedValue(moved_result.src_node.graph, true) ||
+        !noUnusedValue(moved_result.tgt_node.graph, true)) {
+      logger->trace(
+          "Stopped applying boundary moves: move={} src={} tgt={} direction={}",
+          move.node_id, move.src_id, move.tgt_id, move.direction);
+      break;
+    }
 
-      all_nodes = values(node_map);
+    node_map[moved_result.src_node.id] = moved_result.src_node;
+    node_map[moved_result.tgt_node.id] = moved_result.tgt_node;
+    if (moved_result.edge.sub_edges.empty()) {
+      edge_map.erase(k);
+    } else {
+      edge_map[k] = moved_result.edge;
+    }
+    all_nodes = sorted_nodes();
+    changed_nodes.insert(move.src_id);
+    changed_nodes.insert(move.tgt_id);
+    applied_num++;
+  }
 
-      all_sub_edges.clear();
-      for (const auto& e : values(edge_map)) {
-        for (const auto& se : e.sub_edges) {
-          all_sub_edges.push_back(se);
-        }
-      }
+  if (applied_num == 0) {
+    return ml_graph;
+  }
 
-      assert(verify(MLGraph{values(node_map), values(edge_map)}));
+  // Profile only the resulting nodes and keep the original if they are not
+  // better. As in BoundaryRefiner, the largest node bounds the time of a
+  // pipeline stage, and the communication time of cut edges is added to it.
+  long eval_before = 0;
+  long eval_after = 0;
+  for (const auto& n : ml_graph.nodes) {
+    if (contains(changed_nodes, n.id)) {
+      eval_before = std::max(eval_before, eval(profile(n.graph)));
+
+      const auto& new_node = node_map.at(n.id);
+      const auto prof = profile(new_node.graph);
+      if (!fitToMem(
+              new_node.graph, prof, getMaxDevMem(conf_),
+              conf_.use_amp_master_params, conf_.enable_zero,
+              max_repl_num_)) {
+        logger->trace(
+            "Discarded boundary moves: {} does not fit to memory", n.id);
+        return ml_graph;
+      }
+      eval_after = std::max(eval_after, eval(prof));
+    }
+  }
+  for (const auto& e : ml_graph.edges) {
+    if (contains(changed_nodes, e.src_id) ||
+        contains(changed_nodes, e.tgt_id)) {
+      eval_before += calcCommTime(calcEdgeSize(e) / comm_div);
     }
   }
+  for (const auto& it : edge_map) {
+    const auto& e = it.second;
+    if (contains(changed_nodes, e.src_id) ||
+        contains(changed_nodes, e.tgt_id)) {
+      eval_after += calcCommTime(calcEdgeSize(e) / comm_div);
+    }
+  }
+
+  logger->trace(
+      "Boundary refinement: #moves={} eval_before={} eval_after={}",
+      applied_num, eval_before, eval_after);
+  if (eval_after >= eval_before) {
+    return ml_graph;
+  }
 
-  return MLGraph{values(node_map), values(edge_map)};
+  MLGraph result{sorted_nodes(), sorted_edges()};
+  assert(verify(result));
+  return result;
 }
 
 MLGraph MLPartitioner::uncoarsen(const MLGraph& ml_graph) {
@@ -797,7 +980,7 @@ MLGraph MLPartitioner::mergeSmall(
           merge(preceding, min_node, merged_graph.nodes, merged_graph.edges);
       const auto prof_in = makeProfileDistInput(merged.graph);
       const auto prof = prof_util_.profile(prof_in);
-      if (!fitToMem(merged.graph, prof, conf_.dev_mem, prof_in)) {
+      if (!fitToMem(merged.graph, prof, getMaxDevMem(conf_), prof_in)) {
         break;
       }
       min_adj_eval = eval(prof);
@@ -812,7 +995,7 @@ MLGraph MLPartitioner::mergeSmall(
           merge(min_node, following, merged_graph.nodes, merged_graph.edges);
       const auto prof_in = makeProfileDistInput(merged_fol.graph);
       const auto prof = prof_util_.profile(prof_in);
-      if (!fitToMem(merged_fol.graph, prof, conf_.dev_mem, prof_in)) {
+      if (!fitToMem(merged_fol.graph, prof, getMaxDevMem(conf_), prof_in)) {
         break;
       }
       long val_following = eval(prof);
@@ -6,6 +6,7 @@
 #define PYRANNC_PARTITIONER_H
 
 #include <comp/GraphProfiler.h>
+#include <Config.h>
 #include <ostream>
 #include "Decomposition.h"
 #include "ir.h"
@@ -38,6 +39,8 @@ class MLPartitioner {
         conf_(std::move(conf)),
         coarsen_by_time_(coarsen_by_time) {
     max_repl_num_ = conf.dev_num;
+    thread_num_ =
+        config::Config::get().getVal<int>(config::PARTITIONING_THREAD_NUM);
   }
 
   MLGraph partition(const std::shared_ptr<IRGraph>& ir_graph);
@@ -86,6 +89,7 @@ class MLPartitioner {
   size_t batch_size_;
   bool coarsen_by_time_;
   int max_repl_num_;
+  size_t thread_num_;
 
   static const int DEFALUT_ITERATION_NUM;
 
@@ -0,0 +1,329 @@
+#include "PlanStore.h"
+
+#include <iomanip>
+
+#include <Config.h>
+#include "RecomputePolicy.h"
+
+namespace rannc {
+
+namespace {
+const std::string PLAN_FILE_PREFIX = "plan_";
+const std::string ENTRY_FILE_SUFFIX = ".bin";
+const std::string DP_CACHE_FILE = "dp_cache.bin";
+const std::string GRAPH_PROFILE_FILE = "graph_profile.bin";
+
+// FNV-1a. Unlike std::hash, the value does not depend on the standard library
+// and can be shared across builds.
+uint64_t hashBytes(const char* data, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Tensors are written by the hash of the contents, which does not depend on
+// the device holding them
+void writeConstant(std::ostream& os, const torch::jit::IValue& iv) {
+  if (iv.isTensor()) {
+    const auto ten = iv.toTensor()
+                         .detach()
+                         .to(c10::Device(c10::DeviceType::CPU))
+                         .contiguous();
+    os << "T" << ten.scalar_type() << join_as_str(ten.sizes().vec()) << "#"
+       << hashBytes(static_cast<const char*>(ten.data_ptr()), ten.nbytes());
+  } else if (iv.isTensorList()) {
+    os << "[";
+    for (const auto& ten : iv.toTensorVector()) {
+      writeConstant(os, ten);
+      os << ",";
+    }
+    os << "]";
+  } else if (iv.isTuple()) {
+    os << "(";
+    for (const auto& elem : iv.toTuple()->elements()) {
+      writeConstant(os, elem);
+      os << ",";
+    }
+    os << ")";
+  } else {
+    os << iv.tagKind() << ":" << iv;
+  }
+}
+
+// Configuration items read by the partitioner and not in PartitioningConf
+const std::vector<std::string>& getPartitioningConfigItems() {
+  static const std::vector<std::string> items = {
+      config::ALLOC_MEM_AWARE,
+      config::ALLOC_REPL_FLAT,
+      config::CHECKPOINTING,
+      config::COARSEN_BY_TIME,
+      config::CONSOLIDATE_GRADS,
+      config::CPG_BEAM_WIDTH,
+      config::CPG_SEARCH,
+      config::DO_COARSENING,
+      config::DO_UNCOARSENING,
+      config::DP_SEARCH_ALL,
+      config::GRAD_COMPRESSION,
+      config::LIMIT_DEV_NUM_MORE_THAN_BS,
+      config::LIMIT_DEV_NUM_POT,
+      config::MEM_LIMIT_GB,
+      config::MEM_MARGIN,
+      config::MIN_PIPELINE_BS,
+      config::OFFLOAD_ACTIVATIONS,
+      config::POWERSGD_RANK,
+      config::PROFILE_BY_ACC,
+      config::REPLICA_NUM,
+      config::SELECTIVE_RECOMPUTE,
+      config::TOPK_RATIO};
+  return items;
+}
+
+std::string toHex(uint64_t val) {
+  std::stringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << val;
+  return ss.str();
+}
+} // namespace
+
+std::string getModelFingerprint(
+    const std::shared_ptr<IRGraph>& g, const IValueMap& constants) {
+  std::stringstream ss;
+
+  ss << "in=";
+  for (const auto& in_name : g->getInputNames()) {
+    const auto& val = g->getValue(in_name);
+    IRType type = val.getType();
+    if (!val.isParam()) {
+      type.setBatchSize(0);
+    }
+    ss << in_name << ":" << toString(type) << (val.isParam() ? ":P" : "")
+       << ",";
+  }
+  for (const auto& node : g->getNodes()) {
+    ss << ";" << node.getName() << "(" << join_as_str(node.getInputNames())
+       << ")->(" << join_as_str(node.getOutputNames()) << ")";
+    for (const auto& out_name : node.getOutputNames()) {
+      IValueLocation loc(out_name);
+      if (contains(constants, loc)) {
+        ss << out_name << "=";
+        writeConstant(ss, constants.at(loc));
+        ss << ",";
+      }
+    }
+  }
+  ss << ";out=" << join_as_str(g->getOutputNames());
+
+  const auto str = ss.str();
+  return toHex(hashBytes(str.data(), str.size()));
+}
+
+PlanKey makePlanKey(
+    const PartitioningConf& conf, const std::string& decomp_name) {
+  config::Config& config = config::Config::get();
+
+  std::stringstream ss;
+  for (const auto& item : getPartitioningConfigItems()) {
+    ss << item << "=" << config.getValAsString(item) << ";";
+  }
+  return PlanKey{conf, decomp_name, ss.str()};
+}
+
+std::string getConfFingerprint(const PlanKey& key) {
+  PlanKey fp_key = key;
+  if (!isHeterogeneous(fp_key.conf.dev_caps)) {
+    fp_key.conf.dev_caps.clear();
+  }
+  const auto data = serialize(fp_key);
+  return toHex(hashBytes(data.data(), data.size()));
+}
+
+std::string PlanStore::getModelDir(const std::string& model_fp) const {
+  return (fs::path(dir_) / model_fp).string();
+}
+
+std::string PlanStore::getPlanFile(
+    const std::string& model_fp, const PlanKey& key) const {
+  const auto file =
+      PLAN_FILE_PREFIX + getConfFingerprint(key) + ENTRY_FILE_SUFFIX;
+  return (fs::path(getModelDir(model_fp)) / file).string();
+}
+
+template <typename T>
+void PlanStore::saveEntry(const std::string& path, const T& obj) const {
+  fs::create_directories(fs::path(path).parent_path());
+
+  // Jobs sharing the store may write the same entry at the same time. Readers
+  // see either the old or the new file.
+  const auto tmp_path = path + "." + fs::unique_path().string();
+  saveToFile(tmp_path, obj);
+  fs::rename(tmp_path, path);
+}
+
+bool PlanStore::hasPlan(
+    const std::string& model_fp, const PlanKey& key) const {
+  return fs::exists(getPlanFile(model_fp, key));
+}
+
+Deployment PlanStore::loadPlan(
+    const std::string& model_fp, const PlanKey& key) const {
+  const auto entry = loadFromFile<PlanEntry>(getPlanFile(model_fp, key));
+  if (getConfFingerprint(entry.key) != getConfFingerprint(key)) {
+    throw std::invalid_argument(
+        "The configuration of the stored plan does not match: model=" +
+        model_fp);
+  }
+  return entry.deployment;
+}
+
+void PlanStore::savePlan(
+    const std::string& model_fp, const PlanKey& key,
+    const Deployment& deployment) const {
+  const auto path = getPlanFile(model_fp, key);
+  logger->info(
+      "Saving a plan to {} (dev_num={} batch_size={})", path,
+      key.conf.dev_num, key.conf.batch_size);
+  saveEntry(path, PlanEntry{key, deployment});
+}
+
+std::vector<PlanKey> PlanStore::listPlans(
+    const std::string& model_fp) const {
+  const fs::path model_dir = getModelDir(model_fp);
+  if (!fs::is_directory(model_dir)) {
+    return {};
+  }
+
+  // Oldest first
+  std::vector<std::pair<std::time_t, std::string>> files;
+  for (const auto& entry : fs::directory_iterator(model_dir)) {
+    const auto file = entry.path().filename().string();
+    if (begins_with(file, PLAN_FILE_PREFIX) &&
+        ends_with(file, ENTRY_FILE_SUFFIX)) {
+      files.emplace_back(
+          fs::last_write_time(entry.path()), entry.path().string());
+    }
+  }
+  std::sort(files.begin(), files.end());
+
+  std::vector<PlanKey> keys;
+  for (const auto& it : files) {
+    keys.push_back(loadFromFile<PlanEntry>(it.second).key);
+  }
+  return keys;
+}
+
+std::vector<std::string> PlanStore::listModels() const {
+  std::vector<std::string> models;
+  if (!fs::is_directory(dir_)) {
+    return models;
+  }
+  for (const auto& entry : fs::directory_iterator(dir_)) {
+    if (fs::is_directory(entry.path())) {
+      models.push_back(entry.path().filename().string());
+    }
+  }
+  std::sort(models.begin(), models.end());
+  return models;
+}
+
+bool PlanStore::hasDPCache(const std::string& model_fp) const {
+  return fs::exists(fs::path(getModelDir(model_fp)) / DP_CACHE_FILE);
+}
+
+DPStagingCache PlanStore::loadDPCache(const std::string& model_fp) const {
+  return loadFromFile<DPStagingCache>(
+      (fs::path(getModelDir(model_fp)) / DP_CACHE_FILE).string());
+}
+
+void PlanStore::saveDPCache(
+    const std::string& model_fp, const DPStagingCache& cache) const {
+  const auto path = (fs::path(getModelDir(model_fp)) / DP_CACHE_FILE).string();
+  logger->info("Saving DP cache to {}", path);
+  saveEntry(path, cache);
+}
+
+bool PlanStore::hasProfiles(const std::string& model_fp) const {
+  return fs::exists(getProfileFile(model_fp));
+}
+
+std::string PlanStore::getProfileFile(const std::string& model_fp) const {
+  return (fs::path(getModelDir(model_fp)) / GRAPH_PROFILE_FILE).string();
+}
+
+size_t precomputePlans(
+    const PlanStore& store, const std::string& model_fp,
+    const std::vector<int>& world_sizes,
+    const std::vector<size_t>& batch_sizes) {
+  const auto logger = getLogger("PlanStore");
+
+  const auto base_keys = store.listPlans(model_fp);
+  if (base_keys.empty() || !store.hasDPCache(model_fp)) {
+    throw std::invalid_argument(
+        "No plan or DP cache of the model found in the plan store: model=" +
+        model_fp);
+  }
+  const auto& base_conf = base_keys.front().conf;
+  const auto& decomp_name = base_keys.front().decomp_name;
+  const auto base_cache = store.loadDPCache(model_fp);
+
+  if (makePlanKey(base_conf, decomp_name).config_items !=
+      base_keys.front().config_items) {
+    logger->warn(
+        "The configuration items that affect partitioning differ from those of the base plan. The plans are computed and stored with the current ones.");
+  }
+
+  std::vector<size_t> target_batch_sizes = batch_sizes;
+  if (target_batch_sizes.empty()) {
+    target_batch_sizes.push_back(base_conf.batch_size);
+  }
+
+  size_t count = 0;
+  for (int world_size : world_sizes) {
+    for (size_t batch_size : target_batch_sizes) {
+      // The DP cache has the configuration adjusted for available memory.
+      // The plan is keyed by the configuration given by the job.
+      PartitioningConf conf = base_conf;
+      DPStagingCache cache = base_cache;
+      conf.dev_num = cache.conf.dev_num = world_size;
+      conf.batch_size = cache.conf.batch_size = batch_size;
+
+      if (world_size != base_conf.dev_num) {
+        if (isHeterogeneous(base_conf.dev_caps)) {
+          logger->warn(
+              "Skipped world_size={} because the devices of the base configuration are heterogeneous.",
+              world_size);
+          continue;
+        }
+        conf.dev_caps.clear();
+        cache.conf.dev_caps.clear();
+      }
+
+      const auto key = makePlanKey(conf, decomp_name);
+      if (store.hasPlan(model_fp, key)) {
+        logger->info(
+            "Plan exists: world_size={} batch_size={}", world_size,
+            batch_size);
+        continue;
+      }
+
+      logger->info(
+          "Computing a plan: world_size={} batch_size={}", world_size,
+          batch_size);
+      try {
+        DPDryStaging dp(cache);
+        Deployment deployment = dp.partition();
+        setRecomputePolicy(deployment);
+        store.savePlan(model_fp, key, deployment);
+        count++;
+      } catch (std::exception& e) {
+        logger->warn(
+            "Failed to compute a plan: world_size={} batch_size={} {}",
+            world_size, batch_size, e.what());
+      }
+    }
+  }
+  return count;
+}
+} // namespace rannc
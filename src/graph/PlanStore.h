@@ -0,0 +1,131 @@
+#ifndef PYRANNC_PLANSTORE_H
+#define PYRANNC_PLANSTORE_H
+
+#include <Logging.h>
+#include <torch/TorchUtil.h>
+#include "Decomposition.h"
+#include "DPStaging.h"
+#include "ir.h"
+
+namespace rannc {
+
+/**
+ * Computes a key that identifies a model. The key covers the structure of the
+ * graph, the types of the graph inputs, which values are parameters, and the
+ * values of constants (e.g. a scale or the shape given to a view). It does not
+ * need the types found by the profiler, so that a plan can be looked up before
+ * profiling. The first dimension of non-parameter inputs is excluded because
+ * it is the batch dimension, and the batch size is a part of
+ * *PartitioningConf*.
+ *
+ * @param g Graph of the whole model.
+ * @param constants Constants used in the graph.
+ * @return Fingerprint of the model.
+ */
+std::string getModelFingerprint(
+    const std::shared_ptr<IRGraph>& g, const IValueMap& constants);
+
+/**
+ * Key of a plan. In addition to *PartitioningConf*, partitioning depends on
+ * the decomposer and configuration items read by the partitioner (e.g.
+ * *selective_recompute* and *grad_compression*).
+ */
+struct PlanKey {
+  PartitioningConf conf;
+  std::string decomp_name;
+  // Values of the configuration items that affect partitioning
+  std::string config_items;
+
+  MSGPACK_DEFINE(conf, decomp_name, config_items);
+};
+
+/**
+ * Creates a key of a plan with the current values of the configuration items
+ * that affect partitioning.
+ *
+ * @param conf Configuration of partitioning.
+ * @param decomp_name Name of the decomposer.
+ * @return Key of a plan.
+ */
+PlanKey makePlanKey(
+    const PartitioningConf& conf, const std::string& decomp_name);
+
+/**
+ * Computes a key that identifies a configuration of partitioning. Capabilities
+ * of devices are ignored unless the devices are heterogeneous.
+ *
+ * @param key Key of a plan.
+ * @return Fingerprint of the configuration.
+ */
+std::string getConfFingerprint(const PlanKey& key);
+
+struct PlanEntry {
+  PlanKey key;
+  Deployment deployment;
+
+  MSGPACK_DEFINE(key, deployment);
+};
+
+/**
+ * A directory-backed store of partitioning plans. Plans are kept per model
+ * fingerprint and are looked up by *PlanKey*. Each model also has
+ * the latest DP cache and graph profiles, from which plans for other
+ * configurations can be computed offline.
+ *
+ * Layout: <dir>/<model fingerprint>/{plan_<conf fingerprint>.bin,
+ * dp_cache.bin, graph_profile.bin}
+ */
+class PlanStore {
+ public:
+  explicit PlanStore(std::string dir) : dir_(std::move(dir)) {}
+
+  bool hasPlan(const std::string& model_fp, const PlanKey& key) const;
+  Deployment loadPlan(const std::string& model_fp, const PlanKey& key) const;
+  void savePlan(
+      const std::string& model_fp, const PlanKey& key,
+      const Deployment& deployment) const;
+  std::vector<PlanKey> listPlans(const std::string& model_fp) const;
+  std::vector<std::string> listModels() const;
+
+  bool hasDPCache(const std::string& model_fp) const;
+  DPStagingCache loadDPCache(const std::string& model_fp) const;
+  void saveDPCache(
+      const std::string& model_fp, const DPStagingCache& cache) const;
+
+  bool hasProfiles(const std::string& model_fp) const;
+  std::string getProfileFile(const std::string& model_fp) const;
+
+ private:
+  std::string getModelDir(const std::string& model_fp) const;
+  std::string getPlanFile(
+      const std::string& model_fp, const PlanKey& key) const;
+  template <typename T>
+  void saveEntry(const std::string& path, const T& obj) const;
+
+  std::string dir_;
+
+  const std::shared_ptr<spdlog::logger> logger = getLogger("PlanStore");
+};
+
+/**
+ * Computes plans of a model for the given world sizes and batch sizes from
+ * the DP cache in the store, without running the profiler. Profiles of batch
+ * sizes that were not profiled are extrapolated from the cached ones. The key
+ * of the first stored plan of the model is used as the base of the new keys.
+ * The plans are computed with the configuration items of the current process
+ * and are keyed by them. Plans already in the store are skipped.
+ *
+ * @param store Plan store.
+ * @param model_fp Fingerprint of the model.
+ * @param world_sizes World sizes to compute plans for.
+ * @param batch_sizes Global batch sizes. The batch size of the base
+ * configuration is used if empty.
+ * @return Number of plans added to the store.
+ */
+size_t precomputePlans(
+    const PlanStore& store, const std::string& model_fp,
+    const std::vector<int>& world_sizes,
+    const std::vector<size_t>& batch_sizes);
+} // namespace rannc
+
+#endif // PYRANNC_PLANSTORE_H
@@ -3,10 +3,13 @@
 //
 
 #include "ProfilerUtil.h"
+#include <comm/GradCompressor.h>
+#include <Config.h>
 #include <cuda/CudaSync.h>
 #include <cuda/CudaUtil.h>
 #include <distop/DistTaskDispatcher.h>
 #include <distop/PartitionTensor.h>
+#include "RecomputePolicy.h"
 
 namespace rannc {
 
@@ -52,6 +55,31 @@ long calcAllReduceTime(long size) {
   return size * 1e6 / (double)(10 * 1024L * 1024L * 1024L);
 }
 
+long calcAllGatherTime(long size) {
+  // A ring allreduce consists of a reduce-scatter and an allgather
+  return calcAllReduceTime(size) / 2;
+}
+
+size_t calcGradCommSize(const IRValue& param, bool compress) {
+  const auto& type = param.getType();
+  if (!compress || type.getBaseType() != IRBaseType::TENSOR) {
+    return param.getSizeInByte();
+  }
+  double ratio = getGradCompressionRatio(
+      type.getTensorDim(), getTensorElemSize(type.getTensorElemType()));
+  return param.getSizeInByte() * ratio;
+}
+
+size_t calcGradCommSize(const std::shared_ptr<IRGraph>& g, bool compress) {
+  size_t sum = 0;
+  for (const auto& v : g->getValues()) {
+    if (v.second.isParam()) {
+      sum += calcGradCommSize(v.second, compress);
+    }
+  }
+  return sum;
+}
+
 size_t getOptMemSize(
     const std::shared_ptr<IRGraph>& ir_graph, const ProfilingInput& prof_in) {
   assert(contains(prof_in.replica_nums, ir_graph->getName()));
@@ -117,12 +145,61 @@ size_t getAmpMasterParamSize(const std::shared_ptr<IRGraph>& ir_graph) {
   return sum;
 }
 
+size_t calcStashedInputMem(
+    const GraphProfile& prof, const ProfilingInput& prof_in) {
+  if (!prof.checkpointing || prof_in.pipeline_num <= 1) {
+    return 0;
+  }
+
+  // Inputs of all micro-batches are kept for recomputation. When they are
+  // offloaded to host, only the one prefetched for the next backward pass is
+  // on the device.
+  const bool offload_act =
+      config::Config::get().getVal<bool>(config::OFFLOAD_ACTIVATIONS);
+  size_t resident_num = offload_act ? 1 : prof_in.pipeline_num - 1;
+  return prof.input_size * resident_num;
+}
+
+size_t calcStoredActivationMem(
+    const std::shared_ptr<IRGraph>& g, const GraphProfile& prof,
+    const ProfilingInput& prof_in) {
+  if (!prof.checkpointing || prof_in.pipeline_num <= 1 ||
+      !config::Config::get().getVal<bool>(config::SELECTIVE_RECOMPUTE)) {
+    return 0;
+  }
+
+  // Stored nodes keep their inputs and outputs for backward, which are on the
+  // device for all micro-batches like the stashed inputs.
+  const auto stored_nodes = selectStoredNodes(g);
+  std::unordered_set<std::string> kept_values;
+  for (const auto& node : g->getNodes()) {
+    if (!contains(stored_nodes, node.getId())) {
+      continue;
+    }
+    for (const auto& in : node.getInputNames()) {
+      kept_values.insert(in);
+    }
+    for (const auto& out : node.getOutputNames()) {
+      kept_values.insert(out);
+    }
+  }
+
+  size_t sum = 0;
+  for (const auto& name : kept_values) {
+    const auto& val = g->getValue(name);
+    if (!val.isParam() && val.getType().getBaseType() == IRBaseType::TENSOR) {
+      sum += val.getSizeInByte();
+    }
+  }
+  return sum * (prof_in.pipeline_num - 1);
+}
+
 size_t calcGraphMem(
     const std::shared_ptr<IRGraph>& g, const GraphProfile& prof,
     const ProfilingInput& prof_in) {
   size_t opt_mem = getOptMemSize(g, prof_in);
 
-  return prof.max_allocated_mem + opt_mem;
+  return prof.max_allocated_mem + opt_mem + calcStashedInputMem(prof, prof_in);
 }
 
 size_t calcGraphMem(
@@ -135,7 +212,8 @@ size_t calcGraphMem(
   auto scaled = std::make_shared<IRGraph>("scaled", *g);
   scaled->setBatchSize(bs);
 
-  return calcGraphMem(g, prof, in) + calcCommBufSize(scaled);
+  return calcGraphMem(g, prof, in) + calcCommBufSize(scaled) +
+      calcStoredActivationMem(scaled, prof, in);
 }
 
 GraphProfile makeErrorProfile() {
@@ -147,6 +225,51 @@ GraphProfile makeErrorProfile() {
   return p;
 }
 
+size_t absDiff(size_t a, size_t b) {
+  return a > b ? a - b : b - a;
+}
+
+// Estimates a profile from the cached one of the nearest batch size. Times and
+// batch-dependent sizes are scaled linearly.
+GraphProfile extrapolateProfile(
+    const MLProfileCache& cache, const MLProfileKey& key) {
+  const MLProfileKey* nearest = nullptr;
+  for (const auto& it : cache) {
+    const auto& k = it.first;
+    if (k.id != key.id || k.checkpointing != key.checkpointing) {
+      continue;
+    }
+    if (it.second.max_allocated_mem == ProfilerUtil::ERROR_VAL) {
+      // A smaller batch did not fit
+      if (k.batch_size <= key.batch_size) {
+        return makeErrorProfile();
+      }
+      continue;
+    }
+    if (nearest == nullptr ||
+        absDiff(k.batch_size, key.batch_size) <
+            absDiff(nearest->batch_size, key.batch_size)) {
+      nearest = &k;
+    }
+  }
+  if (nearest == nullptr) {
+    throw std::runtime_error("No cached profile to estimate from: " + key.id);
+  }
+
+  GraphProfile prof = cache.at(*nearest);
+  const double ratio = key.batch_size / (double)nearest->batch_size;
+  const long batch_mem = prof.activation_size + prof.working_mem;
+  prof.fwd_time *= ratio;
+  prof.bwd_time *= ratio;
+  prof.input_size *= ratio;
+  prof.output_size *= ratio;
+  prof.activation_size *= ratio;
+  prof.working_mem *= ratio;
+  prof.max_allocated_mem +=
+      prof.activation_size + prof.working_mem - batch_mem;
+  return prof;
+}
+
 GraphProfile ProfilerUtil::profile(const ProfilingInput& in) {
   if (in.force_dist_matmul) {
     bool dist = true;
@@ -182,6 +305,20 @@ GraphProfile ProfilerUtil::profileDist(const ProfilingInput& in) {
   });
 }
 
+// Profiles of a graph differ when its params are partitioned
+std::string getProfileId(
+    const std::shared_ptr<IRGraph>& g, const ProfilingInput& in) {
+  if (in.force_dist_matmul && contains(in.part_info, g->getName())) {
+    const auto& part_info = in.part_info.at(g->getName());
+    if (!part_info.param_partitions.empty()) {
+      std::stringstream ss;
+      ss << g->getName() << "_dist" << part_info.ranks.size();
+      return ss.str();
+    }
+  }
+  return g->getName();
+}
+
 GraphProfile ProfilerUtil::doProfile(
     const ProfilingInput& in,
     const std::function<ProfilingResult(const ProfilingInput& input)>& f) {
@@ -197,28 +334,45 @@ GraphProfile ProfilerUtil::doProfile(
 
   size_t bs = ceil(in.batch_size / (double)(replica_num * in.pipeline_num));
 
-  const MLProfileKey k{g->getName(), bs, in.checkpointing};
+  const auto prof_id = getProfileId(g, in);
+  const MLProfileKey k{prof_id, bs, in.checkpointing};
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    if (contains(profile_cache_, k)) {
+      return profile_cache_.at(k);
+    }
+  }
+
+  // Only one thread runs the profiler at a time. The other threads can still
+  // look up the cache.
+  std::lock_guard<std::mutex> prof_lock(profiler_mutex_);
+  std::unique_lock<std::mutex> lock(cache_mutex_);
   if (contains(profile_cache_, k)) {
     return profile_cache_.at(k);
   }
 
-  if (!contains(max_batch_size_cache_[in.checkpointing], g->getName())) {
-    max_batch_size_cache_[in.checkpointing][g->getName()] = SIZE_MAX;
+  // Dry runs have no profiler
+  if (!profiler_) {
+    profile_cache_[k] = extrapolateProfile(profile_cache_, k);
+    return profile_cache_.at(k);
   }
 
-  size_t max_bs = max_batch_size_cache_[in.checkpointing][g->getName()];
+  if (!contains(max_batch_size_cache_[in.checkpointing], prof_id)) {
+    max_batch_size_cache_[in.checkpointing][prof_id] = SIZE_MAX;
+  }
+
+  size_t max_bs = max_batch_size_cache_[in.checkpointing][prof_id];
   if (max_bs < bs) {
     profile_cache_[k] = makeErrorProfile();
     return profile_cache_.at(k);
   }
+  lock.unlock();
 
-  std::unordered_map<std::string, std::shared_ptr<IRGraph>> prof_in_v;
-  prof_in_v[g->getName()] = g;
-
+  GraphProfile prof;
   try {
     ProfilingResult prof_v = f(in);
     assert(prof_v.node_profiles.size() == 1);
-    profile_cache_[k] = prof_v.node_profiles.begin()->second;
+    prof = prof_v.node_profiles.begin()->second;
   } catch (std::exception& e) {
     std::string msg = e.what();
     std::string::size_type pos1 = msg.find("CUDA out of memory");
@@ -229,20 +383,27 @@ GraphProfile ProfilerUtil::doProfile(
           g->getName(), in.batch_size, replica_num, in.pipeline_num, e.what());
       throw std::runtime_error("Failed to profile graph: " + toString(*g));
     } else {
-      profile_cache_[k] = makeErrorProfile();
+      prof = makeErrorProfile();
 
-      if (max_batch_size_cache_[in.checkpointing][g->getName()] >= bs) {
-        max_batch_size_cache_[in.checkpointing][g->getName()] = bs - 1;
+      lock.lock();
+      if (max_batch_size_cache_[in.checkpointing][prof_id] >= bs) {
+        max_batch_size_cache_[in.checkpointing][prof_id] = bs - 1;
       }
+      lock.unlock();
+
       profiler_->clear();
       emptyCache();
       syncWithErrorCheck();
     }
   }
-  return profile_cache_.at(k);
+
+  lock.lock();
+  profile_cache_[k] = prof;
+  return prof;
 }
 
 void ProfilerUtil::clearCache() {
+  std::lock_guard<std::mutex> lock(cache_mutex_);
   profile_cache_.clear();
 }
 
@@ -328,9 +489,13 @@ std::string displayGraphProfiles(
     scaled->setBatchSize(bs);
     size_t comm_buf = calcCommBufSize(scaled);
 
-    long ar_time = calcAllReduceTime(g->getParamSizeInByte());
+    // Whether the replicas span nodes is unknown here
+    long ar_time = calcAllReduceTime(calcGradCommSize(g, false));
+
+    size_t stash = calcStashedInputMem(prof, prof_inputs) +
+        calcStoredActivationMem(scaled, prof, prof_inputs);
 
-    size_t total = prof.max_allocated_mem + opt_mem + comm_buf;
+    size_t total = prof.max_allocated_mem + opt_mem + comm_buf + stash;
 
     size_t fp32params = 0;
     size_t fp16params = 0;
@@ -358,7 +523,8 @@ std::string displayGraphProfiles(
        << " out_size=" << calcOutputSize(scaled)
        << " fp32param_size=" << fp32params << " fp16param_size=" << fp16params
        << " total_mem=" << total << " (fwd+bwd=" << prof.max_allocated_mem
-       << " opt=" << opt_mem << " comm=" << comm_buf << ")";
+       << " opt=" << opt_mem << " comm=" << comm_buf << " stash=" << stash
+       << ")";
 
     if (idx < prof_inputs.ir_graphs.size() - 1) {
       ss << std::endl;
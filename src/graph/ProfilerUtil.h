@@ -5,6 +5,8 @@
 #ifndef PYRANNC_PROFILERUTIL_H
 #define PYRANNC_PROFILERUTIL_H
 
+#include <mutex>
+
 #include <comp/GraphProfiler.h>
 #include <distop/PartitionTensor.h>
 #include "ir.h"
@@ -17,11 +19,24 @@ long calcCommTime(long cut_size);
 long calcInputCommTime(const std::shared_ptr<IRGraph>& g, int repl);
 long calcOutputCommTime(const std::shared_ptr<IRGraph>& g, int repl);
 long calcAllReduceTime(long cut_size);
+long calcAllGatherTime(long size);
+// Size of the gradient of a param exchanged by allreduce. The size is scaled
+// by the ratio of grad_compression if *compress* is true.
+size_t calcGradCommSize(const IRValue& param, bool compress);
+size_t calcGradCommSize(const std::shared_ptr<IRGraph>& g, bool compress);
 
 size_t getOptMemSize(
     const std::shared_ptr<IRGraph>& ir_graph, const ProfilingInput& prof_in);
 size_t getAmpMasterParamSize(const std::shared_ptr<IRGraph>& ir_graph);
 
+size_t calcStashedInputMem(
+    const GraphProfile& prof, const ProfilingInput& prof_in);
+// Memory for activations kept by *selective_recompute*, which the profile with
+// checkpointing does not include. *g* must have the batch size of a
+// micro-batch.
+size_t calcStoredActivationMem(
+    const std::shared_ptr<IRGraph>& g, const GraphProfile& prof,
+    const ProfilingInput& prof_in);
 size_t calcGraphMem(
     const std::shared_ptr<IRGraph>& g, const GraphProfile& prof,
     const ProfilingInput& prof_in);
@@ -57,6 +72,11 @@ struct MLProfileKeyHash {
 using MLProfileCache =
     std::unordered_map<MLProfileKey, GraphProfile, MLProfileKeyHash>;
 
+/**
+ * Profiles graphs and caches the results. *profile()* can be called from
+ * multiple threads. Profiling itself is serialized and runs on the calling
+ * thread.
+ */
 class ProfilerUtil {
  public:
   ProfilerUtil(std::shared_ptr<GraphProfiler> profiler)
@@ -70,6 +90,7 @@ class ProfilerUtil {
   }
 
   void setProfileCache(const MLProfileCache& profileCache) {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
     profile_cache_ = profileCache;
   }
 
@@ -86,6 +107,9 @@ class ProfilerUtil {
   std::unordered_map<bool, std::unordered_map<std::string, size_t>>
       max_batch_size_cache_;
   std::shared_ptr<GraphProfiler> profiler_;
+
+  std::mutex cache_mutex_;
+  std::mutex profiler_mutex_;
 };
 
 GraphProfile accProfileValues(
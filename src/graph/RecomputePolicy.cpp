@@ -0,0 +1,197 @@
+#include "RecomputePolicy.h"
+
+#include <Config.h>
+
+namespace rannc {
+
+namespace {
+// Outputs of a node that performs at least this number of operations per
+// output element (e.g. matmul and convolution) are cheaper to store than to
+// recompute.
+const long STORE_MIN_OPS_PER_ELEM = 16;
+
+const std::unordered_set<std::string> MATMUL_OPS = {
+    "aten::matmul", "aten::mm", "aten::bmm", "aten::linear"};
+const std::unordered_set<std::string> BIASED_MATMUL_OPS = {
+    "aten::addmm", "aten::baddbmm"};
+const std::unordered_set<std::string> CONV_OPS = {
+    "aten::_convolution", "aten::convolution", "aten::conv1d", "aten::conv2d",
+    "aten::conv3d"};
+
+bool isConstantNode(const IRNode& node) {
+  return node.getName() == "prim::Constant";
+}
+
+size_t countOutputElems(
+    const std::shared_ptr<IRGraph>& g, const IRNode& node) {
+  size_t sum = 0;
+  for (const auto& out_name : node.getOutputNames()) {
+    const auto& type = g->getValue(out_name).getType();
+    if (type.getBaseType() == IRBaseType::TENSOR) {
+      sum += productDim(type.getTensorDim());
+    }
+  }
+  return sum;
+}
+
+const IRType& getInputType(
+    const std::shared_ptr<IRGraph>& g, const IRNode& node, size_t index) {
+  assert(index < node.getInputNames().size());
+  return g->getValue(node.getInputNames().at(index)).getType();
+}
+} // namespace
+
+long estimateNodeCost(const std::shared_ptr<IRGraph>& g, const IRNode& node) {
+  const long out_elems = countOutputElems(g, node);
+
+  // The cost is roughly the number of multiply-adds. Ops not listed here are
+  // regarded as elementwise.
+  const auto& op = node.getName();
+  if (contains(MATMUL_OPS, op) || contains(BIASED_MATMUL_OPS, op)) {
+    size_t in_idx = contains(BIASED_MATMUL_OPS, op) ? 1 : 0;
+    const auto& type = getInputType(g, node, in_idx);
+    if (type.getBaseType() == IRBaseType::TENSOR &&
+        !type.getTensorDim().empty()) {
+      return out_elems * type.getTensorDim().back();
+    }
+  } else if (contains(CONV_OPS, op)) {
+    const auto& type = getInputType(g, node, 1);
+    if (type.getBaseType() == IRBaseType::TENSOR &&
+        !type.getTensorDim().empty() && type.getTensorDim().front() > 0) {
+      const auto& dim = type.getTensorDim();
+      return out_elems * (productDim(dim) / dim.front());
+    }
+  }
+  return out_elems;
+}
+
+std::unordered_set<std::string> selectStoredNodes(
+    const std::shared_ptr<IRGraph>& g) {
+  std::unordered_set<std::string> stored_nodes;
+  for (const auto& node : g->getNodes()) {
+    if (isConstantNode(node)) {
+      continue;
+    }
+    const long out_elems = countOutputElems(g, node);
+    if (out_elems == 0) {
+      continue;
+    }
+    if (estimateNodeCost(g, node) >= STORE_MIN_OPS_PER_ELEM * out_elems) {
+      stored_nodes.insert(node.getId());
+    }
+  }
+  return stored_nodes;
+}
+
+std::vector<RecomputeSegment> splitByRecomputePolicy(
+    const std::shared_ptr<IRGraph>& g,
+    const std::unordered_set<std::string>& stored_nodes) {
+  // Group consecutive nodes that share the same policy. Constants are copied
+  // to every segment that uses them.
+  std::unordered_map<std::string, IRNode> const_nodes;
+  std::vector<std::vector<IRNode>> groups;
+  std::vector<bool> recompute_flags;
+  for (const auto& node : g->getNodes()) {
+    if (isConstantNode(node)) {
+      for (const auto& out_name : node.getOutputNames()) {
+        const_nodes[out_name] = node;
+      }
+      continue;
+    }
+
+    bool recompute = !contains(stored_nodes, node.getId());
+    if (groups.empty() || recompute_flags.back() != recompute) {
+      groups.emplace_back();
+      recompute_flags.push_back(recompute);
+    }
+    groups.back().push_back(node);
+  }
+
+  if (groups.size() < 2) {
+    return {RecomputeSegment{g, true}};
+  }
+
+  std::unordered_map<std::string, size_t> last_use;
+  for (size_t i = 0; i < groups.size(); i++) {
+    for (const auto& node : groups.at(i)) {
+      for (const auto& in_name : node.getInputNames()) {
+        last_use[in_name] = i;
+      }
+    }
+  }
+
+  const auto& graph_outputs = g->getOutputNames();
+  std::vector<RecomputeSegment> segments;
+  for (size_t i = 0; i < groups.size(); i++) {
+    std::vector<IRNode> nodes;
+    std::unordered_map<std::string, IRValue> values;
+    std::unordered_set<std::string> produced;
+
+    for (const auto& node : groups.at(i)) {
+      for (const auto& in_name : node.getInputNames()) {
+        if (contains(const_nodes, in_name) && !contains(produced, in_name)) {
+          const auto& const_node = const_nodes.at(in_name);
+          nodes.push_back(const_node);
+          for (const auto& out_name : const_node.getOutputNames()) {
+            produced.insert(out_name);
+            values[out_name] = g->getValue(out_name);
+          }
+        }
+      }
+    }
+
+    std::vector<std::string> inputs;
+    std::vector<std::string> param_inputs;
+    std::vector<std::string> outputs;
+    for (const auto& node : groups.at(i)) {
+      for (const auto& in_name : node.getInputNames()) {
+        const auto& val = g->getValue(in_name);
+        values[in_name] = val;
+        if (contains(produced, in_name)) {
+          continue;
+        }
+        auto& target = val.isParam() ? param_inputs : inputs;
+        if (!contains(target, in_name)) {
+          target.push_back(in_name);
+        }
+      }
+
+      nodes.push_back(node);
+      for (const auto& out_name : node.getOutputNames()) {
+        produced.insert(out_name);
+        values[out_name] = g->getValue(out_name);
+
+        bool used_later =
+            contains(last_use, out_name) && last_use.at(out_name) > i;
+        if (used_later || contains(graph_outputs, out_name)) {
+          outputs.push_back(out_name);
+        }
+      }
+    }
+    // TorchDriver expects parameters at the end of inputs
+    inputs.insert(inputs.end(), param_inputs.begin(), param_inputs.end());
+
+    const auto name = g->getName() + "_seg" + std::to_string(i);
+    segments.push_back(RecomputeSegment{
+        std::make_shared<IRGraph>(name, nodes, values, inputs, outputs),
+        recompute_flags.at(i)});
+  }
+  return segments;
+}
+
+void setRecomputePolicy(Deployment& deployment) {
+  deployment.stored_nodes.clear();
+
+  if (!deployment.checkpointing ||
+      !config::Config::get().getVal<bool>(config::SELECTIVE_RECOMPUTE)) {
+    return;
+  }
+
+  for (const auto& it : deployment.subgraphs) {
+    const auto stored_nodes = selectStoredNodes(it.second);
+    if (!stored_nodes.empty()) {
+      deployment.stored_nodes[it.first] = stored_nodes;
+    }
+  }
+}
+} // namespace rannc
@@ -0,0 +1,28 @@
+#ifndef PYRANNC_RECOMPUTEPOLICY_H
+#define PYRANNC_RECOMPUTEPOLICY_H
+
+#include "Decomposition.h"
+#include "ir.h"
+
+namespace rannc {
+
+/**
+ * A contiguous range of nodes of a checkpointed subgraph. Activations of a
+ * segment with *recompute* set are discarded after forward and recomputed
+ * before backward. The other segments keep their activations.
+ */
+struct RecomputeSegment {
+  std::shared_ptr<IRGraph> graph;
+  bool recompute;
+};
+
+long estimateNodeCost(const std::shared_ptr<IRGraph>& g, const IRNode& node);
+std::unordered_set<std::string> selectStoredNodes(
+    const std::shared_ptr<IRGraph>& g);
+std::vector<RecomputeSegment> splitByRecomputePolicy(
+    const std::shared_ptr<IRGraph>& g,
+    const std::unordered_set<std::string>& stored_nodes);
+void setRecomputePolicy(Deployment& deployment);
+} // namespace rannc
+
+#endif // PYRANNC_RECOMPUTEPOLICY_H
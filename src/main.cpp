@@ -15,11 +15,19 @@
 #include "bind/RaNNCProcess.h"
 #include "bind/Tracer.h"
 #include "comm/MPIUtil.h"
+#include "comp/BatchSizeCalculator.h"
 #include "comp/DistributedParamLocator.h"
+#include "comp/OffloadedParamMap.h"
+#include "comp/ParamFileStore.h"
 #include "comp/RaNNCModule.h"
 #include "cuda/CudaSync.h"
 #include "graph/DeploymentSerializer.h"
+#include "graph/PlanStore.h"
 #include "Logging.h"
+#include "torch/BufferArena.h"
+#include "torch/FusedOptimizer.h"
+#include "torch/HalfConversion.h"
+#include "torch/TrackingAllocator.h"
 
 #include "cpg/CPG.h"
 #include "distop/DistMatmul.h"
@@ -227,12 +235,89 @@ PYBIND11_MODULE(_pyrannc, m) {
     return zpl.registered(pid);
   });
 
+  m.def("offload_file_enabled", []() {
+    OffloadedParamMap& param_map = OffloadedParamMap::get();
+    return param_map.fileTierEnabled();
+  });
+
+  py::class_<FileSpace>(m, "FileSpace")
+      .def(py::init<>())
+      .def("alloc", &FileSpace::alloc)
+      .def("release", &FileSpace::release)
+      .def("get_end", &FileSpace::getEnd)
+      .def("get_free_extent_num", &FileSpace::getFreeExtentNum);
+
+  m.def("offload_prefetch_num", []() {
+    OffloadedParamMap& param_map = OffloadedParamMap::get();
+    return param_map.getPrefetchNum();
+  });
+
+  m.def("load_offloaded_param", [](py::object& obj) {
+    auto ten = py::cast<at::Tensor>(obj);
+    OffloadedParamMap& param_map = OffloadedParamMap::get();
+    param_map.loadParamFromFile(ten);
+  });
+
+  m.def("store_offloaded_param", [](py::object& obj) {
+    auto ten = py::cast<at::Tensor>(obj);
+    OffloadedParamMap& param_map = OffloadedParamMap::get();
+    param_map.storeParamToFile(ten);
+  });
+
+  m.def("prefetch_offloaded_param", [](py::object& obj) {
+    auto ten = py::cast<at::Tensor>(obj);
+    OffloadedParamMap& param_map = OffloadedParamMap::get();
+    param_map.prefetchParamFromFile(ten);
+  });
+
+  m.def("store_offloaded_tensor", [](const std::string& key, py::object& obj) {
+    auto ten = py::cast<at::Tensor>(obj);
+    OffloadedParamMap& param_map = OffloadedParamMap::get();
+    param_map.storeTensorToFile(key, ten);
+  });
+
+  m.def("load_offloaded_tensor", [](const std::string& key, py::object& obj) {
+    auto ten = py::cast<at::Tensor>(obj);
+    OffloadedParamMap& param_map = OffloadedParamMap::get();
+    param_map.loadTensorFromFile(key, ten);
+  });
+
+  m.def("prefetch_offloaded_tensor", [](const std::string& key) {
+    OffloadedParamMap& param_map = OffloadedParamMap::get();
+    param_map.prefetchTensorFromFile(key);
+  });
+
   m.def("get_param_ranks", [](long pid) {
     auto r = RaNNCFactory::get();
     auto param_storage = r->getParamStorage();
     return param_storage->getRanks(pid);
   });
 
+  m.def(
+      "fused_adam_step",
+      [](const std::vector<at::Tensor>& params,
+         const std::vector<at::Tensor>& grads,
+         const std::vector<at::Tensor>& exp_avgs,
+         const std::vector<at::Tensor>& exp_avg_sqs, int64_t step, double lr,
+         double beta1, double beta2, double eps, double weight_decay,
+         bool adamw) {
+        fusedAdamStep(
+            params, grads, exp_avgs, exp_avg_sqs, step, lr, beta1, beta2, eps,
+            weight_decay, adamw);
+      });
+
+  m.def(
+      "fused_sgd_step",
+      [](const std::vector<at::Tensor>& params,
+         const std::vector<at::Tensor>& grads,
+         const std::vector<at::Tensor>& momentum_bufs, double lr,
+         double momentum, double dampening, double weight_decay, bool nesterov,
+         bool first_step) {
+        fusedSGDStep(
+            params, grads, momentum_bufs, lr, momentum, dampening,
+            weight_decay, nesterov, first_step);
+      });
+
   m.def("set_tracing_state", [](bool enable) {
     static std::shared_ptr<torch::jit::tracer::TracingState> state;
     if (enable) {
@@ -314,7 +399,10 @@ PYBIND11_MODULE(_pyrannc, m) {
           })
       .def(
           "allreduce_grads",
-          [](RaNNCModule& self) { self.allReduceParamGrads(); })
+          [](RaNNCModule& self, double grad_scale) {
+            self.allReduceParamGrads(grad_scale);
+          },
+          py::arg("grad_scale") = 1.0)
       .def(
           "allreduce_grads_zero",
           [](RaNNCModule& self, double loss_scale) {
@@ -325,6 +413,11 @@ PYBIND11_MODULE(_pyrannc, m) {
           [](RaNNCModule& self, float max_grad_norm) {
             self.clipGrad(max_grad_norm);
           })
+      .def(
+          "scale_grads_and_check_overflow",
+          [](RaNNCModule& self, double scale) {
+            return self.scaleGradsAndCheckOverflow(scale);
+          })
       .def(
           "calc_grad_norm",
           [](RaNNCModule& self) { return self.calcGradL2Norm(); })
@@ -404,6 +497,30 @@ PYBIND11_MODULE(_pyrannc, m) {
     save(deployment_file, deployment, cache.conf.dev_num, cache.conf.dev_mem);
   });
 
+  m.def("list_plan_models", [](const std::string& dir) {
+    PlanStore store(dir);
+    return store.listModels();
+  });
+
+  m.def("list_plans", [](const std::string& dir, const std::string& model_fp) {
+    PlanStore store(dir);
+    py::list plans;
+    for (const auto& key : store.listPlans(model_fp)) {
+      plans.append(py::make_tuple(
+          key.conf.dev_num, key.conf.batch_size, key.conf.dev_mem));
+    }
+    return plans;
+  });
+
+  m.def(
+      "precompute_plans",
+      [](const std::string& dir, const std::string& model_fp,
+         const std::vector<int>& world_sizes,
+         const std::vector<size_t>& batch_sizes) {
+        PlanStore store(dir);
+        return precomputePlans(store, model_fp, world_sizes, batch_sizes);
+      });
+
   m.def("show_deployment", [](const std::string& path, int64_t batch_size) {
     spdlog::info("Loading deployment state from {}", path);
     const DeploymentState state = loadDeploymentState(path);
@@ -455,15 +572,21 @@ PYBIND11_MODULE(_pyrannc, m) {
 
   m.def(
       "matmul_dist",
-      [](py::handle py_tensor1, py::handle py_tensor2,
-         const std::string& type) {
+      [](py::handle py_tensor1, py::handle py_tensor2, const std::string& type,
+         bool cuda) {
         auto iv1 = torch::jit::_toTypeInferredIValue(py_tensor1);
         assert(iv1.isTensor());
-        at::Tensor ten1 = iv1.toTensor().cuda();
+        at::Tensor ten1 = iv1.toTensor();
 
         auto iv2 = torch::jit::_toTypeInferredIValue(py_tensor2);
         assert(iv2.isTensor());
-        at::Tensor ten2 = iv2.toTensor().cuda();
+        at::Tensor ten2 = iv2.toTensor();
+
+        // CPU tensors are exchanged by MPI
+        if (cuda) {
+          ten1 = ten1.cuda();
+          ten2 = ten2.cuda();
+        }
 
         DistMatmul dist_mm;
         if (type == "RRR") {
@@ -475,6 +598,100 @@ PYBIND11_MODULE(_pyrannc, m) {
         }
         spdlog::info("No match: {}", type);
         return at::Tensor();
+      },
+      py::arg("x"), py::arg("y"), py::arg("type"), py::arg("cuda") = true);
+
+  m.def("convert_scalar_type", [](py::handle py_tensor, py::object& obj) {
+    auto iv = torch::jit::_toTypeInferredIValue(py_tensor);
+    assert(iv.isTensor());
+    auto dtype = reinterpret_cast<THPDtype*>(obj.ptr());
+    return convertScalarType(iv.toTensor(), dtype->scalar_type);
+  });
+
+  m.def("to_float_scaled", [](py::handle py_tensor, double scale) {
+    auto iv = torch::jit::_toTypeInferredIValue(py_tensor);
+    assert(iv.isTensor());
+    return toFloatScaled(iv.toTensor(), scale);
+  });
+
+  m.def(
+      "accumulate_to_float",
+      [](py::handle py_dst, py::handle py_src, double scale) {
+        auto iv_dst = torch::jit::_toTypeInferredIValue(py_dst);
+        assert(iv_dst.isTensor());
+        auto iv_src = torch::jit::_toTypeInferredIValue(py_src);
+        assert(iv_src.isTensor());
+        auto dst = iv_dst.toTensor();
+        accumulateToFloat(dst, iv_src.toTensor(), scale);
+      });
+
+  m.def(
+      "assign_buffer_offsets",
+      [](const std::vector<std::tuple<
+             std::string, size_t, std::vector<LiveRange>>>& buffers,
+         size_t alignment) {
+        std::vector<BufferInterval> intervals;
+        for (const auto& buf : buffers) {
+          intervals.push_back(
+              {std::get<0>(buf), std::get<1>(buf), std::get<2>(buf)});
+        }
+        size_t total_size = 0;
+        const auto offsets =
+            assignBufferOffsets(intervals, alignment, total_size);
+        return std::make_pair(offsets, total_size);
+      });
+
+  m.def("scale_by_speed", [](long fwd_time, long bwd_time, double speed) {
+    GraphProfile prof;
+    prof.fwd_time = fwd_time;
+    prof.bwd_time = bwd_time;
+    scaleBySpeed(prof, speed);
+    return std::make_pair(prof.fwd_time, prof.bwd_time);
+  });
+
+  m.def(
+      "get_stage_capability",
+      [](const std::vector<std::pair<size_t, double>>& dev_caps,
+         int dev_num, size_t dev_mem, size_t dev_begin, size_t dev_end,
+         size_t dev_num_per_group, int replica_num) {
+        PartitioningConf conf =
+            makePartitioningConf(dev_num, 1, dev_mem, false, false, false);
+        for (const auto& cap : dev_caps) {
+          conf.dev_caps.push_back({cap.first, cap.second});
+        }
+        const auto stage_cap = getStageCapability(
+            conf, dev_begin, dev_end, dev_num_per_group, replica_num);
+        return std::make_pair(stage_cap.mem, stage_cap.speed);
+      });
+
+  m.def("install_tracking_cpu_allocator", []() {
+    TrackingCPUAllocator::get().install();
+  });
+  m.def("tracking_cpu_allocator_installed", []() {
+    return TrackingCPUAllocator::get().isInstalled();
+  });
+  m.def("get_tracked_cpu_allocated", []() {
+    return TrackingCPUAllocator::get().getAllocated();
+  });
+  m.def("get_tracked_cpu_peak", []() {
+    return TrackingCPUAllocator::get().getPeak();
+  });
+  m.def("reset_tracked_cpu_peak", []() {
+    TrackingCPUAllocator::get().resetPeak();
+  });
+
+  m.def(
+      "split_local_batch_sizes",
+      [](int pipeline_num,
+         const std::unordered_map<int, int64_t>& local_batch_sizes) {
+        BatchSizeCalculator bs_calc(pipeline_num, local_batch_sizes);
+        const auto ranks = vectorToSet(keys(local_batch_sizes));
+        std::unordered_map<int, std::vector<int64_t>> local_split_sizes;
+        for (int r : ranks) {
+          local_split_sizes[r] = bs_calc.getAllLocalSplitBatchSizes(ranks, r);
+        }
+        return std::make_pair(
+            local_split_sizes, bs_calc.getAllGlobalSplitBatchSizes());
       });
 
   m.def("test_gather", [](py::handle py_tensor, int64_t dim) {
@@ -0,0 +1,425 @@
+#include "BufferArena.h"
+
+#include <c10/cuda/CUDACachingAllocator.h>
+
+namespace rannc {
+
+namespace {
+// Large enough for any element type and for coalesced accesses
+const size_t ARENA_ALIGNMENT = 512;
+
+size_t alignUp(size_t size, size_t alignment) {
+  return ((size + alignment - 1) / alignment) * alignment;
+}
+
+bool overlaps(const LiveRange& r1, const LiveRange& r2) {
+  return r1.first <= r2.second && r2.first <= r1.second;
+}
+
+bool overlaps(
+    const std::vector<LiveRange>& ranges1,
+    const std::vector<LiveRange>& ranges2) {
+  for (const auto& r1 : ranges1) {
+    for (const auto& r2 : ranges2) {
+      if (overlaps(r1, r2)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+std::vector<LiveRange> mergeRanges(std::vector<LiveRange> ranges) {
+  std::sort(ranges.begin(), ranges.end());
+
+  std::vector<LiveRange> merged;
+  for (const auto& r : ranges) {
+    if (!merged.empty() && r.first <= merged.back().second) {
+      merged.back().second = std::max(merged.back().second, r.second);
+    } else {
+      merged.push_back(r);
+    }
+  }
+  return merged;
+}
+
+const c10::StorageImpl* getStorageImpl(const at::Tensor& ten) {
+  return ten.storage().unsafeGetStorageImpl();
+}
+} // namespace
+
+std::unordered_map<std::string, size_t> assignBufferOffsets(
+    const std::vector<BufferInterval>& buffers, size_t alignment,
+    size_t& total_size) {
+  std::vector<BufferInterval> sorted = buffers;
+  std::sort(
+      sorted.begin(), sorted.end(),
+      [](const BufferInterval& a, const BufferInterval& b) {
+        if (a.size != b.size) {
+          return a.size > b.size;
+        }
+        return a.key < b.key;
+      });
+
+  std::unordered_map<std::string, size_t> offsets;
+  std::vector<BufferInterval> placed;
+  total_size = 0;
+
+  for (const auto& buf : sorted) {
+    const size_t size = alignUp(buf.size, alignment);
+
+    // (offset, size) of placed buffers whose lifetimes overlap
+    std::vector<std::pair<size_t, size_t>> conflicts;
+    for (const auto& p : placed) {
+      if (overlaps(p.ranges, buf.ranges)) {
+        conflicts.emplace_back(offsets.at(p.key), alignUp(p.size, alignment));
+      }
+    }
+    std::sort(conflicts.begin(), conflicts.end());
+
+    size_t offset = 0;
+    for (const auto& c : conflicts) {
+      if (offset + size <= c.first) {
+        break;
+      }
+      offset = std::max(offset, c.first + c.second);
+    }
+
+    offsets[buf.key] = offset;
+    placed.push_back(buf);
+    total_size = std::max(total_size, offset + size);
+  }
+  return offsets;
+}
+
+BufferArena& BufferArena::get() {
+  static BufferArena instance;
+  return instance;
+}
+
+void BufferArena::beginPass(const std::string& name, size_t step_num) {
+  const bool repeated = std::any_of(
+      passes_.begin(), passes_.end(),
+      [&name](const std::pair<std::string, size_t>& p) {
+        return p.first == name;
+      });
+  if (repeated) {
+    endIteration();
+  }
+
+  if (!passes_.empty()) {
+    pass_base_ += pass_step_num_;
+  }
+  const size_t pass_idx = passes_.size();
+  passes_.emplace_back(name, step_num);
+  if (!planned_passes_.empty()) {
+    valid_ = valid_ && pass_idx < planned_passes_.size() &&
+        planned_passes_.at(pass_idx) == passes_.back();
+  }
+
+  pass_step_num_ = step_num;
+  step_ = 0;
+  active_ = true;
+}
+
+void BufferArena::setStep(size_t step) {
+  if (!active_) {
+    return;
+  }
+  assert(step < pass_step_num_);
+  step_ = step;
+}
+
+void BufferArena::endPass() {
+  active_ = false;
+}
+
+size_t BufferArena::getCurrentStep() const {
+  return pass_base_ + step_;
+}
+
+at::Tensor BufferArena::getBuffer(
+    const std::string& key, const IRType& type, bool overwrite) {
+  if (!active_) {
+    return fallback_.get(key, type);
+  }
+
+  const size_t step = getCurrentStep();
+  auto& rec = records_[key];
+
+  // The caller continues to use the current value
+  if (!overwrite && rec.live && rec.cur_type == type) {
+    extendValue(key, rec, step);
+    auto ret = rec.cur_tensor;
+    ret.set_requires_grad(type.requiresGrad());
+    return ret;
+  }
+
+  endValue(rec);
+
+  const size_t nbytes = type.getSizeInByte();
+  rec.size = std::max(rec.size, nbytes);
+  rec.live = true;
+  rec.cur_range = {step, step};
+  rec.cur_type = type;
+
+  at::Tensor ret;
+  if (valid_ && rec.planned && nbytes <= rec.capacity &&
+      coveredByPlan(rec, step, step)) {
+    const auto scalar_type =
+        fromIRTensorElemTypeToScalarType(type.getTensorElemType());
+    at::TensorOptions options;
+    options = options.dtype(scalar_type).device(arena_.device());
+    fenceArenaStreams();
+    recordArenaStream();
+
+    // The deleter holds the arena so that the buffer remains valid after
+    // replanning
+    auto arena = arena_;
+    ret = torch::from_blob(
+        static_cast<uint8_t*>(arena_.data_ptr()) + rec.offset,
+        type.getTensorDim(), [arena](void*) {}, options);
+    ret.set_requires_grad(type.requiresGrad());
+
+    rec.cur_in_arena = true;
+    rec.arena_defined = true;
+    rec.arena_def_step = step;
+  } else {
+    ret = fallback_.get(key, type);
+    rec.cur_in_arena = false;
+    dirty_ = true;
+  }
+
+  rec.cur_tensor = ret;
+  storage_keys_[getStorageImpl(ret)] = key;
+  return ret;
+}
+
+void BufferArena::use(const torch::jit::IValue& ivalue) {
+  if (!active_) {
+    return;
+  }
+  for (const auto& path : findPathsToTensorInIValue(ivalue)) {
+    use(getElemInIValue(ivalue, path).toTensor());
+  }
+}
+
+void BufferArena::use(const at::Tensor& ten) {
+  if (!active_ || !ten.defined() || !ten.has_storage()) {
+    return;
+  }
+
+  const auto it = storage_keys_.find(getStorageImpl(ten));
+  if (it == storage_keys_.end()) {
+    return;
+  }
+  const auto key = it->second;
+  auto& rec = records_.at(key);
+  if (rec.live) {
+    extendValue(key, rec, getCurrentStep());
+    if (rec.cur_in_arena) {
+      recordArenaStream();
+    }
+  }
+}
+
+void BufferArena::endValue(BufferRecord& rec) {
+  if (!rec.live) {
+    return;
+  }
+
+  rec.iter_ranges.push_back(rec.cur_range);
+  // Values in fallback buffers of the same key share the storage
+  const auto it = storage_keys_.find(getStorageImpl(rec.cur_tensor));
+  if (it != storage_keys_.end()) {
+    storage_keys_.erase(it);
+  }
+  rec.cur_tensor = at::Tensor();
+  rec.live = false;
+  rec.cur_in_arena = false;
+}
+
+void BufferArena::extendValue(
+    const std::string& key, BufferRecord& rec, size_t step) {
+  if (step <= rec.cur_range.second) {
+    return;
+  }
+
+  if (!coveredByPlan(rec, rec.cur_range.first, step)) {
+    if (valid_ && rec.cur_in_arena && overwritten(key, rec)) {
+      logger->warn(
+          "Buffer {} was used at step {} after its memory was given to "
+          "another buffer. The uses of buffers differ from the previous "
+          "iterations. Buffers are allocated separately until the arena is "
+          "planned again.",
+          key, getCurrentStep());
+      valid_ = false;
+    }
+    dirty_ = true;
+  }
+  rec.cur_range.second = step;
+}
+
+bool BufferArena::coveredByPlan(
+    const BufferRecord& rec, size_t start, size_t end) const {
+  if (!rec.planned) {
+    return false;
+  }
+  for (const auto& r : rec.ranges) {
+    if (r.first <= start && end <= r.second) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BufferArena::overwritten(
+    const std::string& key, const BufferRecord& rec) const {
+  // Buffers placed at the same memory are not live at the same step in the
+  // plan. Those defined after this value are therefore placed so because this
+  // value was expected to be dead.
+  for (const auto& it : records_) {
+    const auto& other = it.second;
+    if (it.first == key || !other.arena_defined ||
+        other.arena_def_step < rec.cur_range.first) {
+      continue;
+    }
+    if (other.offset < rec.offset + rec.capacity &&
+        rec.offset < other.offset + other.capacity) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void BufferArena::recordArenaStream() {
+  if (!arena_.is_cuda()) {
+    return;
+  }
+  const auto stream = c10::cuda::getCurrentCUDAStream();
+  if (contains(arena_streams_, stream.id())) {
+    return;
+  }
+  arena_streams_.emplace(stream.id(), stream);
+  c10::cuda::CUDACachingAllocator::recordStream(
+      arena_.storage().data_ptr(), stream);
+}
+
+void BufferArena::fenceArenaStreams() {
+  if (!arena_.is_cuda()) {
+    return;
+  }
+  const auto cur_stream = c10::cuda::getCurrentCUDAStream();
+  for (const auto& it : arena_streams_) {
+    if (it.second != cur_stream) {
+      at::cuda::CUDAEvent evt;
+      evt.record(it.second);
+      evt.block(cur_stream);
+    }
+  }
+}
+
+void BufferArena::endIteration() {
+  // An iteration with a prefix of the planned passes (e.g. forward only) uses
+  // the same steps
+  const bool same_passes = !planned_passes_.empty() && valid_;
+  bool changed = dirty_ || !same_passes;
+
+  for (auto it = records_.begin(); it != records_.end();) {
+    auto& rec = it->second;
+    endValue(rec);
+
+    if (same_passes) {
+      auto ranges = rec.ranges;
+      ranges.insert(
+          ranges.end(), rec.iter_ranges.begin(), rec.iter_ranges.end());
+      ranges = mergeRanges(ranges);
+      changed |= ranges != rec.ranges;
+      rec.ranges = ranges;
+    } else {
+      rec.ranges = mergeRanges(rec.iter_ranges);
+    }
+    rec.iter_ranges.clear();
+    rec.arena_defined = false;
+
+    if (rec.ranges.empty()) {
+      it = records_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  if (!same_passes) {
+    planned_passes_ = passes_;
+  }
+  passes_.clear();
+  pass_base_ = 0;
+  valid_ = true;
+
+  if (changed) {
+    plan();
+  }
+}
+
+void BufferArena::plan() {
+  std::vector<BufferInterval> buffers;
+  size_t sum_size = 0;
+  for (const auto& it : records_) {
+    const auto& rec = it.second;
+    if (rec.size > 0) {
+      buffers.push_back({it.first, rec.size, rec.ranges});
+      sum_size += rec.size;
+    }
+  }
+
+  size_t total_size = 0;
+  const auto offsets =
+      assignBufferOffsets(buffers, ARENA_ALIGNMENT, total_size);
+
+  at::TensorOptions options;
+  if (torch::cuda::is_available()) {
+    options = options.device(c10::Device(c10::DeviceType::CUDA));
+  } else {
+    options = options.device(c10::Device(c10::DeviceType::CPU));
+  }
+  options = options.dtype(c10::ScalarType::Byte);
+  arena_ = torch::empty({static_cast<int64_t>(total_size)}, options);
+  arena_streams_.clear();
+
+  for (auto& it : records_) {
+    auto& rec = it.second;
+    rec.planned = contains(offsets, it.first);
+    if (rec.planned) {
+      rec.offset = offsets.at(it.first);
+      rec.capacity = rec.size;
+    }
+  }
+  fallback_.clear();
+  dirty_ = false;
+
+  logger->debug(
+      "Planned buffer arena: #buffers={} arena_size={} sum_size={}",
+      buffers.size(), total_size, sum_size);
+}
+
+void BufferArena::clear() {
+  records_.clear();
+  storage_keys_.clear();
+  fallback_.clear();
+  arena_ = at::Tensor();
+  arena_streams_.clear();
+  dirty_ = false;
+
+  passes_.clear();
+  planned_passes_.clear();
+  valid_ = true;
+  active_ = false;
+  pass_base_ = 0;
+  pass_step_num_ = 0;
+  step_ = 0;
+}
+
+size_t BufferArena::getArenaSize() const {
+  return arena_.defined() ? arena_.nbytes() : 0;
+}
+} // namespace rannc
@@ -0,0 +1,151 @@
+#ifndef PYRANNC_BUFFERARENA_H
+#define PYRANNC_BUFFERARENA_H
+
+#include <ATen/cuda/CUDAEvent.h>
+#include <torch/torch.h>
+
+#include <Logging.h>
+#include "TorchUtil.h"
+
+namespace rannc {
+
+// Steps (inclusive) in which a buffer holds a value
+using LiveRange = std::pair<size_t, size_t>;
+
+struct BufferInterval {
+  std::string key;
+  size_t size;
+  std::vector<LiveRange> ranges;
+};
+
+/**
+ * Assigns offsets to buffers so that buffers live at the same time do not
+ * overlap. Buffers are placed from the largest one at the lowest offset that
+ * does not conflict with placed buffers (greedy coloring of the interval
+ * graph).
+ *
+ * @param buffers Buffers to place.
+ * @param alignment Alignment of offsets.
+ * @param total_size Set to the size of the arena required.
+ * @return Offsets of the buffers.
+ */
+std::unordered_map<std::string, size_t> assignBufferOffsets(
+    const std::vector<BufferInterval>& buffers, size_t alignment,
+    size_t& total_size);
+
+/**
+ * Places buffers of communication (SComm) and of the drivers (TorchDriver) in
+ * a single arena by their lifetimes.
+ *
+ * An iteration consists of passes (forward or backward of a graph), and a
+ * pass consists of steps set by the caller (e.g. a subgraph of a split). A
+ * value is defined in a buffer by *getBuffer()* and is live until the last
+ * step in which the buffer is requested again without overwriting or is
+ * given to *use()*. An iteration ends when a pass of the same name starts
+ * again, and then buffers are assigned to offsets in the arena from the live
+ * ranges observed so far.
+ *
+ * Buffers are allocated separately (as *BufferTensorCache* does) until they
+ * are planned, when a value is defined at a step not covered by the plan, or
+ * when the passes of the iteration differ from those of the planned one.
+ * They are also allocated separately for the rest of an iteration once a value
+ * is used after its memory was given to another buffer. Buffers requested
+ * outside passes (between *endPass()* and the next *beginPass()*) are neither
+ * recorded nor planned.
+ *
+ * Buffers in the arena are views without their own allocations. The arena is
+ * therefore told about the streams that use the buffers, so that the caching
+ * allocator does not reuse it before they finish, and a buffer is placed
+ * only after the other streams reach the uses of the buffers placed before.
+ */
+class BufferArena {
+ public:
+  BufferArena(const BufferArena&) = delete;
+  BufferArena& operator=(const BufferArena&) = delete;
+  BufferArena(BufferArena&&) = delete;
+  BufferArena& operator=(BufferArena&&) = delete;
+
+  static BufferArena& get();
+
+  void beginPass(const std::string& name, size_t step_num);
+  void setStep(size_t step);
+  void endPass();
+
+  /**
+   * Returns a buffer for a key.
+   *
+   * @param key Key of the buffer.
+   * @param type Type of the buffer.
+   * @param overwrite Whether the caller overwrites the contents. Otherwise the
+   * buffer has the value defined by the last call in this iteration.
+   */
+  at::Tensor getBuffer(
+      const std::string& key, const IRType& type, bool overwrite);
+  // Records a use of the buffers holding tensors in *ivalue*
+  void use(const torch::jit::IValue& ivalue);
+  void use(const at::Tensor& ten);
+  void clear();
+
+  size_t getArenaSize() const;
+
+ private:
+  BufferArena() = default;
+  ~BufferArena() = default;
+
+  struct BufferRecord {
+    size_t size = 0;
+    // Ranges merged over the iterations with the same passes
+    std::vector<LiveRange> ranges;
+    std::vector<LiveRange> iter_ranges;
+
+    // Current value
+    bool live = false;
+    LiveRange cur_range;
+    at::Tensor cur_tensor;
+    IRType cur_type;
+    bool cur_in_arena = false;
+    // Whether (and the last step when) a value was placed in the arena in
+    // this iteration
+    bool arena_defined = false;
+    size_t arena_def_step = 0;
+
+    bool planned = false;
+    size_t offset = 0;
+    size_t capacity = 0;
+  };
+
+  size_t getCurrentStep() const;
+  void endValue(BufferRecord& rec);
+  void extendValue(const std::string& key, BufferRecord& rec, size_t step);
+  bool coveredByPlan(const BufferRecord& rec, size_t start, size_t end) const;
+  // Whether the memory of the value was given to another buffer after the
+  // value was defined
+  bool overwritten(const std::string& key, const BufferRecord& rec) const;
+  void recordArenaStream();
+  void fenceArenaStreams();
+  void endIteration();
+  void plan();
+
+  std::unordered_map<std::string, BufferRecord> records_;
+  std::unordered_map<const c10::StorageImpl*, std::string> storage_keys_;
+  BufferTensorCache fallback_;
+  at::Tensor arena_;
+  // Streams that used buffers in the arena
+  std::unordered_map<c10::StreamId, c10::cuda::CUDAStream> arena_streams_;
+  bool dirty_ = false;
+
+  // Names and numbers of steps of passes
+  std::vector<std::pair<std::string, size_t>> passes_;
+  std::vector<std::pair<std::string, size_t>> planned_passes_;
+  // Whether the passes of this iteration match the planned ones so far
+  bool valid_ = true;
+  bool active_ = false;
+  size_t pass_base_ = 0;
+  size_t pass_step_num_ = 0;
+  size_t step_ = 0;
+
+  const std::shared_ptr<spdlog::logger> logger = getLogger("BufferArena");
+};
+} // namespace rannc
+
+#endif // PYRANNC_BUFFERARENA_H
@@ -8,6 +8,7 @@
 #include <torch/torch.h>
 
 #include "comp/OffloadedParamMap.h"
+#include "comp/ZeroBcastEvents.h"
 #include "distop/DistMatmul.h"
 #include "graph/ir.h"
 #include "torch/TorchUtil.h"
@@ -34,6 +35,26 @@ at::Tensor offloadingPostHook(
   return OffloadingHookFunction::apply(tensor, name, false);
 }
 
+// *names* are comma-separated names of params used by the next node
+torch::jit::IValue zeroParamWaitHook(
+    const torch::jit::IValue& val, const std::string& names) {
+  ZeroBcastEvents& bcast_events = ZeroBcastEvents::get();
+  for (const auto& name : split(names, ',')) {
+    bcast_events.wait(name);
+  }
+  return val;
+}
+
+at::Tensor zeroParamPreHook(
+    const at::Tensor& tensor, const std::string& names) {
+  return ZeroParamHookFunction::apply(tensor, names);
+}
+
+at::Tensor zeroParamPostHook(
+    const at::Tensor& tensor, const std::string& names) {
+  return ZeroParamPostHookFunction::apply(tensor, names);
+}
+
 at::Tensor matmulDist(
     const at::Tensor& input, const at::Tensor& weight,
     const c10::optional<at::Tensor>& bias,
@@ -41,6 +62,22 @@ at::Tensor matmulDist(
   return DistLinearFunction::apply(input, weight, bias, dist_ranks);
 }
 
+// The weight of matmul is the transpose of that of linear
+at::Tensor matmulWeightDist(
+    const at::Tensor& input, const at::Tensor& weight,
+    const std::vector<int64_t>& dist_ranks) {
+  return DistLinearFunction::apply(
+      input, weight.t(), c10::optional<at::Tensor>(), dist_ranks);
+}
+
+at::Tensor embeddingDist(
+    const at::Tensor& weight, const at::Tensor& indices, int64_t padding_idx,
+    bool scale_grad_by_freq, bool sparse,
+    const std::vector<int64_t>& dist_ranks) {
+  return EmbeddingDistFunction::apply(
+      weight, indices, padding_idx, scale_grad_by_freq, sparse, dist_ranks);
+}
+
 at::Tensor gather(
     const at::Tensor& input, int64_t dim,
     const std::vector<int64_t>& dist_ranks) {
@@ -51,12 +88,25 @@ TORCH_LIBRARY(rannc, m) {
   m.def("displayValueHook", displayValueHook);
   m.def("offloadingPreHook", offloadingPreHook);
   m.def("offloadingPostHook", offloadingPostHook);
+  m.def("zeroParamWaitHook", zeroParamWaitHook);
+  m.def("zeroParamPreHook", zeroParamPreHook);
+  m.def("zeroParamPostHook", zeroParamPostHook);
 
   m.def(
       TORCH_SELECTIVE_SCHEMA(
           "rannc::linear_dist(Tensor input, Tensor weight, Tensor? bias, int[] dist_ranks) -> Tensor"),
       matmulDist);
 
+  m.def(
+      TORCH_SELECTIVE_SCHEMA(
+          "rannc::matmul_dist(Tensor input, Tensor weight, int[] dist_ranks) -> Tensor"),
+      matmulWeightDist);
+
+  m.def(
+      TORCH_SELECTIVE_SCHEMA(
+          "rannc::embedding_dist(Tensor weight, Tensor indices, int padding_idx, bool scale_grad_by_freq, bool sparse, int[] dist_ranks) -> Tensor"),
+      embeddingDist);
+
   m.def(
       TORCH_SELECTIVE_SCHEMA(
           "rannc::gather(Tensor input, int dim_idx, int[] dist_ranks) -> Tensor"),
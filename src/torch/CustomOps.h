@@ -6,6 +6,7 @@
 #define PYRANNC_CUSTOMOPS_H
 
 #include <comp/OffloadedParamMap.h>
+#include <comp/ZeroParamMap.h>
 #include <spdlog/spdlog.h>
 #include <torch/torch.h>
 #include "TorchUtil.h"
@@ -21,12 +22,11 @@ class OffloadingHookFunction
     ctx->saved_data["param_name"] = param_name;
     ctx->saved_data["to_cuda"] = to_cuda;
     OffloadedParamMap& param_map = OffloadedParamMap::get();
-    at::Tensor param = param_map.getParam(param_name);
 
     if (to_cuda) {
-      toCUDAInPlace(param);
+      param_map.fetch(param_name, false);
     } else {
-      toCPUInPlace(param);
+      param_map.offload(param_name);
     }
 
     return input;
@@ -38,16 +38,16 @@ class OffloadingHookFunction
     const torch::jit::IValue iv_param_name = ctx->saved_data["param_name"];
     assert(iv_param_name.isString());
     OffloadedParamMap& param_map = OffloadedParamMap::get();
-    at::Tensor param = param_map.getParam(iv_param_name.toStringRef());
+    const auto& param_name = iv_param_name.toStringRef();
 
     const torch::jit::IValue iv_to_cuda = ctx->saved_data["to_cuda"];
     assert(iv_to_cuda.isBool());
     bool to_cuda = iv_to_cuda.toBool();
 
     if (to_cuda) {
-      toCPUInPlace(param);
+      param_map.offload(param_name);
     } else {
-      toCUDAInPlace(param);
+      param_map.fetch(param_name, true);
     }
 
     grad_outputs.push_back(torch::autograd::Variable());
@@ -64,9 +64,7 @@ class OffloadingPostHookFunction
       const std::string& param_name) {
     ctx->saved_data["param_name"] = param_name;
     OffloadedParamMap& param_map = OffloadedParamMap::get();
-    at::Tensor param = param_map.getParam(param_name);
-
-    toCPUInPlace(param);
+    param_map.offload(param_name);
 
     return input;
   }
@@ -77,9 +75,72 @@ class OffloadingPostHookFunction
     const torch::jit::IValue iv_param_name = ctx->saved_data["param_name"];
     assert(iv_param_name.isString());
     OffloadedParamMap& param_map = OffloadedParamMap::get();
-    at::Tensor param = param_map.getParam(iv_param_name.toStringRef());
+    param_map.fetch(iv_param_name.toStringRef(), true);
+
+    grad_outputs.push_back(torch::autograd::Variable());
+    return grad_outputs;
+  }
+};
+
+// Gathers ZeRO params before the node using them and releases them after the
+// backward of the node. The hook takes one of the params, so the backward runs
+// whenever the param requires grad. *param_names* is a comma-separated list.
+class ZeroParamHookFunction
+    : public torch::autograd::Function<ZeroParamHookFunction> {
+ public:
+  static torch::Tensor forward(
+      torch::autograd::AutogradContext* ctx, torch::Tensor input,
+      const std::string& param_names) {
+    ctx->saved_data["param_names"] = param_names;
+    ZeroParamMap& zero_param_map = ZeroParamMap::get();
+    for (const auto& name : split(param_names, ',')) {
+      zero_param_map.gather(name, false);
+    }
+
+    return input;
+  }
+
+  static torch::autograd::tensor_list backward(
+      torch::autograd::AutogradContext* ctx,
+      torch::autograd::tensor_list grad_outputs) {
+    const torch::jit::IValue iv_param_names = ctx->saved_data["param_names"];
+    assert(iv_param_names.isString());
+    ZeroParamMap& zero_param_map = ZeroParamMap::get();
+    for (const auto& name : split(iv_param_names.toStringRef(), ',')) {
+      zero_param_map.release(name);
+    }
+
+    grad_outputs.push_back(torch::autograd::Variable());
+    return grad_outputs;
+  }
+};
+
+// Releases ZeRO params after the node using them and gathers them again before
+// the backward of the node. *param_names* is a comma-separated list.
+class ZeroParamPostHookFunction
+    : public torch::autograd::Function<ZeroParamPostHookFunction> {
+ public:
+  static torch::Tensor forward(
+      torch::autograd::AutogradContext* ctx, torch::Tensor input,
+      const std::string& param_names) {
+    ctx->saved_data["param_names"] = param_names;
+    ZeroParamMap& zero_param_map = ZeroParamMap::get();
+    for (const auto& name : split(param_names, ',')) {
+      zero_param_map.release(name);
+    }
+
+    return input;
+  }
 
-    toCUDAInPlace(param);
+  static torch::autograd::tensor_list backward(
+      torch::autograd::AutogradContext* ctx,
+      torch::autograd::tensor_list grad_outputs) {
+    const torch::jit::IValue iv_param_names = ctx->saved_data["param_names"];
+    assert(iv_param_names.isString());
+    ZeroParamMap& zero_param_map = ZeroParamMap::get();
+    for (const auto& name : split(iv_param_names.toStringRef(), ',')) {
+      zero_param_map.gather(name, true);
+    }
 
     grad_outputs.push_back(torch::autograd::Variable());
     return grad_outputs;
@@ -89,6 +150,10 @@ class OffloadingPostHookFunction
 at::Tensor offloadingPreHook(const at::Tensor& tensor, const std::string& name);
 at::Tensor offloadingPostHook(
     const at::Tensor& tensor, const std::string& name);
+at::Tensor zeroParamPreHook(
+    const at::Tensor& tensor, const std::string& names);
+at::Tensor zeroParamPostHook(
+    const at::Tensor& tensor, const std::string& names);
 
 } // namespace rannc
 
@@ -0,0 +1,188 @@
+#include "FunctionCache.h"
+
+#include <Config.h>
+
+namespace rannc {
+
+namespace {
+size_t hashTensorData(const at::Tensor& ten) {
+  const auto cpu_ten = ten.detach().to(c10::Device(c10::DeviceType::CPU))
+                           .contiguous();
+  return std::hash<std::string>()(std::string(
+      static_cast<const char*>(cpu_ten.data_ptr()), cpu_ten.nbytes()));
+}
+
+void writeConstant(std::ostream& os, const torch::jit::IValue& iv) {
+  if (iv.isTensor()) {
+    // Written by content because the memory of a freed tensor can be reused by
+    // another one
+    const auto& ten = iv.toTensor();
+    os << "T" << ten.scalar_type() << ten.device()
+       << join_as_str(ten.sizes().vec()) << "#" << hashTensorData(ten);
+  } else if (iv.isTensorList()) {
+    os << "[";
+    for (const auto& ten : iv.toTensorVector()) {
+      writeConstant(os, ten);
+      os << ",";
+    }
+    os << "]";
+  } else if (iv.isTuple()) {
+    os << "(";
+    for (const auto& elem : iv.toTuple()->elements()) {
+      writeConstant(os, elem);
+      os << ",";
+    }
+    os << ")";
+  } else {
+    os << iv.tagKind() << ":" << iv;
+  }
+}
+
+void collectTensors(
+    const torch::jit::IValue& iv, std::vector<at::Tensor>& tensors) {
+  if (iv.isTensor()) {
+    tensors.push_back(iv.toTensor());
+  } else if (iv.isTensorList()) {
+    for (const auto& ten : iv.toTensorVector()) {
+      tensors.push_back(ten);
+    }
+  } else if (iv.isTuple()) {
+    for (const auto& elem : iv.toTuple()->elements()) {
+      collectTensors(elem, tensors);
+    }
+  }
+}
+
+bool equalTensors(
+    const std::vector<at::Tensor>& tensors1,
+    const std::vector<at::Tensor>& tensors2) {
+  if (tensors1.size() != tensors2.size()) {
+    return false;
+  }
+  // Types, shapes and devices are covered by the signature
+  for (size_t i = 0; i < tensors1.size(); i++) {
+    if (!at::equal(tensors1.at(i), tensors2.at(i))) {
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace
+
+std::string getGraphSignature(
+    const std::shared_ptr<IRGraph>& ir_graph, const IValueMap& constants) {
+  // A converted graph refers to the functions it calls, which are owned by
+  // the module that defines them and can be freed with the module
+  for (const auto& node : ir_graph->getNodes()) {
+    if (ir_graph->isFunctionNode(node)) {
+      return "";
+    }
+  }
+
+  std::unordered_map<std::string, std::string> canonical_names;
+  std::stringstream ss;
+
+  const auto canonicalize = [&](const std::string& name) {
+    if (!contains(canonical_names, name)) {
+      const auto& val = ir_graph->getValue(name);
+      std::stringstream vs;
+      vs << "v" << canonical_names.size() << ":" << toString(val.getType());
+      canonical_names[name] = vs.str();
+    }
+    return canonical_names.at(name);
+  };
+
+  ss << "in=";
+  for (const auto& in_name : ir_graph->getInputNames()) {
+    ss << canonicalize(in_name) << ",";
+  }
+  for (const auto& node : ir_graph->getNodes()) {
+    ss << ";" << node.getName() << "(";
+    for (const auto& in_name : node.getInputNames()) {
+      ss << canonicalize(in_name) << ",";
+    }
+    ss << ")->(";
+    for (const auto& out_name : node.getOutputNames()) {
+      ss << canonicalize(out_name);
+      IValueLocation loc(out_name);
+      if (contains(constants, loc)) {
+        ss << "=";
+        writeConstant(ss, constants.at(loc));
+      }
+      ss << ",";
+    }
+    ss << ")";
+  }
+  ss << ";out=";
+  for (const auto& out_name : ir_graph->getOutputNames()) {
+    ss << canonicalize(out_name) << ",";
+  }
+  return ss.str();
+}
+
+std::vector<at::Tensor> getGraphTensorConstants(
+    const std::shared_ptr<IRGraph>& ir_graph, const IValueMap& constants) {
+  std::vector<at::Tensor> tensors;
+  for (const auto& node : ir_graph->getNodes()) {
+    for (const auto& out_name : node.getOutputNames()) {
+      IValueLocation loc(out_name);
+      if (contains(constants, loc)) {
+        collectTensors(constants.at(loc), tensors);
+      }
+    }
+  }
+  return tensors;
+}
+
+FunctionCache::FunctionCache() {
+  max_size_ = config::Config::get().getVal<int>(config::FUNC_CACHE_SIZE);
+}
+
+std::shared_ptr<torch::jit::Function> FunctionCache::find(
+    const std::string& signature,
+    const std::vector<at::Tensor>& tensor_constants) {
+  if (signature.empty()) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = functions_.find(signature);
+  if (it != functions_.end()) {
+    if (equalTensors(it->second.tensor_constants, tensor_constants)) {
+      hit_count_++;
+      return it->second.func;
+    }
+    logger->debug("Tensor constants differ for the same signature");
+  }
+  miss_count_++;
+  return nullptr;
+}
+
+void FunctionCache::put(
+    const std::string& signature,
+    const std::vector<at::Tensor>& tensor_constants,
+    const std::shared_ptr<torch::jit::Function>& func) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (max_size_ == 0 || signature.empty() ||
+      contains(functions_, signature)) {
+    return;
+  }
+
+  while (functions_.size() >= max_size_) {
+    functions_.erase(order_.front());
+    order_.pop_front();
+  }
+  functions_[signature] = {func, tensor_constants};
+  order_.push_back(signature);
+
+  logger->trace(
+      "Cached function: #functions={} hit={} miss={}", functions_.size(),
+      hit_count_, miss_count_);
+}
+
+void FunctionCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  functions_.clear();
+  order_.clear();
+}
+} // namespace rannc
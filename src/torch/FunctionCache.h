@@ -0,0 +1,94 @@
+#ifndef PYRANNC_FUNCTIONCACHE_H
+#define PYRANNC_FUNCTIONCACHE_H
+
+#include <deque>
+#include <mutex>
+
+#include <torch/csrc/jit/api/function_impl.h>
+
+#include <graph/ir.h>
+#include <Logging.h>
+#include "TorchUtil.h"
+
+namespace rannc {
+
+/**
+ * Computes a key that identifies the TorchScript graph converted from an
+ * *IRGraph*. Values are renamed by the order of their appearance, so that
+ * structurally identical subgraphs (e.g. layers of the same shape) share the
+ * key. The key also covers value types and the contents of constants.
+ *
+ * @param ir_graph Graph to convert.
+ * @param constants Constants used in the graph.
+ * @return Signature of the graph, or an empty string if the graph calls
+ * functions and must not be cached.
+ */
+std::string getGraphSignature(
+    const std::shared_ptr<IRGraph>& ir_graph, const IValueMap& constants);
+
+// Tensor constants of the graph in the order the signature covers them
+std::vector<at::Tensor> getGraphTensorConstants(
+    const std::shared_ptr<IRGraph>& ir_graph, const IValueMap& constants);
+
+/**
+ * Keeps compiled functions across creation and destruction of modules. A
+ * function found in the cache carries its optimized executor, which saves
+ * graph conversion and JIT warm-up.
+ *
+ * The signature covers tensor constants only by hashes of their contents.
+ * A function is therefore found only when the contents of the tensor
+ * constants are also equal to those of the cached one.
+ */
+class FunctionCache {
+ public:
+  FunctionCache(const FunctionCache&) = delete;
+  FunctionCache& operator=(const FunctionCache&) = delete;
+  FunctionCache(FunctionCache&&) = delete;
+  FunctionCache& operator=(FunctionCache&&) = delete;
+
+  static FunctionCache& get() {
+    static FunctionCache instance;
+    return instance;
+  }
+
+  std::shared_ptr<torch::jit::Function> find(
+      const std::string& signature,
+      const std::vector<at::Tensor>& tensor_constants);
+  void put(
+      const std::string& signature,
+      const std::vector<at::Tensor>& tensor_constants,
+      const std::shared_ptr<torch::jit::Function>& func);
+  void clear();
+
+  size_t getHitCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hit_count_;
+  }
+  size_t getMissCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return miss_count_;
+  }
+
+ private:
+  FunctionCache();
+  ~FunctionCache() = default;
+
+  struct CacheEntry {
+    std::shared_ptr<torch::jit::Function> func;
+    std::vector<at::Tensor> tensor_constants;
+  };
+
+  size_t max_size_;
+  std::unordered_map<std::string, CacheEntry> functions_;
+  // Signatures in the order of insertion. The oldest one is evicted first.
+  std::deque<std::string> order_;
+
+  size_t hit_count_ = 0;
+  size_t miss_count_ = 0;
+  mutable std::mutex mutex_;
+
+  const std::shared_ptr<spdlog::logger> logger = getLogger("FunctionCache");
+};
+} // namespace rannc
+
+#endif // PYRANNC_FUNCTIONCACHE_H
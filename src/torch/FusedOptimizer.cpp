@@ -0,0 +1,382 @@
+#include "FusedOptimizer.h"
+
+#include <ATen/Parallel.h>
+
+#include <cmath>
+#include <initializer_list>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RANNC_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace rannc {
+
+namespace {
+// Elements processed by a thread
+const int64_t GRAIN_SIZE = 32768;
+
+struct AdamConsts {
+  float beta1;
+  float one_minus_beta1;
+  float beta2;
+  float one_minus_beta2;
+  float eps;
+  float weight_decay;
+  float decay; // 1 - lr * weight_decay (AdamW)
+  float sqrt_bc2; // sqrt(1 - beta2^step)
+  float neg_step_size; // -lr / (1 - beta1^step)
+  bool decoupled;
+};
+
+struct SGDConsts {
+  float momentum;
+  float one_minus_dampening;
+  float weight_decay;
+  float neg_lr;
+  bool nesterov;
+  bool first_step;
+};
+
+void adamScalar(
+    float* p, const float* g, float* m, float* v, int64_t count,
+    const AdamConsts& c) {
+  for (int64_t i = 0; i < count; i++) {
+    float grad = g[i];
+    float param = p[i];
+    if (c.decoupled) {
+      param = param * c.decay;
+    } else if (c.weight_decay != 0) {
+      grad = grad + c.weight_decay * param;
+    }
+    const float mi = m[i] * c.beta1 + c.one_minus_beta1 * grad;
+    const float vi = v[i] * c.beta2 + c.one_minus_beta2 * (grad * grad);
+    const float denom = std::sqrt(vi) / c.sqrt_bc2 + c.eps;
+    m[i] = mi;
+    v[i] = vi;
+    p[i] = param + c.neg_step_size * (mi / denom);
+  }
+}
+
+void sgdScalar(
+    float* p, const float* g, float* buf, int64_t count, const SGDConsts& c) {
+  for (int64_t i = 0; i < count; i++) {
+    float d = g[i];
+    if (c.weight_decay != 0) {
+      d = d + c.weight_decay * p[i];
+    }
+    if (buf != nullptr) {
+      const float b = c.first_step
+          ? d
+          : buf[i] * c.momentum + c.one_minus_dampening * d;
+      buf[i] = b;
+      d = c.nesterov ? d + c.momentum * b : b;
+    }
+    p[i] = p[i] + c.neg_lr * d;
+  }
+}
+
+#ifdef RANNC_X86_SIMD
+// FMA is not used so that results match the scalar loop
+__attribute__((target("avx2"))) void adamAVX2(
+    float* p, const float* g, float* m, float* v, int64_t count,
+    const AdamConsts& c) {
+  const __m256 beta1 = _mm256_set1_ps(c.beta1);
+  const __m256 one_minus_beta1 = _mm256_set1_ps(c.one_minus_beta1);
+  const __m256 beta2 = _mm256_set1_ps(c.beta2);
+  const __m256 one_minus_beta2 = _mm256_set1_ps(c.one_minus_beta2);
+  const __m256 eps = _mm256_set1_ps(c.eps);
+  const __m256 wd = _mm256_set1_ps(c.weight_decay);
+  const __m256 decay = _mm256_set1_ps(c.decay);
+  const __m256 sqrt_bc2 = _mm256_set1_ps(c.sqrt_bc2);
+  const __m256 neg_step_size = _mm256_set1_ps(c.neg_step_size);
+  const bool coupled_wd = !c.decoupled && c.weight_decay != 0;
+
+  int64_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 grad = _mm256_loadu_ps(g + i);
+    __m256 param = _mm256_loadu_ps(p + i);
+    if (c.decoupled) {
+      param = _mm256_mul_ps(param, decay);
+    } else if (coupled_wd) {
+      grad = _mm256_add_ps(grad, _mm256_mul_ps(wd, param));
+    }
+    const __m256 mi = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_loadu_ps(m + i), beta1),
+        _mm256_mul_ps(one_minus_beta1, grad));
+    const __m256 vi = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_loadu_ps(v + i), beta2),
+        _mm256_mul_ps(one_minus_beta2, _mm256_mul_ps(grad, grad)));
+    const __m256 denom =
+        _mm256_add_ps(_mm256_div_ps(_mm256_sqrt_ps(vi), sqrt_bc2), eps);
+    _mm256_storeu_ps(m + i, mi);
+    _mm256_storeu_ps(v + i, vi);
+    _mm256_storeu_ps(
+        p + i,
+        _mm256_add_ps(
+            param, _mm256_mul_ps(neg_step_size, _mm256_div_ps(mi, denom))));
+  }
+  adamScalar(p + i, g + i, m + i, v + i, count - i, c);
+}
+
+__attribute__((target("avx2"))) void sgdAVX2(
+    float* p, const float* g, float* buf, int64_t count, const SGDConsts& c) {
+  const __m256 momentum = _mm256_set1_ps(c.momentum);
+  const __m256 one_minus_dampening = _mm256_set1_ps(c.one_minus_dampening);
+  const __m256 wd = _mm256_set1_ps(c.weight_decay);
+  const __m256 neg_lr = _mm256_set1_ps(c.neg_lr);
+
+  int64_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 param = _mm256_loadu_ps(p + i);
+    __m256 d = _mm256_loadu_ps(g + i);
+    if (c.weight_decay != 0) {
+      d = _mm256_add_ps(d, _mm256_mul_ps(wd, param));
+    }
+    if (buf != nullptr) {
+      const __m256 b = c.first_step
+          ? d
+          : _mm256_add_ps(
+                _mm256_mul_ps(_mm256_loadu_ps(buf + i), momentum),
+                _mm256_mul_ps(one_minus_dampening, d));
+      _mm256_storeu_ps(buf + i, b);
+      d = c.nesterov ? _mm256_add_ps(d, _mm256_mul_ps(momentum, b)) : b;
+    }
+    _mm256_storeu_ps(p + i, _mm256_add_ps(param, _mm256_mul_ps(neg_lr, d)));
+  }
+  sgdScalar(p + i, g + i, buf == nullptr ? nullptr : buf + i, count - i, c);
+}
+#endif
+
+bool useAVX2() {
+#ifdef RANNC_X86_SIMD
+  static const bool use_avx2 = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+  }();
+  return use_avx2;
+#else
+  return false;
+#endif
+}
+
+void adamCPU(
+    float* p, const float* g, float* m, float* v, int64_t count,
+    const AdamConsts& c) {
+#ifdef RANNC_X86_SIMD
+  if (useAVX2()) {
+    adamAVX2(p, g, m, v, count, c);
+    return;
+  }
+#endif
+  adamScalar(p, g, m, v, count, c);
+}
+
+void sgdCPU(
+    float* p, const float* g, float* buf, int64_t count, const SGDConsts& c) {
+#ifdef RANNC_X86_SIMD
+  if (useAVX2()) {
+    sgdAVX2(p, g, buf, count, c);
+    return;
+  }
+#endif
+  sgdScalar(p, g, buf, count, c);
+}
+
+// True if all tensors can be processed by the CPU kernels
+bool isFlatCPUFloat(std::initializer_list<const at::Tensor*> tensors) {
+  for (const auto* ten : tensors) {
+    if (!ten->is_cpu() || ten->scalar_type() != c10::ScalarType::Float ||
+        !ten->is_contiguous()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void checkSizes(
+    const at::Tensor& param, const at::Tensor& ten, const std::string& name) {
+  if (param.numel() != ten.numel()) {
+    std::stringstream ss;
+    ss << "The size of " << name << " does not match the parameter: "
+       << ten.numel() << " != " << param.numel();
+    throw std::invalid_argument(ss.str());
+  }
+}
+} // namespace
+
+void fusedAdamStep(
+    const std::vector<at::Tensor>& params,
+    const std::vector<at::Tensor>& grads,
+    const std::vector<at::Tensor>& exp_avgs,
+    const std::vector<at::Tensor>& exp_avg_sqs, int64_t step, double lr,
+    double beta1, double beta2, double eps, double weight_decay,
+    bool decoupled_weight_decay) {
+  assert(params.size() == grads.size());
+  assert(params.size() == exp_avgs.size());
+  assert(params.size() == exp_avg_sqs.size());
+  assert(step > 0);
+
+  torch::NoGradGuard no_grad;
+
+  const double bias_correction1 = 1 - std::pow(beta1, step);
+  const double bias_correction2 = 1 - std::pow(beta2, step);
+  const double step_size = lr / bias_correction1;
+  const double sqrt_bc2 = std::sqrt(bias_correction2);
+
+  AdamConsts consts;
+  consts.beta1 = beta1;
+  consts.one_minus_beta1 = 1 - beta1;
+  consts.beta2 = beta2;
+  consts.one_minus_beta2 = 1 - beta2;
+  consts.eps = eps;
+  consts.weight_decay = weight_decay;
+  consts.decay = 1 - lr * weight_decay;
+  consts.sqrt_bc2 = sqrt_bc2;
+  consts.neg_step_size = -step_size;
+  consts.decoupled = decoupled_weight_decay;
+
+  std::vector<at::Tensor> f_params, f_grads, f_exp_avgs, f_exp_avg_sqs;
+  for (size_t i = 0; i < params.size(); i++) {
+    auto param = params.at(i);
+    const auto& grad = grads.at(i);
+    auto exp_avg = exp_avgs.at(i);
+    auto exp_avg_sq = exp_avg_sqs.at(i);
+    if (!grad.defined() || param.numel() == 0) {
+      continue;
+    }
+    checkSizes(param, grad, "grad");
+    checkSizes(param, exp_avg, "exp_avg");
+    checkSizes(param, exp_avg_sq, "exp_avg_sq");
+
+    if (isFlatCPUFloat({&param, &grad, &exp_avg, &exp_avg_sq})) {
+      float* p = param.data_ptr<float>();
+      const float* g = grad.data_ptr<float>();
+      float* m = exp_avg.data_ptr<float>();
+      float* v = exp_avg_sq.data_ptr<float>();
+      at::parallel_for(
+          0, param.numel(), GRAIN_SIZE, [&](int64_t begin, int64_t end) {
+            adamCPU(
+                p + begin, g + begin, m + begin, v + begin, end - begin,
+                consts);
+          });
+      continue;
+    }
+    f_params.push_back(param);
+    f_grads.push_back(grad);
+    f_exp_avgs.push_back(exp_avg);
+    f_exp_avg_sqs.push_back(exp_avg_sq);
+  }
+
+  if (f_params.empty()) {
+    return;
+  }
+
+  if (decoupled_weight_decay) {
+    if (weight_decay != 0) {
+      at::_foreach_mul_(f_params, 1 - lr * weight_decay);
+    }
+  } else if (weight_decay != 0) {
+    f_grads = at::_foreach_add(f_grads, f_params, weight_decay);
+  }
+
+  at::_foreach_mul_(f_exp_avgs, beta1);
+  at::_foreach_add_(f_exp_avgs, f_grads, 1 - beta1);
+  at::_foreach_mul_(f_exp_avg_sqs, beta2);
+  at::_foreach_addcmul_(f_exp_avg_sqs, f_grads, f_grads, 1 - beta2);
+
+  auto denoms = at::_foreach_sqrt(f_exp_avg_sqs);
+  at::_foreach_div_(denoms, sqrt_bc2);
+  at::_foreach_add_(denoms, eps);
+  at::_foreach_addcdiv_(f_params, f_exp_avgs, denoms, -step_size);
+}
+
+void fusedSGDStep(
+    const std::vector<at::Tensor>& params,
+    const std::vector<at::Tensor>& grads,
+    const std::vector<at::Tensor>& momentum_bufs, double lr, double momentum,
+    double dampening, double weight_decay, bool nesterov, bool first_step) {
+  assert(params.size() == grads.size());
+
+  const bool use_momentum = momentum != 0;
+  if (use_momentum) {
+    assert(params.size() == momentum_bufs.size());
+  }
+
+  torch::NoGradGuard no_grad;
+
+  SGDConsts consts;
+  consts.momentum = momentum;
+  consts.one_minus_dampening = 1 - dampening;
+  consts.weight_decay = weight_decay;
+  consts.neg_lr = -lr;
+  consts.nesterov = nesterov;
+  consts.first_step = first_step;
+
+  std::vector<at::Tensor> f_params, f_grads, f_bufs;
+  for (size_t i = 0; i < params.size(); i++) {
+    auto param = params.at(i);
+    const auto& grad = grads.at(i);
+    if (!grad.defined() || param.numel() == 0) {
+      continue;
+    }
+    checkSizes(param, grad, "grad");
+
+    at::Tensor buf;
+    if (use_momentum) {
+      buf = momentum_bufs.at(i);
+      checkSizes(param, buf, "momentum_buffer");
+    }
+
+    const bool flat = use_momentum
+        ? isFlatCPUFloat({&param, &grad, &buf})
+        : isFlatCPUFloat({&param, &grad});
+    if (flat) {
+      float* p = param.data_ptr<float>();
+      const float* g = grad.data_ptr<float>();
+      float* b = use_momentum ? buf.data_ptr<float>() : nullptr;
+      at::parallel_for(
+          0, param.numel(), GRAIN_SIZE, [&](int64_t begin, int64_t end) {
+            sgdCPU(
+                p + begin, g + begin, b == nullptr ? nullptr : b + begin,
+                end - begin, consts);
+          });
+      continue;
+    }
+    f_params.push_back(param);
+    f_grads.push_back(grad);
+    if (use_momentum) {
+      f_bufs.push_back(buf);
+    }
+  }
+
+  if (f_params.empty()) {
+    return;
+  }
+
+  if (weight_decay != 0) {
+    f_grads = at::_foreach_add(f_grads, f_params, weight_decay);
+  }
+
+  if (use_momentum) {
+    if (first_step) {
+      for (size_t i = 0; i < f_bufs.size(); i++) {
+        f_bufs.at(i).copy_(f_grads.at(i));
+      }
+    } else {
+      at::_foreach_mul_(f_bufs, momentum);
+      at::_foreach_add_(f_bufs, f_grads, 1 - dampening);
+    }
+
+    if (nesterov) {
+      f_grads = at::_foreach_add(f_grads, f_bufs, momentum);
+    } else {
+      f_grads = f_bufs;
+    }
+  }
+
+  at::_foreach_add_(f_params, f_grads, -lr);
+}
+} // namespace rannc
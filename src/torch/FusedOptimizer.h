@@ -0,0 +1,48 @@
+#ifndef PYRANNC_FUSEDOPTIMIZER_H
+#define PYRANNC_FUSEDOPTIMIZER_H
+
+#include <torch/torch.h>
+
+namespace rannc {
+
+/**
+ * Update steps of optimizers applied to lists of tensors in one call. The
+ * tensors are typically local segments of ZeRO or amp master params, and
+ * optimizer states are updated in place.
+ *
+ * When a parameter, its gradient and states are contiguous fp32 tensors on
+ * CPU (e.g. offloaded ones), the update is done by a vectorized loop in a
+ * single pass over the elements. Other tensors are processed by multi-tensor
+ * (foreach) operations of PyTorch.
+ *
+ * The math follows *torch.optim.Adam*, *torch.optim.AdamW* and
+ * *torch.optim.SGD*.
+ */
+
+/**
+ * Performs a step of Adam (or AdamW when *decoupled_weight_decay* is true).
+ *
+ * @param step Step count after increment. Must be the same for all params.
+ */
+void fusedAdamStep(
+    const std::vector<at::Tensor>& params,
+    const std::vector<at::Tensor>& grads,
+    const std::vector<at::Tensor>& exp_avgs,
+    const std::vector<at::Tensor>& exp_avg_sqs, int64_t step, double lr,
+    double beta1, double beta2, double eps, double weight_decay,
+    bool decoupled_weight_decay);
+
+/**
+ * Performs a step of SGD with momentum.
+ *
+ * @param momentum_bufs Momentum buffers. Ignored if *momentum* is zero.
+ * @param first_step If true, momentum buffers are initialized with gradients.
+ */
+void fusedSGDStep(
+    const std::vector<at::Tensor>& params,
+    const std::vector<at::Tensor>& grads,
+    const std::vector<at::Tensor>& momentum_bufs, double lr, double momentum,
+    double dampening, double weight_decay, bool nesterov, bool first_step);
+} // namespace rannc
+
+#endif // PYRANNC_FUSEDOPTIMIZER_H
@@ -0,0 +1,391 @@
+#include "HalfConversion.h"
+
+#include <ATen/Parallel.h>
+#include <c10/util/BFloat16.h>
+#include <c10/util/Half.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RANNC_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace rannc {
+
+namespace {
+// Elements processed by a thread
+const int64_t GRAIN_SIZE = 32768;
+
+enum class SimdLevel { SCALAR, AVX2, AVX512 };
+
+SimdLevel getSimdLevel() {
+  static const SimdLevel level = []() {
+#ifdef RANNC_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+      return SimdLevel::AVX512;
+    }
+    // All the processors with AVX2 support F16C
+    if (__builtin_cpu_supports("avx2")) {
+      return SimdLevel::AVX2;
+    }
+#endif
+    return SimdLevel::SCALAR;
+  }();
+  return level;
+}
+
+// Loads and stores vectors of fp16 values
+struct HalfOps {
+  using scalar_t = c10::Half;
+
+#ifdef RANNC_X86_SIMD
+  __attribute__((target("avx2,f16c"))) static __m256 load8(
+      const uint16_t* src) {
+    return _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+  }
+
+  __attribute__((target("avx2,f16c"))) static void store8(
+      uint16_t* dst, __m256 v) {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(dst),
+        _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+  }
+
+  __attribute__((target("avx512f"))) static __m512 load16(
+      const uint16_t* src) {
+    return _mm512_cvtph_ps(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+  }
+
+  __attribute__((target("avx512f"))) static void store16(
+      uint16_t* dst, __m512 v) {
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(dst),
+        _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+  }
+#endif
+};
+
+// Loads and stores vectors of bf16 values. Stores round to nearest even as
+// c10::BFloat16 does, and NaN becomes 0x7FC0.
+struct Bf16Ops {
+  using scalar_t = c10::BFloat16;
+
+#ifdef RANNC_X86_SIMD
+  __attribute__((target("avx2"))) static __m256 load8(const uint16_t* src) {
+    const __m256i w = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(w, 16));
+  }
+
+  __attribute__((target("avx2"))) static void store8(uint16_t* dst, __m256 v) {
+    const __m256i u = _mm256_castps_si256(v);
+    const __m256i lsb =
+        _mm256_and_si256(_mm256_srli_epi32(u, 16), _mm256_set1_epi32(1));
+    __m256i r = _mm256_srli_epi32(
+        _mm256_add_epi32(_mm256_add_epi32(u, _mm256_set1_epi32(0x7FFF)), lsb),
+        16);
+    const __m256 nan = _mm256_cmp_ps(v, v, _CMP_UNORD_Q);
+    r = _mm256_blendv_epi8(
+        r, _mm256_set1_epi32(0x7FC0), _mm256_castps_si256(nan));
+    // packus works within 128-bit lanes
+    const __m256i packed =
+        _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0xD8);
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(dst), _mm256_castsi256_si128(packed));
+  }
+
+  __attribute__((target("avx512f"))) static __m512 load16(
+      const uint16_t* src) {
+    const __m512i w = _mm512_cvtepu16_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(w, 16));
+  }
+
+  __attribute__((target("avx512f"))) static void store16(
+      uint16_t* dst, __m512 v) {
+    const __m512i u = _mm512_castps_si512(v);
+    const __m512i lsb =
+        _mm512_and_si512(_mm512_srli_epi32(u, 16), _mm512_set1_epi32(1));
+    __m512i r = _mm512_srli_epi32(
+        _mm512_add_epi32(_mm512_add_epi32(u, _mm512_set1_epi32(0x7FFF)), lsb),
+        16);
+    const __mmask16 nan = _mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q);
+    r = _mm512_mask_mov_epi32(r, nan, _mm512_set1_epi32(0x7FC0));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(dst), _mm512_cvtepi32_epi16(r));
+  }
+#endif
+};
+
+template <typename Ops>
+void toFloatScalar(
+    const uint16_t* src, float* dst, int64_t count, bool accumulate,
+    float scale) {
+  using T = typename Ops::scalar_t;
+  const T* typed_src = reinterpret_cast<const T*>(src);
+  if (accumulate) {
+    for (int64_t i = 0; i < count; i++) {
+      dst[i] += scale * static_cast<float>(typed_src[i]);
+    }
+  } else {
+    for (int64_t i = 0; i < count; i++) {
+      dst[i] = scale * static_cast<float>(typed_src[i]);
+    }
+  }
+}
+
+template <typename Ops>
+void fromFloatScalar(
+    const float* src, uint16_t* dst, int64_t count, float scale) {
+  using T = typename Ops::scalar_t;
+  T* typed_dst = reinterpret_cast<T*>(dst);
+  for (int64_t i = 0; i < count; i++) {
+    typed_dst[i] = static_cast<T>(scale * src[i]);
+  }
+}
+
+#ifdef RANNC_X86_SIMD
+// Multiplication and addition are not fused so that the results match the
+// scalar kernels.
+template <typename Ops>
+__attribute__((target("avx2,f16c"))) void toFloatAVX2(
+    const uint16_t* src, float* dst, int64_t count, bool accumulate,
+    float scale) {
+  const __m256 vscale = _mm256_set1_ps(scale);
+  int64_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 v = _mm256_mul_ps(Ops::load8(src + i), vscale);
+    if (accumulate) {
+      v = _mm256_add_ps(_mm256_loadu_ps(dst + i), v);
+    }
+    _mm256_storeu_ps(dst + i, v);
+  }
+  toFloatScalar<Ops>(src + i, dst + i, count - i, accumulate, scale);
+}
+
+template <typename Ops>
+__attribute__((target("avx2,f16c"))) void fromFloatAVX2(
+    const float* src, uint16_t* dst, int64_t count, float scale) {
+  const __m256 vscale = _mm256_set1_ps(scale);
+  int64_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    Ops::store8(dst + i, _mm256_mul_ps(_mm256_loadu_ps(src + i), vscale));
+  }
+  fromFloatScalar<Ops>(src + i, dst + i, count - i, scale);
+}
+
+template <typename Ops>
+__attribute__((target("avx512f"))) void toFloatAVX512(
+    const uint16_t* src, float* dst, int64_t count, bool accumulate,
+    float scale) {
+  const __m512 vscale = _mm512_set1_ps(scale);
+  int64_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m512 v = _mm512_mul_ps(Ops::load16(src + i), vscale);
+    if (accumulate) {
+      v = _mm512_add_ps(_mm512_loadu_ps(dst + i), v);
+    }
+    _mm512_storeu_ps(dst + i, v);
+  }
+  toFloatScalar<Ops>(src + i, dst + i, count - i, accumulate, scale);
+}
+
+template <typename Ops>
+__attribute__((target("avx512f"))) void fromFloatAVX512(
+    const float* src, uint16_t* dst, int64_t count, float scale) {
+  const __m512 vscale = _mm512_set1_ps(scale);
+  int64_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    Ops::store16(dst + i, _mm512_mul_ps(_mm512_loadu_ps(src + i), vscale));
+  }
+  fromFloatScalar<Ops>(src + i, dst + i, count - i, scale);
+}
+#endif
+
+using ToFloatKernel = void (*)(const uint16_t*, float*, int64_t, bool, float);
+using FromFloatKernel = void (*)(const float*, uint16_t*, int64_t, float);
+
+template <typename Ops>
+ToFloatKernel getToFloatKernel() {
+#ifdef RANNC_X86_SIMD
+  switch (getSimdLevel()) {
+    case SimdLevel::AVX512:
+      return toFloatAVX512<Ops>;
+    case SimdLevel::AVX2:
+      return toFloatAVX2<Ops>;
+    default:
+      break;
+  }
+#endif
+  return toFloatScalar<Ops>;
+}
+
+template <typename Ops>
+FromFloatKernel getFromFloatKernel() {
+#ifdef RANNC_X86_SIMD
+  switch (getSimdLevel()) {
+    case SimdLevel::AVX512:
+      return fromFloatAVX512<Ops>;
+    case SimdLevel::AVX2:
+      return fromFloatAVX2<Ops>;
+    default:
+      break;
+  }
+#endif
+  return fromFloatScalar<Ops>;
+}
+
+void runToFloat(
+    ToFloatKernel kernel, const void* src, float* dst, int64_t count,
+    bool accumulate, float scale) {
+  const auto* src16 = static_cast<const uint16_t*>(src);
+  at::parallel_for(0, count, GRAIN_SIZE, [&](int64_t begin, int64_t end) {
+    kernel(src16 + begin, dst + begin, end - begin, accumulate, scale);
+  });
+}
+
+void runFromFloat(
+    FromFloatKernel kernel, const float* src, void* dst, int64_t count,
+    float scale) {
+  auto* dst16 = static_cast<uint16_t*>(dst);
+  at::parallel_for(0, count, GRAIN_SIZE, [&](int64_t begin, int64_t end) {
+    kernel(src + begin, dst16 + begin, end - begin, scale);
+  });
+}
+
+bool isHalfOrBf16(c10::ScalarType stype) {
+  return stype == c10::ScalarType::Half || stype == c10::ScalarType::BFloat16;
+}
+
+bool useHostKernel(const at::Tensor& ten) {
+  return ten.device().is_cpu() && ten.is_contiguous();
+}
+
+bool hostConvertible(c10::ScalarType src, c10::ScalarType dst) {
+  return (src == c10::ScalarType::Float && isHalfOrBf16(dst)) ||
+      (isHalfOrBf16(src) && dst == c10::ScalarType::Float);
+}
+} // namespace
+
+void halfToFloat(const void* src, float* dst, int64_t count, float scale) {
+  static const auto kernel = getToFloatKernel<HalfOps>();
+  runToFloat(kernel, src, dst, count, false, scale);
+}
+
+void floatToHalf(const float* src, void* dst, int64_t count, float scale) {
+  static const auto kernel = getFromFloatKernel<HalfOps>();
+  runFromFloat(kernel, src, dst, count, scale);
+}
+
+void bf16ToFloat(const void* src, float* dst, int64_t count, float scale) {
+  static const auto kernel = getToFloatKernel<Bf16Ops>();
+  runToFloat(kernel, src, dst, count, false, scale);
+}
+
+void floatToBf16(const float* src, void* dst, int64_t count, float scale) {
+  static const auto kernel = getFromFloatKernel<Bf16Ops>();
+  runFromFloat(kernel, src, dst, count, scale);
+}
+
+void accumulateHalfToFloat(
+    const void* src, float* dst, int64_t count, float scale) {
+  static const auto kernel = getToFloatKernel<HalfOps>();
+  runToFloat(kernel, src, dst, count, true, scale);
+}
+
+void accumulateBf16ToFloat(
+    const void* src, float* dst, int64_t count, float scale) {
+  static const auto kernel = getToFloatKernel<Bf16Ops>();
+  runToFloat(kernel, src, dst, count, true, scale);
+}
+
+namespace {
+// Both must be contiguous tensors on CPU
+void convertOnHost(at::Tensor& dst, const at::Tensor& src) {
+  const int64_t count = src.numel();
+  switch (dst.scalar_type()) {
+    case c10::ScalarType::Half:
+      floatToHalf(src.data_ptr<float>(), dst.data_ptr(), count);
+      break;
+    case c10::ScalarType::BFloat16:
+      floatToBf16(src.data_ptr<float>(), dst.data_ptr(), count);
+      break;
+    default:
+      if (src.scalar_type() == c10::ScalarType::Half) {
+        halfToFloat(src.data_ptr(), dst.data_ptr<float>(), count);
+      } else {
+        bf16ToFloat(src.data_ptr(), dst.data_ptr<float>(), count);
+      }
+  }
+}
+} // namespace
+
+at::Tensor toFloatScaled(const at::Tensor& src, double scale) {
+  torch::NoGradGuard no_grad;
+
+  if (!useHostKernel(src) || !isHalfOrBf16(src.scalar_type())) {
+    auto ret = src.to(c10::ScalarType::Float, true, true);
+    return scale == 1 ? ret : ret.mul_(scale);
+  }
+
+  auto ret = torch::empty(
+      src.sizes(), src.options().dtype(c10::ScalarType::Float));
+  if (src.scalar_type() == c10::ScalarType::Half) {
+    halfToFloat(src.data_ptr(), ret.data_ptr<float>(), src.numel(), scale);
+  } else {
+    bf16ToFloat(src.data_ptr(), ret.data_ptr<float>(), src.numel(), scale);
+  }
+  return ret;
+}
+
+void accumulateToFloat(at::Tensor& dst, const at::Tensor& src, double scale) {
+  torch::NoGradGuard no_grad;
+
+  assert(dst.scalar_type() == c10::ScalarType::Float);
+  assert(dst.numel() == src.numel());
+
+  if (!useHostKernel(src) || !useHostKernel(dst) ||
+      !isHalfOrBf16(src.scalar_type())) {
+    dst.add_(src.reshape(dst.sizes()), scale);
+    return;
+  }
+
+  if (src.scalar_type() == c10::ScalarType::Half) {
+    accumulateHalfToFloat(
+        src.data_ptr(), dst.data_ptr<float>(), src.numel(), scale);
+  } else {
+    accumulateBf16ToFloat(
+        src.data_ptr(), dst.data_ptr<float>(), src.numel(), scale);
+  }
+}
+
+at::Tensor convertScalarType(const at::Tensor& src, c10::ScalarType stype) {
+  if (!useHostKernel(src) || !hostConvertible(src.scalar_type(), stype)) {
+    return src.to(stype);
+  }
+
+  auto ret = torch::empty(src.sizes(), src.options().dtype(stype));
+  convertOnHost(ret, src);
+  return ret;
+}
+
+void copyConverting(at::Tensor& dst, const at::Tensor& src) {
+  torch::NoGradGuard no_grad;
+
+  assert(dst.numel() == src.numel());
+  if (!useHostKernel(src) ||
+      !hostConvertible(src.scalar_type(), dst.scalar_type())) {
+    dst.copy_(src.reshape(dst.sizes()));
+    return;
+  }
+
+  if (useHostKernel(dst)) {
+    convertOnHost(dst, src);
+    return;
+  }
+  // Converted before the transfer, which is smaller in fp16/bf16
+  dst.copy_(convertScalarType(src, dst.scalar_type()).reshape(dst.sizes()));
+}
+} // namespace rannc
@@ -0,0 +1,53 @@
+#ifndef PYRANNC_HALFCONVERSION_H
+#define PYRANNC_HALFCONVERSION_H
+
+#include <torch/torch.h>
+
+namespace rannc {
+
+/**
+ * Conversions between fp16/bf16 and fp32 buffers on the host. The kernels use
+ * AVX-512 or AVX2 (with F16C) when the CPU supports them, and otherwise fall
+ * back to scalar conversions. Rounding is round-to-nearest-even, which is the
+ * same as *copy_* of PyTorch.
+ *
+ * *scale* is multiplied in fp32: dst = scale * src for conversions to fp16/bf16
+ * and dst = scale * float(src) (or dst += scale * float(src) for the
+ * accumulating variants) for conversions to fp32.
+ */
+void halfToFloat(const void* src, float* dst, int64_t count, float scale = 1);
+void floatToHalf(const float* src, void* dst, int64_t count, float scale = 1);
+void bf16ToFloat(const void* src, float* dst, int64_t count, float scale = 1);
+void floatToBf16(const float* src, void* dst, int64_t count, float scale = 1);
+void accumulateHalfToFloat(
+    const void* src, float* dst, int64_t count, float scale = 1);
+void accumulateBf16ToFloat(
+    const void* src, float* dst, int64_t count, float scale = 1);
+
+/**
+ * Returns a fp32 tensor of *scale* * *src*. The host kernels are used for
+ * contiguous fp16/bf16 tensors on CPU.
+ */
+at::Tensor toFloatScaled(const at::Tensor& src, double scale = 1);
+
+/**
+ * Adds *scale* * *src* to a fp32 tensor *dst*.
+ */
+void accumulateToFloat(
+    at::Tensor& dst, const at::Tensor& src, double scale = 1);
+
+/**
+ * Same as *src.to(stype)*, but uses the host kernels for conversions between
+ * fp32 and fp16/bf16 of contiguous tensors on CPU.
+ */
+at::Tensor convertScalarType(const at::Tensor& src, c10::ScalarType stype);
+
+/**
+ * Same as *dst.copy_(src)* for tensors with the same number of elements. A
+ * contiguous fp32 or fp16/bf16 tensor *src* on CPU is converted by the host
+ * kernels, before the transfer if *dst* is on a device.
+ */
+void copyConverting(at::Tensor& dst, const at::Tensor& src);
+} // namespace rannc
+
+#endif // PYRANNC_HALFCONVERSION_H
@@ -0,0 +1,158 @@
+#include "MultiTensorScale.h"
+
+#include <ATen/Parallel.h>
+
+#include <atomic>
+#include <cmath>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RANNC_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace rannc {
+
+namespace {
+// Elements processed by a thread
+const int64_t GRAIN_SIZE = 32768;
+
+struct TensorGroup {
+  c10::Device device;
+  c10::ScalarType stype;
+  std::vector<at::Tensor> tensors;
+};
+
+// Returns true if non-finite values are found
+bool scaleFloatScalar(float* data, int64_t count, float scale) {
+  bool found = false;
+  for (int64_t i = 0; i < count; i++) {
+    found |= !std::isfinite(data[i]);
+    data[i] *= scale;
+  }
+  return found;
+}
+
+#ifdef RANNC_X86_SIMD
+// x * 0 is NaN only when x is inf or NaN. The products are summed up and the
+// sum is checked at the end.
+__attribute__((target("avx2"))) bool scaleFloatAVX2(
+    float* data, int64_t count, float scale) {
+  const __m256 vscale = _mm256_set1_ps(scale);
+  const __m256 zero = _mm256_setzero_ps();
+  __m256 acc = _mm256_setzero_ps();
+  int64_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 v = _mm256_loadu_ps(data + i);
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(v, zero));
+    _mm256_storeu_ps(data + i, _mm256_mul_ps(v, vscale));
+  }
+  const bool found =
+      _mm256_movemask_ps(_mm256_cmp_ps(acc, acc, _CMP_UNORD_Q)) != 0;
+  return scaleFloatScalar(data + i, count - i, scale) || found;
+}
+#endif
+
+bool scaleFloat(float* data, int64_t count, float scale) {
+#ifdef RANNC_X86_SIMD
+  static const bool use_avx2 = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+  }();
+  if (use_avx2) {
+    return scaleFloatAVX2(data, count, scale);
+  }
+#endif
+  return scaleFloatScalar(data, count, scale);
+}
+
+bool scaleCPUTensor(at::Tensor& ten, double scale) {
+  if (ten.scalar_type() == c10::ScalarType::Float && ten.is_contiguous()) {
+    std::atomic_bool found(false);
+    float* data = ten.data_ptr<float>();
+    at::parallel_for(
+        0, ten.numel(), GRAIN_SIZE, [&](int64_t begin, int64_t end) {
+          if (scaleFloat(data + begin, end - begin, scale)) {
+            found = true;
+          }
+        });
+    return found;
+  }
+
+  bool found = !at::isfinite(ten).all().item<bool>();
+  ten.mul_(scale);
+  return found;
+}
+
+// The fused kernel of PyTorch supports fp32 and fp16
+bool useFusedKernel(const TensorGroup& group) {
+  return group.device.is_cuda() &&
+      (group.stype == c10::ScalarType::Float ||
+       group.stype == c10::ScalarType::Half);
+}
+
+std::vector<TensorGroup> groupTensors(const std::vector<at::Tensor>& tensors) {
+  std::vector<TensorGroup> groups;
+  for (const auto& ten : tensors) {
+    if (!ten.defined() || ten.numel() == 0) {
+      continue;
+    }
+    auto it = std::find_if(
+        groups.begin(), groups.end(), [&ten](const TensorGroup& g) {
+          return g.device == ten.device() && g.stype == ten.scalar_type();
+        });
+    if (it == groups.end()) {
+      groups.push_back({ten.device(), ten.scalar_type(), {}});
+      it = groups.end() - 1;
+    }
+    it->tensors.push_back(ten);
+  }
+  return groups;
+}
+} // namespace
+
+void scaleTensors(const std::vector<at::Tensor>& tensors, double scale) {
+  torch::NoGradGuard no_grad;
+  for (auto& group : groupTensors(tensors)) {
+    at::_foreach_mul_(group.tensors, scale);
+  }
+}
+
+bool scaleTensorsAndCheckFinite(
+    const std::vector<at::Tensor>& tensors, double scale) {
+  torch::NoGradGuard no_grad;
+
+  std::vector<TensorGroup> groups = groupTensors(tensors);
+  bool found = false;
+  std::vector<at::Tensor> found_bufs;
+  for (auto& group : groups) {
+    if (group.device.is_cpu()) {
+      for (auto& ten : group.tensors) {
+        found |= scaleCPUTensor(ten, scale);
+      }
+      continue;
+    }
+
+    // Flags stay on the device until all groups are processed
+    const auto options = torch::TensorOptions()
+                             .dtype(c10::ScalarType::Float)
+                             .device(group.device);
+    auto found_buf = torch::zeros({1}, options);
+    if (useFusedKernel(group)) {
+      const auto scale_buf = torch::full({1}, scale, options);
+      at::_amp_foreach_non_finite_check_and_unscale_(
+          group.tensors, found_buf, scale_buf);
+    } else {
+      for (auto& ten : group.tensors) {
+        found_buf.add_(at::logical_not(at::isfinite(ten)).any());
+        ten.mul_(scale);
+      }
+    }
+    found_bufs.push_back(found_buf);
+  }
+
+  for (const auto& buf : found_bufs) {
+    found |= buf.item<float>() > 0;
+  }
+  return found;
+}
+} // namespace rannc
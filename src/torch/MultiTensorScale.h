@@ -0,0 +1,36 @@
+#ifndef PYRANNC_MULTITENSORSCALE_H
+#define PYRANNC_MULTITENSORSCALE_H
+
+#include <torch/torch.h>
+
+namespace rannc {
+
+/**
+ * Multiplies tensors by *scale* in place. Tensors are grouped by device and
+ * dtype, and each group is processed by a multi-tensor (foreach) operation.
+ * Unlike *scaleTensorsAndCheckFinite*, this does not synchronize with the
+ * device.
+ *
+ * @param tensors Tensors to scale. Undefined tensors are skipped.
+ * @param scale Scale factor.
+ */
+void scaleTensors(const std::vector<at::Tensor>& tensors, double scale);
+
+/**
+ * Multiplies tensors by *scale* in place and checks whether they have inf or
+ * NaN in the same pass. Tensors are grouped by device and dtype, and each group
+ * of CUDA tensors is processed by a multi-tensor kernel. Contiguous fp32
+ * tensors on CPU are processed by a vectorized kernel.
+ *
+ * Non-finite values are checked before scaling, in the same way as AMP of
+ * PyTorch.
+ *
+ * @param tensors Tensors to scale. Undefined tensors are skipped.
+ * @param scale Scale factor.
+ * @return True if any of the tensors has inf or NaN.
+ */
+bool scaleTensorsAndCheckFinite(
+    const std::vector<at::Tensor>& tensors, double scale);
+} // namespace rannc
+
+#endif // PYRANNC_MULTITENSORSCALE_H
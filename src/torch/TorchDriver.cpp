@@ -10,10 +10,13 @@
 #include <Common.h>
 #include <comp/EventRecorder.h>
 #include <comp/OffloadedParamMap.h>
+#include <comp/ZeroBcastEvents.h>
 #include <cuda/CudaSync.h>
 #include <cuda/CudaUtil.h>
 #include <graph/ConvertGraph.h>
+#include "BufferArena.h"
 #include "ConfiguredTorch.h"
+#include "FunctionCache.h"
 
 #include "TorchDriver.h"
 
@@ -24,6 +27,15 @@ DriverExecConf toDriverExecConf(const Deployment& d) {
       d.pipeline_num, d.checkpointing, d.offload_params, d.force_dist_matmul};
 }
 
+DriverExecConf toDriverExecConf(
+    const Deployment& d, const std::string& graph_id) {
+  DriverExecConf conf = toDriverExecConf(d);
+  if (contains(d.stored_nodes, graph_id)) {
+    conf.stored_nodes = d.stored_nodes.at(graph_id);
+  }
+  return conf;
+}
+
 const torch::jit::IValue matchIValue(
     const IValueMap& ival_map, const IValueLocation& loc) {
   IValueLocation key_loc{loc.value_name};
@@ -72,30 +84,35 @@ void clearGradsInIValue(torch::jit::IValue& ivalue) {
   processTensorInIValue(ivalue, clearGradIfDefined);
 }
 
+// Each tensor in an IValue has its own buffer because the buffers of a value
+// are live at the same time
 void setZerosToGradInIValueIfUndefined(
-    torch::jit::IValue& ivalue, BufferTensorCache& buf_cache,
-    const std::string& key) {
-  processTensorInIValue(ivalue, [&buf_cache, &key](at::Tensor t) {
+    torch::jit::IValue& ivalue, const std::string& key) {
+  size_t index = 0;
+  processTensorInIValue(ivalue, [&key, &index](at::Tensor t) {
     if (!t.grad().defined()) {
       auto type = toIRType(t);
       type.setRequiresGrad(false);
-      getMutableGradRef(t) = buf_cache.get(key, type);
+      getMutableGradRef(t) = BufferArena::get().getBuffer(
+          key + "_" + std::to_string(index), type, true);
       t.grad().zero_();
     }
+    index++;
   });
 }
 
 torch::jit::IValue sumGradTensorsInIValues(
-    const std::vector<torch::jit::IValue>& ivalues,
-    BufferTensorCache& buf_cache, const std::string& key) {
+    const std::vector<torch::jit::IValue>& ivalues, const std::string& key) {
+  size_t index = 0;
   return aggregateTensorsInIValues(
-      ivalues, [&buf_cache, &key](const std::vector<at::Tensor>& tensors) {
+      ivalues, [&key, &index](const std::vector<at::Tensor>& tensors) {
         at::Tensor grad_sum;
         for (const auto& input_ten : tensors) {
           if (!grad_sum.defined()) {
             auto type = toIRType(input_ten);
             type.setRequiresGrad(false);
-            grad_sum = buf_cache.get(key, type);
+            grad_sum = BufferArena::get().getBuffer(
+                key + "_" + std::to_string(index++), type, true);
             grad_sum.zero_();
           }
 
@@ -109,6 +126,21 @@ torch::jit::IValue sumGradTensorsInIValues(
       });
 }
 
+torch::jit::IValue cloneTensorsInIValueWithArena(
+    const torch::jit::IValue& ivalue, const std::string& key) {
+  return transformTensorsInIValueWithPath(
+      ivalue, key, [](const at::Tensor& t, const IValueLocation& loc) {
+        auto buf =
+            BufferArena::get().getBuffer(toString(loc), toIRType(t), true);
+        {
+          torch::NoGradGuard no_grad;
+          buf.copy_(t, false);
+        }
+        buf.set_requires_grad(t.requires_grad());
+        return buf;
+      });
+}
+
 std::vector<torch::jit::IValue> getNonParamInputElems(
     const std::shared_ptr<IRGraph>& ir_graph,
     const std::unordered_map<std::string, std::vector<std::string>>&
@@ -149,7 +181,10 @@ std::vector<at::Tensor> TorchDriver::getParamInputTensors(
       for (const auto& cl_name : clone_names.at(param_name)) {
         std::stringstream ss;
         ss << "[PARAM_CLONE]" << id << "_" << cl_name;
-        at::Tensor t_copy = buffer_cache_[id].get(ss.str(), toIRType(p));
+        // The clones made at the first split are used until backward of the
+        // last split
+        at::Tensor t_copy =
+            BufferArena::get().getBuffer(ss.str(), toIRType(p), init);
 
         if (init) {
           torch::NoGradGuard no_grad_guard;
@@ -169,12 +204,16 @@ std::vector<at::Tensor> TorchDriver::getParamInputTensors(
   return res;
 }
 
+// A hook is inserted for the first input of a node for which *f* returns a
+// name. Only params are hooked if *hook_param* is set, and only the other
+// inputs otherwise.
 std::shared_ptr<IRGraph> insertInValueHook(
     const std::shared_ptr<IRGraph>& g, IValueMap& constants,
     const std::string& op_name,
     const std::function<std::string(
         const IRValue& out, const IRNode& node,
-        const std::shared_ptr<IRGraph>& g)>& f) {
+        const std::shared_ptr<IRGraph>& g)>& f,
+    bool hook_param = false) {
   std::vector<IRNode> new_nodes;
   const std::unordered_map<std::string, IRValue>& vals = g->getValues();
   std::unordered_map<std::string, IRValue> new_values;
@@ -193,10 +232,12 @@ std::shared_ptr<IRGraph> insertInValueHook(
       assert(contains(vals, in_name));
       const IRValue& in_val = vals.at(in_name);
 
-      if (!inserted && !in_val.isParam()) {
+      if (!inserted && in_val.isParam() == hook_param) {
         const std::string hook_input_name = f(in_val, n, g);
         if (!hook_input_name.empty()) {
-          const std::string out_name_var = hook_input_name + "_name";
+          // Named after the hooked value. Out value hooks may be given the
+          // same *hook_input_name*.
+          const std::string out_name_var = in_name + "_hook_name";
           IRNode var_name_node("prim::Constant", {}, {out_name_var});
           new_nodes.push_back(var_name_node);
 
@@ -210,7 +251,10 @@ std::shared_ptr<IRGraph> insertInValueHook(
           new_nodes.push_back(hook);
 
           hook_out_names[in_name] = hook_out_name;
-          new_values[hook_out_name] = IRValue(hook_out_name, in_val);
+          IRValue hook_out_val(hook_out_name, in_val);
+          // The output of a hook is not a graph input
+          hook_out_val.setParam(false);
+          new_values[hook_out_name] = hook_out_val;
 
           constants[out_name_var] = torch::jit::IValue(hook_input_name);
 
@@ -339,6 +383,135 @@ std::shared_ptr<IRGraph> insertOffloadingPreHooks(
       });
 }
 
+// A hook is inserted before the first node using each param. The hook takes
+// a tensor input of the node. *hooked_params* receives the names of the
+// params.
+std::shared_ptr<IRGraph> insertZeroParamWaitHooks(
+    const std::shared_ptr<IRGraph>& g, IValueMap& constants,
+    std::unordered_set<std::string>& hooked_params) {
+  return insertInValueHook(
+      g, constants, "rannc::zeroParamWaitHook",
+      [&hooked_params](
+          const IRValue& in, const IRNode& node,
+          const std::shared_ptr<IRGraph>& g) {
+        if (in.getType().getBaseType() != IRBaseType::TENSOR) {
+          return std::string("");
+        }
+
+        std::vector<std::string> param_names;
+        for (const auto& in_name : node.getInputNames()) {
+          const auto& in_val = g->getValue(in_name);
+          if (in_val.isParam() && !contains(hooked_params, in_name)) {
+            param_names.push_back(in_name);
+          }
+        }
+        for (const auto& name : param_names) {
+          hooked_params.insert(name);
+        }
+        return join_as_str(param_names, ",");
+      });
+}
+
+// Ops whose outputs do not share memory with the params they take
+const std::unordered_set<std::string> RELEASABLE_PARAM_OPS = {
+    "aten::linear",     "aten::matmul",     "aten::mm",
+    "aten::bmm",        "aten::addmm",      "aten::conv1d",
+    "aten::conv2d",     "aten::conv3d",     "aten::_convolution",
+    "aten::embedding",  "aten::layer_norm", "aten::group_norm",
+    "aten::add",        "aten::mul"};
+
+std::unordered_set<std::string> findReleasableParams(
+    const std::shared_ptr<IRGraph>& g) {
+  std::unordered_map<std::string, int> use_counts;
+  for (const auto& n : g->getNodes()) {
+    for (const auto& in_name : n.getInputNames()) {
+      use_counts[in_name]++;
+    }
+  }
+
+  std::unordered_set<std::string> params;
+  for (const auto& n : g->getNodes()) {
+    if (!contains(RELEASABLE_PARAM_OPS, n.getName()) ||
+        n.getOutputNames().size() != 1) {
+      continue;
+    }
+    const auto& out_val = g->getValue(n.getOutputNames().front());
+    if (out_val.getType().getBaseType() != IRBaseType::TENSOR) {
+      continue;
+    }
+
+    bool takes_tensor = false;
+    std::vector<std::string> node_params;
+    for (const auto& in_name : n.getInputNames()) {
+      const auto& in_val = g->getValue(in_name);
+      if (in_val.isParam()) {
+        // The backward of a param that does not require grad does not run and
+        // cannot release it
+        if (use_counts.at(in_name) == 1 &&
+            in_val.getType().requiresGrad()) {
+          node_params.push_back(in_name);
+        }
+      } else if (in_val.getType().getBaseType() == IRBaseType::TENSOR) {
+        takes_tensor = true;
+      }
+    }
+    if (takes_tensor) {
+      for (const auto& name : node_params) {
+        params.insert(name);
+      }
+    }
+  }
+
+  for (const auto& out_name : g->getOutputNames()) {
+    params.erase(out_name);
+  }
+  return params;
+}
+
+// Returns comma-separated names of params of *node* in *released_params*
+std::string getReleasedParams(
+    const IRNode& node,
+    const std::unordered_set<std::string>& released_params) {
+  std::vector<std::string> param_names;
+  for (const auto& in_name : node.getInputNames()) {
+    if (contains(released_params, in_name)) {
+      param_names.push_back(in_name);
+    }
+  }
+  return join_as_str(param_names, ",");
+}
+
+// The hook takes a released param rather than an activation. Released params
+// require grad, so the backward of the hook always runs after that of the node
+// and releases the params gathered for it.
+std::shared_ptr<IRGraph> insertZeroParamPreHooks(
+    const std::shared_ptr<IRGraph>& g, IValueMap& constants,
+    const std::unordered_set<std::string>& released_params) {
+  return insertInValueHook(
+      g, constants, "rannc::zeroParamPreHook",
+      [&released_params](
+          const IRValue& in, const IRNode& node,
+          const std::shared_ptr<IRGraph>& g) {
+        if (!contains(released_params, in.getName())) {
+          return std::string("");
+        }
+        return getReleasedParams(node, released_params);
+      },
+      true);
+}
+
+std::shared_ptr<IRGraph> insertZeroParamPostHooks(
+    const std::shared_ptr<IRGraph>& g, IValueMap& constants,
+    const std::unordered_set<std::string>& released_params) {
+  return insertOutValueHook(
+      g, constants, "rannc::zeroParamPostHook",
+      [&released_params](
+          const IRValue& out, const IRNode& node,
+          const std::shared_ptr<IRGraph>& g) {
+        return getReleasedParams(node, released_params);
+      });
+}
+
 std::shared_ptr<IRGraph> insertValueHook(
     const std::shared_ptr<IRGraph>& g, IValueMap& constants) {
   return insertOutValueHook(
@@ -413,12 +586,26 @@ void TorchDriver::createModule(
         insertOffloadingPreHooks(clone_input_ir_graphs_[id], constants_[id]);
   }
 
-  ConvertGraph cg;
-  auto graph =
-      cg.toTorch(clone_input_ir_graphs_[id], constants_[id], functions);
+  if (!conf.released_zero_params.empty()) {
+    clone_input_ir_graphs_[id] = insertZeroParamPostHooks(
+        clone_input_ir_graphs_[id], constants_[id], conf.released_zero_params);
+    clone_input_ir_graphs_[id] = insertZeroParamPreHooks(
+        clone_input_ir_graphs_[id], constants_[id], conf.released_zero_params);
+  }
+
+  if (conf.wait_zero_params) {
+    std::unordered_set<std::string> hooked_params;
+    clone_input_ir_graphs_[id] = insertZeroParamWaitHooks(
+        clone_input_ir_graphs_[id], constants_[id], hooked_params);
 
-  logger->trace("Finished to convert graph.");
-  logger->debug("Subgraph {} deployed: {}", id, graph->toString());
+    // Cloned params are copied before the graph runs
+    for (const auto& it : parameters) {
+      if (!contains(hooked_params, it.first) ||
+          contains(input_clone_names_[id], it.first)) {
+        unhooked_zero_params_[id].push_back(it.first);
+      }
+    }
+  }
 
   const auto& input_names = irGraph->getInputNames();
   size_t input_idx = input_names.size() - parameters.size();
@@ -441,16 +628,71 @@ void TorchDriver::createModule(
 
   func_storages_[id] = functions;
 
-  logger->trace("TorchDriver::createModule creating function.");
-  functions_[id] =
-      std::make_shared<torch::jit::GraphFunction>("forward", graph, nullptr);
+  FunctionCache& func_cache = FunctionCache::get();
+  func_signatures_[id] =
+      getGraphSignature(clone_input_ir_graphs_[id], constants_[id]);
+  const auto tensor_constants =
+      getGraphTensorConstants(clone_input_ir_graphs_[id], constants_[id]);
+  functions_[id] = func_cache.find(func_signatures_[id], tensor_constants);
+
+  if (functions_[id]) {
+    logger->trace("Reusing the compiled function of subgraph {}", id);
+  } else {
+    ConvertGraph cg;
+    auto graph =
+        cg.toTorch(clone_input_ir_graphs_[id], constants_[id], functions);
+
+    logger->trace("Finished to convert graph.");
+    logger->debug("Subgraph {} deployed: {}", id, graph->toString());
+
+    logger->trace("TorchDriver::createModule creating function.");
+    functions_[id] =
+        std::make_shared<torch::jit::GraphFunction>("forward", graph, nullptr);
+    func_cache.put(func_signatures_[id], tensor_constants, functions_[id]);
+  }
 
   syncWithErrorCheck();
   time_counter_.stop("TorchDriver::createModule");
 
+  if (conf.checkpointing && !conf.stored_nodes.empty()) {
+    createSegmentModules(
+        id, model_id, irGraph, constants, functions, parameters, conf);
+  }
+
   logger->trace("TorchDriver::createModule finished");
 }
 
+void TorchDriver::createSegmentModules(
+    const std::string& id, const std::string& model_id,
+    const std::shared_ptr<rannc::IRGraph>& ir_graph, const IValueMap& constants,
+    const std::shared_ptr<FunctionStorage>& functions,
+    const std::unordered_map<std::string, at::Tensor>& parameters,
+    const DriverExecConf& conf) {
+  const auto segments = splitByRecomputePolicy(ir_graph, conf.stored_nodes);
+  if (segments.size() < 2) {
+    return;
+  }
+
+  DriverExecConf seg_conf = conf;
+  seg_conf.stored_nodes.clear();
+  for (const auto& seg : segments) {
+    std::unordered_map<std::string, at::Tensor> seg_params;
+    for (const auto& in_name : seg.graph->getInputNames()) {
+      if (contains(parameters, in_name)) {
+        seg_params[in_name] = parameters.at(in_name);
+      }
+    }
+    createModule(
+        seg.graph->getName(), model_id, seg.graph, constants, functions,
+        seg_params, seg_conf);
+  }
+  recomp_segments_[id] = segments;
+
+  logger->debug(
+      "Split {} into {} segments for selective recomputation", id,
+      segments.size());
+}
+
 void TorchDriver::displayValue(
     const std::string& prefix, size_t count, int split_index, bool grad_mode,
     const IValueMap& vals) {
@@ -497,6 +739,11 @@ IValueMap TorchDriver::forward(
   recordStart(
       getFuncKey("TorchDriver", "forward_copy_in", id, split_idx, grad_mode));
 
+  BufferArena& buf_arena = BufferArena::get();
+  for (const auto& in : inputs) {
+    buf_arena.use(in.second);
+  }
+
   IValueMap graphIn;
   std::unordered_map<std::string, std::vector<std::string>>& clone_names =
       input_clone_names_[id];
@@ -506,8 +753,8 @@ IValueMap TorchDriver::forward(
         std::stringstream ss;
         ss << "[SHARED_IN]" << id << "_" << cl_name;
 
-        const auto cl_ivalue = cloneTensorsInIValueWithBuffer(
-            in.second, ss.str(), buffer_cache_[id]);
+        const auto cl_ivalue =
+            cloneTensorsInIValueWithArena(in.second, ss.str());
         graphIn[cl_name] = cl_ivalue;
       }
     } else {
@@ -549,6 +796,13 @@ IValueMap TorchDriver::forward(
   recordStart(getFuncKey(
       "TorchDriver", "forward_copy_param", id, split_idx, grad_mode));
 
+  if (contains(unhooked_zero_params_, id)) {
+    ZeroBcastEvents& bcast_events = ZeroBcastEvents::get();
+    for (const auto& param_name : unhooked_zero_params_.at(id)) {
+      bcast_events.wait(param_name);
+    }
+  }
+
   auto& graph_clone_params = clone_params_[id];
   if (split_idx <= last_split_idx_) {
     graph_clone_params.clear();
@@ -680,6 +934,21 @@ IValueMap TorchDriver::backward(
   }
 
   auto& graphLastIn = last_inputs_[id];
+  auto& graph_clone_params = clone_params_[id];
+
+  // Inputs and clones kept since forward are used until this backward
+  BufferArena& buf_arena = BufferArena::get();
+  for (const auto& in : required_inputs) {
+    buf_arena.use(in.second);
+  }
+  for (const auto& in : graphLastIn) {
+    buf_arena.use(in.second);
+  }
+  for (const auto& it : graph_clone_params) {
+    for (const auto& cl_param : it.second) {
+      buf_arena.use(cl_param);
+    }
+  }
 
   for (const auto& in_name : ir_graphs_[id]->getInputNames()) {
     const auto& val = irGraph->getValue(in_name);
@@ -748,8 +1017,7 @@ IValueMap TorchDriver::backward(
           assert(contains(graphLastIn, cl_name));
           input_ivals.push_back(graphLastIn.at(cl_name));
         }
-        inGrads[in_name] =
-            sumGradTensorsInIValues(input_ivals, buffer_cache_[id], ss.str());
+        inGrads[in_name] = sumGradTensorsInIValues(input_ivals, ss.str());
 
         // Clear grads of shared input
         for (const auto& cl_name : clone_names.at(in_name)) {
@@ -764,7 +1032,7 @@ IValueMap TorchDriver::backward(
       } else {
         assert(contains(graphLastIn, in_name));
         auto iv = graphLastIn.at(in_name);
-        setZerosToGradInIValueIfUndefined(iv, buffer_cache_[id], ss.str());
+        setZerosToGradInIValueIfUndefined(iv, ss.str());
         const auto grad_iv = transformTensorsInIValue(
             iv, [](const at::Tensor& t) { return t.grad().contiguous(); });
         inGrads[in_name] = grad_iv;
@@ -778,7 +1046,6 @@ IValueMap TorchDriver::backward(
       "TorchDriver", "backward_sum_paramgrad", id, split_idx, false));
 
   size_t param_idx = 0;
-  auto& graph_clone_params = clone_params_[id];
   for (const auto& param_name : ordered_param_names_[id]) {
     std::unordered_map<std::string, std::vector<std::string>>& clone_names =
         input_clone_names_[id];
@@ -793,7 +1060,7 @@ IValueMap TorchDriver::backward(
           ss << "[GRAD_SUM]" << id << "_" << param_name;
           auto type = toIRType(cl_param);
           type.setRequiresGrad(false);
-          grad_sum = buffer_cache_[id].get(ss.str(), type);
+          grad_sum = buf_arena.getBuffer(ss.str(), type, true);
           grad_sum.zero_();
         }
         if (cl_param.grad().defined()) {
@@ -845,7 +1112,170 @@ IValueMap TorchDriver::backward(
   return inGrads;
 }
 
+bool TorchDriver::isSelectiveRecompute(const std::string& id) const {
+  return contains(recomp_segments_, id);
+}
+
+IValueMap TorchDriver::forwardSelective(
+    const std::string& id, const IValueMap& inputs, int split_idx) {
+  assert(contains(recomp_segments_, id));
+  const auto& segments = recomp_segments_.at(id);
+
+  // Inputs may be placed in receive buffers reused by later splits
+  IValueMap values;
+  for (const auto& it : inputs) {
+    values[it.first] = cloneTensorsInIValue(it.second);
+  }
+  // Only the shapes, dtypes and devices of the inputs are kept to create zero
+  // gradients. An expanded scalar holds them with a single element.
+  IValueMap& stage_in = stage_inputs_[id][split_idx];
+  stage_in.clear();
+  for (const auto& it : values) {
+    stage_in[it.first] =
+        transformTensorsInIValue(it.second, [](const at::Tensor& t) {
+          return torch::zeros({}, t.options()).expand(t.sizes());
+        });
+  }
+
+  auto& states = segment_states_[id][split_idx];
+  states.clear();
+  states.resize(segments.size());
+
+  for (size_t i = 0; i < segments.size(); i++) {
+    const auto& seg = segments.at(i);
+    const auto& seg_id = seg.graph->getName();
+
+    // Segments are connected by detached values so that each backward stops at
+    // the boundary of the segment
+    IValueMap seg_in;
+    for (const auto& in_name : getNonParamInputNames(seg.graph)) {
+      if (seg.graph->getValue(in_name).isFunction()) {
+        continue;
+      }
+      assert(contains(values, in_name));
+      seg_in[in_name] = detach(values.at(in_name));
+    }
+
+    IValueMap seg_out;
+    if (seg.recompute) {
+      states[i].inputs = seg_in;
+      states[i].rng_state = getRngState();
+
+      torch::NoGradGuard no_grad;
+      seg_out = forward(seg_id, seg_in, split_idx);
+    } else {
+      torch::autograd::AutoGradMode gm(true);
+      seg_out = forward(seg_id, seg_in, split_idx);
+
+      states[i].inputs = last_inputs_[seg_id];
+      states[i].outputs = last_outputs_[seg_id];
+    }
+
+    for (const auto& it : seg_out) {
+      values[it.first] = it.second;
+    }
+  }
+
+  IValueMap outputs;
+  for (const auto& out_name : ir_graphs_.at(id)->getOutputNames()) {
+    assert(contains(values, out_name));
+    outputs[out_name] = detach(values.at(out_name));
+  }
+  return outputs;
+}
+
+IValueMap TorchDriver::backwardSelective(
+    const std::string& id, const IValueMap& inputs, int split_idx) {
+  assert(contains(recomp_segments_, id));
+  const auto& segments = recomp_segments_.at(id);
+  assert(contains(segment_states_[id], split_idx));
+  auto& states = segment_states_[id].at(split_idx);
+
+  const auto sum_grads = [](const std::vector<torch::jit::IValue>& grads) {
+    return grads.size() == 1 ? grads.front() : sumTensorsInIValues(grads);
+  };
+
+  std::unordered_map<
+      IValueLocation, std::vector<torch::jit::IValue>, IValueLocationHash>
+      grads;
+  for (const auto& it : inputs) {
+    grads[it.first].push_back(it.second);
+  }
+
+  for (size_t i = segments.size(); i > 0; i--) {
+    const auto& seg = segments.at(i - 1);
+    const auto& seg_id = seg.graph->getName();
+    auto& state = states.at(i - 1);
+
+    IValueMap seg_grads;
+    for (const auto& it : grads) {
+      if (contains(seg.graph->getOutputNames(), it.first.value_name)) {
+        seg_grads[it.first] = sum_grads(it.second);
+      }
+    }
+
+    if (!seg_grads.empty()) {
+      if (seg.recompute) {
+        const auto stashed_rng_state = getRngState();
+        setRngState(state.rng_state);
+        {
+          torch::autograd::AutoGradMode gm(true);
+          forward(seg_id, state.inputs, split_idx);
+        }
+        setRngState(stashed_rng_state);
+      } else {
+        last_inputs_[seg_id] = state.inputs;
+        last_outputs_[seg_id] = state.outputs;
+      }
+
+      for (const auto& it : backward(seg_id, seg_grads, split_idx)) {
+        grads[it.first].push_back(it.second);
+      }
+    }
+
+    // Release activations of the segment
+    state = SegmentState();
+  }
+
+  IValueMap in_grads;
+  const auto& ir_graph = ir_graphs_.at(id);
+  const auto& stage_in = stage_inputs_[id].at(split_idx);
+  for (const auto& in_name : ir_graph->getInputNames()) {
+    const auto& val = ir_graph->getValue(in_name);
+    if (val.isParam() || val.isFunction() ||
+        !passedForBackward(val.getType())) {
+      continue;
+    }
+
+    IValueLocation loc{in_name};
+    if (contains(grads, loc)) {
+      in_grads[loc] = sum_grads(grads.at(loc));
+    } else {
+      assert(contains(stage_in, loc));
+      in_grads[loc] = transformTensorsInIValue(
+          stage_in.at(loc),
+          [](const at::Tensor& t) {
+            return torch::zeros(t.sizes(), t.options());
+          });
+    }
+  }
+
+  stage_inputs_[id].erase(split_idx);
+  segment_states_[id].erase(split_idx);
+
+  return in_grads;
+}
+
 void TorchDriver::destroyModule(const std::string& id) {
+  if (contains(recomp_segments_, id)) {
+    for (const auto& seg : recomp_segments_.at(id)) {
+      destroyModule(seg.graph->getName());
+    }
+  }
+  recomp_segments_.erase(id);
+  segment_states_.erase(id);
+  stage_inputs_.erase(id);
+
   last_inputs_.erase(id);
   last_outputs_.erase(id);
   ir_graphs_.erase(id);
@@ -855,8 +1285,10 @@ void TorchDriver::destroyModule(const std::string& id) {
   ordered_param_names_.erase(id);
   input_clone_names_.erase(id);
   clone_params_.erase(id);
+  unhooked_zero_params_.erase(id);
 
   functions_.erase(id);
+  func_signatures_.erase(id);
 
   buffer_cache_.erase(id);
 }
@@ -869,7 +1301,20 @@ void TorchDriver::destroy() {
 }
 
 void TorchDriver::enableDropout(const std::string& id, bool enable) {
+  FunctionCache& func_cache = FunctionCache::get();
   for (const auto& sub_id : subgraph_ids_[id]) {
+    // An empty signature means that the graph is not cached
+    const auto& base_sig = func_signatures_[sub_id];
+    const auto sig = base_sig.empty()
+        ? base_sig
+        : base_sig + ";dropout=" + (enable ? "true" : "false");
+    const auto tensor_constants = getGraphTensorConstants(
+        clone_input_ir_graphs_[sub_id], constants_[sub_id]);
+    functions_[sub_id] = func_cache.find(sig, tensor_constants);
+    if (functions_[sub_id]) {
+      continue;
+    }
+
     ConvertGraph cg;
     auto graph = cg.toTorch(
         clone_input_ir_graphs_[sub_id], constants_[sub_id],
@@ -877,6 +1322,7 @@ void TorchDriver::enableDropout(const std::string& id, bool enable) {
     const auto graph_dropout = rannc::enableDropout(graph, enable);
     functions_[sub_id] = std::make_shared<torch::jit::GraphFunction>(
         "forward", graph_dropout, nullptr);
+    func_cache.put(sig, tensor_constants, functions_[sub_id]);
   }
 }
 
@@ -12,6 +12,7 @@
 #include <Config.h>
 #include <graph/ConvertGraph.h>
 #include <graph/Decomposition.h>
+#include <graph/RecomputePolicy.h>
 #include <Logging.h>
 #include <torch/TorchUtil.h>
 
@@ -37,9 +38,24 @@ struct DriverExecConf {
   bool checkpointing;
   bool offload_params;
   bool force_dist_matmul;
+  std::unordered_set<std::string> stored_nodes;
+  // Wait for asynchronous broadcasts of ZeRO params before their first use
+  bool wait_zero_params = false;
+  // ZeRO params gathered before the node using them and released after it
+  std::unordered_set<std::string> released_zero_params;
 };
 
 DriverExecConf toDriverExecConf(const Deployment& d);
+DriverExecConf toDriverExecConf(
+    const Deployment& d, const std::string& graph_id);
+
+/**
+ * Finds params that can be released between their uses. Such a param requires
+ * grad and is used only by one node, which computes a new tensor from the
+ * param and a tensor that is not a param.
+ */
+std::unordered_set<std::string> findReleasableParams(
+    const std::shared_ptr<IRGraph>& g);
 
 class TorchDriver {
  public:
@@ -99,6 +115,38 @@ class TorchDriver {
   IValueMap backward(
       const std::string& id, const IValueMap& inputs, int split_idx);
 
+  /**
+   * Returns true if only a part of activations of the graph are recomputed.
+   * Such a graph must be computed by *forwardSelective()* and
+   * *backwardSelective()*.
+   *
+   * @param id ID of the given Graph.
+   */
+  bool isSelectiveRecompute(const std::string& id) const;
+
+  /**
+   * Computes forward propagation keeping activations of stored nodes. Inputs
+   * of the other nodes are kept for recomputation.
+   *
+   * @param id ID of the given Graph.
+   * @param inputs Inputs of forward propagation.
+   * @return Outputs of forward propagation.
+   */
+  IValueMap forwardSelective(
+      const std::string& id, const IValueMap& inputs, int split_idx);
+
+  /**
+   * Computes backward propagation of a graph computed by *forwardSelective()*.
+   * Segments whose activations were discarded are recomputed just before
+   * their backward.
+   *
+   * @param id ID of the given Graph.
+   * @param inputs Inputs of backward propagation.
+   * @return Outputs of backward propagation.
+   */
+  IValueMap backwardSelective(
+      const std::string& id, const IValueMap& inputs, int split_idx);
+
   void destroyModule(const std::string& id);
 
   void destroy();
@@ -119,6 +167,13 @@ class TorchDriver {
       const IValueMap& vals);
   std::vector<at::Tensor> getParamInputTensors(
       const std::string& id, bool init);
+  void createSegmentModules(
+      const std::string& id, const std::string& model_id,
+      const std::shared_ptr<rannc::IRGraph>& ir_graph,
+      const IValueMap& constants,
+      const std::shared_ptr<FunctionStorage>& functions,
+      const std::unordered_map<std::string, at::Tensor>& parameters,
+      const DriverExecConf& conf);
 
   /**
    * Inputs used in the previous forward().
@@ -151,19 +206,49 @@ class TorchDriver {
   std::unordered_map<
       std::string, std::unordered_map<std::string, std::vector<at::Tensor>>>
       clone_params_;
+  /**
+   * ZeRO params waited for before the graph runs because no hook in the graph
+   * waits for them.
+   */
+  std::unordered_map<std::string, std::vector<std::string>>
+      unhooked_zero_params_;
 
   /**
    * Script modules built from Torch IR. The key is a graph ID.
    */
   std::unordered_map<std::string, std::shared_ptr<torch::jit::Function>>
       functions_;
+  /**
+   * Keys of compiled functions in *FunctionCache*. The key is a graph ID.
+   */
+  std::unordered_map<std::string, std::string> func_signatures_;
 
+  // Gradients of cloned params persist across iterations
   std::unordered_map<std::string, BufferTensorCache> buffer_cache_;
   std::unordered_map<std::string, IValueMap> constants_;
   std::unordered_map<std::string, std::shared_ptr<FunctionStorage>>
       func_storages_;
   std::unordered_map<std::string, DriverExecConf> exec_conf_;
 
+  /**
+   * State of a segment kept from forward to backward. Stored segments keep
+   * inputs/outputs of the autograd graph, and the others keep only inputs.
+   */
+  struct SegmentState {
+    IValueMap inputs;
+    IValueMap outputs;
+    RngState rng_state;
+  };
+  std::unordered_map<std::string, std::vector<RecomputeSegment>>
+      recomp_segments_;
+  // graph id -> split index -> states of segments
+  std::unordered_map<
+      std::string, std::unordered_map<int, std::vector<SegmentState>>>
+      segment_states_;
+  // graph id -> split index -> inputs with the data dropped (expanded scalars)
+  std::unordered_map<std::string, std::unordered_map<int, IValueMap>>
+      stage_inputs_;
+
   int last_split_idx_ = INT32_MAX;
 
   TimeCounter time_counter_;
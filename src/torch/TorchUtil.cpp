@@ -14,7 +14,9 @@
 #include "comp/BatchSizeCalculator.h"
 #include "ConfiguredTorch.h"
 #include "graph/ir.h"
+#include "HalfConversion.h"
 #include "TorchUtil.h"
+#include "TrackingAllocator.h"
 
 #include <c10/cuda/CUDACachingAllocator.h>
 
@@ -204,6 +206,39 @@ IValueMap toCPU(const IValueMap& iv_map, bool detach, bool non_blocking) {
   return ret;
 }
 
+torch::jit::IValue toPinnedCPU(
+    const torch::jit::IValue& iv, bool non_blocking) {
+  if (!torch::cuda::is_available()) {
+    return toCPU(iv, true, non_blocking);
+  }
+
+  // Page-locked buffers come from the caching host allocator, which reuses
+  // them once the copies recorded on them have finished.
+  return processTensorInIValue(iv, [non_blocking](at::Tensor t) {
+    if (t.numel() == 0) {
+      return t;
+    }
+
+    auto ret = torch::empty(
+        t.sizes(),
+        t.options().device(torch::Device(torch::kCPU)).pinned_memory(true));
+    {
+      torch::NoGradGuard no_grad;
+      ret.copy_(t.detach(), non_blocking);
+    }
+    ret.set_requires_grad(t.requires_grad());
+    return ret;
+  });
+}
+
+IValueMap toPinnedCPU(const IValueMap& iv_map, bool non_blocking) {
+  IValueMap ret;
+  for (const auto& it : iv_map) {
+    ret[it.first] = toPinnedCPU(it.second, non_blocking);
+  }
+  return ret;
+}
+
 torch::jit::IValue toCUDAIfAvailable(
     const torch::jit::IValue& iv, bool detach, bool non_blocking) {
   if (torch::cuda::is_available()) {
@@ -235,6 +270,32 @@ IValueMap toCUDAIfAvailable(
   return ret;
 }
 
+torch::jit::IValue toCUDAIfAvailableNoCopy(
+    const torch::jit::IValue& iv, bool non_blocking) {
+  const bool cuda = torch::cuda::is_available();
+  return processTensorInIValue(iv, [cuda, non_blocking](at::Tensor t) {
+    if (!t.defined() || t.numel() == 0) {
+      return t;
+    }
+
+    auto ret = t;
+    if (cuda && !t.is_cuda()) {
+      ret = t.to(torch::Device(torch::kCUDA), non_blocking);
+    }
+    auto dret = ret.contiguous().detach();
+    dret.set_requires_grad(t.requires_grad());
+    return dret;
+  });
+}
+
+IValueMap toCUDAIfAvailableNoCopy(const IValueMap& iv_map, bool non_blocking) {
+  IValueMap ret;
+  for (const auto& it : iv_map) {
+    ret[it.first] = toCUDAIfAvailableNoCopy(it.second, non_blocking);
+  }
+  return ret;
+}
+
 void toCUDAInPlace(at::Tensor& t) {
   if (t.is_cuda()) {
     return;
@@ -942,7 +1003,7 @@ torch::jit::IValue scaleTensorsInIValue(
 
 at::Tensor toFloatIfHalf(const at::Tensor& tensor) {
   if (tensor.scalar_type() == at::ScalarType::Half) {
-    return tensor.to(torch::kFloat32);
+    return convertScalarType(tensor, torch::kFloat32);
   }
   return tensor;
 }
@@ -1316,20 +1377,6 @@ bool equals(const torch::jit::IValue& iv1, const torch::jit::IValue& iv2) {
   return false;
 }
 
-void halfToFloat(void* half_buf, float* float_buf, int count) {
-  const auto half_t =
-      torch::from_blob(half_buf, {count}, c10::ScalarType::Half);
-  auto float_t = torch::from_blob(float_buf, {count}, c10::ScalarType::Float);
-  float_t.copy_(half_t);
-}
-
-void floatToHalf(float* float_buf, void* half_buf, int count) {
-  const auto float_t =
-      torch::from_blob(float_buf, {count}, c10::ScalarType::Float);
-  auto half_t = torch::from_blob(half_buf, {count}, c10::ScalarType::Half);
-  half_t.copy_(float_t);
-}
-
 std::unordered_map<std::string, torch::jit::Value*> getGraphConstantValues(
     const std::shared_ptr<torch::jit::Graph>& graph) {
   std::unordered_map<std::string, torch::jit::Value*> results;
@@ -1384,7 +1431,7 @@ long getAllocatedMemory() {
         c10::cuda::CUDACachingAllocator::getDeviceStats(dev_id);
     return stats.allocated_bytes[0].current;
   }
-  return 0;
+  return TrackingCPUAllocator::get().getAllocated();
 }
 
 long getMaxAllocatedMemory() {
@@ -1394,7 +1441,7 @@ long getMaxAllocatedMemory() {
         c10::cuda::CUDACachingAllocator::getDeviceStats(dev_id);
     return stats.allocated_bytes[0].peak;
   }
-  return 0;
+  return TrackingCPUAllocator::get().getPeak();
 }
 
 long getMaxCachedMemory() {
@@ -1411,6 +1458,8 @@ void resetMaxAllocatedMemory() {
   if (torch::cuda::is_available()) {
     int dev_id = getCurrentCudaDeviceId();
     c10::cuda::CUDACachingAllocator::resetPeakStats(dev_id);
+  } else {
+    TrackingCPUAllocator::get().resetPeak();
   }
 }
 
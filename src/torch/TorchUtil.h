@@ -56,10 +56,16 @@ torch::jit::IValue to(
 torch::jit::IValue detach(const torch::jit::IValue& iv);
 torch::jit::IValue toCPU(
     const torch::jit::IValue& iv, bool detach, bool non_blocking = false);
+torch::jit::IValue toPinnedCPU(
+    const torch::jit::IValue& iv, bool non_blocking = false);
 torch::jit::IValue toCUDAIfAvailable(
     const torch::jit::IValue& iv, bool detach, bool non_blocking = false);
 at::Tensor toCUDAIfAvailable(
     const at::Tensor& t, bool detach, bool non_blocking = false);
+// Unlike toCUDAIfAvailable, returns detached views of contiguous tensors that
+// are already on the device.
+torch::jit::IValue toCUDAIfAvailableNoCopy(
+    const torch::jit::IValue& iv, bool non_blocking = false);
 void toCUDAInPlace(at::Tensor& t);
 void toCPUInPlace(at::Tensor& t);
 torch::jit::IValue contiguous(const torch::jit::IValue& iv);
@@ -76,8 +82,11 @@ std::vector<IValueLocation> getKeys(const IValueMap& map);
 
 IValueMap toCPU(
     const IValueMap& iv_map, bool detach, bool non_blocking = false);
+IValueMap toPinnedCPU(const IValueMap& iv_map, bool non_blocking = false);
 IValueMap toCUDAIfAvailable(
     const IValueMap& iv_map, bool detach, bool non_blocking = false);
+IValueMap toCUDAIfAvailableNoCopy(
+    const IValueMap& iv_map, bool non_blocking = false);
 
 enum class IRTensorElemType;
 IRTensorElemType toTensorElemType(const c10::ScalarType& scalarType);
@@ -153,9 +162,6 @@ void initTensorGrad(at::Tensor& t);
 
 bool equals(const torch::jit::IValue& iv1, const torch::jit::IValue& iv2);
 
-void halfToFloat(void* half_buf, float* float_buf, int count);
-void floatToHalf(float* float_buf, void* half_buf, int count);
-
 std::unordered_map<std::string, torch::jit::Value*> getGraphConstantValues(
     const std::shared_ptr<torch::jit::Graph>& graph);
 bool isGraphReady(
@@ -193,6 +199,7 @@ std::vector<T> arrayRefToVector(c10::ArrayRef<T> array) {
 
 void emptyCache();
 void showMem(const std::string& prefix, int rank = -1);
+// Fall back to host memory counted by TrackingCPUAllocator without CUDA
 long getAllocatedMemory();
 long getMaxAllocatedMemory();
 void resetMaxAllocatedMemory();
@@ -0,0 +1,40 @@
+#include "TrackingAllocator.h"
+
+#include <mutex>
+
+namespace rannc {
+
+namespace {
+// Owns the allocation of the base allocator
+struct TrackedContext {
+  c10::DataPtr data_ptr;
+  long nbytes;
+};
+} // namespace
+
+void TrackingCPUAllocator::install() {
+  static std::once_flag flag;
+  std::call_once(flag, [this]() {
+    base_ = c10::GetAllocator(c10::DeviceType::CPU);
+    c10::SetAllocator(c10::DeviceType::CPU, this);
+  });
+}
+
+c10::DataPtr TrackingCPUAllocator::allocate(size_t nbytes) const {
+  auto ctx = new TrackedContext{base_->allocate(nbytes), (long)nbytes};
+  void* data = ctx->data_ptr.get();
+  const auto device = ctx->data_ptr.device();
+
+  long current = allocated_ += ctx->nbytes;
+  long peak = peak_;
+  while (current > peak && !peak_.compare_exchange_weak(peak, current)) {
+  }
+  return {data, ctx, &TrackingCPUAllocator::deleteTracked, device};
+}
+
+void TrackingCPUAllocator::deleteTracked(void* ctx) {
+  auto tracked = static_cast<TrackedContext*>(ctx);
+  get().allocated_ -= tracked->nbytes;
+  delete tracked;
+}
+} // namespace rannc
@@ -0,0 +1,59 @@
+#ifndef PYRANNC_TRACKINGALLOCATOR_H
+#define PYRANNC_TRACKINGALLOCATOR_H
+
+#include <atomic>
+
+#include <c10/core/Allocator.h>
+
+namespace rannc {
+
+/**
+ * Wraps the CPU allocator of PyTorch to count the current and the peak bytes
+ * allocated on host memory. The caching allocator of CUDA keeps such
+ * statistics, but the CPU allocator does not. This lets the profiler estimate
+ * memory usage of graphs on CPU-only workers.
+ */
+class TrackingCPUAllocator : public c10::Allocator {
+ public:
+  TrackingCPUAllocator(const TrackingCPUAllocator&) = delete;
+  TrackingCPUAllocator& operator=(const TrackingCPUAllocator&) = delete;
+  TrackingCPUAllocator(TrackingCPUAllocator&&) = delete;
+  TrackingCPUAllocator& operator=(TrackingCPUAllocator&&) = delete;
+
+  static TrackingCPUAllocator& get() {
+    static TrackingCPUAllocator instance;
+    return instance;
+  }
+
+  // Replaces the CPU allocator. Tensors allocated before this call are not
+  // counted.
+  void install();
+  bool isInstalled() const {
+    return base_ != nullptr;
+  }
+
+  c10::DataPtr allocate(size_t nbytes) const override;
+
+  long getAllocated() const {
+    return allocated_;
+  }
+  long getPeak() const {
+    return peak_;
+  }
+  void resetPeak() {
+    peak_ = allocated_.load();
+  }
+
+ private:
+  TrackingCPUAllocator() = default;
+  ~TrackingCPUAllocator() = default;
+
+  static void deleteTracked(void* ctx);
+
+  c10::Allocator* base_ = nullptr;
+  mutable std::atomic<long> allocated_{0};
+  mutable std::atomic<long> peak_{0};
+};
+} // namespace rannc
+
+#endif // PYRANNC_TRACKINGALLOCATOR_H
@@ -56,6 +56,30 @@ class SmallParamModel(nn.Module):
         return x
 
 
+class LinearModel(nn.Module):
+
+    INPUT_DIM = (16,)
+    OUTPUT_DIM = (8,)
+
+    def __init__(self):
+        super(LinearModel, self).__init__()
+        self.fc = nn.Linear(16, 8)
+
+    def forward(self, x):
+        x = self.fc(x)
+        x = x * 2
+        return x
+
+
+class ScaledLinearModel(LinearModel):
+    # Differs from LinearModel only in the value of a constant
+
+    def forward(self, x):
+        x = self.fc(x)
+        x = x * 3
+        return x
+
+
 class NestModel(nn.Module):
     INPUT_DIM = (3,)
     OUTPUT_DIM = (3,)
@@ -0,0 +1,37 @@
+import random
+
+import pytest
+
+from pyrannc import _pyrannc
+
+
+def test_split_local_batch_sizes():
+    local, glob = _pyrannc.split_local_batch_sizes(4, {0: 5, 1: 6, 2: 3})
+    # Remainders of a rank start from the split next to the ones of the
+    # previous rank
+    assert local == {0: [2, 1, 1, 1], 1: [1, 2, 2, 1], 2: [1, 1, 0, 1]}
+    assert glob == [4, 4, 3, 3]
+
+
+def test_divisible_local_batch_sizes():
+    local, glob = _pyrannc.split_local_batch_sizes(2, {0: 4, 1: 8})
+    assert local == {0: [2, 2], 1: [4, 4]}
+    assert glob == [6, 6]
+
+
+@pytest.mark.parametrize("seed", [0, 1, 2])
+def test_split_sums(seed):
+    rnd = random.Random(seed)
+    pipeline_num = rnd.randint(1, 8)
+    local_batch_sizes = {r: rnd.randint(1, 20) for r in range(rnd.randint(1, 8))}
+
+    local, glob = _pyrannc.split_local_batch_sizes(pipeline_num, local_batch_sizes)
+    assert len(glob) == pipeline_num
+    for r, bs in local_batch_sizes.items():
+        assert len(local[r]) == pipeline_num
+        assert sum(local[r]) == bs
+        assert max(local[r]) - min(local[r]) <= 1
+
+    for i in range(pipeline_num):
+        assert sum(local[r][i] for r in local_batch_sizes) == glob[i]
+    assert max(glob) - min(glob) <= 1
@@ -0,0 +1,68 @@
+import random
+
+import pytest
+
+from pyrannc import _pyrannc
+
+ALIGNMENT = 512
+
+
+def _overlaps(ranges1, ranges2):
+    return any(r1[0] <= r2[1] and r2[0] <= r1[1] for r1 in ranges1 for r2 in ranges2)
+
+
+def _aligned(size):
+    return (size + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+
+def test_disjoint_lifetimes_share_memory():
+    offsets, total = _pyrannc.assign_buffer_offsets(
+        [("a", 100, [(0, 1)]), ("b", 100, [(2, 3)])], ALIGNMENT)
+    assert offsets == {"a": 0, "b": 0}
+    assert total == ALIGNMENT
+
+
+def test_overlapping_lifetimes():
+    offsets, total = _pyrannc.assign_buffer_offsets(
+        [("a", 1000, [(0, 2)]), ("b", 100, [(1, 3)])], ALIGNMENT)
+    # The larger buffer is placed first
+    assert offsets == {"a": 0, "b": 1024}
+    assert total == 1536
+
+
+def test_place_at_lowest_free_offset():
+    offsets, total = _pyrannc.assign_buffer_offsets(
+        [("a", 2048, [(0, 5)]),
+         ("b", 1024, [(0, 1)]),
+         ("c", 1024, [(2, 3)]),
+         ("d", 512, [(0, 3)]),
+         ("e", 512, [(4, 5)])], ALIGNMENT)
+    assert offsets == {"a": 0, "b": 2048, "c": 2048, "d": 3072, "e": 2048}
+    assert total == 3584
+
+
+def test_multiple_ranges():
+    # Buffers share memory only if none of their ranges overlap
+    offsets, _ = _pyrannc.assign_buffer_offsets(
+        [("a", 1024, [(0, 1), (4, 5)]), ("b", 512, [(2, 3), (5, 6)])], ALIGNMENT)
+    assert offsets == {"a": 0, "b": 1024}
+
+
+@pytest.mark.parametrize("seed", [0, 1, 2])
+def test_live_buffers_do_not_overlap(seed):
+    rnd = random.Random(seed)
+    buffers = []
+    for i in range(50):
+        start = rnd.randint(0, 30)
+        buffers.append(("buf{}".format(i), rnd.randint(1, 4096), [(start, start + rnd.randint(0, 5))]))
+
+    offsets, total = _pyrannc.assign_buffer_offsets(buffers, ALIGNMENT)
+    for key, size, _ in buffers:
+        assert offsets[key] % ALIGNMENT == 0
+        assert offsets[key] + _aligned(size) <= total
+
+    for i, (k1, s1, r1) in enumerate(buffers):
+        for k2, s2, r2 in buffers[i + 1:]:
+            if _overlaps(r1, r2):
+                o1, o2 = offsets[k1], offsets[k2]
+                assert o1 + _aligned(s1) <= o2 or o2 + _aligned(s2) <= o1
@@ -0,0 +1,52 @@
+import pytest
+import torch
+
+from pyrannc import _pyrannc
+
+# CPU tensors are exchanged by nonblocking MPI collectives instead of NCCL
+
+
+def _randn(seed, *size):
+    gen = torch.Generator().manual_seed(seed)
+    return torch.randn(*size, generator=gen)
+
+
+@pytest.mark.parametrize("seed", [0, 1])
+def test_matmul_dist_rrr_cpu(seed):
+    np = _pyrannc.get_world_size()
+    rank = _pyrannc.get_rank()
+
+    # x is replicated and y is partitioned along the rows
+    x = _randn(seed, 6, 4 * np)
+    y = _randn(seed + 100, 4 * np, 5)
+    out = _pyrannc.matmul_dist(x, y.narrow(0, 4 * rank, 4).contiguous(), "RRR", cuda=False)
+
+    assert not out.is_cuda
+    torch.testing.assert_allclose(out, torch.matmul(x, y))
+
+
+@pytest.mark.parametrize("seed", [0, 1])
+def test_matmul_dist_rcr_cpu(seed):
+    np = _pyrannc.get_world_size()
+    rank = _pyrannc.get_rank()
+
+    # x is replicated and y is partitioned along the columns
+    x = _randn(seed, 6, 8)
+    y = _randn(seed + 100, 8, 3 * np)
+    out = _pyrannc.matmul_dist(x, y.narrow(1, 3 * rank, 3).contiguous(), "RCR", cuda=False)
+
+    torch.testing.assert_allclose(out, torch.matmul(x, y))
+
+
+@pytest.mark.parametrize("seed", [0, 1])
+def test_matmul_dist_crc_cpu(seed):
+    np = _pyrannc.get_world_size()
+    rank = _pyrannc.get_rank()
+
+    # The i-th slice of the sum of the products of all ranks is reduced to rank i
+    xs = [_randn(seed + r, 6, 4) for r in range(np)]
+    ys = [_randn(seed + 100 + r, 4, 3 * np) for r in range(np)]
+    out = _pyrannc.matmul_dist(xs[rank], ys[rank], "CRC", cuda=False)
+
+    expected = sum(torch.matmul(x, y) for x, y in zip(xs, ys))
+    torch.testing.assert_allclose(out, expected.narrow(1, 3 * rank, 3))
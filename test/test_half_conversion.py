@@ -0,0 +1,50 @@
+import pytest
+import torch
+
+from pyrannc import _pyrannc
+
+# Not multiples of the vector widths, and large enough to be split across threads
+SIZES = [1, 7, 16, 33, 100003]
+
+
+def get_values(size):
+    x = torch.randn(size) * 100
+    specials = torch.tensor([0.0, -0.0, float("inf"), float("-inf"), float("nan"),
+                             1e-8, -1e-8, 65504.0, 65520.0, 1e5, 3.0e38, 1.0 + 2 ** -8])
+    n = min(size, specials.numel())
+    x[:n] = specials[:n]
+    return x
+
+
+def assert_same(actual, expected):
+    assert actual.dtype == expected.dtype
+    assert actual.size() == expected.size()
+    assert torch.equal(actual.isnan(), expected.isnan())
+    mask = ~expected.isnan()
+    assert torch.equal(actual[mask], expected[mask])
+
+
+@pytest.mark.parametrize("size", SIZES)
+@pytest.mark.parametrize("dtype", [torch.half, torch.bfloat16])
+def test_round_trip(size, dtype):
+    x = get_values(size)
+
+    low = _pyrannc.convert_scalar_type(x, dtype)
+    assert_same(low, x.to(dtype))
+
+    back = _pyrannc.convert_scalar_type(low, torch.float)
+    assert_same(back, low.to(torch.float))
+
+
+@pytest.mark.parametrize("size", SIZES)
+@pytest.mark.parametrize("dtype", [torch.half, torch.bfloat16])
+def test_scale_and_accumulate(size, dtype):
+    src = get_values(size).to(dtype)
+    scale = 0.125
+
+    assert_same(_pyrannc.to_float_scaled(src, scale), src.to(torch.float) * scale)
+
+    dst = torch.randn(size)
+    expected = dst + src.to(torch.float) * scale
+    _pyrannc.accumulate_to_float(dst, src, scale)
+    assert_same(dst, expected)
@@ -0,0 +1,52 @@
+from pyrannc import _pyrannc
+
+PAGE_SIZE = 4096
+
+
+def test_merge_released_extents():
+    space = _pyrannc.FileSpace()
+    offsets = [space.alloc(PAGE_SIZE) for _ in range(4)]
+    assert offsets == [i * PAGE_SIZE for i in range(4)]
+
+    space.release(offsets[0], PAGE_SIZE)
+    space.release(offsets[2], PAGE_SIZE)
+    assert space.get_free_extent_num() == 2
+
+    # Merged with both neighbors
+    space.release(offsets[1], PAGE_SIZE)
+    assert space.get_free_extent_num() == 1
+
+    # A larger extent reuses the merged space
+    assert space.alloc(3 * PAGE_SIZE) == 0
+    assert space.get_free_extent_num() == 0
+    assert space.get_end() == 4 * PAGE_SIZE
+
+
+def test_shrink_at_end():
+    space = _pyrannc.FileSpace()
+    first = space.alloc(PAGE_SIZE)
+    second = space.alloc(2 * PAGE_SIZE)
+
+    space.release(second, 2 * PAGE_SIZE)
+    assert space.get_end() == PAGE_SIZE
+    assert space.get_free_extent_num() == 0
+
+    space.release(first, PAGE_SIZE)
+    assert space.get_end() == 0
+    assert space.get_free_extent_num() == 0
+
+
+def test_split_on_realloc():
+    space = _pyrannc.FileSpace()
+    large = space.alloc(4 * PAGE_SIZE)
+    space.alloc(PAGE_SIZE)
+    space.release(large, 4 * PAGE_SIZE)
+
+    # The smallest free extent that fits is split and the rest stays free
+    assert space.alloc(PAGE_SIZE) == 0
+    assert space.alloc(2 * PAGE_SIZE) == PAGE_SIZE
+    assert space.get_free_extent_num() == 1
+    assert space.alloc(2 * PAGE_SIZE) == 5 * PAGE_SIZE
+    assert space.alloc(PAGE_SIZE) == 3 * PAGE_SIZE
+    assert space.get_free_extent_num() == 0
+    assert space.get_end() == 7 * PAGE_SIZE
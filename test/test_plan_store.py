@@ -0,0 +1,20 @@
+import os
+import tempfile
+
+import pytest
+
+# Read when pyrannc is imported
+plan_store_dir = tempfile.mkdtemp()
+os.environ["RANNC_PLAN_STORE_DIR"] = plan_store_dir
+
+from . import common, models
+
+
+def test_constant_in_fingerprint(init_dist, init_seed, batch_size, iteration):
+    print("test_constant_in_fingerprint")
+    # The models have the same graph structure. A plan of one must not be
+    # found for the other.
+    common.run(models.LinearModel, batch_size, iteration)
+    common.run(models.ScaledLinearModel, batch_size, iteration)
+
+    assert len(os.listdir(plan_store_dir)) == 2
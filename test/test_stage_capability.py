@@ -0,0 +1,43 @@
+import pytest
+
+from pyrannc import _pyrannc
+
+GB = 1 << 30
+
+
+def test_scale_by_speed():
+    # A device twice as fast as rank 0 halves the profiled times
+    assert _pyrannc.scale_by_speed(100, 300, 2.0) == (50, 150)
+    assert _pyrannc.scale_by_speed(100, 300, 0.5) == (200, 600)
+
+
+@pytest.mark.parametrize("speed", [1.0, 0.0, -1.0])
+def test_scale_by_speed_unchanged(speed):
+    assert _pyrannc.scale_by_speed(100, 300, speed) == (100, 300)
+
+
+def test_min_capability_of_stage():
+    caps = [(16 * GB, 10.0), (32 * GB, 20.0), (8 * GB, 15.0), (32 * GB, 5.0)]
+    # Devices 1 and 2
+    assert _pyrannc.get_stage_capability(caps, 4, 16 * GB, 1, 3, 4, 1) == (8 * GB, 1.5)
+    # Device 1 only
+    assert _pyrannc.get_stage_capability(caps, 4, 16 * GB, 1, 2, 4, 1) == (32 * GB, 2.0)
+
+
+def test_min_capability_over_replicas():
+    caps = [(16 * GB, 10.0), (16 * GB, 10.0), (16 * GB, 10.0), (8 * GB, 5.0)]
+    # Device 1 of each group of two ranks
+    assert _pyrannc.get_stage_capability(caps, 4, 16 * GB, 1, 2, 2, 1) == (16 * GB, 1.0)
+    assert _pyrannc.get_stage_capability(caps, 4, 16 * GB, 1, 2, 2, 2) == (8 * GB, 0.5)
+
+
+def test_unknown_memory_falls_back_to_dev_mem():
+    caps = [(0, 10.0), (0, 20.0)]
+    assert _pyrannc.get_stage_capability(caps, 2, 4 * GB, 1, 2, 2, 1) == (4 * GB, 2.0)
+
+
+def test_unknown_capabilities():
+    # Capabilities are ignored unless given for all devices
+    caps = [(8 * GB, 10.0), (8 * GB, 20.0)]
+    assert _pyrannc.get_stage_capability(caps, 4, 16 * GB, 0, 2, 4, 1) == (16 * GB, 1.0)
+    assert _pyrannc.get_stage_capability([], 4, 16 * GB, 0, 2, 4, 1) == (16 * GB, 1.0)
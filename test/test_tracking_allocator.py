@@ -0,0 +1,50 @@
+import torch
+
+from pyrannc import _pyrannc
+
+ELEM_NUM = 1 << 20
+NBYTES = ELEM_NUM * 4
+
+
+def _install():
+    _pyrannc.install_tracking_cpu_allocator()
+    assert _pyrannc.tracking_cpu_allocator_installed()
+
+
+def test_allocated_delta():
+    _install()
+
+    before = _pyrannc.get_tracked_cpu_allocated()
+    t = torch.empty(ELEM_NUM, dtype=torch.float32)
+    assert _pyrannc.get_tracked_cpu_allocated() - before == NBYTES
+
+    del t
+    assert _pyrannc.get_tracked_cpu_allocated() == before
+
+
+def test_peak():
+    _install()
+
+    _pyrannc.reset_tracked_cpu_peak()
+    before = _pyrannc.get_tracked_cpu_allocated()
+    assert _pyrannc.get_tracked_cpu_peak() == before
+
+    t1 = torch.empty(ELEM_NUM, dtype=torch.float32)
+    t2 = torch.empty(ELEM_NUM, dtype=torch.float32)
+    del t1, t2
+    assert _pyrannc.get_tracked_cpu_allocated() == before
+    assert _pyrannc.get_tracked_cpu_peak() - before == 2 * NBYTES
+
+    # The peak restarts from the current allocation
+    _pyrannc.reset_tracked_cpu_peak()
+    assert _pyrannc.get_tracked_cpu_peak() == _pyrannc.get_tracked_cpu_allocated()
+
+
+def test_install_twice():
+    _install()
+    before = _pyrannc.get_tracked_cpu_allocated()
+    _install()
+    t = torch.empty(ELEM_NUM, dtype=torch.float32)
+    # Allocations are not counted twice
+    assert _pyrannc.get_tracked_cpu_allocated() - before == NBYTES
+    del t
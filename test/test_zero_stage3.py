@@ -0,0 +1,21 @@
+import os
+
+import pytest
+
+# Read when pyrannc is imported
+os.environ["RANNC_ZERO_STAGE3"] = "true"
+
+from . import common, models
+
+
+@pytest.mark.parametrize("gradient_accumulation_steps", [1, 2])
+def test_released_linear(init_dist, init_seed, batch_size, iteration, gradient_accumulation_steps):
+    print("test_released_linear gradient_accumulation_steps={}".format(gradient_accumulation_steps))
+    # Both the weight and the bias of the linear are released between uses
+    common.run(models.LinearModel, batch_size, iteration,
+               gradient_accumulation_steps=gradient_accumulation_steps,
+               use_amp=True,
+               allreduce_amp_master_params=True,
+               enable_zero=True,
+               rtol=1e-1,
+               atol=1e-2)